@@ -0,0 +1,25 @@
+/*
+ * linux/arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+/*
+ * Kernel mode NEON: code built with -mfpu=neon may only run between
+ * kernel_neon_begin() and kernel_neon_end(), from process context.
+ * Keep such code in a compilation unit of its own and call it from a
+ * unit built with the normal flags, otherwise GCC is free to emit NEON
+ * instructions outside of the begin/end pair.
+ */
+void kernel_neon_begin(void);
+void kernel_neon_end(void);
+
+#endif /* __ASM_ARM_NEON_H */
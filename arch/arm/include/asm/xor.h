@@ -132,10 +132,99 @@ static struct xor_block_template xor_block_arm4regs = {
 	.do_5	= xor_arm4regs_5,
 };
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+#include <linux/hardirq.h>
+#include <asm/neon.h>
+
+/* In arch/arm/lib/xor-neon.c, built with -mfpu=neon */
+void xor_neon_inner_2(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2);
+void xor_neon_inner_3(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3);
+void xor_neon_inner_4(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3, unsigned long *p4);
+void xor_neon_inner_5(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3, unsigned long *p4,
+		      unsigned long *p5);
+
+/*
+ * Kernel mode NEON is not available in interrupt context, where async_tx
+ * may end up calling xor_blocks(); fall back to the integer version there.
+ */
+static void
+xor_neon_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	if (in_interrupt()) {
+		xor_arm4regs_2(bytes, p1, p2);
+	} else {
+		kernel_neon_begin();
+		xor_neon_inner_2(bytes, p1, p2);
+		kernel_neon_end();
+	}
+}
+
+static void
+xor_neon_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3)
+{
+	if (in_interrupt()) {
+		xor_arm4regs_3(bytes, p1, p2, p3);
+	} else {
+		kernel_neon_begin();
+		xor_neon_inner_3(bytes, p1, p2, p3);
+		kernel_neon_end();
+	}
+}
+
+static void
+xor_neon_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4)
+{
+	if (in_interrupt()) {
+		xor_arm4regs_4(bytes, p1, p2, p3, p4);
+	} else {
+		kernel_neon_begin();
+		xor_neon_inner_4(bytes, p1, p2, p3, p4);
+		kernel_neon_end();
+	}
+}
+
+static void
+xor_neon_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	if (in_interrupt()) {
+		xor_arm4regs_5(bytes, p1, p2, p3, p4, p5);
+	} else {
+		kernel_neon_begin();
+		xor_neon_inner_5(bytes, p1, p2, p3, p4, p5);
+		kernel_neon_end();
+	}
+}
+
+static struct xor_block_template xor_block_neon = {
+	.name	= "neon",
+	.do_2	= xor_neon_2,
+	.do_3	= xor_neon_3,
+	.do_4	= xor_neon_4,
+	.do_5	= xor_neon_5,
+};
+
+#define NEON_TEMPLATES					\
+	do {						\
+		if (cpu_has_neon())			\
+			xor_speed(&xor_block_neon);	\
+	} while (0)
+#else
+#define NEON_TEMPLATES
+#endif
+
 #undef XOR_TRY_TEMPLATES
 #define XOR_TRY_TEMPLATES			\
 	do {					\
 		xor_speed(&xor_block_arm4regs);	\
 		xor_speed(&xor_block_8regs);	\
 		xor_speed(&xor_block_32regs);	\
+		NEON_TEMPLATES;			\
 	} while (0)
@@ -49,6 +49,11 @@ extern void __aeabi_ulcmp(void);
 
 extern void fpundefinstr(void);
 
+extern void xor_neon_inner_2(void);
+extern void xor_neon_inner_3(void);
+extern void xor_neon_inner_4(void);
+extern void xor_neon_inner_5(void);
+
 
 EXPORT_SYMBOL(__backtrace);
 
@@ -168,3 +173,12 @@ EXPORT_SYMBOL(__gnu_mcount_nc);
 #ifdef CONFIG_ARM_PATCH_PHYS_VIRT
 EXPORT_SYMBOL(__pv_phys_offset);
 #endif
+
+#if defined(CONFIG_KERNEL_MODE_NEON) && \
+    (defined(CONFIG_XOR_BLOCKS) || defined(CONFIG_XOR_BLOCKS_MODULE))
+	/* NEON xor_blocks() kernels, see asm/xor.h */
+EXPORT_SYMBOL(xor_neon_inner_2);
+EXPORT_SYMBOL(xor_neon_inner_3);
+EXPORT_SYMBOL(xor_neon_inner_4);
+EXPORT_SYMBOL(xor_neon_inner_5);
+#endif
@@ -0,0 +1,91 @@
+/*
+ *  linux/arch/arm/kernel/topology.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * CPU capacity for the HMP scheduler on big.LITTLE systems.  The
+ * capacity of each CPU is its clock-frequency from the device tree
+ * weighted by how much work its core type does per cycle, scaled so
+ * that the fastest CPU gets SCHED_POWER_SCALE.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/of.h>
+#include <linux/sched.h>
+#include <linux/threads.h>
+
+static unsigned long cpu_capacity[NR_CPUS] __read_mostly;
+
+#ifdef CONFIG_OF
+struct cpu_efficiency {
+	const char *compatible;
+	unsigned long efficiency;
+};
+
+/*
+ * Relative work done per cycle.  Cores not listed here are not given a
+ * capacity and are treated as fast.
+ */
+static const struct cpu_efficiency table_efficiency[] __initconst = {
+	{ "arm,cortex-a15",	3891 },
+	{ "arm,cortex-a7",	2048 },
+	{ NULL, },
+};
+
+static int __init parse_dt_cpu_capacity(void)
+{
+	const struct cpu_efficiency *eff;
+	struct device_node *cn;
+	unsigned long max = 0;
+	int cpu;
+
+	for_each_node_by_type(cn, "cpu") {
+		const u32 *reg, *rate;
+		int len;
+
+		reg = of_get_property(cn, "reg", &len);
+		if (!reg || len != 4)
+			continue;
+		cpu = be32_to_cpup(reg);
+		if (cpu >= nr_cpu_ids)
+			continue;
+
+		for (eff = table_efficiency; eff->compatible; eff++)
+			if (of_device_is_compatible(cn, eff->compatible))
+				break;
+		if (!eff->compatible)
+			continue;
+
+		rate = of_get_property(cn, "clock-frequency", &len);
+		if (!rate || len != 4) {
+			pr_warn("%s: missing clock-frequency\n", cn->full_name);
+			continue;
+		}
+
+		/* MHz (roughly) times efficiency fits in 32 bits */
+		cpu_capacity[cpu] = (be32_to_cpup(rate) >> 20) *
+				    eff->efficiency;
+		max = max(max, cpu_capacity[cpu]);
+	}
+
+	if (!max)
+		return 0;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+		if (cpu_capacity[cpu])
+			cpu_capacity[cpu] = div64_u64((u64)cpu_capacity[cpu] <<
+						      SCHED_POWER_SHIFT, max);
+	return 0;
+}
+/* before sched_init_smp() sets up the HMP domains */
+early_initcall(parse_dt_cpu_capacity);
+#endif
+
+unsigned long arch_scale_cpu_capacity(int cpu)
+{
+	return cpu_capacity[cpu] ? : SCHED_POWER_SCALE;
+}
@@ -0,0 +1,128 @@
+/*
+ * linux/arch/arm/lib/xor-neon.c
+ *
+ * NEON xor_blocks() kernels, 64 bytes per loop.  This file is built
+ * with -mfpu=neon, so its functions may only be called between
+ * kernel_neon_begin() and kernel_neon_end(); see asm/xor.h.  It must
+ * not include kernel headers, whose integer typedefs clash with
+ * <arm_neon.h>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <arm_neon.h>
+
+void xor_neon_inner_2(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2);
+void xor_neon_inner_3(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3);
+void xor_neon_inner_4(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3, unsigned long *p4);
+void xor_neon_inner_5(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3, unsigned long *p4,
+		      unsigned long *p5);
+
+#define LOAD(v, p)							\
+	do {								\
+		const uint32_t *__p = (const uint32_t *)(p);		\
+		v##0 = vld1q_u32(__p);					\
+		v##1 = vld1q_u32(__p + 4);				\
+		v##2 = vld1q_u32(__p + 8);				\
+		v##3 = vld1q_u32(__p + 12);				\
+	} while (0)
+
+#define XOR(v, p)							\
+	do {								\
+		const uint32_t *__p = (const uint32_t *)(p);		\
+		v##0 = veorq_u32(v##0, vld1q_u32(__p));			\
+		v##1 = veorq_u32(v##1, vld1q_u32(__p + 4));		\
+		v##2 = veorq_u32(v##2, vld1q_u32(__p + 8));		\
+		v##3 = veorq_u32(v##3, vld1q_u32(__p + 12));		\
+	} while (0)
+
+#define STORE(v, p)							\
+	do {								\
+		uint32_t *__p = (uint32_t *)(p);			\
+		vst1q_u32(__p, v##0);					\
+		vst1q_u32(__p + 4, v##1);				\
+		vst1q_u32(__p + 8, v##2);				\
+		vst1q_u32(__p + 12, v##3);				\
+	} while (0)
+
+/* Longs per loop */
+#define STEP	(64 / sizeof(unsigned long))
+
+void xor_neon_inner_2(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2)
+{
+	unsigned long lines = bytes / 64;
+	uint32x4_t v0, v1, v2, v3;
+
+	do {
+		LOAD(v, p1);
+		XOR(v, p2);
+		STORE(v, p1);
+		p1 += STEP;
+		p2 += STEP;
+	} while (--lines);
+}
+
+void xor_neon_inner_3(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3)
+{
+	unsigned long lines = bytes / 64;
+	uint32x4_t v0, v1, v2, v3;
+
+	do {
+		LOAD(v, p1);
+		XOR(v, p2);
+		XOR(v, p3);
+		STORE(v, p1);
+		p1 += STEP;
+		p2 += STEP;
+		p3 += STEP;
+	} while (--lines);
+}
+
+void xor_neon_inner_4(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3, unsigned long *p4)
+{
+	unsigned long lines = bytes / 64;
+	uint32x4_t v0, v1, v2, v3;
+
+	do {
+		LOAD(v, p1);
+		XOR(v, p2);
+		XOR(v, p3);
+		XOR(v, p4);
+		STORE(v, p1);
+		p1 += STEP;
+		p2 += STEP;
+		p3 += STEP;
+		p4 += STEP;
+	} while (--lines);
+}
+
+void xor_neon_inner_5(unsigned long bytes, unsigned long *p1,
+		      unsigned long *p2, unsigned long *p3, unsigned long *p4,
+		      unsigned long *p5)
+{
+	unsigned long lines = bytes / 64;
+	uint32x4_t v0, v1, v2, v3;
+
+	do {
+		LOAD(v, p1);
+		XOR(v, p2);
+		XOR(v, p3);
+		XOR(v, p4);
+		XOR(v, p5);
+		STORE(v, p1);
+		p1 += STEP;
+		p2 += STEP;
+		p3 += STEP;
+		p4 += STEP;
+		p5 += STEP;
+	} while (--lines);
+}
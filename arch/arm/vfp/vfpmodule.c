@@ -17,8 +17,10 @@
 #include <linux/sched.h>
 #include <linux/smp.h>
 #include <linux/init.h>
+#include <linux/hardirq.h>
 
 #include <asm/cputype.h>
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 
@@ -498,6 +500,59 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Kernel-side NEON support functions
+ */
+void kernel_neon_begin(void)
+{
+	union vfp_state *vfp = &current_thread_info()->vfpstate;
+	unsigned int cpu;
+	u32 fpexc;
+
+	/*
+	 * Kernel mode NEON is only allowed outside of interrupt context
+	 * with preemption disabled. This will make sure that the kernel
+	 * mode NEON register contents never need to be preserved.
+	 */
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc);
+
+	/*
+	 * Save the user space NEON/VFP state if the hardware holds it. On
+	 * SMP it was saved at the last context switch unless it belongs
+	 * to 'current'; on UP the owner may be any task.
+	 */
+#ifdef CONFIG_SMP
+	if (last_VFP_context[cpu] == vfp) {
+		vfp_save_state(vfp, fpexc);
+		vfp->hard.cpu = cpu;
+	}
+#else
+	vfp = last_VFP_context[cpu];
+	if (vfp)
+		vfp_save_state(vfp, fpexc);
+#endif
+
+	/* Force a reload on the next user space VFP access */
+	last_VFP_context[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* Disable the NEON/VFP unit. */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 /*
  * VFP hardware can lose all context when a CPU goes offline.
  * As we will be running in SMP mode with CPU hotplug, we will save the
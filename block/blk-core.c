@@ -16,6 +16,7 @@
 #include <linux/backing-dev.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/highmem.h>
 #include <linux/mm.h>
 #include <linux/kernel_stat.h>
@@ -28,11 +29,13 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/fault-inject.h>
 #include <linux/list_sort.h>
+#include <linux/ktime.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
 
 #include "blk.h"
+#include "blk-mq.h"
 
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_bio_remap);
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_rq_remap);
@@ -55,7 +58,7 @@ struct kmem_cache *blk_requestq_cachep;
  */
 static struct workqueue_struct *kblockd_workqueue;
 
-static void drive_stat_acct(struct request *rq, int new_io)
+void drive_stat_acct(struct request *rq, int new_io)
 {
 	struct hd_struct *part;
 	int rw = rq_data_dir(rq);
@@ -143,6 +146,7 @@ void blk_rq_init(struct request_queue *q, struct request *rq)
 	rq->ref_count = 1;
 	rq->start_time = jiffies;
 	set_start_time_ns(rq);
+	blk_rq_set_hist_start(rq);
 	rq->part = NULL;
 }
 EXPORT_SYMBOL(blk_rq_init);
@@ -286,6 +290,8 @@ void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
 	cancel_delayed_work_sync(&q->delay_work);
+	if (q->mq_ops)
+		blk_mq_sync_queue(q);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -372,6 +378,9 @@ void blk_cleanup_queue(struct request_queue *q)
 	queue_flag_set_unlocked(QUEUE_FLAG_DEAD, q);
 	mutex_unlock(&q->sysfs_lock);
 
+	if (q->mq_ops)
+		blk_mq_exit_queue(q);
+
 	if (q->queue_lock != &q->__queue_lock)
 		q->queue_lock = &q->__queue_lock;
 
@@ -839,6 +848,9 @@ struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp_mask)
 
 	BUG_ON(rw != READ && rw != WRITE);
 
+	if (q->mq_ops)
+		return blk_mq_alloc_request(q, rw, gfp_mask);
+
 	spin_lock_irq(q->queue_lock);
 	if (gfp_mask & __GFP_WAIT) {
 		rq = get_request_wait(q, rw, NULL);
@@ -1038,6 +1050,11 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 	if (unlikely(--req->ref_count))
 		return;
 
+	if (q->mq_ops) {
+		blk_mq_free_request(req);
+		return;
+	}
+
 	elv_completed_request(q, req);
 
 	/* this is a bio leak */
@@ -1065,6 +1082,12 @@ void blk_put_request(struct request *req)
 	unsigned long flags;
 	struct request_queue *q = req->q;
 
+	/* nothing to protect, multi-queue requests are refcounted singly */
+	if (q->mq_ops) {
+		__blk_put_request(q, req);
+		return;
+	}
+
 	spin_lock_irqsave(q->queue_lock, flags);
 	__blk_put_request(q, req);
 	spin_unlock_irqrestore(q->queue_lock, flags);
@@ -1777,7 +1800,49 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
-static void blk_account_io_done(struct request *req)
+#ifdef CONFIG_BLK_LATENCY_HIST
+static void blk_account_io_latency(int cpu, struct request *req)
+{
+	struct disk_latency_hist *hist;
+	u64 ns = ktime_to_ns(ktime_get()) - req->hist_start_ns;
+	unsigned int bytes = req->hist_bytes;
+	int op, size, bucket;
+
+	if (!req->rq_disk->lat_hist)
+		return;
+
+	if (req->cmd_flags & REQ_FLUSH)
+		op = LAT_HIST_FLUSH;
+	else if (rq_data_dir(req) == WRITE)
+		op = LAT_HIST_WRITE;
+	else
+		op = LAT_HIST_READ;
+
+	if (bytes <= 4096)
+		size = LAT_HIST_4K;
+	else if (bytes <= 32768)
+		size = LAT_HIST_32K;
+	else if (bytes <= 262144)
+		size = LAT_HIST_256K;
+	else
+		size = LAT_HIST_LARGE;
+
+	/* Completion on another CPU may see a slightly earlier clock */
+	if ((s64)ns < 0)
+		ns = 0;
+	bucket = min_t(int, fls64(div_u64(ns, NSEC_PER_USEC)),
+		       LAT_HIST_BUCKETS - 1);
+
+	hist = per_cpu_ptr(req->rq_disk->lat_hist, cpu);
+	hist->count[op][size][bucket]++;
+}
+#else
+static inline void blk_account_io_latency(int cpu, struct request *req)
+{
+}
+#endif
+
+void blk_account_io_done(struct request *req)
 {
 	/*
 	 * Account IO completion.  flush_rq isn't accounted as a
@@ -1797,6 +1862,7 @@ static void blk_account_io_done(struct request *req)
 		part_stat_add(cpu, part, ticks[rw], duration);
 		part_round_stats(cpu, part);
 		part_dec_in_flight(part, rw);
+		blk_account_io_latency(cpu, req);
 
 		hd_struct_put(part);
 		part_stat_unlock();
@@ -1948,6 +2014,7 @@ void blk_start_request(struct request *req)
 	req->resid_len = blk_rq_bytes(req);
 	if (unlikely(blk_bidi_rq(req)))
 		req->next_rq->resid_len = blk_rq_bytes(req->next_rq);
+	blk_rq_set_hist_bytes(req);
 
 	blk_add_timer(req);
 }
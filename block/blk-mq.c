@@ -0,0 +1,680 @@
+/*
+ * Multi-queue request path.
+ *
+ * Requests are staged on per-CPU software queues and handed to the
+ * driver by one of its hardware contexts, each of which owns a tag
+ * space of preallocated requests. Neither submission nor completion
+ * takes the request_queue's queue_lock, and there is no elevator: the
+ * devices this is meant for (fast SSDs, virtual disks) gain nothing
+ * from sorting, and at the rates they complete I/O the single lock is
+ * what limits throughput.
+ *
+ * See Documentation/block/blk-mq.txt
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+static struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
+					      unsigned int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+
+/*
+ * The context of the submitting CPU is only a locality hint; the task
+ * may migrate right after picking it, which is harmless since every
+ * context is protected by its own lock.
+ */
+static struct blk_mq_ctx *blk_mq_current_ctx(struct request_queue *q)
+{
+	return per_cpu_ptr(q->queue_ctx, raw_smp_processor_id());
+}
+
+/*
+ * Find a free tag, starting where this CPU last found one so that CPUs
+ * sharing a hardware context mostly touch different words of the map.
+ */
+static int __blk_mq_get_tag(struct blk_mq_hw_ctx *hctx,
+			    struct blk_mq_ctx *ctx)
+{
+	unsigned int depth = hctx->queue_depth;
+	unsigned int tag = ctx->last_tag;
+	bool wrapped = false;
+
+	for (;;) {
+		tag = find_next_zero_bit(hctx->tag_map, depth, tag);
+		if (tag >= depth) {
+			if (wrapped)
+				return -1;
+			wrapped = true;
+			tag = 0;
+			continue;
+		}
+		if (!test_and_set_bit_lock(tag, hctx->tag_map))
+			break;
+	}
+
+	ctx->last_tag = tag + 1;
+	return tag;
+}
+
+static struct request *blk_mq_get_request(struct request_queue *q,
+					  struct blk_mq_ctx *ctx, int rw,
+					  gfp_t gfp)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(q, ctx->cpu);
+	struct request *rq;
+	int tag;
+
+	tag = __blk_mq_get_tag(hctx, ctx);
+	if (tag < 0) {
+		if (!(gfp & __GFP_WAIT))
+			return NULL;
+		wait_event(hctx->tag_wait,
+			   (tag = __blk_mq_get_tag(hctx, ctx)) >= 0);
+	}
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request on a multi-queue device
+ * @q: the queue
+ * @rw: READ or WRITE, possibly with other REQ_* flags
+ * @gfp: allocation flags; with __GFP_WAIT this waits for a free tag
+ *
+ * Description:
+ *    blk_get_request() ends up here for multi-queue devices, so drivers
+ *    and passthrough users need not call this directly.
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	return blk_mq_get_request(q, blk_mq_current_ctx(q), rw, gfp);
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/**
+ * blk_mq_free_request - release a request and its tag
+ * @rq: the request
+ */
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(rq->q,
+						      rq->mq_ctx->cpu);
+	int tag = rq->tag;
+
+	/* this is a bio leak */
+	WARN_ON(rq->bio != NULL);
+
+	rq->tag = -1;
+	clear_bit_unlock(tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->tag_wait))
+		wake_up(&hctx->tag_wait);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static void blk_mq_start_request(struct request *rq)
+{
+	trace_block_rq_issue(rq->q, rq);
+
+	rq->resid_len = blk_rq_bytes(rq);
+	blk_rq_set_hist_bytes(rq);
+	rq->cmd_flags |= REQ_STARTED;
+}
+
+/*
+ * Hand everything queued on @hctx to the driver, in order: first the
+ * requests it bounced last time, then those on the software queues.
+ * Several CPUs may run the same context at once; drivers serialise
+ * access to their hardware themselves.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct request *rq;
+	unsigned long flags;
+	LIST_HEAD(rq_list);
+	int bit;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	spin_lock_irqsave(&hctx->lock, flags);
+	list_splice_init(&hctx->dispatch, &rq_list);
+	spin_unlock_irqrestore(&hctx->lock, flags);
+
+	/*
+	 * Clear the bit before taking the list: a request added after
+	 * that sets it again and is picked up by the next run.
+	 */
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		struct blk_mq_ctx *ctx = hctx->ctxs[bit];
+
+		clear_bit(bit, hctx->ctx_map);
+		spin_lock_irqsave(&ctx->lock, flags);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock_irqrestore(&ctx->lock, flags);
+	}
+
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		blk_mq_start_request(rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq, list_empty(&rq_list));
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			rq->cmd_flags &= ~REQ_STARTED;
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		WARN_ON(ret != BLK_MQ_RQ_QUEUE_ERROR);
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/*
+	 * The driver ran out of resources and has stopped the queue; it
+	 * restarts it once something completes.  That may already have
+	 * happened, and found dispatch empty: run the queue again then.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock_irqsave(&hctx->lock, flags);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock_irqrestore(&hctx->lock, flags);
+
+		/* Pairs with test_and_clear_bit() in the restart */
+		smp_mb();
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - hand queued requests to the driver
+ * @hctx: hardware context to run
+ * @async: run from kblockd rather than the calling context
+ *
+ * Description:
+ *    Must be called with @async set from interrupt context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop handing requests to the driver
+ * @hctx: hardware context to stop
+ *
+ * Description:
+ *    A driver that returns %BLK_MQ_RQ_QUEUE_BUSY must stop the context
+ *    first, under whatever lock its completion path takes, and restart
+ *    it with blk_mq_start_stopped_hw_queues() when resources free up.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+/**
+ * blk_mq_insert_request - queue a request on a multi-queue device
+ * @rq: request from blk_mq_alloc_request()
+ * @at_head: dispatch ahead of everything already queued
+ * @run: run the hardware queue from the calling context
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(rq->q, ctx->cpu);
+	unsigned long flags;
+
+	drive_stat_acct(rq, 1);
+	trace_block_rq_insert(rq->q, rq);
+
+	if (at_head) {
+		spin_lock_irqsave(&hctx->lock, flags);
+		list_add(&rq->queuelist, &hctx->dispatch);
+		spin_unlock_irqrestore(&hctx->lock, flags);
+	} else {
+		spin_lock_irqsave(&ctx->lock, flags);
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+		set_bit(ctx->index_hw, hctx->ctx_map);
+		spin_unlock_irqrestore(&ctx->lock, flags);
+	}
+
+	if (run)
+		blk_mq_run_hw_queue(hctx, false);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/**
+ * blk_mq_end_io - complete a request in full
+ * @rq: the request
+ * @error: 0 for success, < 0 for error
+ *
+ * Description:
+ *    May be called from any context, but not with locks held that the
+ *    driver's queue_rq takes: completing a bio may submit new I/O.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	blk_update_request(rq, error, blk_rq_bytes(rq));
+	if (error && !rq->errors)
+		rq->errors = error;
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		__blk_put_request(rq->q, rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+/*
+ * Back merge into the newest request on this CPU's queue. A request is
+ * only still there while the hardware queue is stopped or being run on
+ * another CPU, which is exactly when merging pays off.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	unsigned long flags;
+	bool merged = false;
+
+	if (blk_queue_nomerges(q))
+		return false;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	if (list_empty(&ctx->rq_list))
+		goto out;
+
+	rq = list_entry(ctx->rq_list.prev, struct request, queuelist);
+	if (!rq_mergeable(rq) || rq->special ||
+	    blk_rq_pos(rq) + blk_rq_sectors(rq) != bio->bi_sector ||
+	    bio_data_dir(bio) != rq_data_dir(rq) ||
+	    rq->rq_disk != bio->bi_bdev->bd_disk ||
+	    (bio->bi_rw & (REQ_DISCARD | REQ_SECURE)) !=
+	    (rq->bio->bi_rw & (REQ_DISCARD | REQ_SECURE)) ||
+	    bio_integrity(bio) != blk_integrity_rq(rq))
+		goto out;
+
+	if (!ll_back_merge_fn(q, rq, bio))
+		goto out;
+
+	trace_block_bio_backmerge(q, bio);
+
+	if ((rq->cmd_flags & REQ_FAILFAST_MASK) !=
+	    (bio->bi_rw & REQ_FAILFAST_MASK))
+		blk_rq_set_mixed_merge(rq);
+
+	rq->biotail->bi_next = bio;
+	rq->biotail = bio;
+	rq->__data_len += bio->bi_size;
+	rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+
+	drive_stat_acct(rq, 0);
+	merged = true;
+out:
+	spin_unlock_irqrestore(&ctx->lock, flags);
+	return merged;
+}
+
+static void blk_mq_submit_bio(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_ctx *ctx = blk_mq_current_ctx(q);
+	struct request *rq;
+
+	if (blk_mq_attempt_merge(q, ctx, bio))
+		return;
+
+	rq = blk_mq_get_request(q, ctx, bio_data_dir(bio), GFP_NOIO);
+	trace_block_getrq(q, bio, bio_data_dir(bio));
+
+	init_request_from_bio(rq, bio);
+	blk_mq_insert_request(rq, false, true);
+}
+
+/* Issue an empty cache flush and wait for it */
+static int blk_mq_issue_flush(struct request_queue *q, struct gendisk *disk)
+{
+	struct request *rq;
+	int ret;
+
+	rq = blk_mq_alloc_request(q, WRITE_FLUSH, GFP_NOIO);
+	rq->cmd_type = REQ_TYPE_FS;
+	ret = blk_execute_rq(q, disk, rq, 0);
+	blk_put_request(rq);
+
+	return ret;
+}
+
+struct blk_mq_fua_wait {
+	struct completion	done;
+	int			error;
+};
+
+static void blk_mq_fua_end_io(struct bio *bio, int error)
+{
+	struct blk_mq_fua_wait *wait = bio->bi_private;
+
+	wait->error = error;
+	complete(&wait->done);
+}
+
+/*
+ * There is no flush state machine on this path. A preflush is issued
+ * and waited for before the data, and FUA the driver can't do natively
+ * becomes a flush after the data has completed. Both block the
+ * submitter, which is fine for the journal commits that use them.
+ */
+static void blk_mq_flush_bio(struct request_queue *q, struct bio *bio)
+{
+	struct gendisk *disk = bio->bi_bdev->bd_disk;
+	bool fua = (bio->bi_rw & REQ_FUA) && !(q->flush_flags & REQ_FUA);
+	struct blk_mq_fua_wait wait;
+	bio_end_io_t *end_io;
+	void *private;
+	int error = 0;
+
+	/* Nothing to flush without a volatile write cache */
+	if (!(q->flush_flags & REQ_FLUSH)) {
+		bio->bi_rw &= ~(REQ_FLUSH | REQ_FUA);
+		if (!bio_has_data(bio))
+			goto out;
+		blk_mq_submit_bio(q, bio);
+		return;
+	}
+
+	if (bio->bi_rw & REQ_FLUSH) {
+		bio->bi_rw &= ~REQ_FLUSH;
+		error = blk_mq_issue_flush(q, disk);
+		if (error || !bio_has_data(bio))
+			goto out;
+	}
+
+	if (!fua) {
+		blk_mq_submit_bio(q, bio);
+		return;
+	}
+
+	bio->bi_rw &= ~REQ_FUA;
+	init_completion(&wait.done);
+	end_io = bio->bi_end_io;
+	private = bio->bi_private;
+	bio->bi_end_io = blk_mq_fua_end_io;
+	bio->bi_private = &wait;
+
+	blk_mq_submit_bio(q, bio);
+	wait_for_completion(&wait.done);
+
+	bio->bi_end_io = end_io;
+	bio->bi_private = private;
+	error = wait.error;
+	if (!error)
+		error = blk_mq_issue_flush(q, disk);
+out:
+	bio_endio(bio, error);
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(bio->bi_rw & (REQ_FLUSH | REQ_FUA)))
+		blk_mq_flush_bio(q, bio);
+	else
+		blk_mq_submit_bio(q, bio);
+
+	return 0;
+}
+
+static void blk_mq_free_hctx(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs)
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+	kfree(hctx->rqs);
+	kfree(hctx->tag_map);
+	kfree(hctx->ctx_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct request_queue *q,
+					       struct blk_mq_reg *reg,
+					       unsigned int hctx_num)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int node = reg->numa_node;
+	unsigned int i;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, node);
+	if (!hctx)
+		return NULL;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	init_waitqueue_head(&hctx->tag_wait);
+	hctx->queue = q;
+	hctx->queue_num = hctx_num;
+	hctx->queue_depth = reg->queue_depth;
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(*hctx->ctxs),
+				  GFP_KERNEL, node);
+	hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+				     sizeof(unsigned long), GFP_KERNEL, node);
+	hctx->tag_map = kzalloc_node(BITS_TO_LONGS(reg->queue_depth) *
+				     sizeof(unsigned long), GFP_KERNEL, node);
+	hctx->rqs = kzalloc_node(reg->queue_depth * sizeof(*hctx->rqs),
+				 GFP_KERNEL, node);
+	if (!hctx->ctxs || !hctx->ctx_map || !hctx->tag_map || !hctx->rqs)
+		goto fail;
+
+	for (i = 0; i < reg->queue_depth; i++) {
+		hctx->rqs[i] = kzalloc_node(sizeof(struct request) +
+					    reg->cmd_size, GFP_KERNEL, node);
+		if (!hctx->rqs[i])
+			goto fail;
+	}
+
+	return hctx;
+fail:
+	blk_mq_free_hctx(hctx);
+	return NULL;
+}
+
+/**
+ * blk_mq_init_queue - create a multi-queue request queue
+ * @reg: description of the driver's hardware queues
+ * @driver_data: stored in the queue's queuedata
+ *
+ * Description:
+ *    The multi-queue counterpart of blk_init_queue(). Every possible
+ *    CPU gets a software queue, and consecutive CPUs share one of the
+ *    @reg->nr_hw_queues hardware contexts. Requests carry
+ *    @reg->cmd_size bytes of driver data, see blk_mq_rq_to_pdu().
+ *
+ *    Returns the queue, or %NULL on failure. Tear it down with
+ *    blk_cleanup_queue() as usual.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i, cpu;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->queue_depth || reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->queuedata = driver_data;
+	q->nr_hw_queues = reg->nr_hw_queues;
+
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(*q->mq_map), GFP_KERNEL,
+				 reg->numa_node);
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues *
+				       sizeof(*q->queue_hw_ctx), GFP_KERNEL,
+				       reg->numa_node);
+	if (!q->mq_map || !q->queue_ctx || !q->queue_hw_ctx)
+		goto fail;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		q->queue_hw_ctx[i] = blk_mq_alloc_hctx(q, reg, i);
+		if (!q->queue_hw_ctx[i])
+			goto fail;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+
+		q->mq_map[cpu] = cpu * reg->nr_hw_queues / nr_cpu_ids;
+		hctx = q->queue_hw_ctx[q->mq_map[cpu]];
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		if (!reg->ops->init_hctx)
+			break;
+		if (reg->ops->init_hctx(q->queue_hw_ctx[i], driver_data, i))
+			goto fail_init;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	queue_flag_set_unlocked(QUEUE_FLAG_IO_STAT, q);
+	q->mq_ops = reg->ops;
+
+	return q;
+
+fail_init:
+	while (i--)
+		if (reg->ops->exit_hctx)
+			reg->ops->exit_hctx(q->queue_hw_ctx[i], i);
+fail:
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/* Called by blk_sync_queue() */
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		cancel_work_sync(&hctx->run_work);
+}
+
+/*
+ * Called by blk_cleanup_queue(): the driver may go away after that,
+ * even if the queue itself lives on for a while.
+ */
+void blk_mq_exit_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	if (!q->mq_ops->exit_hctx)
+		return;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		q->mq_ops->exit_hctx(hctx, i);
+}
+
+/* Called when the last reference to the queue is dropped */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	if (q->queue_hw_ctx)
+		for (i = 0; i < q->nr_hw_queues; i++)
+			if (q->queue_hw_ctx[i])
+				blk_mq_free_hctx(q->queue_hw_ctx[i]);
+
+	kfree(q->queue_hw_ctx);
+	free_percpu(q->queue_ctx);
+	kfree(q->mq_map);
+}
@@ -0,0 +1,21 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-CPU software staging queue. Submitters only touch the context of
+ * the CPU they run on, so the lock is normally uncontended; the owning
+ * hardware context collects the requests when it runs.
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in the hctx's ctx_map */
+	unsigned int		last_tag;	/* allocation hint */
+} ____cacheline_aligned_in_smp;
+
+void blk_mq_sync_queue(struct request_queue *q);
+void blk_mq_exit_queue(struct request_queue *q);
+void blk_mq_free_queue(struct request_queue *q);
+
+#endif
@@ -11,6 +11,8 @@ extern struct kmem_cache *blk_requestq_cachep;
 extern struct kobj_type blk_queue_ktype;
 
 void init_request_from_bio(struct request *req, struct bio *bio);
+void drive_stat_acct(struct request *rq, int new_io);
+void blk_account_io_done(struct request *req);
 void blk_rq_bio_prep(struct request_queue *q, struct request *rq,
 			struct bio *bio);
 int blk_rq_append_bio(struct request_queue *q, struct request *rq,
@@ -186,4 +188,29 @@ static inline int blk_do_io_stat(struct request *rq)
 	        (rq->cmd_flags & REQ_DISCARD));
 }
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+static inline void blk_rq_set_hist_start(struct request *rq)
+{
+	rq->hist_start_ns = ktime_to_ns(ktime_get());
+}
+
+static inline void blk_rq_set_hist_bytes(struct request *rq)
+{
+	rq->hist_bytes = blk_rq_bytes(rq);
+}
+
+/* A merged request is as old as the older of the two */
+static inline void blk_rq_merge_hist_start(struct request *req,
+					   struct request *next)
+{
+	if (next->hist_start_ns < req->hist_start_ns)
+		req->hist_start_ns = next->hist_start_ns;
+}
+#else
+static inline void blk_rq_set_hist_start(struct request *rq) {}
+static inline void blk_rq_set_hist_bytes(struct request *rq) {}
+static inline void blk_rq_merge_hist_start(struct request *req,
+					   struct request *next) {}
+#endif
+
 #endif
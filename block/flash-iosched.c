@@ -0,0 +1,631 @@
+/*
+ *  Flash i/o scheduler.
+ *
+ *  Built from the deadline scheduler for devices without a seek penalty,
+ *  such as eMMC and SD cards. Requests are kept on three queues: sync
+ *  reads, sync writes and async writes. Reads always go first, within
+ *  starvation limits, in arrival order. Writes go out in batches sorted
+ *  by sector, which lets the FTL of a cheap card fill its erase blocks
+ *  sequentially. Unlike CFQ, the scheduler never idles waiting for more
+ *  requests from a process.
+ *
+ *  See Documentation/block/flash-iosched.txt
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+enum flash_queue {
+	FLASH_SYNC_READ,
+	FLASH_SYNC_WRITE,
+	FLASH_ASYNC,
+	FLASH_NR_QUEUES,
+};
+
+static const char *const flash_queue_name[FLASH_NR_QUEUES] = {
+	[FLASH_SYNC_READ]	= "sync_read",
+	[FLASH_SYNC_WRITE]	= "sync_write",
+	[FLASH_ASYNC]		= "async",
+};
+
+static const int read_expire = HZ / 8;	/* max time before a read is submitted. */
+static const int sync_write_expire = HZ / 2;
+static const int async_write_expire = 5 * HZ; /* these limits are SOFT! */
+static const int read_batch = 8;	/* # of reads dispatched in a row */
+static const int write_batch = 32;	/* # of sorted writes dispatched in a row */
+static const int writes_starved = 4;	/* max read batches before a write batch */
+static const int async_starved = 2;	/* max sync write batches before async */
+
+/*
+ * Per-request scheduler data, kept in the elevator_private pointers:
+ * the queue the request was added to and, for the latency statistics,
+ * the insert and dispatch times in microseconds. The times are
+ * truncated to 32 bits; only their differences are used.
+ */
+#define RQ_QUEUE(rq)		((unsigned long)(rq)->elevator_private[0])
+#define RQ_INSERT_US(rq)	((u32)(unsigned long)(rq)->elevator_private[1])
+#define RQ_DISPATCH_US(rq)	((u32)(unsigned long)(rq)->elevator_private[2])
+
+struct flash_latency {
+	unsigned long nr;		/* completed requests */
+	u64 wait_us;			/* total time in the scheduler */
+	u64 service_us;			/* total time in the driver */
+	u32 max_us;			/* worst insert to completion time */
+};
+
+struct flash_data {
+	struct request_queue *queue;
+
+	/*
+	 * run time data
+	 */
+
+	/*
+	 * requests are present on both sort_list and fifo_list
+	 */
+	struct rb_root sort_list[FLASH_NR_QUEUES];
+	struct list_head fifo_list[FLASH_NR_QUEUES];
+
+	/*
+	 * current batch: its queue, the next request in sort order for
+	 * write batches, and the number of requests dispatched so far.
+	 * A write batch that was started only because no reads were
+	 * waiting gives way to the first read that arrives.
+	 */
+	int batch_queue;
+	struct request *next_rq;
+	unsigned int batching;
+	int batch_preempt;
+	unsigned int starved;		/* read batches run while writes wait */
+	unsigned int async_starved;	/* sync write batches run while async waits */
+
+	struct flash_latency latency[FLASH_NR_QUEUES];
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[FLASH_NR_QUEUES];
+	int read_batch;
+	int write_batch;
+	int writes_starved;
+	int async_starved_max;
+	int front_merges;
+};
+
+static inline u32 flash_now_us(void)
+{
+	return (u32)ktime_to_us(ktime_get());
+}
+
+static inline int flash_rq_queue(struct request *rq)
+{
+	if (rq_data_dir(rq) == READ)
+		return FLASH_SYNC_READ;
+	if (rq_is_sync(rq))
+		return FLASH_SYNC_WRITE;
+	return FLASH_ASYNC;
+}
+
+static inline struct rb_root *
+flash_rb_root(struct flash_data *fd, struct request *rq)
+{
+	return &fd->sort_list[RQ_QUEUE(rq)];
+}
+
+static inline struct request *
+flash_latter_request(struct request *rq)
+{
+	struct rb_node *node = rb_next(&rq->rb_node);
+
+	if (node)
+		return rb_entry_rq(node);
+
+	return NULL;
+}
+
+static void
+flash_add_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	struct rb_root *root = flash_rb_root(fd, rq);
+	struct request *__alias;
+
+	/*
+	 * An alias can't be merged (e.g. it differs in its flags); push
+	 * it out to the driver rather than keep two requests for one
+	 * sector in the tree.
+	 */
+	while (unlikely(__alias = elv_rb_add(root, rq))) {
+		rq_fifo_clear(__alias);
+		elv_rb_del(root, __alias);
+		if (fd->next_rq == __alias)
+			fd->next_rq = NULL;
+		elv_dispatch_add_tail(__alias->q, __alias);
+	}
+}
+
+static inline void
+flash_del_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	if (fd->next_rq == rq)
+		fd->next_rq = flash_latter_request(rq);
+
+	elv_rb_del(flash_rb_root(fd, rq), rq);
+}
+
+/*
+ * add rq to rbtree and fifo
+ */
+static void
+flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int queue = flash_rq_queue(rq);
+
+	rq->elevator_private[0] = (void *)(unsigned long)queue;
+	rq->elevator_private[1] = (void *)(unsigned long)flash_now_us();
+	rq->elevator_private[2] = rq->elevator_private[1];
+
+	flash_add_rq_rb(fd, rq);
+
+	/*
+	 * set expire time and add to fifo list
+	 */
+	rq_set_fifo_time(rq, jiffies + fd->fifo_expire[queue]);
+	list_add_tail(&rq->queuelist, &fd->fifo_list[queue]);
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void flash_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	rq_fifo_clear(rq);
+	flash_del_rq_rb(fd, rq);
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *__rq;
+	int queue;
+
+	/*
+	 * check for front merge
+	 */
+	if (!fd->front_merges)
+		return ELEVATOR_NO_MERGE;
+
+	if (bio_data_dir(bio) == READ)
+		queue = FLASH_SYNC_READ;
+	else if (bio->bi_rw & REQ_SYNC)
+		queue = FLASH_SYNC_WRITE;
+	else
+		queue = FLASH_ASYNC;
+
+	__rq = elv_rb_find(&fd->sort_list[queue], bio->bi_sector +
+			   bio_sectors(bio));
+	if (__rq && elv_rq_merge_ok(__rq, bio)) {
+		*req = __rq;
+		return ELEVATOR_FRONT_MERGE;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void flash_merged_request(struct request_queue *q,
+				 struct request *req, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(flash_rb_root(fd, req), req);
+		flash_add_rq_rb(fd, req);
+	}
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *req,
+		      struct request *next)
+{
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo.
+	 * The merged request also inherits the earlier insert time, so
+	 * that the latency statistics cover the older of the two. A sync
+	 * write may have been merged into an async one; req then stays on
+	 * its own queue.
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist) &&
+	    RQ_QUEUE(req) == RQ_QUEUE(next)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+		if ((s32)(RQ_INSERT_US(next) - RQ_INSERT_US(req)) < 0)
+			req->elevator_private[1] = next->elevator_private[1];
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	flash_remove_request(q, next);
+}
+
+/*
+ * move request from sort list to dispatch queue.
+ */
+static void
+flash_move_request(struct flash_data *fd, struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	if (RQ_QUEUE(rq) == FLASH_SYNC_READ)
+		fd->next_rq = NULL;
+	else
+		fd->next_rq = flash_latter_request(rq);
+
+	flash_remove_request(q, rq);
+	elv_dispatch_add_tail(q, rq);
+}
+
+/*
+ * flash_check_fifo returns 0 if there are no expired requests on the fifo,
+ * 1 otherwise.
+ */
+static inline int flash_check_fifo(struct flash_data *fd, int queue)
+{
+	struct request *rq;
+
+	if (list_empty(&fd->fifo_list[queue]))
+		return 0;
+
+	rq = rq_entry_fifo(fd->fifo_list[queue].next);
+
+	/*
+	 * rq is expired!
+	 */
+	if (time_after(jiffies, rq_fifo_time(rq)))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Pick the queue for a new batch. Reads win unless writes have already
+ * been passed over writes_starved times or one of them has expired;
+ * likewise sync writes win over async writes within async_starved.
+ */
+static int flash_choose_queue(struct flash_data *fd)
+{
+	const int reads = !list_empty(&fd->fifo_list[FLASH_SYNC_READ]);
+	const int sync_writes = !list_empty(&fd->fifo_list[FLASH_SYNC_WRITE]);
+	const int async_writes = !list_empty(&fd->fifo_list[FLASH_ASYNC]);
+
+	fd->batch_preempt = !reads;
+
+	if (reads) {
+		if (!sync_writes && !async_writes)
+			return FLASH_SYNC_READ;
+
+		if (fd->starved++ < fd->writes_starved &&
+		    !flash_check_fifo(fd, FLASH_SYNC_WRITE) &&
+		    !flash_check_fifo(fd, FLASH_ASYNC))
+			return FLASH_SYNC_READ;
+	}
+
+	/*
+	 * there are either no reads or writes have been starved
+	 */
+	fd->starved = 0;
+
+	if (sync_writes) {
+		if (!async_writes)
+			return FLASH_SYNC_WRITE;
+
+		if (fd->async_starved++ < fd->async_starved_max &&
+		    !flash_check_fifo(fd, FLASH_ASYNC))
+			return FLASH_SYNC_WRITE;
+	}
+
+	if (async_writes) {
+		fd->async_starved = 0;
+		return FLASH_ASYNC;
+	}
+
+	return -1;
+}
+
+/*
+ * flash_dispatch_requests selects the best request according to
+ * the batch in progress, starvation limits and expiry times
+ */
+static int flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *rq;
+	int queue = fd->batch_queue;
+
+	if (queue == FLASH_SYNC_READ) {
+		/*
+		 * A read batch ends as soon as there are no more reads;
+		 * there is nothing to be gained by waiting for one.
+		 */
+		if (fd->batching < fd->read_batch &&
+		    !list_empty(&fd->fifo_list[FLASH_SYNC_READ])) {
+			rq = rq_entry_fifo(fd->fifo_list[FLASH_SYNC_READ].next);
+			goto dispatch_request;
+		}
+	} else if (queue >= 0) {
+		rq = fd->next_rq;
+		if (rq && fd->batching < fd->write_batch &&
+		    !(fd->batch_preempt &&
+		      !list_empty(&fd->fifo_list[FLASH_SYNC_READ])))
+			goto dispatch_request;
+	}
+
+	/*
+	 * at this point we are not running a batch. select the appropriate
+	 * queue
+	 */
+	queue = flash_choose_queue(fd);
+	if (queue < 0) {
+		fd->batch_queue = -1;
+		fd->next_rq = NULL;
+		return 0;
+	}
+
+	/*
+	 * Reads are served in arrival order. A write batch starts from the
+	 * oldest write, then continues in increasing sector order.
+	 */
+	rq = rq_entry_fifo(fd->fifo_list[queue].next);
+	fd->batch_queue = queue;
+	fd->batching = 0;
+
+dispatch_request:
+	/*
+	 * rq is the selected appropriate request.
+	 */
+	fd->batching++;
+	flash_move_request(fd, rq);
+
+	return 1;
+}
+
+/*
+ * The request was handed to the driver; this may happen again after a
+ * requeue, in which case the driver time restarts.
+ */
+static void flash_activate_request(struct request_queue *q, struct request *rq)
+{
+	rq->elevator_private[2] = (void *)(unsigned long)flash_now_us();
+}
+
+static void flash_completed_request(struct request_queue *q,
+				    struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct flash_latency *lat = &fd->latency[RQ_QUEUE(rq)];
+	u32 now = flash_now_us();
+	u32 total = now - RQ_INSERT_US(rq);
+
+	lat->nr++;
+	lat->wait_us += RQ_DISPATCH_US(rq) - RQ_INSERT_US(rq);
+	lat->service_us += now - RQ_DISPATCH_US(rq);
+	if (total > lat->max_us)
+		lat->max_us = total;
+}
+
+static void flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+	int i;
+
+	for (i = 0; i < FLASH_NR_QUEUES; i++)
+		BUG_ON(!list_empty(&fd->fifo_list[i]));
+
+	kfree(fd);
+}
+
+/*
+ * initialize elevator private data (flash_data).
+ */
+static void *flash_init_queue(struct request_queue *q)
+{
+	struct flash_data *fd;
+	int i;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	for (i = 0; i < FLASH_NR_QUEUES; i++) {
+		INIT_LIST_HEAD(&fd->fifo_list[i]);
+		fd->sort_list[i] = RB_ROOT;
+	}
+	fd->queue = q;
+	fd->batch_queue = -1;
+	fd->fifo_expire[FLASH_SYNC_READ] = read_expire;
+	fd->fifo_expire[FLASH_SYNC_WRITE] = sync_write_expire;
+	fd->fifo_expire[FLASH_ASYNC] = async_write_expire;
+	fd->read_batch = read_batch;
+	fd->write_batch = write_batch;
+	fd->writes_starved = writes_starved;
+	fd->async_starved_max = async_starved;
+	fd->front_merges = 1;
+	return fd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+flash_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+flash_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return flash_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(flash_read_expire_show, fd->fifo_expire[FLASH_SYNC_READ], 1);
+SHOW_FUNCTION(flash_sync_write_expire_show, fd->fifo_expire[FLASH_SYNC_WRITE], 1);
+SHOW_FUNCTION(flash_async_write_expire_show, fd->fifo_expire[FLASH_ASYNC], 1);
+SHOW_FUNCTION(flash_read_batch_show, fd->read_batch, 0);
+SHOW_FUNCTION(flash_write_batch_show, fd->write_batch, 0);
+SHOW_FUNCTION(flash_writes_starved_show, fd->writes_starved, 0);
+SHOW_FUNCTION(flash_async_starved_show, fd->async_starved_max, 0);
+SHOW_FUNCTION(flash_front_merges_show, fd->front_merges, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_read_expire_store, &fd->fifo_expire[FLASH_SYNC_READ], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_sync_write_expire_store, &fd->fifo_expire[FLASH_SYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_async_write_expire_store, &fd->fifo_expire[FLASH_ASYNC], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_read_batch_store, &fd->read_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_write_batch_store, &fd->write_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_writes_starved_store, &fd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(flash_async_starved_store, &fd->async_starved_max, 0, INT_MAX, 0);
+STORE_FUNCTION(flash_front_merges_store, &fd->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+/*
+ * One line per queue: completed requests, average time spent in the
+ * scheduler and in the driver, and the worst total latency, all in
+ * microseconds. Writing anything resets the counters.
+ */
+static ssize_t flash_latency_stats_show(struct elevator_queue *e, char *page)
+{
+	struct flash_data *fd = e->elevator_data;
+	struct flash_latency latency[FLASH_NR_QUEUES];
+	ssize_t len = 0;
+	int i;
+
+	spin_lock_irq(fd->queue->queue_lock);
+	memcpy(latency, fd->latency, sizeof(latency));
+	spin_unlock_irq(fd->queue->queue_lock);
+
+	for (i = 0; i < FLASH_NR_QUEUES; i++) {
+		struct flash_latency lat = latency[i];
+		unsigned long nr = lat.nr ? lat.nr : 1;
+
+		len += sprintf(page + len, "%-10s %lu %llu %llu %u\n",
+			       flash_queue_name[i], lat.nr,
+			       div_u64(lat.wait_us, nr),
+			       div_u64(lat.service_us, nr), lat.max_us);
+	}
+
+	return len;
+}
+
+static ssize_t flash_latency_stats_store(struct elevator_queue *e,
+					 const char *page, size_t count)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	spin_lock_irq(fd->queue->queue_lock);
+	memset(fd->latency, 0, sizeof(fd->latency));
+	spin_unlock_irq(fd->queue->queue_lock);
+	return count;
+}
+
+#define FLASH_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	FLASH_ATTR(read_expire),
+	FLASH_ATTR(sync_write_expire),
+	FLASH_ATTR(async_write_expire),
+	FLASH_ATTR(read_batch),
+	FLASH_ATTR(write_batch),
+	FLASH_ATTR(writes_starved),
+	FLASH_ATTR(async_starved),
+	FLASH_ATTR(front_merges),
+	FLASH_ATTR(latency_stats),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn = 		flash_merge,
+		.elevator_merged_fn =		flash_merged_request,
+		.elevator_merge_req_fn =	flash_merged_requests,
+		.elevator_dispatch_fn =		flash_dispatch_requests,
+		.elevator_add_req_fn =		flash_add_request,
+		.elevator_activate_req_fn =	flash_activate_request,
+		.elevator_completed_req_fn =	flash_completed_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		flash_init_queue,
+		.elevator_exit_fn =		flash_exit_queue,
+	},
+
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	elv_register(&iosched_flash);
+
+	return 0;
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("flash IO scheduler");
@@ -1014,6 +1014,71 @@ static ssize_t disk_discard_alignment_show(struct device *dev,
 	return sprintf(buf, "%d\n", queue_discard_alignment(disk->queue));
 }
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+static const char *const lat_hist_op_name[LAT_HIST_OPS] = {
+	[LAT_HIST_READ]		= "read",
+	[LAT_HIST_WRITE]	= "write",
+	[LAT_HIST_FLUSH]	= "flush",
+};
+
+static const char *const lat_hist_size_name[LAT_HIST_SIZES] = {
+	[LAT_HIST_4K]		= "4k",
+	[LAT_HIST_32K]		= "32k",
+	[LAT_HIST_256K]		= "256k",
+	[LAT_HIST_LARGE]	= "large",
+};
+
+/*
+ * One line per request type and size class, followed by the count in
+ * each latency bucket summed over all CPUs.
+ */
+static ssize_t disk_latency_hist_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct gendisk *disk = dev_to_disk(dev);
+	unsigned long count[LAT_HIST_BUCKETS];
+	ssize_t len = 0;
+	int op, size, i, cpu;
+
+	for (op = 0; op < LAT_HIST_OPS; op++) {
+		for (size = 0; size < LAT_HIST_SIZES; size++) {
+			memset(count, 0, sizeof(count));
+			for_each_possible_cpu(cpu) {
+				struct disk_latency_hist *hist =
+					per_cpu_ptr(disk->lat_hist, cpu);
+
+				for (i = 0; i < LAT_HIST_BUCKETS; i++)
+					count[i] += hist->count[op][size][i];
+			}
+
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%s %s",
+					 lat_hist_op_name[op],
+					 lat_hist_size_name[size]);
+			for (i = 0; i < LAT_HIST_BUCKETS; i++)
+				len += scnprintf(buf + len, PAGE_SIZE - len,
+						 " %lu", count[i]);
+			len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+		}
+	}
+
+	return len;
+}
+
+static ssize_t disk_latency_hist_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct gendisk *disk = dev_to_disk(dev);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(disk->lat_hist, cpu), 0,
+		       sizeof(struct disk_latency_hist));
+
+	return count;
+}
+#endif
+
 static DEVICE_ATTR(range, S_IRUGO|S_IWUSR, disk_range_show, disk_range_store);
 static DEVICE_ATTR(ext_range, S_IRUGO, disk_ext_range_show, NULL);
 static DEVICE_ATTR(removable, S_IRUGO, disk_removable_show, NULL);
@@ -1025,6 +1090,10 @@ static DEVICE_ATTR(discard_alignment, S_IRUGO, disk_discard_alignment_show,
 static DEVICE_ATTR(capability, S_IRUGO, disk_capability_show, NULL);
 static DEVICE_ATTR(stat, S_IRUGO, part_stat_show, NULL);
 static DEVICE_ATTR(inflight, S_IRUGO, part_inflight_show, NULL);
+#ifdef CONFIG_BLK_LATENCY_HIST
+static DEVICE_ATTR(latency_hist, S_IRUGO|S_IWUSR, disk_latency_hist_show,
+		   disk_latency_hist_store);
+#endif
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 static struct device_attribute dev_attr_fail =
 	__ATTR(make-it-fail, S_IRUGO|S_IWUSR, part_fail_show, part_fail_store);
@@ -1046,6 +1115,9 @@ static struct attribute *disk_attrs[] = {
 	&dev_attr_capability.attr,
 	&dev_attr_stat.attr,
 	&dev_attr_inflight.attr,
+#ifdef CONFIG_BLK_LATENCY_HIST
+	&dev_attr_latency_hist.attr,
+#endif
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 	&dev_attr_fail.attr,
 #endif
@@ -1149,6 +1221,9 @@ static void disk_release(struct device *dev)
 	disk_replace_part_tbl(disk, NULL);
 	free_part_stats(&disk->part0);
 	free_part_info(&disk->part0);
+#ifdef CONFIG_BLK_LATENCY_HIST
+	free_percpu(disk->lat_hist);
+#endif
 	if (disk->queue)
 		blk_put_queue(disk->queue);
 	kfree(disk);
@@ -1304,8 +1379,19 @@ struct gendisk *alloc_disk_node(int minors, int node_id)
 			kfree(disk);
 			return NULL;
 		}
+#ifdef CONFIG_BLK_LATENCY_HIST
+		disk->lat_hist = alloc_percpu(struct disk_latency_hist);
+		if (!disk->lat_hist) {
+			free_part_stats(&disk->part0);
+			kfree(disk);
+			return NULL;
+		}
+#endif
 		disk->node_id = node_id;
 		if (disk_expand_part_tbl(disk, 0)) {
+#ifdef CONFIG_BLK_LATENCY_HIST
+			free_percpu(disk->lat_hist);
+#endif
 			free_part_stats(&disk->part0);
 			kfree(disk);
 			return NULL;
@@ -0,0 +1,225 @@
+/*
+ * Null block device driver.
+ *
+ * A block device that completes every request immediately without
+ * touching any data. It exists to measure the overhead of the block
+ * layer itself: the same workload can be run against the bio-based,
+ * request_fn and multi-queue paths by changing queue_mode.
+ *
+ *	modprobe null_blk queue_mode=2 submit_queues=4
+ *	fio --filename=/dev/nullb0 --direct=1 --rw=randread --bs=4k \
+ *	    --ioengine=libaio --iodepth=32 --numjobs=4 ...
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+
+enum {
+	NULL_Q_BIO	= 0,
+	NULL_Q_RQ	= 1,
+	NULL_Q_MQ	= 2,
+};
+
+struct nullb {
+	struct list_head	list;
+	unsigned int		index;
+	struct request_queue	*q;
+	struct gendisk		*disk;
+	spinlock_t		lock;		/* queue_lock for NULL_Q_RQ */
+};
+
+static LIST_HEAD(nullb_list);
+static int null_major;
+
+static int queue_mode = NULL_Q_MQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode, "Block interface: 0=bio, 1=request_fn, 2=multi-queue");
+
+static int submit_queues;
+module_param(submit_queues, int, S_IRUGO);
+MODULE_PARM_DESC(submit_queues, "Hardware queues for queue_mode=2, default one per online CPU");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Requests per hardware queue, default 64");
+
+static int nr_devices = 2;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices, default 2");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size of each device in GB, default 250");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Logical block size in bytes, default 512");
+
+static int null_make_request(struct request_queue *q, struct bio *bio)
+{
+	bio_endio(bio, 0);
+	return 0;
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while ((rq = blk_fetch_request(q)) != NULL)
+		__blk_end_request_all(rq, 0);
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq,
+			 bool last)
+{
+	blk_mq_end_io(rq, 0);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+};
+
+static const struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+
+	del_gendisk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	kfree(nullb);
+}
+
+static int null_add_dev(unsigned int index)
+{
+	struct nullb *nullb;
+	struct gendisk *disk;
+	sector_t size;
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		return -ENOMEM;
+
+	nullb->index = index;
+	spin_lock_init(&nullb->lock);
+
+	switch (queue_mode) {
+	case NULL_Q_MQ: {
+		struct blk_mq_reg reg = {
+			.ops		= &null_mq_ops,
+			.nr_hw_queues	= submit_queues,
+			.queue_depth	= hw_queue_depth,
+			.numa_node	= -1,
+		};
+
+		nullb->q = blk_mq_init_queue(&reg, nullb);
+		break;
+	}
+	case NULL_Q_RQ:
+		nullb->q = blk_init_queue(null_request_fn, &nullb->lock);
+		break;
+	default:
+		nullb->q = blk_alloc_queue(GFP_KERNEL);
+		if (nullb->q)
+			blk_queue_make_request(nullb->q, null_make_request);
+		break;
+	}
+	if (!nullb->q)
+		goto out_free;
+
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out_cleanup;
+
+	size = (sector_t)gb * 1024 * 1024 * 1024;
+	set_capacity(disk, size >> 9);
+
+	disk->flags |= GENHD_FL_EXT_DEVT | GENHD_FL_SUPPRESS_PARTITION_INFO;
+	disk->major = null_major;
+	disk->first_minor = index;
+	disk->fops = &null_fops;
+	disk->private_data = nullb;
+	disk->queue = nullb->q;
+	sprintf(disk->disk_name, "nullb%d", index);
+	add_disk(disk);
+
+	list_add_tail(&nullb->list, &nullb_list);
+	return 0;
+
+out_cleanup:
+	blk_cleanup_queue(nullb->q);
+out_free:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	unsigned int i;
+	int ret;
+
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ) {
+		pr_warn("null_blk: invalid queue_mode %d, using %d\n",
+			queue_mode, NULL_Q_MQ);
+		queue_mode = NULL_Q_MQ;
+	}
+
+	if (submit_queues <= 0 || submit_queues > nr_cpu_ids)
+		submit_queues = num_online_cpus();
+
+	if (hw_queue_depth <= 0 || hw_queue_depth > BLK_MQ_MAX_DEPTH)
+		hw_queue_depth = 64;
+
+	if (bs < 512 || bs > PAGE_SIZE || !is_power_of_2(bs))
+		bs = 512;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		ret = null_add_dev(i);
+		if (ret)
+			goto out;
+	}
+
+	pr_info("null_blk: module loaded\n");
+	return 0;
+
+out:
+	while (!list_empty(&nullb_list))
+		null_del_dev(list_entry(nullb_list.next, struct nullb, list));
+	unregister_blkdev(null_major, "nullb");
+	return ret;
+}
+
+static void __exit null_exit(void)
+{
+	while (!list_empty(&nullb_list))
+		null_del_dev(list_entry(nullb_list.next, struct nullb, list));
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Null block device for block layer benchmarking");
@@ -2,6 +2,7 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -14,6 +15,13 @@
 static int major, index;
 struct workqueue_struct *virtblk_wq;
 
+static bool use_mq;
+module_param(use_mq, bool, S_IRUGO);
+MODULE_PARM_DESC(use_mq, "Use the multi-queue request path");
+
+/* Requests per hardware queue on the multi-queue path */
+#define VIRTBLK_MQ_DEPTH	64
+
 struct virtio_blk
 {
 	spinlock_t lock;
@@ -48,28 +56,30 @@ struct virtblk_req
 	u8 status;
 };
 
+static int virtblk_result(struct virtblk_req *vbr)
+{
+	switch (vbr->status) {
+	case VIRTIO_BLK_S_OK:
+		return 0;
+	case VIRTIO_BLK_S_UNSUPP:
+		return -ENOTTY;
+	default:
+		return -EIO;
+	}
+}
+
 static void blk_done(struct virtqueue *vq)
 {
 	struct virtio_blk *vblk = vq->vdev->priv;
-	struct virtblk_req *vbr;
+	struct request_queue *q = vblk->disk->queue;
+	struct virtblk_req *vbr, *tmp;
 	unsigned int len;
 	unsigned long flags;
+	LIST_HEAD(done);
 
 	spin_lock_irqsave(&vblk->lock, flags);
 	while ((vbr = virtqueue_get_buf(vblk->vq, &len)) != NULL) {
-		int error;
-
-		switch (vbr->status) {
-		case VIRTIO_BLK_S_OK:
-			error = 0;
-			break;
-		case VIRTIO_BLK_S_UNSUPP:
-			error = -ENOTTY;
-			break;
-		default:
-			error = -EIO;
-			break;
-		}
+		int error = virtblk_result(vbr);
 
 		switch (vbr->req->cmd_type) {
 		case REQ_TYPE_BLOCK_PC:
@@ -84,13 +94,30 @@ static void blk_done(struct virtqueue *vq)
 			break;
 		}
 
+		/*
+		 * Completing a multi-queue request may submit more I/O,
+		 * which needs vblk->lock; do that after dropping it.
+		 */
+		if (q->mq_ops) {
+			list_move_tail(&vbr->list, &done);
+			continue;
+		}
+
 		__blk_end_request_all(vbr->req, error);
 		list_del(&vbr->list);
 		mempool_free(vbr, vblk->pool);
 	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+	if (q->mq_ops)
+		blk_mq_start_stopped_hw_queues(q);
+	else
+		blk_start_queue(q);
 	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	list_for_each_entry_safe(vbr, tmp, &done, list) {
+		list_del(&vbr->list);
+		blk_mq_end_io(vbr->req, virtblk_result(vbr));
+	}
 }
 
 static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
@@ -99,7 +126,10 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	unsigned long num, out = 0, in = 0;
 	struct virtblk_req *vbr;
 
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
+	if (q->mq_ops)
+		vbr = blk_mq_rq_to_pdu(req);
+	else
+		vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
 	if (!vbr)
 		/* When another request finishes we'll try again. */
 		return false;
@@ -166,7 +196,8 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	}
 
 	if (virtqueue_add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0) {
-		mempool_free(vbr, vblk->pool);
+		if (!q->mq_ops)
+			mempool_free(vbr, vblk->pool);
 		return false;
 	}
 
@@ -197,6 +228,44 @@ static void do_virtblk_request(struct request_queue *q)
 		virtqueue_kick(vblk->vq);
 }
 
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req,
+			    bool last)
+{
+	struct virtio_blk *vblk = hctx->queue->queuedata;
+	unsigned long flags;
+
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	if (!do_req(hctx->queue, vblk, req)) {
+		/*
+		 * Stop under vblk->lock, so that blk_done() can't restart
+		 * the queue before it is stopped.
+		 */
+		blk_mq_stop_hw_queue(hctx);
+		virtqueue_kick(vblk->vq);
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
+	if (last)
+		virtqueue_kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops virtblk_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+};
+
+static struct blk_mq_reg virtblk_mq_reg = {
+	.ops		= &virtblk_mq_ops,
+	.nr_hw_queues	= 1,
+	.queue_depth	= VIRTBLK_MQ_DEPTH,
+	.cmd_size	= sizeof(struct virtblk_req),
+	.numa_node	= -1,
+};
+
 /* return id (s/n) string for *disk to *id_str
  */
 static int virtblk_get_id(struct gendisk *disk, char *id_str)
@@ -395,7 +464,11 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_mempool;
 	}
 
-	q = vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
+	if (use_mq)
+		q = blk_mq_init_queue(&virtblk_mq_reg, vblk);
+	else
+		q = blk_init_queue(do_virtblk_request, &vblk->lock);
+	vblk->disk->queue = q;
 	if (!q) {
 		err = -ENOMEM;
 		goto out_put_disk;
@@ -0,0 +1,831 @@
+/*
+ *  drivers/cpufreq/cpufreq_interactive.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The "interactive" governor samples CPU load on a per-CPU timer like
+ * ondemand, but the timer is driven by idle entry and exit: a CPU that
+ * leaves idle at its minimum speed is re-evaluated one tick later
+ * instead of up to a whole sampling period later, and a wakeup that
+ * queues work on a busy, slow CPU raises it to hispeed_freq at once.
+ * Speed is lowered only after the current one has been held for
+ * min_sample_time.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpumask.h>
+#include <linux/irq_work.h>
+#include <linux/jiffies.h>
+#include <linux/kernel_stat.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/tick.h>
+#include <linux/timer.h>
+#include <linux/ktime.h>
+
+#define DEFAULT_GO_HISPEED_LOAD		(85)
+#define DEFAULT_TARGET_LOAD		(90)
+#define DEFAULT_MIN_SAMPLE_TIME		(80 * USEC_PER_MSEC)
+#define DEFAULT_TIMER_RATE		(20 * USEC_PER_MSEC)
+#define DEFAULT_ABOVE_HISPEED_DELAY	(20 * USEC_PER_MSEC)
+
+struct cpufreq_interactive_cpuinfo {
+	struct timer_list cpu_timer;
+	int timer_idlecancel;	/* cancel the timer if the CPU goes idle */
+	int short_sample;	/* timer armed on idle exit */
+	int idling;
+	u64 time_in_idle;
+	u64 time_in_idle_timestamp;
+	u64 target_set_time;
+	u64 target_set_time_in_idle;
+	struct cpufreq_policy *policy;
+	struct cpufreq_frequency_table *freq_table;
+	unsigned int target_freq;
+	unsigned int floor_freq;
+	u64 floor_validate_time;
+	u64 hispeed_validate_time;
+	unsigned long wakeup_boost;	/* bit 0: boost asked for by a wakeup */
+	/*
+	 * Held for writing while the governor is started or stopped on
+	 * this CPU, so that the speed change task never uses a stale
+	 * policy.
+	 */
+	struct rw_semaphore enable_sem;
+	int governor_enabled;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
+
+/* realtime thread handles frequency changes */
+static struct task_struct *speedchange_task;
+static cpumask_t speedchange_cpumask;
+static DEFINE_SPINLOCK(speedchange_cpumask_lock);
+
+/* applies the boosts asked for by wakeups, outside try_to_wake_up() */
+static struct irq_work boost_work;
+
+/* number of CPUs using this governor, protected by gov_lock */
+static unsigned int active_count;
+static DEFINE_MUTEX(gov_lock);
+
+/*
+ * Target loads: "load freq:load freq:load ...", each load applying
+ * from the preceding frequency up.  The governor picks the speed at
+ * which the current work would keep the CPU at the target load.
+ */
+static DEFINE_SPINLOCK(target_loads_lock);
+static unsigned int default_target_loads[] = {DEFAULT_TARGET_LOAD};
+
+/* Tunables, shared by all CPUs like ondemand's; times are in uS */
+static struct interactive_tuners {
+	unsigned int hispeed_freq;
+	unsigned int go_hispeed_load;
+	unsigned int min_sample_time;
+	unsigned int timer_rate;
+	unsigned int above_hispeed_delay;
+	unsigned int *target_loads;
+	int ntarget_loads;
+} tuners_ins = {
+	.go_hispeed_load = DEFAULT_GO_HISPEED_LOAD,
+	.min_sample_time = DEFAULT_MIN_SAMPLE_TIME,
+	.timer_rate = DEFAULT_TIMER_RATE,
+	.above_hispeed_delay = DEFAULT_ABOVE_HISPEED_DELAY,
+	.target_loads = default_target_loads,
+	.ntarget_loads = ARRAY_SIZE(default_target_loads),
+};
+
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+					unsigned int event);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+static
+#endif
+struct cpufreq_governor cpufreq_gov_interactive = {
+	.name = "interactive",
+	.governor = cpufreq_governor_interactive,
+	.max_transition_latency = 10000000,
+	.owner = THIS_MODULE,
+};
+
+static inline cputime64_t get_cpu_idle_time_jiffy(unsigned int cpu,
+						  cputime64_t *wall)
+{
+	cputime64_t idle_time;
+	cputime64_t cur_wall_time;
+	cputime64_t busy_time;
+
+	cur_wall_time = jiffies64_to_cputime64(get_jiffies_64());
+	busy_time = cputime64_add(kstat_cpu(cpu).cpustat.user,
+			kstat_cpu(cpu).cpustat.system);
+
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.irq);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.softirq);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.steal);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.nice);
+
+	idle_time = cputime64_sub(cur_wall_time, busy_time);
+	if (wall)
+		*wall = (cputime64_t)jiffies_to_usecs(cur_wall_time);
+
+	return (cputime64_t)jiffies_to_usecs(idle_time);
+}
+
+static inline cputime64_t get_cpu_idle_time(unsigned int cpu, cputime64_t *wall)
+{
+	u64 idle_time = get_cpu_idle_time_us(cpu, wall);
+
+	if (idle_time == -1ULL)
+		return get_cpu_idle_time_jiffy(cpu, wall);
+
+	return idle_time;
+}
+
+static inline u64 now_us(void)
+{
+	return ktime_to_us(ktime_get());
+}
+
+/* Start a new load sample and arm the timer @delay jiffies out. */
+static void cpufreq_interactive_arm_timer(struct cpufreq_interactive_cpuinfo *pcpu,
+					  int cpu, unsigned long delay)
+{
+	pcpu->time_in_idle = get_cpu_idle_time(cpu,
+					       &pcpu->time_in_idle_timestamp);
+	mod_timer_pinned(&pcpu->cpu_timer, jiffies + delay);
+}
+
+static unsigned int freq_to_targetload(unsigned int freq)
+{
+	unsigned long flags;
+	unsigned int ret;
+	int i;
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+
+	for (i = 0; i < tuners_ins.ntarget_loads - 1 &&
+		    freq >= tuners_ins.target_loads[i+1]; i += 2)
+		;
+
+	ret = tuners_ins.target_loads[i];
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+	return ret;
+}
+
+/*
+ * Pick the lowest frequency at which the load seen at the current
+ * speed stays at or below the target load for that frequency.  The
+ * target load depends on the frequency, so iterate; freqmin/freqmax
+ * bound the search so that it cannot oscillate.
+ */
+static unsigned int choose_freq(struct cpufreq_interactive_cpuinfo *pcpu,
+				unsigned int load)
+{
+	unsigned int freq = pcpu->policy->cur;
+	unsigned int loadadjfreq = freq * load;
+	unsigned int prevfreq, freqmin = 0, freqmax = UINT_MAX;
+	unsigned int index;
+
+	do {
+		prevfreq = freq;
+		if (cpufreq_frequency_table_target(pcpu->policy,
+				pcpu->freq_table,
+				loadadjfreq / freq_to_targetload(freq),
+				CPUFREQ_RELATION_L, &index))
+			break;
+		freq = pcpu->freq_table[index].frequency;
+
+		if (freq > prevfreq) {
+			/* The previous frequency is too low */
+			freqmin = prevfreq;
+
+			if (freq >= freqmax) {
+				/* Try the highest frequency below freqmax */
+				if (cpufreq_frequency_table_target(pcpu->policy,
+						pcpu->freq_table, freqmax - 1,
+						CPUFREQ_RELATION_H, &index))
+					break;
+				freq = pcpu->freq_table[index].frequency;
+
+				/*
+				 * Already found to be too low: freqmax is
+				 * the lowest speed that is fast enough.
+				 */
+				if (freq == freqmin) {
+					freq = freqmax;
+					break;
+				}
+			}
+		} else if (freq < prevfreq) {
+			/* The previous frequency is high enough */
+			freqmax = prevfreq;
+
+			if (freq <= freqmin) {
+				/* Try the lowest frequency above freqmin */
+				if (cpufreq_frequency_table_target(pcpu->policy,
+						pcpu->freq_table, freqmin + 1,
+						CPUFREQ_RELATION_L, &index))
+					break;
+				freq = pcpu->freq_table[index].frequency;
+
+				/*
+				 * Nothing between freqmin and freqmax:
+				 * freqmax is the one.
+				 */
+				if (freq == freqmax)
+					break;
+			}
+		}
+	} while (freq != prevfreq);
+
+	return freq;
+}
+
+static void cpufreq_interactive_timer(unsigned long data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, data);
+	u64 now, now_idle, wall;
+	unsigned int delta_idle, delta_time;
+	unsigned int cpu_load, load_since_change;
+	unsigned int new_freq, index;
+	unsigned long flags;
+
+	smp_rmb();
+	if (!pcpu->governor_enabled)
+		return;
+
+	pcpu->short_sample = 0;
+	now_idle = get_cpu_idle_time(data, &wall);
+	now = now_us();
+
+	delta_idle = (unsigned int)(now_idle - pcpu->time_in_idle);
+	delta_time = (unsigned int)(wall - pcpu->time_in_idle_timestamp);
+	if (!delta_time)
+		goto rearm;
+	cpu_load = delta_idle > delta_time ? 0 :
+		   100 * (delta_time - delta_idle) / delta_time;
+
+	delta_idle = (unsigned int)(now_idle - pcpu->target_set_time_in_idle);
+	delta_time = (unsigned int)(wall - pcpu->target_set_time);
+	load_since_change = !delta_time || delta_idle > delta_time ? 0 :
+			    100 * (delta_time - delta_idle) / delta_time;
+
+	/*
+	 * Choose the greater of short-term load (since the last sample)
+	 * and long-term load (since the last speed change).
+	 */
+	cpu_load = max(cpu_load, load_since_change);
+
+	if (cpu_load >= tuners_ins.go_hispeed_load) {
+		new_freq = choose_freq(pcpu, cpu_load);
+		if (new_freq < tuners_ins.hispeed_freq)
+			new_freq = tuners_ins.hispeed_freq;
+	} else {
+		new_freq = choose_freq(pcpu, cpu_load);
+	}
+
+	/* Above hispeed, ramp up only every above_hispeed_delay */
+	if (pcpu->target_freq >= tuners_ins.hispeed_freq &&
+	    new_freq > pcpu->target_freq &&
+	    now - pcpu->hispeed_validate_time < tuners_ins.above_hispeed_delay)
+		goto rearm;
+
+	pcpu->hispeed_validate_time = now;
+
+	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+					   new_freq, CPUFREQ_RELATION_L,
+					   &index))
+		goto rearm;
+
+	new_freq = pcpu->freq_table[index].frequency;
+
+	/*
+	 * Do not scale below floor_freq unless we have been at or above
+	 * it for min_sample_time.
+	 */
+	if (new_freq < pcpu->floor_freq &&
+	    now - pcpu->floor_validate_time < tuners_ins.min_sample_time)
+		goto rearm;
+
+	pcpu->floor_freq = new_freq;
+	pcpu->floor_validate_time = now;
+
+	if (pcpu->target_freq == new_freq)
+		goto rearm_if_notmax;
+
+	pcpu->target_set_time_in_idle = now_idle;
+	pcpu->target_set_time = wall;
+	pcpu->target_freq = new_freq;
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	cpumask_set_cpu(data, &speedchange_cpumask);
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+	wake_up_process(speedchange_task);
+
+rearm_if_notmax:
+	/*
+	 * Already at max speed and no need to change that: wait until
+	 * the next idle to re-evaluate.
+	 */
+	if (pcpu->target_freq == pcpu->policy->max)
+		return;
+
+rearm:
+	if (timer_pending(&pcpu->cpu_timer))
+		return;
+
+	/*
+	 * At min speed, an idle CPU needs no timer; a busy one only
+	 * until it goes idle.
+	 */
+	if (pcpu->target_freq == pcpu->policy->min) {
+		smp_rmb();
+		if (pcpu->idling)
+			return;
+		pcpu->timer_idlecancel = 1;
+	}
+
+	cpufreq_interactive_arm_timer(pcpu, data,
+				      usecs_to_jiffies(tuners_ins.timer_rate));
+}
+
+/* Called from the idle loop with interrupts disabled */
+void cpufreq_interactive_idle_start(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, smp_processor_id());
+	int pending;
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	pcpu->idling = 1;
+	smp_wmb();
+	pending = timer_pending(&pcpu->cpu_timer);
+
+	if (pcpu->target_freq != pcpu->policy->min) {
+		/*
+		 * Entering idle above min speed.  On some platforms the
+		 * other CPUs of the policy are held at that speed too, so
+		 * keep sampling until this CPU is lowered.
+		 */
+		if (!pending) {
+			pcpu->timer_idlecancel = 0;
+			cpufreq_interactive_arm_timer(pcpu, smp_processor_id(),
+					usecs_to_jiffies(tuners_ins.timer_rate));
+		}
+	} else if (pending && pcpu->timer_idlecancel) {
+		/*
+		 * At min speed the timer was only armed in case the CPU
+		 * went busy.  It did not; idle exit rechecks.
+		 */
+		del_timer(&pcpu->cpu_timer);
+		pcpu->timer_idlecancel = 0;
+	}
+}
+
+void cpufreq_interactive_idle_end(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, smp_processor_id());
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	pcpu->idling = 0;
+	smp_wmb();
+
+	/*
+	 * Sample the first tick after idle exit instead of waiting a
+	 * whole timer_rate, so a busy CPU leaves min speed quickly.  A
+	 * timer still pending keeps its sample.
+	 */
+	if (!timer_pending(&pcpu->cpu_timer)) {
+		pcpu->timer_idlecancel = pcpu->target_freq == pcpu->policy->min;
+		pcpu->short_sample = 1;
+		cpufreq_interactive_arm_timer(pcpu, smp_processor_id(), 1);
+	}
+}
+
+static void cpufreq_interactive_boost(struct irq_work *work)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned long flags;
+	int cpu, boost = 0;
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	for_each_possible_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!test_and_clear_bit(0, &pcpu->wakeup_boost))
+			continue;
+		if (!pcpu->governor_enabled ||
+		    pcpu->target_freq >= tuners_ins.hispeed_freq)
+			continue;
+
+		pcpu->target_freq = tuners_ins.hispeed_freq;
+		pcpu->floor_freq = tuners_ins.hispeed_freq;
+		pcpu->floor_validate_time = now_us();
+		pcpu->hispeed_validate_time = pcpu->floor_validate_time;
+		cpumask_set_cpu(cpu, &speedchange_cpumask);
+		boost = 1;
+	}
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+	if (boost)
+		wake_up_process(speedchange_task);
+}
+
+/*
+ * Called by the scheduler after waking @p onto @cpu.  More work queued
+ * on a busy CPU running below hispeed_freq raises it there right away;
+ * an idle CPU is handled by its own idle exit.  This runs on every
+ * wakeup, so it only flags the CPU and leaves the boost to an irq_work.
+ */
+void cpufreq_interactive_wakeup(struct task_struct *p, int cpu)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+
+	if (!pcpu->governor_enabled || pcpu->idling || pcpu->short_sample ||
+	    pcpu->target_freq >= tuners_ins.hispeed_freq ||
+	    p == speedchange_task)
+		return;
+
+	if (!test_and_set_bit(0, &pcpu->wakeup_boost))
+		irq_work_queue(&boost_work);
+}
+
+static int cpufreq_interactive_speedchange_task(void *data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int cpu, j, max_freq;
+	unsigned long flags;
+	cpumask_t tmp_mask;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+
+		if (cpumask_empty(&speedchange_cpumask)) {
+			spin_unlock_irqrestore(&speedchange_cpumask_lock,
+					       flags);
+			schedule();
+
+			if (kthread_should_stop())
+				break;
+
+			spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+		}
+
+		set_current_state(TASK_RUNNING);
+		tmp_mask = speedchange_cpumask;
+		cpumask_clear(&speedchange_cpumask);
+		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+		for_each_cpu(cpu, &tmp_mask) {
+			pcpu = &per_cpu(cpuinfo, cpu);
+			if (!down_read_trylock(&pcpu->enable_sem))
+				continue;
+			if (!pcpu->governor_enabled) {
+				up_read(&pcpu->enable_sem);
+				continue;
+			}
+
+			/* The policy's CPUs share a clock: use the highest */
+			max_freq = 0;
+			for_each_cpu(j, pcpu->policy->cpus) {
+				struct cpufreq_interactive_cpuinfo *pjcpu =
+					&per_cpu(cpuinfo, j);
+
+				if (pjcpu->target_freq > max_freq)
+					max_freq = pjcpu->target_freq;
+			}
+
+			if (max_freq != pcpu->policy->cur)
+				__cpufreq_driver_target(pcpu->policy, max_freq,
+							CPUFREQ_RELATION_H);
+
+			up_read(&pcpu->enable_sem);
+		}
+	}
+
+	return 0;
+}
+
+/************************** sysfs interface ************************/
+
+static ssize_t show_target_loads(struct kobject *kobj,
+				 struct attribute *attr, char *buf)
+{
+	unsigned long flags;
+	ssize_t ret = 0;
+	int i;
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+
+	for (i = 0; i < tuners_ins.ntarget_loads; i++)
+		ret += sprintf(buf + ret, "%u%s", tuners_ins.target_loads[i],
+			       i & 0x1 ? ":" : " ");
+
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+	buf[ret - 1] = '\n';
+	return ret;
+}
+
+static ssize_t store_target_loads(struct kobject *kobj,
+				  struct attribute *attr, const char *buf,
+				  size_t count)
+{
+	const char *cp = buf;
+	unsigned int *new_loads, *old_loads;
+	unsigned long flags;
+	int ntokens = 1, i = 0;
+
+	while ((cp = strpbrk(cp + 1, " :")))
+		ntokens++;
+
+	if (!(ntokens & 0x1))
+		return -EINVAL;
+
+	new_loads = kmalloc(ntokens * sizeof(unsigned int), GFP_KERNEL);
+	if (!new_loads)
+		return -ENOMEM;
+
+	cp = buf;
+	while (i < ntokens) {
+		if (sscanf(cp, "%u", &new_loads[i]) != 1)
+			goto err;
+		/* loads at even positions, ascending frequencies between */
+		if (!(i & 0x1) ? new_loads[i] == 0 || new_loads[i] > 100 :
+		    i > 1 && new_loads[i] <= new_loads[i - 2])
+			goto err;
+		i++;
+
+		cp = strpbrk(cp, " :");
+		if (!cp)
+			break;
+		cp++;
+	}
+
+	if (i != ntokens)
+		goto err;
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+	old_loads = tuners_ins.target_loads;
+	tuners_ins.target_loads = new_loads;
+	tuners_ins.ntarget_loads = ntokens;
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+
+	if (old_loads != default_target_loads)
+		kfree(old_loads);
+	return count;
+
+err:
+	kfree(new_loads);
+	return -EINVAL;
+}
+
+define_one_global_rw(target_loads);
+
+#define show_one(file_name)						\
+static ssize_t show_##file_name						\
+(struct kobject *kobj, struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%u\n", tuners_ins.file_name);		\
+}
+show_one(hispeed_freq);
+show_one(go_hispeed_load);
+show_one(min_sample_time);
+show_one(timer_rate);
+show_one(above_hispeed_delay);
+
+static ssize_t store_hispeed_freq(struct kobject *a, struct attribute *b,
+				  const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+	tuners_ins.hispeed_freq = input;
+	return count;
+}
+
+static ssize_t store_go_hispeed_load(struct kobject *a, struct attribute *b,
+				     const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1 || input > 100)
+		return -EINVAL;
+	tuners_ins.go_hispeed_load = input;
+	return count;
+}
+
+static ssize_t store_min_sample_time(struct kobject *a, struct attribute *b,
+				     const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+	tuners_ins.min_sample_time = input;
+	return count;
+}
+
+static ssize_t store_timer_rate(struct kobject *a, struct attribute *b,
+				const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1 || !input)
+		return -EINVAL;
+	tuners_ins.timer_rate = input;
+	return count;
+}
+
+static ssize_t store_above_hispeed_delay(struct kobject *a,
+					 struct attribute *b,
+					 const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+	tuners_ins.above_hispeed_delay = input;
+	return count;
+}
+
+define_one_global_rw(hispeed_freq);
+define_one_global_rw(go_hispeed_load);
+define_one_global_rw(min_sample_time);
+define_one_global_rw(timer_rate);
+define_one_global_rw(above_hispeed_delay);
+
+static struct attribute *interactive_attributes[] = {
+	&target_loads.attr,
+	&hispeed_freq.attr,
+	&go_hispeed_load.attr,
+	&min_sample_time.attr,
+	&timer_rate.attr,
+	&above_hispeed_delay.attr,
+	NULL,
+};
+
+static struct attribute_group interactive_attr_group = {
+	.attrs = interactive_attributes,
+	.name = "interactive",
+};
+
+/************************** sysfs end ************************/
+
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+					unsigned int event)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int j;
+	int rc;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu) || !policy->cur ||
+		    !cpufreq_frequency_get_table(policy->cpu))
+			return -EINVAL;
+
+		mutex_lock(&gov_lock);
+
+		if (!active_count) {
+			rc = sysfs_create_group(cpufreq_global_kobject,
+						&interactive_attr_group);
+			if (rc) {
+				mutex_unlock(&gov_lock);
+				return rc;
+			}
+		}
+		active_count++;
+
+		if (!tuners_ins.hispeed_freq)
+			tuners_ins.hispeed_freq = policy->max;
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+
+			down_write(&pcpu->enable_sem);
+			del_timer_sync(&pcpu->cpu_timer);
+			pcpu->policy = policy;
+			pcpu->freq_table = cpufreq_frequency_get_table(j);
+			pcpu->target_freq = policy->cur;
+			pcpu->target_set_time_in_idle =
+				get_cpu_idle_time(j, &pcpu->target_set_time);
+			pcpu->floor_freq = pcpu->target_freq;
+			pcpu->floor_validate_time = now_us();
+			pcpu->hispeed_validate_time =
+				pcpu->floor_validate_time;
+			pcpu->timer_idlecancel = 0;
+			pcpu->short_sample = 0;
+			pcpu->time_in_idle = get_cpu_idle_time(j,
+					&pcpu->time_in_idle_timestamp);
+			pcpu->cpu_timer.expires =
+				jiffies + usecs_to_jiffies(tuners_ins.timer_rate);
+			add_timer_on(&pcpu->cpu_timer, j);
+			pcpu->governor_enabled = 1;
+			smp_wmb();
+			up_write(&pcpu->enable_sem);
+		}
+
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		mutex_lock(&gov_lock);
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+
+			down_write(&pcpu->enable_sem);
+			pcpu->governor_enabled = 0;
+			smp_wmb();
+			del_timer_sync(&pcpu->cpu_timer);
+			up_write(&pcpu->enable_sem);
+		}
+
+		if (!--active_count)
+			sysfs_remove_group(cpufreq_global_kobject,
+					   &interactive_attr_group);
+
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy, policy->max,
+						CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy, policy->min,
+						CPUFREQ_RELATION_L);
+		break;
+	}
+	return 0;
+}
+
+static int __init cpufreq_interactive_init(void)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		pcpu = &per_cpu(cpuinfo, i);
+		init_timer(&pcpu->cpu_timer);
+		pcpu->cpu_timer.function = cpufreq_interactive_timer;
+		pcpu->cpu_timer.data = i;
+		init_rwsem(&pcpu->enable_sem);
+	}
+	init_irq_work(&boost_work, cpufreq_interactive_boost);
+
+	speedchange_task = kthread_create(cpufreq_interactive_speedchange_task,
+					  NULL, "cfinteractive");
+	if (IS_ERR(speedchange_task))
+		return PTR_ERR(speedchange_task);
+
+	sched_setscheduler_nocheck(speedchange_task, SCHED_FIFO, &param);
+	get_task_struct(speedchange_task);
+
+	/* NB: wake up so the thread does not look hung to the freezer */
+	wake_up_process(speedchange_task);
+
+	return cpufreq_register_governor(&cpufreq_gov_interactive);
+}
+
+static void __exit cpufreq_interactive_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_interactive);
+	kthread_stop(speedchange_task);
+	put_task_struct(speedchange_task);
+}
+
+MODULE_DESCRIPTION("'cpufreq_interactive' - A cpufreq governor for "
+	"latency sensitive workloads");
+MODULE_LICENSE("GPL");
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+fs_initcall(cpufreq_interactive_init);
+#else
+module_init(cpufreq_interactive_init);
+#endif
+module_exit(cpufreq_interactive_exit);
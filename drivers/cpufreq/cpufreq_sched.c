@@ -0,0 +1,264 @@
+/*
+ *  drivers/cpufreq/cpufreq_sched.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The "sched" governor does not sample anything.  The CFS scheduler
+ * keeps a decaying utilisation average for every entity and every
+ * runqueue, and calls back here from enqueue, dequeue and the tick
+ * whenever a CPU's utilisation changes (see sched_register_capacity_fn).
+ * The new speed for the policy is chosen from the busiest of its CPUs,
+ * so a task that migrates takes its demand along with it instead of
+ * waiting for idle statistics to catch up.
+ *
+ * The callback runs under the runqueue lock, where neither the cpufreq
+ * driver nor wake_up_process() may be called, so it only records the
+ * request and kicks an irq_work, which in turn wakes a per-policy
+ * SCHED_FIFO thread that performs the transition.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpumask.h>
+#include <linux/delay.h>
+#include <linux/irq_work.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+/* Run at 80% utilisation of the chosen speed, i.e. 25% headroom */
+#define CAPACITY_MARGIN		1280
+
+/* Protects gov_refcount and the per-cpu gd pointers being set up */
+static DEFINE_MUTEX(gov_mutex);
+static int gov_refcount;
+
+struct gov_data {
+	struct cpufreq_policy *policy;
+	struct task_struct *task;
+	struct irq_work irq_work;
+	struct mutex lock;	/* serialises transitions with LIMITS */
+	unsigned int requested_freq;
+	unsigned long pending;	/* bit 0: a wakeup is on its way */
+	unsigned int throttle_ms;
+};
+
+static DEFINE_PER_CPU(struct gov_data *, cpu_gd);
+static DEFINE_PER_CPU(unsigned long, cpu_util);
+
+static int cpufreq_sched_thread(void *data)
+{
+	struct gov_data *gd = data;
+	struct cpufreq_policy *policy = gd->policy;
+	unsigned int freq;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!test_and_clear_bit(0, &gd->pending)) {
+			if (kthread_should_stop())
+				break;
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		freq = ACCESS_ONCE(gd->requested_freq);
+		mutex_lock(&gd->lock);
+		if (freq != policy->cur)
+			__cpufreq_driver_target(policy, freq,
+						CPUFREQ_RELATION_L);
+		mutex_unlock(&gd->lock);
+
+		/* Do not ask the hardware faster than it can switch */
+		msleep(gd->throttle_ms);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void cpufreq_sched_irq_work(struct irq_work *irq_work)
+{
+	struct gov_data *gd = container_of(irq_work, struct gov_data, irq_work);
+
+	wake_up_process(gd->task);
+}
+
+/*
+ * Called by the scheduler with the rq lock of @cpu held.  @util is the
+ * fraction (out of SCHED_POWER_SCALE) of @cpu's time spent running at
+ * the current speed; it is converted to a speed that would leave
+ * CAPACITY_MARGIN of headroom.
+ */
+static void cpufreq_sched_capacity(int cpu, unsigned long util)
+{
+	struct gov_data *gd = per_cpu(cpu_gd, cpu);
+	struct cpufreq_policy *policy;
+	unsigned long max_util = 0;
+	unsigned int freq;
+	int i;
+
+	if (!gd)
+		return;
+
+	per_cpu(cpu_util, cpu) = util;
+	policy = gd->policy;
+
+	for_each_cpu(i, policy->cpus)
+		max_util = max(max_util, per_cpu(cpu_util, i));
+
+	freq = ((u64)policy->cur * max_util * CAPACITY_MARGIN) >>
+		(2 * SCHED_POWER_SHIFT);
+	freq = clamp(freq, policy->min, policy->max);
+
+	if (freq == gd->requested_freq)
+		return;
+
+	gd->requested_freq = freq;
+	if (!test_and_set_bit(0, &gd->pending))
+		irq_work_queue(&gd->irq_work);
+}
+
+static int cpufreq_sched_start(struct cpufreq_policy *policy)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+	struct gov_data *gd;
+	unsigned int latency;
+	int cpu, ret = 0;
+
+	gd = kzalloc(sizeof(*gd), GFP_KERNEL);
+	if (!gd)
+		return -ENOMEM;
+
+	gd->policy = policy;
+	gd->requested_freq = policy->cur;
+	mutex_init(&gd->lock);
+	init_irq_work(&gd->irq_work, cpufreq_sched_irq_work);
+
+	latency = policy->cpuinfo.transition_latency;
+	gd->throttle_ms = max_t(unsigned int, 1,
+				DIV_ROUND_UP(latency, NSEC_PER_MSEC));
+
+	gd->task = kthread_create(cpufreq_sched_thread, gd, "kschedfreq/%d",
+				  cpumask_first(policy->related_cpus));
+	if (IS_ERR(gd->task)) {
+		ret = PTR_ERR(gd->task);
+		kfree(gd);
+		return ret;
+	}
+	sched_setscheduler_nocheck(gd->task, SCHED_FIFO, &param);
+	get_task_struct(gd->task);
+	wake_up_process(gd->task);
+
+	mutex_lock(&gov_mutex);
+	for_each_cpu(cpu, policy->cpus) {
+		per_cpu(cpu_util, cpu) = sched_cpu_util(cpu);
+		per_cpu(cpu_gd, cpu) = gd;
+	}
+	if (!gov_refcount++) {
+		ret = sched_register_capacity_fn(cpufreq_sched_capacity);
+		if (ret)
+			gov_refcount--;
+	}
+	mutex_unlock(&gov_mutex);
+
+	if (ret) {
+		for_each_cpu(cpu, policy->cpus)
+			per_cpu(cpu_gd, cpu) = NULL;
+		kthread_stop(gd->task);
+		put_task_struct(gd->task);
+		kfree(gd);
+		return ret;
+	}
+
+	return 0;
+}
+
+static void cpufreq_sched_stop(struct cpufreq_policy *policy)
+{
+	struct gov_data *gd = per_cpu(cpu_gd, policy->cpu);
+	int cpu;
+
+	mutex_lock(&gov_mutex);
+	for_each_cpu(cpu, policy->cpus)
+		per_cpu(cpu_gd, cpu) = NULL;
+	/* Waits for callbacks still running under some rq lock */
+	if (!--gov_refcount)
+		sched_unregister_capacity_fn(cpufreq_sched_capacity);
+	else
+		synchronize_sched();
+	mutex_unlock(&gov_mutex);
+
+	irq_work_sync(&gd->irq_work);
+	kthread_stop(gd->task);
+	put_task_struct(gd->task);
+	kfree(gd);
+}
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+				  unsigned int event)
+{
+	struct gov_data *gd = per_cpu(cpu_gd, policy->cpu);
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu))
+			return -EINVAL;
+		return cpufreq_sched_start(policy);
+
+	case CPUFREQ_GOV_STOP:
+		if (gd)
+			cpufreq_sched_stop(policy);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		if (!gd)
+			break;
+		mutex_lock(&gd->lock);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy, policy->max,
+						CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy, policy->min,
+						CPUFREQ_RELATION_L);
+		mutex_unlock(&gd->lock);
+		break;
+	}
+	return 0;
+}
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+static
+#endif
+struct cpufreq_governor cpufreq_gov_sched = {
+	.name			= "sched",
+	.governor		= cpufreq_governor_sched,
+	.owner			= THIS_MODULE,
+};
+
+static int __init cpufreq_sched_init(void)
+{
+	return cpufreq_register_governor(&cpufreq_gov_sched);
+}
+
+static void __exit cpufreq_sched_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_sched);
+}
+
+MODULE_DESCRIPTION("'cpufreq_sched' - cpufreq governor driven by "
+		   "scheduler utilisation");
+MODULE_LICENSE("GPL");
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+fs_initcall(cpufreq_sched_init);
+#else
+module_init(cpufreq_sched_init);
+#endif
+module_exit(cpufreq_sched_exit);
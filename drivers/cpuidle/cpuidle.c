@@ -15,6 +15,7 @@
 #include <linux/pm_qos_params.h>
 #include <linux/cpu.h>
 #include <linux/cpuidle.h>
+#include <linux/cpufreq.h>
 #include <linux/ktime.h>
 #include <linux/hrtimer.h>
 #include <trace/events/power.h>
@@ -42,6 +43,41 @@ static void cpuidle_kick_cpus(void) {}
 
 static int __cpuidle_register_device(struct cpuidle_device *dev);
 
+/*
+ * Judge the state just left against the measured idle time: it was too
+ * deep ("above") if it was left before its target residency, and too
+ * shallow ("below") if a deeper state allowed by PM QoS would have
+ * paid off.
+ */
+static void cpuidle_account_state(struct cpuidle_device *dev,
+				  struct cpuidle_state *state)
+{
+	int residency = dev->last_residency;
+	int latency_req;
+	int i;
+
+	if (!(state->flags & CPUIDLE_FLAG_TIME_VALID))
+		return;
+
+	if (residency < state->target_residency) {
+		state->above++;
+		return;
+	}
+
+	latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	for (i = state - dev->states + 1; i < dev->state_count; i++) {
+		struct cpuidle_state *s = &dev->states[i];
+
+		if (s->flags & CPUIDLE_FLAG_IGNORE ||
+		    s->exit_latency > latency_req)
+			continue;
+		if (s->target_residency <= residency) {
+			state->below++;
+			return;
+		}
+	}
+}
+
 /**
  * cpuidle_idle_call - the main idle loop
  *
@@ -99,9 +135,11 @@ static void cpuidle_idle_call(void)
 
 	trace_power_start(POWER_CSTATE, next_state, dev->cpu);
 	trace_cpu_idle(next_state, dev->cpu);
+	cpufreq_interactive_idle_start();
 
 	dev->last_residency = target_state->enter(dev, target_state);
 
+	cpufreq_interactive_idle_end();
 	trace_power_end(dev->cpu);
 	trace_cpu_idle(PWR_EVENT_EXIT, dev->cpu);
 
@@ -110,6 +148,7 @@ static void cpuidle_idle_call(void)
 
 	target_state->time += (unsigned long long)dev->last_residency;
 	target_state->usage++;
+	cpuidle_account_state(dev, target_state);
 
 	/* give the governor an opportunity to reflect on the outcome */
 	if (cpuidle_curr_governor->reflect)
@@ -236,6 +275,8 @@ int cpuidle_enable_device(struct cpuidle_device *dev)
 	for (i = 0; i < dev->state_count; i++) {
 		dev->states[i].usage = 0;
 		dev->states[i].time = 0;
+		dev->states[i].above = 0;
+		dev->states[i].below = 0;
 	}
 	dev->last_residency = 0;
 	dev->last_state = NULL;
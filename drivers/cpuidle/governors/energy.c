@@ -0,0 +1,246 @@
+/*
+ * energy.c - the energy-aware idle governor
+ *
+ * This code is licenced under the GPL version 2 as described
+ * in the COPYING file that acompanies the Linux Kernel.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuidle.h>
+#include <linux/pm_qos_params.h>
+#include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/tick.h>
+#include <linux/sched.h>
+
+#define INTERVALS 7
+#define UNKNOWN_US UINT_MAX
+
+/*
+ * Concepts and ideas behind the energy governor
+ *
+ * Like menu, this governor picks the lowest power state whose target
+ * residency (the energy break even point) fits in the predicted idle
+ * duration and whose exit latency satisfies PM QoS.  It differs in how
+ * the duration is predicted.
+ *
+ * menu scales the time to the next timer event by a running average of
+ * how far off that guess used to be.  On bursty interrupt loads the
+ * average is dragged around by a few outliers, so menu alternates
+ * between going too deep right before the next interrupt and staying
+ * shallow through long quiet periods.
+ *
+ * Here the prediction is the median of the last INTERVALS measured idle
+ * durations, capped by the next timer event.  A median ignores the odd
+ * long or short period, and follows a change of pattern once it holds
+ * for more than half of the history.  Idle periods entered with I/O
+ * pending on the CPU tend to end with its completion interrupt, so
+ * they are kept in a second history of their own.
+ *
+ * The median is only trusted when the history is tightly grouped, with
+ * a standard deviation of at most 20 us or a sixth of the average, as
+ * menu requires of its typical interval.  Otherwise the pattern is
+ * changing, e.g. the first long quiet periods after a burst, and the
+ * next timer event is used, so that the CPU does not sit in a shallow
+ * state until a timer that may be seconds away.
+ *
+ * Until a history has been filled, its unknown entries count as
+ * infinitely long, which also makes it too spread out to be trusted.
+ */
+
+struct energy_device {
+	int		last_state_idx;
+	int		needs_update;
+
+	unsigned int	next_timer_us;
+	unsigned int	predicted_us;
+	unsigned int	exit_us;
+	int		iowait;		/* history in use for this period */
+
+	unsigned int	intervals[2][INTERVALS];
+	int		interval_ptr[2];
+};
+
+static DEFINE_PER_CPU(struct energy_device, energy_devices);
+
+static void energy_update(struct cpuidle_device *dev);
+
+/*
+ * Median of a history, by insertion sort of a copy, or UNKNOWN_US if
+ * the history is too spread out for the median to mean anything.
+ */
+static unsigned int typical_interval(const unsigned int *intervals)
+{
+	unsigned int sorted[INTERVALS];
+	u64 avg = 0, variance = 0;
+	int i, j;
+
+	for (i = 0; i < INTERVALS; i++) {
+		unsigned int v = intervals[i];
+
+		avg += v;
+		for (j = i; j > 0 && sorted[j - 1] > v; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = v;
+	}
+	avg = div_u64(avg, INTERVALS);
+
+	/* Each term is below 2^64 / INTERVALS, so the sum cannot wrap */
+	for (i = 0; i < INTERVALS; i++) {
+		u64 diff = intervals[i] > avg ? intervals[i] - avg :
+						avg - intervals[i];
+
+		variance += div_u64(diff * diff, INTERVALS);
+	}
+
+	/* stddev <= 20 us, or avg > 6 * stddev */
+	if (variance <= 400 || variance < div_u64(avg * avg, 36))
+		return sorted[INTERVALS / 2];
+
+	return UNKNOWN_US;
+}
+
+/**
+ * energy_select - selects the next idle state to enter
+ * @dev: the CPU
+ */
+static int energy_select(struct cpuidle_device *dev)
+{
+	struct energy_device *data = &__get_cpu_var(energy_devices);
+	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	unsigned int power_usage = -1;
+	unsigned int typical;
+	struct timespec t;
+	int i;
+
+	if (data->needs_update) {
+		energy_update(dev);
+		data->needs_update = 0;
+	}
+
+	data->last_state_idx = 0;
+	data->exit_us = 0;
+
+	/* Special case when user has set very strict latency requirement */
+	if (unlikely(latency_req == 0))
+		return 0;
+
+	t = ktime_to_timespec(tick_nohz_get_sleep_length());
+	data->next_timer_us =
+		t.tv_sec * USEC_PER_SEC + t.tv_nsec / NSEC_PER_USEC;
+
+	data->iowait = nr_iowait_cpu(smp_processor_id()) ? 1 : 0;
+	typical = typical_interval(data->intervals[data->iowait]);
+	data->predicted_us = min(typical, data->next_timer_us);
+
+	/* Default to C1 (hlt) rather than polling, as menu does */
+	if (data->predicted_us > 5)
+		data->last_state_idx = CPUIDLE_DRIVER_STATE_START;
+
+	for (i = CPUIDLE_DRIVER_STATE_START; i < dev->state_count; i++) {
+		struct cpuidle_state *s = &dev->states[i];
+
+		if (s->flags & CPUIDLE_FLAG_IGNORE)
+			continue;
+		if (s->target_residency > data->predicted_us)
+			continue;
+		if (s->exit_latency > latency_req)
+			continue;
+
+		if (s->power_usage < power_usage) {
+			power_usage = s->power_usage;
+			data->last_state_idx = i;
+			data->exit_us = s->exit_latency;
+		}
+	}
+
+	return data->last_state_idx;
+}
+
+/**
+ * energy_reflect - records that data structures need update
+ * @dev: the CPU
+ *
+ * NOTE: it's important to be fast here because this operation will add to
+ *       the overall exit latency.
+ */
+static void energy_reflect(struct cpuidle_device *dev)
+{
+	struct energy_device *data = &__get_cpu_var(energy_devices);
+	data->needs_update = 1;
+}
+
+/**
+ * energy_update - adds the last idle period to the history
+ * @dev: the CPU
+ */
+static void energy_update(struct cpuidle_device *dev)
+{
+	struct energy_device *data = &__get_cpu_var(energy_devices);
+	struct cpuidle_state *target = &dev->states[data->last_state_idx];
+	unsigned int measured_us = cpuidle_get_last_residency(dev);
+	int h = data->iowait;
+
+	/*
+	 * Without a residency measurement, assume we slept until the
+	 * next timer, which keeps the history from favouring this state.
+	 */
+	if (unlikely(!(target->flags & CPUIDLE_FLAG_TIME_VALID)))
+		measured_us = data->next_timer_us;
+
+	/* The wakeup event happened before the exit latency was paid */
+	if (measured_us > data->exit_us)
+		measured_us -= data->exit_us;
+
+	data->intervals[h][data->interval_ptr[h]++] = measured_us;
+	if (data->interval_ptr[h] >= INTERVALS)
+		data->interval_ptr[h] = 0;
+}
+
+/**
+ * energy_enable_device - scans a CPU's states and does setup
+ * @dev: the CPU
+ */
+static int energy_enable_device(struct cpuidle_device *dev)
+{
+	struct energy_device *data = &per_cpu(energy_devices, dev->cpu);
+	int h, i;
+
+	memset(data, 0, sizeof(struct energy_device));
+	for (h = 0; h < 2; h++)
+		for (i = 0; i < INTERVALS; i++)
+			data->intervals[h][i] = UNKNOWN_US;
+
+	return 0;
+}
+
+static struct cpuidle_governor energy_governor = {
+	.name =		"energy",
+	.rating =	30,
+	.enable =	energy_enable_device,
+	.select =	energy_select,
+	.reflect =	energy_reflect,
+	.owner =	THIS_MODULE,
+};
+
+/**
+ * init_energy - initializes the governor
+ */
+static int __init init_energy(void)
+{
+	return cpuidle_register_governor(&energy_governor);
+}
+
+/**
+ * exit_energy - exits the governor
+ */
+static void __exit exit_energy(void)
+{
+	cpuidle_unregister_governor(&energy_governor);
+}
+
+MODULE_LICENSE("GPL");
+module_init(init_energy);
+module_exit(exit_energy);
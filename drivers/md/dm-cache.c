@@ -0,0 +1,1532 @@
+/*
+ * A target that caches the hot blocks of a slow origin device on a fast
+ * (SSD) cache device, in write-back or write-through mode.
+ *
+ * The cache device starts with a superblock, followed by one 16 byte
+ * entry per cache block, followed by the cached data.  The entries are
+ * kept in core and written back a page at a time; the order of the
+ * writes keeps the on-disk metadata valid at any point:
+ *
+ *   o a block gets invalidated on disk before it is reused for another
+ *     origin block, and marked valid only after its data was copied
+ *   o a clean block gets marked dirty on disk before the first write
+ *     to it completes
+ *   o a dirty block gets marked clean only after its data was written
+ *     back and the origin device flushed
+ *
+ * so after a crash cached blocks are either valid or missing, and no
+ * dirty data is lost.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include <linux/device-mapper.h>
+
+#define DM_MSG_PREFIX "cache"
+#define DAEMON "kcached"
+
+#define CACHE_MAGIC		0x53534443	/* "CDSS" */
+#define CACHE_VERSION		1
+
+#define SECTORS_PER_PAGE	(PAGE_SIZE >> SECTOR_SHIFT)
+#define MIN_BLOCK_SIZE		8	/* sectors */
+#define MAX_BLOCK_SIZE		2048
+
+#define WRITEBACK_BATCH		64	/* blocks per writeback run */
+#define COMMIT_PERIOD		HZ	/* lazy metadata commit interval */
+#define VICTIM_SCAN		256	/* LRU blocks to try for a victim */
+
+#define DEFAULT_DIRTY_THRESH	50	/* percent of the cache */
+#define DEFAULT_PROMOTE_THRESH	2	/* misses before promotion */
+
+/*-----------------------------------------------------------------
+ * On-disk format
+ *---------------------------------------------------------------*/
+struct disk_super {
+	__le32 magic;
+	__le32 version;
+	__le32 block_size;	/* sectors */
+	__le32 nr_blocks;
+	__le64 data_start;	/* sector of cache block 0 */
+} __packed;
+
+struct disk_entry {
+	__le64 oblock;
+	__le32 flags;
+	__le32 padding;
+} __packed;
+
+#define DE_VALID	1
+#define DE_DIRTY	2
+
+#define ENTRIES_PER_PAGE	(PAGE_SIZE / sizeof(struct disk_entry))
+
+/*-----------------------------------------------------------------
+ * In-core structures
+ *---------------------------------------------------------------*/
+#define CB_VALID	1	/* holds oblock */
+#define CB_DIRTY	2	/* newer than the origin */
+#define CB_BUSY		4	/* being promoted or marked dirty, io waits */
+#define CB_CLEANING	8	/* being written back, writes wait */
+#define CB_DRAIN	16	/* copy waits for io in flight to finish */
+
+/*
+ * What a remapped bio holds until it completes, kept in its map_info:
+ * a cache block, whose data must not be copied or reused under it, or
+ * a write miss, which a promotion from the origin must wait for.  The
+ * low 32 bits are the block index or the hash bucket of the write;
+ * HOLD_ODD says which epoch of the bucket the write was counted in.
+ */
+#define HOLD_BLOCK	(1ULL << 32)
+#define HOLD_ORIGIN	(2ULL << 32)
+#define HOLD_ODD	(4ULL << 32)
+
+struct cblock {
+	struct hlist_node hash;
+	struct list_head lru;		/* cc->lru or cc->free */
+	struct list_head list;		/* on one of the worker lists */
+	struct bio_list waiters;
+	struct cache_c *cc;
+	sector_t oblock;
+	unsigned index;
+	unsigned flags;
+	unsigned inflight[2];		/* remapped bios, by direction */
+	unsigned drain_epoch;		/* origin epoch a promotion waits on */
+	int error;
+};
+
+/*
+ * Write misses in flight to one hash bucket.  New writes are counted
+ * in the slot of the current epoch; a promotion waits only for the
+ * epoch it started in and the one before, so later writes to other
+ * blocks of the bucket cannot hold it off.
+ */
+struct origin_bucket {
+	unsigned epoch;
+	unsigned writes[2];
+};
+
+struct cache_c;
+
+/*
+ * Promotion policy: decides which read misses get their block copied
+ * into the cache.  Eviction is always least recently used clean block.
+ */
+struct cache_policy {
+	const char *name;
+	int (*init)(struct cache_c *cc);
+	void (*exit)(struct cache_c *cc);
+
+	/* Called under cc->lock on a read miss */
+	int (*promote)(struct cache_c *cc, sector_t oblock);
+};
+
+struct cache_c {
+	struct dm_target *ti;
+	struct dm_dev *origin;
+	struct dm_dev *cache;
+
+	sector_t block_size;
+	unsigned block_shift;
+	sector_t origin_blocks;		/* whole blocks only */
+	unsigned nr_blocks;
+	sector_t data_start;
+	unsigned md_pages;
+	int writeback;
+
+	const struct cache_policy *policy;
+	void *policy_data;
+	unsigned promote_thresh;
+	unsigned dirty_thresh;
+
+	spinlock_t lock;
+	struct cblock *blocks;
+	struct hlist_head *hash;
+	unsigned hash_bits;
+	struct list_head lru;		/* valid blocks, least recent first */
+	struct list_head free;
+	unsigned nr_valid;
+	unsigned nr_dirty;
+	struct origin_bucket *origin_writes;
+
+	struct disk_entry *md;		/* in-core metadata */
+	unsigned long *md_dirty;	/* pages of md to commit */
+	void *md_buf;
+
+	/* Worker lists, under lock */
+	struct bio_list deferred;
+	struct list_head commit_wait;
+	struct list_head promoted;
+	struct list_head cleaned;
+	struct list_head drained;
+	unsigned cleaning;
+	int flush_all;
+	int suspended;
+
+	atomic_t nr_jobs;		/* kcopyd jobs in flight */
+	wait_queue_head_t jobs_wait;
+
+	struct dm_io_client *io_client;
+	struct dm_kcopyd_client *kc;
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+
+	/* Statistics */
+	atomic_t read_hits;
+	atomic_t read_misses;
+	atomic_t write_hits;
+	atomic_t write_misses;
+	atomic_t promotions;
+	atomic_t demotions;
+	atomic_t writebacks;
+};
+
+static void wake_worker(struct cache_c *cc)
+{
+	queue_work(cc->wq, &cc->worker);
+}
+
+/*-----------------------------------------------------------------
+ * Promotion policies
+ *---------------------------------------------------------------*/
+
+/* lru: promote on every miss */
+static int lru_promote(struct cache_c *cc, sector_t oblock)
+{
+	return 1;
+}
+
+/*
+ * hitcount: promote after promote_thresh misses.  Misses are counted
+ * in a direct mapped table, a colliding block simply restarts the
+ * count.
+ */
+struct miss_entry {
+	sector_t oblock;
+	unsigned count;
+};
+
+#define MISS_TABLE_BITS		14
+
+static int hitcount_init(struct cache_c *cc)
+{
+	struct miss_entry *t;
+	unsigned i;
+
+	t = vmalloc(sizeof(*t) << MISS_TABLE_BITS);
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < 1 << MISS_TABLE_BITS; i++) {
+		t[i].oblock = (sector_t)-1;
+		t[i].count = 0;
+	}
+
+	cc->policy_data = t;
+	return 0;
+}
+
+static void hitcount_exit(struct cache_c *cc)
+{
+	vfree(cc->policy_data);
+}
+
+static int hitcount_promote(struct cache_c *cc, sector_t oblock)
+{
+	struct miss_entry *e = cc->policy_data;
+
+	e += hash_long((unsigned long)oblock, MISS_TABLE_BITS);
+	if (e->oblock != oblock) {
+		e->oblock = oblock;
+		e->count = 0;
+	}
+
+	if (++e->count < cc->promote_thresh)
+		return 0;
+
+	e->oblock = (sector_t)-1;
+	return 1;
+}
+
+static const struct cache_policy cache_policies[] = {
+	{ "lru", NULL, NULL, lru_promote },
+	{ "hitcount", hitcount_init, hitcount_exit, hitcount_promote },
+};
+
+static const struct cache_policy *get_policy(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(cache_policies); i++)
+		if (!strcmp(name, cache_policies[i].name))
+			return cache_policies + i;
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------
+ * Block lookup
+ *---------------------------------------------------------------*/
+static struct hlist_head *hash_bucket(struct cache_c *cc, sector_t oblock)
+{
+	return cc->hash + hash_long((unsigned long)oblock, cc->hash_bits);
+}
+
+static unsigned long bucket_index(struct cache_c *cc, sector_t oblock)
+{
+	return hash_bucket(cc, oblock) - cc->hash;
+}
+
+static struct cblock *lookup_block(struct cache_c *cc, sector_t oblock)
+{
+	struct cblock *b;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(b, n, hash_bucket(cc, oblock), hash)
+		if (b->oblock == oblock)
+			return b;
+
+	return NULL;
+}
+
+static void insert_block(struct cache_c *cc, struct cblock *b)
+{
+	hlist_add_head(&b->hash, hash_bucket(cc, b->oblock));
+}
+
+/*
+ * Pick a block to promote into: a free one, or else the least
+ * recently used clean one that no bio is using.  cc->lock is held.
+ */
+static struct cblock *get_victim(struct cache_c *cc)
+{
+	struct cblock *b;
+	unsigned scanned = 0;
+
+	if (!list_empty(&cc->free))
+		return list_first_entry(&cc->free, struct cblock, lru);
+
+	list_for_each_entry(b, &cc->lru, lru) {
+		if (!(b->flags & (CB_DIRTY | CB_BUSY | CB_CLEANING)) &&
+		    !b->inflight[READ] && !b->inflight[WRITE])
+			return b;
+		if (++scanned == VICTIM_SCAN)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Hand the bios waiting on @b to the worker.  cc->lock is held. */
+static void release_waiters(struct cache_c *cc, struct cblock *b)
+{
+	if (bio_list_empty(&b->waiters))
+		return;
+
+	bio_list_merge(&cc->deferred, &b->waiters);
+	bio_list_init(&b->waiters);
+	wake_worker(cc);
+}
+
+/*
+ * A block marked CB_DRAIN is copied once the io it waits for is gone:
+ * writes already remapped to it before a writeback, or write misses to
+ * the origin before a promotion.  cc->lock is held.
+ */
+static int block_drained(struct cache_c *cc, struct cblock *b)
+{
+	struct origin_bucket *ob;
+
+	if (b->flags & CB_CLEANING)
+		return !b->inflight[WRITE];
+
+	ob = cc->origin_writes + bucket_index(cc, b->oblock);
+	switch (ob->epoch - b->drain_epoch) {
+	case 0:
+		return !ob->writes[0] && !ob->writes[1];
+	case 1:
+		return !ob->writes[b->drain_epoch & 1];
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Start a new epoch so that writes from now on don't count against
+ * promotions already waiting.  Only possible once the slot it reuses,
+ * that of the epoch before the current one, is empty.
+ */
+static void origin_new_epoch(struct origin_bucket *ob)
+{
+	if (!ob->writes[(ob->epoch + 1) & 1])
+		ob->epoch++;
+}
+
+/*
+ * Make a promotion wait for the write misses issued so far.  Returns
+ * nonzero if there are none.  cc->lock is held.
+ */
+static int drain_origin(struct cache_c *cc, struct cblock *b)
+{
+	struct origin_bucket *ob = cc->origin_writes +
+				   bucket_index(cc, b->oblock);
+
+	b->drain_epoch = ob->epoch;
+	if (block_drained(cc, b))
+		return 1;
+
+	b->flags |= CB_DRAIN;
+	origin_new_epoch(ob);
+	return 0;
+}
+
+static void drain_done(struct cache_c *cc, struct cblock *b)
+{
+	b->flags &= ~CB_DRAIN;
+	list_add_tail(&b->list, &cc->drained);
+	wake_worker(cc);
+}
+
+/* Record what @bio holds while it is remapped.  cc->lock is held. */
+static void hold_block(struct cache_c *cc, struct bio *bio, struct cblock *b)
+{
+	b->inflight[bio_data_dir(bio)]++;
+	dm_get_mapinfo(bio)->ll = HOLD_BLOCK | b->index;
+}
+
+static void hold_origin(struct cache_c *cc, struct bio *bio, sector_t oblock)
+{
+	unsigned long bucket = bucket_index(cc, oblock);
+	struct origin_bucket *ob = cc->origin_writes + bucket;
+	unsigned slot = ob->epoch & 1;
+
+	ob->writes[slot]++;
+	dm_get_mapinfo(bio)->ll = HOLD_ORIGIN | (slot ? HOLD_ODD : 0) | bucket;
+}
+
+/* Called from end_io with cc->lock held. */
+static void release_bio(struct cache_c *cc, struct bio *bio,
+			union map_info *info)
+{
+	unsigned long long hold = info->ll;
+	unsigned idx = hold & UINT_MAX;
+	struct origin_bucket *ob;
+	struct cblock *b;
+	struct hlist_node *n;
+	int waiting = 0;
+
+	info->ll = 0;
+
+	if (hold & HOLD_BLOCK) {
+		b = cc->blocks + idx;
+		b->inflight[bio_data_dir(bio)]--;
+		if ((b->flags & CB_DRAIN) && block_drained(cc, b))
+			drain_done(cc, b);
+	} else if (hold & HOLD_ORIGIN) {
+		ob = cc->origin_writes + idx;
+		if (--ob->writes[(hold & HOLD_ODD) ? 1 : 0])
+			return;
+		hlist_for_each_entry(b, n, cc->hash + idx, hash) {
+			if (!(b->flags & CB_DRAIN))
+				continue;
+			if (block_drained(cc, b))
+				drain_done(cc, b);
+			else if (!(b->flags & CB_CLEANING) &&
+				 b->drain_epoch == ob->epoch)
+				waiting = 1;
+		}
+		/* Couldn't start an epoch for these when they began */
+		if (waiting)
+			origin_new_epoch(ob);
+	}
+}
+
+/*-----------------------------------------------------------------
+ * Metadata
+ *---------------------------------------------------------------*/
+
+/* Update the in-core entry of @b.  cc->lock is held. */
+static void md_set(struct cache_c *cc, struct cblock *b)
+{
+	struct disk_entry *e = cc->md + b->index;
+	__le64 oblock = cpu_to_le64((b->flags & CB_VALID) ? b->oblock : 0);
+	u32 f = 0;
+
+	if (b->flags & CB_VALID)
+		f |= DE_VALID;
+	if (b->flags & CB_DIRTY)
+		f |= DE_DIRTY;
+
+	if (e->oblock == oblock && e->flags == cpu_to_le32(f))
+		return;
+
+	e->oblock = oblock;
+	e->flags = cpu_to_le32(f);
+	set_bit(b->index / ENTRIES_PER_PAGE, cc->md_dirty);
+}
+
+static int md_io(struct cache_c *cc, int rw, sector_t sector,
+		 sector_t count, void *data, int vma)
+{
+	struct dm_io_region where = {
+		.bdev = cc->cache->bdev,
+		.sector = sector,
+		.count = count,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = vma ? DM_IO_VMA : DM_IO_KMEM,
+		.mem.ptr.addr = data,
+		.notify.fn = NULL,
+		.client = cc->io_client,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+/*
+ * Write out the dirty metadata pages.  The first write flushes the
+ * cache device, so that data copied in before is on disk before any
+ * entry pointing to it.  Only called from the workqueue.
+ */
+static int commit(struct cache_c *cc)
+{
+	unsigned p;
+	int rw = WRITE_FLUSH_FUA, r = 0;
+
+	for (p = find_first_bit(cc->md_dirty, cc->md_pages); p < cc->md_pages;
+	     p = find_next_bit(cc->md_dirty, cc->md_pages, p + 1)) {
+		clear_bit(p, cc->md_dirty);
+
+		/* Entries may change under us, write a stable copy */
+		spin_lock_irq(&cc->lock);
+		memcpy(cc->md_buf, (void *)cc->md + p * PAGE_SIZE, PAGE_SIZE);
+		spin_unlock_irq(&cc->lock);
+
+		r = md_io(cc, rw, SECTORS_PER_PAGE * (p + 1), SECTORS_PER_PAGE,
+			  cc->md_buf, 0);
+		if (r) {
+			set_bit(p, cc->md_dirty);
+			DMERR_LIMIT("Metadata write failed");
+			break;
+		}
+		rw = WRITE_FUA;
+	}
+
+	return r;
+}
+
+static int write_super(struct cache_c *cc)
+{
+	struct disk_super *sb = cc->md_buf;
+
+	memset(sb, 0, PAGE_SIZE);
+	sb->magic = cpu_to_le32(CACHE_MAGIC);
+	sb->version = cpu_to_le32(CACHE_VERSION);
+	sb->block_size = cpu_to_le32(cc->block_size);
+	sb->nr_blocks = cpu_to_le32(cc->nr_blocks);
+	sb->data_start = cpu_to_le64(cc->data_start);
+
+	return md_io(cc, WRITE_FLUSH_FUA, 0, SECTORS_PER_PAGE, sb, 0);
+}
+
+/* Rebuild the block lists from the metadata read in. */
+static void load_blocks(struct cache_c *cc)
+{
+	unsigned i;
+
+	for (i = 0; i < cc->nr_blocks; i++) {
+		struct cblock *b = cc->blocks + i;
+		struct disk_entry *e = cc->md + i;
+		u32 f = le32_to_cpu(e->flags);
+
+		b->oblock = le64_to_cpu(e->oblock);
+		if (!(f & DE_VALID) || b->oblock >= cc->origin_blocks ||
+		    lookup_block(cc, b->oblock)) {
+			b->flags = 0;
+			md_set(cc, b);
+			list_add_tail(&b->lru, &cc->free);
+			continue;
+		}
+
+		b->flags = CB_VALID;
+		cc->nr_valid++;
+		if (f & DE_DIRTY) {
+			b->flags |= CB_DIRTY;
+			cc->nr_dirty++;
+		}
+		insert_block(cc, b);
+		list_add_tail(&b->lru, &cc->lru);
+	}
+}
+
+/*
+ * Read the metadata, or create it if the superblock is zeroed,
+ * like a new persistent snapshot store.
+ */
+static int load_metadata(struct cache_c *cc)
+{
+	struct disk_super *sb = cc->md_buf;
+	struct dm_target *ti = cc->ti;
+	unsigned i;
+	int r;
+
+	r = md_io(cc, READ, 0, SECTORS_PER_PAGE, sb, 0);
+	if (r) {
+		ti->error = "Error reading cache superblock";
+		return r;
+	}
+
+	if (!sb->magic) {
+		for (i = 0; i < cc->nr_blocks; i++)
+			list_add_tail(&cc->blocks[i].lru, &cc->free);
+
+		/* Zero all entries before the superblock makes them valid */
+		r = md_io(cc, WRITE, SECTORS_PER_PAGE,
+			  (sector_t)cc->md_pages * SECTORS_PER_PAGE, cc->md, 1);
+		if (!r)
+			r = write_super(cc);
+		if (r)
+			ti->error = "Error writing cache metadata";
+		return r;
+	}
+
+	if (le32_to_cpu(sb->magic) != CACHE_MAGIC) {
+		ti->error = "Invalid cache superblock";
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(sb->version) != CACHE_VERSION) {
+		ti->error = "Unsupported cache metadata version";
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(sb->block_size) != cc->block_size ||
+	    le32_to_cpu(sb->nr_blocks) != cc->nr_blocks ||
+	    le64_to_cpu(sb->data_start) != cc->data_start) {
+		ti->error = "Cache device was set up with different parameters";
+		return -EINVAL;
+	}
+
+	r = md_io(cc, READ, SECTORS_PER_PAGE,
+		  (sector_t)cc->md_pages * SECTORS_PER_PAGE, cc->md, 1);
+	if (r) {
+		ti->error = "Error reading cache metadata";
+		return r;
+	}
+
+	load_blocks(cc);
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Promotion and writeback
+ *---------------------------------------------------------------*/
+static void block_region(struct cache_c *cc, struct cblock *b,
+			 struct dm_io_region *origin,
+			 struct dm_io_region *cache)
+{
+	origin->bdev = cc->origin->bdev;
+	origin->sector = b->oblock << cc->block_shift;
+	origin->count = cc->block_size;
+
+	cache->bdev = cc->cache->bdev;
+	cache->sector = cc->data_start +
+			((sector_t)b->index << cc->block_shift);
+	cache->count = cc->block_size;
+}
+
+static void job_done(struct cache_c *cc, struct cblock *b,
+		     struct list_head *list, int error)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc->lock, flags);
+	b->error = error;
+	list_add_tail(&b->list, list);
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	wake_worker(cc);
+	if (atomic_dec_and_test(&cc->nr_jobs))
+		wake_up(&cc->jobs_wait);
+}
+
+static void promote_endio(int read_err, unsigned long write_err,
+			  void *context)
+{
+	struct cblock *b = context;
+
+	job_done(b->cc, b, &b->cc->promoted, read_err || write_err);
+}
+
+static void writeback_endio(int read_err, unsigned long write_err,
+			    void *context)
+{
+	struct cblock *b = context;
+
+	job_done(b->cc, b, &b->cc->cleaned, read_err || write_err);
+}
+
+/*
+ * Start promoting @oblock into a victim block: it becomes busy right
+ * away, the copy starts once the worker has committed the invalidation
+ * of what the victim held before.  cc->lock is held.
+ */
+static void promote(struct cache_c *cc, sector_t oblock)
+{
+	struct cblock *b = get_victim(cc);
+
+	if (!b)
+		return;
+
+	list_del_init(&b->lru);
+	if (b->flags & CB_VALID) {
+		hlist_del(&b->hash);
+		cc->nr_valid--;
+		atomic_inc(&cc->demotions);
+	}
+
+	b->oblock = oblock;
+	b->flags = CB_BUSY;
+	insert_block(cc, b);
+	md_set(cc, b);
+
+	list_add_tail(&b->list, &cc->commit_wait);
+	atomic_inc(&cc->promotions);
+	wake_worker(cc);
+}
+
+static void start_promotion(struct cache_c *cc, struct cblock *b)
+{
+	struct dm_io_region origin, cache;
+
+	block_region(cc, b, &origin, &cache);
+	atomic_inc(&cc->nr_jobs);
+	dm_kcopyd_copy(cc->kc, &origin, 1, &cache, 0, promote_endio, b);
+}
+
+static void finish_promotions(struct cache_c *cc, struct list_head *done)
+{
+	struct cblock *b, *tmp;
+
+	spin_lock_irq(&cc->lock);
+	list_for_each_entry_safe(b, tmp, done, list) {
+		list_del(&b->list);
+
+		if (b->error) {
+			DMERR_LIMIT("Promotion of block %llu failed",
+				    (unsigned long long)b->oblock);
+			hlist_del(&b->hash);
+			b->flags = 0;
+			list_add(&b->lru, &cc->free);
+		} else {
+			b->flags = CB_VALID;
+			cc->nr_valid++;
+			list_add_tail(&b->lru, &cc->lru);
+			md_set(cc, b);
+		}
+
+		release_waiters(cc, b);
+	}
+	spin_unlock_irq(&cc->lock);
+
+	queue_delayed_work(cc->wq, &cc->waker, COMMIT_PERIOD);
+}
+
+/* Blocks waiting for a commit: newly dirtied or about to be promoted. */
+static void finish_commit(struct cache_c *cc, struct list_head *committed,
+			  int error)
+{
+	struct cblock *b, *tmp;
+	struct bio *bio;
+
+	list_for_each_entry_safe(b, tmp, committed, list) {
+		list_del(&b->list);
+
+		if (!(b->flags & CB_VALID)) {
+			spin_lock_irq(&cc->lock);
+			if (!error) {
+				/* Let earlier write misses reach the origin */
+				if (!drain_origin(cc, b)) {
+					spin_unlock_irq(&cc->lock);
+					continue;
+				}
+				spin_unlock_irq(&cc->lock);
+				start_promotion(cc, b);
+				continue;
+			}
+			hlist_del(&b->hash);
+			b->flags = 0;
+			list_add(&b->lru, &cc->free);
+			release_waiters(cc, b);
+			spin_unlock_irq(&cc->lock);
+			continue;
+		}
+
+		spin_lock_irq(&cc->lock);
+		b->flags &= ~CB_BUSY;
+		if (!error) {
+			release_waiters(cc, b);
+			spin_unlock_irq(&cc->lock);
+			continue;
+		}
+
+		/* The block is dirty in core only, fail the writes */
+		while ((bio = bio_list_pop(&b->waiters))) {
+			if (bio_data_dir(bio) == READ) {
+				bio_list_add(&cc->deferred, bio);
+				continue;
+			}
+			spin_unlock_irq(&cc->lock);
+			bio_endio(bio, -EIO);
+			spin_lock_irq(&cc->lock);
+		}
+		b->flags &= ~CB_DIRTY;
+		cc->nr_dirty--;
+		md_set(cc, b);
+		spin_unlock_irq(&cc->lock);
+		wake_worker(cc);
+	}
+}
+
+static void start_writeback(struct cache_c *cc, struct cblock *b)
+{
+	struct dm_io_region origin, cache;
+
+	block_region(cc, b, &origin, &cache);
+	atomic_inc(&cc->nr_jobs);
+	dm_kcopyd_copy(cc->kc, &cache, 1, &origin, 0, writeback_endio, b);
+}
+
+/*
+ * Write back a batch of dirty blocks, oldest first, if the dirty
+ * threshold is exceeded or a flush was requested.  New writes to the
+ * blocks wait, those already remapped to them are let finish first.
+ */
+static void writeback(struct cache_c *cc)
+{
+	struct cblock *b, *tmp;
+	LIST_HEAD(batch);
+	unsigned n = 0;
+
+	spin_lock_irq(&cc->lock);
+	if (cc->suspended || cc->cleaning ||
+	    (!cc->flush_all &&
+	     (u64)cc->nr_dirty * 100 <= (u64)cc->dirty_thresh * cc->nr_blocks)) {
+		spin_unlock_irq(&cc->lock);
+		return;
+	}
+
+	list_for_each_entry(b, &cc->lru, lru) {
+		if ((b->flags & (CB_DIRTY | CB_BUSY | CB_CLEANING)) != CB_DIRTY)
+			continue;
+		b->flags |= CB_CLEANING;
+		if (b->inflight[WRITE])
+			b->flags |= CB_DRAIN;
+		else
+			list_add_tail(&b->list, &batch);
+		if (++n == WRITEBACK_BATCH)
+			break;
+	}
+
+	cc->cleaning = n;
+	if (!n)
+		cc->flush_all = 0;
+	spin_unlock_irq(&cc->lock);
+
+	list_for_each_entry_safe(b, tmp, &batch, list) {
+		list_del(&b->list);
+		start_writeback(cc, b);
+	}
+}
+
+/* Start the copies that were waiting for io in flight. */
+static void start_drained(struct cache_c *cc, struct list_head *drained)
+{
+	struct cblock *b, *tmp;
+
+	list_for_each_entry_safe(b, tmp, drained, list) {
+		list_del(&b->list);
+		if (b->flags & CB_CLEANING)
+			start_writeback(cc, b);
+		else
+			start_promotion(cc, b);
+	}
+}
+
+static int finish_writeback(struct cache_c *cc, struct list_head *done)
+{
+	struct cblock *b, *tmp;
+	int r, errors = 0;
+
+	/* The blocks must be on the origin before they can be clean */
+	r = blkdev_issue_flush(cc->origin->bdev, GFP_NOIO, NULL);
+
+	spin_lock_irq(&cc->lock);
+	list_for_each_entry_safe(b, tmp, done, list) {
+		list_del(&b->list);
+		cc->cleaning--;
+
+		if (b->error || r) {
+			errors++;
+		} else {
+			b->flags &= ~CB_DIRTY;
+			cc->nr_dirty--;
+			atomic_inc(&cc->writebacks);
+			md_set(cc, b);
+		}
+
+		b->flags &= ~CB_CLEANING;
+		release_waiters(cc, b);
+	}
+
+	if (errors)
+		cc->flush_all = 0;
+	spin_unlock_irq(&cc->lock);
+
+	if (errors)
+		DMERR_LIMIT("Writeback of %d blocks failed", errors);
+
+	queue_delayed_work(cc->wq, &cc->waker, COMMIT_PERIOD);
+	return errors;
+}
+
+/*-----------------------------------------------------------------
+ * Bio processing
+ *---------------------------------------------------------------*/
+static void remap_to_origin(struct cache_c *cc, struct bio *bio)
+{
+	bio->bi_bdev = cc->origin->bdev;
+	bio->bi_sector = dm_target_offset(cc->ti, bio->bi_sector);
+}
+
+static void remap_to_cache(struct cache_c *cc, struct bio *bio,
+			   struct cblock *b)
+{
+	sector_t offset = dm_target_offset(cc->ti, bio->bi_sector);
+
+	bio->bi_bdev = cc->cache->bdev;
+	bio->bi_sector = cc->data_start +
+			 ((sector_t)b->index << cc->block_shift) +
+			 (offset & (cc->block_size - 1));
+}
+
+static void writethrough_endio(unsigned long error, void *context)
+{
+	bio_endio(context, error ? -EIO : 0);
+}
+
+/* Write to both the origin and the cached copy of a clean block. */
+static void writethrough(struct cache_c *cc, struct bio *bio,
+			 struct cblock *b)
+{
+	sector_t offset = dm_target_offset(cc->ti, bio->bi_sector);
+	struct dm_io_region where[2];
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE | (bio->bi_rw & WRITE_FLUSH_FUA),
+		.mem.type = DM_IO_BVEC,
+		.mem.ptr.bvec = bio->bi_io_vec + bio->bi_idx,
+		.notify.fn = writethrough_endio,
+		.notify.context = bio,
+		.client = cc->io_client,
+	};
+
+	where[0].bdev = cc->origin->bdev;
+	where[0].sector = offset;
+	where[0].count = bio_sectors(bio);
+
+	where[1].bdev = cc->cache->bdev;
+	where[1].sector = cc->data_start +
+			  ((sector_t)b->index << cc->block_shift) +
+			  (offset & (cc->block_size - 1));
+	where[1].count = bio_sectors(bio);
+
+	BUG_ON(dm_io(&io_req, 2, where, NULL));
+}
+
+/*
+ * Returns DM_MAPIO_REMAPPED with the bio remapped, or
+ * DM_MAPIO_SUBMITTED if it was queued or is being written through.
+ * @first is false for bios the worker runs again after waiting.
+ */
+static int process_bio(struct cache_c *cc, struct bio *bio, int first)
+{
+	sector_t oblock = dm_target_offset(cc->ti, bio->bi_sector) >>
+			  cc->block_shift;
+	int rw = bio_data_dir(bio);
+	struct cblock *b;
+
+	spin_lock_irq(&cc->lock);
+	b = lookup_block(cc, oblock);
+
+	if (b && ((b->flags & CB_BUSY) ||
+		  (rw == WRITE && (b->flags & CB_CLEANING)))) {
+		bio_list_add(&b->waiters, bio);
+		spin_unlock_irq(&cc->lock);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	if (!b) {
+		if (rw == READ) {
+			if (first) {
+				atomic_inc(&cc->read_misses);
+				if (oblock < cc->origin_blocks &&
+				    !cc->suspended &&
+				    cc->policy->promote(cc, oblock))
+					promote(cc, oblock);
+			}
+		} else {
+			if (first)
+				atomic_inc(&cc->write_misses);
+			hold_origin(cc, bio, oblock);
+		}
+
+		spin_unlock_irq(&cc->lock);
+		remap_to_origin(cc, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	list_move_tail(&b->lru, &cc->lru);
+
+	if (rw == READ) {
+		if (first)
+			atomic_inc(&cc->read_hits);
+		hold_block(cc, bio, b);
+		spin_unlock_irq(&cc->lock);
+		remap_to_cache(cc, bio, b);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	if (first)
+		atomic_inc(&cc->write_hits);
+
+	if (!cc->writeback) {
+		hold_block(cc, bio, b);
+		spin_unlock_irq(&cc->lock);
+		writethrough(cc, bio, b);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	if (!(b->flags & CB_DIRTY)) {
+		/* Mark it dirty on disk before the write can complete */
+		b->flags |= CB_DIRTY | CB_BUSY;
+		cc->nr_dirty++;
+		md_set(cc, b);
+		list_add_tail(&b->list, &cc->commit_wait);
+		bio_list_add(&b->waiters, bio);
+		spin_unlock_irq(&cc->lock);
+		wake_worker(cc);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	hold_block(cc, bio, b);
+	spin_unlock_irq(&cc->lock);
+	remap_to_cache(cc, bio, b);
+	return DM_MAPIO_REMAPPED;
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache_c *cc = container_of(ws, struct cache_c, worker);
+	LIST_HEAD(committed);
+	LIST_HEAD(promoted);
+	LIST_HEAD(cleaned);
+	LIST_HEAD(drained);
+	struct bio_list bios;
+	struct bio *bio;
+	int r = 0;
+
+	spin_lock_irq(&cc->lock);
+	list_splice_init(&cc->commit_wait, &committed);
+	list_splice_init(&cc->promoted, &promoted);
+	list_splice_init(&cc->cleaned, &cleaned);
+	list_splice_init(&cc->drained, &drained);
+	spin_unlock_irq(&cc->lock);
+
+	if (!list_empty(&drained))
+		start_drained(cc, &drained);
+
+	if (!list_empty(&promoted))
+		finish_promotions(cc, &promoted);
+
+	if (!list_empty(&cleaned))
+		r = finish_writeback(cc, &cleaned);
+
+	if (!list_empty(&committed))
+		finish_commit(cc, &committed, commit(cc));
+
+	/* Don't retry failing writebacks right away */
+	if (!r)
+		writeback(cc);
+
+	spin_lock_irq(&cc->lock);
+	bios = cc->deferred;
+	bio_list_init(&cc->deferred);
+	spin_unlock_irq(&cc->lock);
+
+	while ((bio = bio_list_pop(&bios)))
+		if (process_bio(cc, bio, 0) == DM_MAPIO_REMAPPED)
+			generic_make_request(bio);
+}
+
+/* Lazily commit entries of promoted and cleaned blocks. */
+static void do_waker(struct work_struct *ws)
+{
+	struct cache_c *cc = container_of(to_delayed_work(ws), struct cache_c,
+					  waker);
+
+	commit(cc);
+}
+
+/*-----------------------------------------------------------------
+ * Target methods
+ *---------------------------------------------------------------*/
+static void cache_free(struct cache_c *cc)
+{
+	if (cc->wq)
+		destroy_workqueue(cc->wq);
+	if (cc->kc)
+		dm_kcopyd_client_destroy(cc->kc);
+	if (cc->io_client)
+		dm_io_client_destroy(cc->io_client);
+	if (cc->policy_data)
+		cc->policy->exit(cc);
+	if (cc->md_buf)
+		free_page((unsigned long)cc->md_buf);
+	kfree(cc->md_dirty);
+	vfree(cc->md);
+	vfree(cc->origin_writes);
+	vfree(cc->hash);
+	vfree(cc->blocks);
+	if (cc->cache)
+		dm_put_device(cc->ti, cc->cache);
+	if (cc->origin)
+		dm_put_device(cc->ti, cc->origin);
+	kfree(cc);
+}
+
+/*
+ * Size the cache: superblock page, metadata pages and data blocks,
+ * data starting on a block boundary.
+ */
+static int cache_layout(struct cache_c *cc)
+{
+	sector_t size = i_size_read(cc->cache->bdev->bd_inode) >> SECTOR_SHIFT;
+	sector_t md_sectors;
+	unsigned nr;
+
+	if ((size >> cc->block_shift) > UINT_MAX)
+		return -EINVAL;
+
+	nr = size >> cc->block_shift;
+	while (nr) {
+		md_sectors = SECTORS_PER_PAGE *
+			     (1 + DIV_ROUND_UP(nr, ENTRIES_PER_PAGE));
+		cc->data_start = (md_sectors + cc->block_size - 1) &
+				 ~(cc->block_size - 1);
+		if (cc->data_start + ((sector_t)nr << cc->block_shift) <= size)
+			break;
+		nr--;
+	}
+
+	if (!nr)
+		return -EINVAL;
+
+	cc->nr_blocks = nr;
+	cc->md_pages = DIV_ROUND_UP(cc->nr_blocks, ENTRIES_PER_PAGE);
+	return 0;
+}
+
+/*
+ * Construct a cache mapping:
+ * <origin dev> <cache dev> <block size> <writeback|writethrough> <policy>
+ */
+static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct cache_c *cc;
+	unsigned long long tmp;
+	unsigned i;
+	char dummy;
+	int r = -EINVAL;
+
+	if (argc != 5) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	cc = kzalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc) {
+		ti->error = "Cannot allocate cache context";
+		return -ENOMEM;
+	}
+
+	cc->ti = ti;
+	spin_lock_init(&cc->lock);
+	INIT_LIST_HEAD(&cc->lru);
+	INIT_LIST_HEAD(&cc->free);
+	bio_list_init(&cc->deferred);
+	INIT_LIST_HEAD(&cc->commit_wait);
+	INIT_LIST_HEAD(&cc->promoted);
+	INIT_LIST_HEAD(&cc->cleaned);
+	INIT_LIST_HEAD(&cc->drained);
+	atomic_set(&cc->nr_jobs, 0);
+	init_waitqueue_head(&cc->jobs_wait);
+	INIT_WORK(&cc->worker, do_worker);
+	INIT_DELAYED_WORK(&cc->waker, do_waker);
+	cc->promote_thresh = DEFAULT_PROMOTE_THRESH;
+	cc->dirty_thresh = DEFAULT_DIRTY_THRESH;
+
+	if (dm_get_device(ti, argv[0], dm_table_get_mode(ti->table),
+			  &cc->origin)) {
+		ti->error = "Origin device lookup failed";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[1], dm_table_get_mode(ti->table),
+			  &cc->cache)) {
+		ti->error = "Cache device lookup failed";
+		goto bad;
+	}
+
+	if (sscanf(argv[2], "%llu%c", &tmp, &dummy) != 1 ||
+	    tmp < MIN_BLOCK_SIZE || tmp > MAX_BLOCK_SIZE ||
+	    !is_power_of_2(tmp)) {
+		ti->error = "Invalid block size";
+		goto bad;
+	}
+	cc->block_size = tmp;
+	cc->block_shift = ffs(tmp) - 1;
+
+	if (!strcmp(argv[3], "writeback"))
+		cc->writeback = 1;
+	else if (strcmp(argv[3], "writethrough")) {
+		ti->error = "Invalid cache mode";
+		goto bad;
+	}
+
+	cc->policy = get_policy(argv[4]);
+	if (!cc->policy) {
+		ti->error = "Unknown promotion policy";
+		goto bad;
+	}
+
+	if (ti->len >
+	    i_size_read(cc->origin->bdev->bd_inode) >> SECTOR_SHIFT) {
+		ti->error = "Origin device too small";
+		goto bad;
+	}
+	cc->origin_blocks = ti->len >> cc->block_shift;
+
+	if (cache_layout(cc)) {
+		ti->error = "Cache device too small";
+		goto bad;
+	}
+
+	r = -ENOMEM;
+	ti->error = "Cannot allocate cache metadata";
+	cc->blocks = vzalloc(sizeof(*cc->blocks) * cc->nr_blocks);
+	if (!cc->blocks)
+		goto bad;
+	for (i = 0; i < cc->nr_blocks; i++) {
+		cc->blocks[i].cc = cc;
+		cc->blocks[i].index = i;
+		INIT_LIST_HEAD(&cc->blocks[i].list);
+		bio_list_init(&cc->blocks[i].waiters);
+	}
+
+	cc->hash_bits = max(ilog2(cc->nr_blocks), 4);
+	cc->hash = vzalloc(sizeof(*cc->hash) << cc->hash_bits);
+	if (!cc->hash)
+		goto bad;
+
+	cc->origin_writes = vzalloc(sizeof(*cc->origin_writes) <<
+				    cc->hash_bits);
+	if (!cc->origin_writes)
+		goto bad;
+
+	cc->md = vzalloc(cc->md_pages * PAGE_SIZE);
+	if (!cc->md)
+		goto bad;
+
+	cc->md_dirty = kzalloc(BITS_TO_LONGS(cc->md_pages) * sizeof(long),
+			       GFP_KERNEL);
+	if (!cc->md_dirty)
+		goto bad;
+
+	cc->md_buf = (void *)__get_free_page(GFP_KERNEL);
+	if (!cc->md_buf)
+		goto bad;
+
+	if (cc->policy->init) {
+		r = cc->policy->init(cc);
+		if (r) {
+			ti->error = "Cannot initialize promotion policy";
+			goto bad;
+		}
+	}
+
+	cc->io_client = dm_io_client_create();
+	if (IS_ERR(cc->io_client)) {
+		r = PTR_ERR(cc->io_client);
+		cc->io_client = NULL;
+		ti->error = "Cannot allocate dm io client";
+		goto bad;
+	}
+
+	cc->kc = dm_kcopyd_client_create();
+	if (IS_ERR(cc->kc)) {
+		r = PTR_ERR(cc->kc);
+		cc->kc = NULL;
+		ti->error = "Cannot allocate kcopyd client";
+		goto bad;
+	}
+
+	cc->wq = create_singlethread_workqueue(DAEMON);
+	if (!cc->wq) {
+		r = -ENOMEM;
+		ti->error = "Cannot allocate workqueue";
+		goto bad;
+	}
+
+	r = load_metadata(cc);
+	if (r)
+		goto bad;
+
+	ti->split_io = cc->block_size;
+	ti->num_flush_requests = 2;
+	ti->private = cc;
+	return 0;
+
+bad:
+	cache_free(cc);
+	return r;
+}
+
+/* Wait for kcopyd jobs and the worker, then commit the metadata. */
+static void cache_drain(struct cache_c *cc)
+{
+	do {
+		wait_event(cc->jobs_wait, !atomic_read(&cc->nr_jobs));
+		flush_workqueue(cc->wq);
+	} while (atomic_read(&cc->nr_jobs));
+
+	cancel_delayed_work_sync(&cc->waker);
+	if (commit(cc))
+		DMERR("Could not commit cache metadata");
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	spin_lock_irq(&cc->lock);
+	cc->suspended = 1;
+	spin_unlock_irq(&cc->lock);
+
+	cache_drain(cc);
+	cache_free(cc);
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache_c *cc = ti->private;
+
+	if (bio->bi_rw & REQ_FLUSH) {
+		bio->bi_bdev = map_context->target_request_nr ?
+			       cc->cache->bdev : cc->origin->bdev;
+		return DM_MAPIO_REMAPPED;
+	}
+
+	return process_bio(cc, bio, 1);
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct cache_c *cc = ti->private;
+	unsigned long flags;
+
+	if (bio->bi_rw & REQ_FLUSH)
+		return error;
+
+	spin_lock_irqsave(&cc->lock, flags);
+	release_bio(cc, bio, map_context);
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	return error;
+}
+
+static void cache_presuspend(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	spin_lock_irq(&cc->lock);
+	cc->suspended = 1;
+	spin_unlock_irq(&cc->lock);
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	cache_drain(ti->private);
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	spin_lock_irq(&cc->lock);
+	cc->suspended = 0;
+	spin_unlock_irq(&cc->lock);
+
+	wake_worker(cc);
+}
+
+static unsigned percent(unsigned hits, unsigned misses)
+{
+	u64 total = (u64)hits + misses;
+
+	return total ? div64_u64((u64)hits * 100, total) : 0;
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned int maxlen)
+{
+	struct cache_c *cc = ti->private;
+	unsigned sz = 0;
+	unsigned rh, rm, wh, wm;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		rh = atomic_read(&cc->read_hits);
+		rm = atomic_read(&cc->read_misses);
+		wh = atomic_read(&cc->write_hits);
+		wm = atomic_read(&cc->write_misses);
+
+		DMEMIT("%u/%u %u %u %u %u %u %u %u %u %u %u",
+		       cc->nr_valid, cc->nr_blocks, cc->nr_dirty,
+		       rh, rm, percent(rh, rm), wh, wm, percent(wh, wm),
+		       atomic_read(&cc->promotions),
+		       atomic_read(&cc->demotions),
+		       atomic_read(&cc->writebacks));
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %llu %s %s", cc->origin->name, cc->cache->name,
+		       (unsigned long long)cc->block_size,
+		       cc->writeback ? "writeback" : "writethrough",
+		       cc->policy->name);
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Messages:
+ *   flush			write back all dirty blocks
+ *   dirty_thresh <percent>	start writeback above this share of dirty blocks
+ *   promote_thresh <misses>	read misses before promotion (hitcount)
+ */
+static int cache_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct cache_c *cc = ti->private;
+	unsigned long val;
+
+	if (argc == 1 && !strcasecmp(argv[0], "flush")) {
+		spin_lock_irq(&cc->lock);
+		cc->flush_all = 1;
+		spin_unlock_irq(&cc->lock);
+		wake_worker(cc);
+		return 0;
+	}
+
+	if (argc != 2 || strict_strtoul(argv[1], 10, &val))
+		goto error;
+
+	if (!strcasecmp(argv[0], "dirty_thresh") && val <= 100) {
+		cc->dirty_thresh = val;
+		wake_worker(cc);
+		return 0;
+	}
+
+	if (!strcasecmp(argv[0], "promote_thresh") && val &&
+	    val <= UINT_MAX) {
+		cc->promote_thresh = val;
+		return 0;
+	}
+
+error:
+	DMWARN("unrecognised message received.");
+	return -EINVAL;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	struct cache_c *cc = ti->private;
+	int r;
+
+	r = fn(ti, cc->origin, 0, ti->len, data);
+	if (!r)
+		r = fn(ti, cc->cache, 0, ti->len, data);
+
+	return r;
+}
+
+static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct cache_c *cc = ti->private;
+
+	blk_limits_io_min(limits, cc->block_size << SECTOR_SHIFT);
+}
+
+static struct target_type cache_target = {
+	.name	     = "cache",
+	.version     = {1, 0, 0},
+	.module      = THIS_MODULE,
+	.ctr	     = cache_ctr,
+	.dtr	     = cache_dtr,
+	.map	     = cache_map,
+	.end_io	     = cache_end_io,
+	.presuspend  = cache_presuspend,
+	.postsuspend = cache_postsuspend,
+	.resume	     = cache_resume,
+	.status	     = cache_status,
+	.message     = cache_message,
+	.iterate_devices = cache_iterate_devices,
+	.io_hints    = cache_io_hints,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r = dm_register_target(&cache_target);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " SSD cache target");
+MODULE_LICENSE("GPL");
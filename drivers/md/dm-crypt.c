@@ -17,6 +17,8 @@
 #include <linux/slab.h>
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/rbtree.h>
 #include <linux/backing-dev.h>
 #include <linux/percpu.h>
 #include <asm/atomic.h>
@@ -43,8 +45,11 @@ struct convert_context {
 	unsigned int offset_out;
 	unsigned int idx_in;
 	unsigned int idx_out;
+	unsigned int idx_end;		/* stop converting bio_in here */
 	sector_t sector;
 	atomic_t pending;
+	struct ablkcipher_request *req;
+	int own_req;			/* not in kcryptd: don't use cpu req */
 };
 
 /*
@@ -61,6 +66,13 @@ struct dm_crypt_io {
 	int error;
 	sector_t sector;
 	struct dm_crypt_io *base_io;
+
+	/* Part of base_bio this io converts, in whole bvecs */
+	unsigned int idx_start;
+	unsigned int idx_end;
+	unsigned int size;
+
+	struct rb_node rb_node;		/* in crypt_config's write_tree */
 };
 
 struct dm_crypt_request {
@@ -103,7 +115,9 @@ struct iv_lmk_private {
  * Crypt: maps a linear range of a block device
  * and encrypts / decrypts at the same time.
  */
-enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID };
+enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
+	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD,
+	     DM_CRYPT_NO_WRITE_WORKQUEUE };
 
 /*
  * Duplicated per-CPU state for cipher.
@@ -135,6 +149,12 @@ struct crypt_config {
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
 
+	/* Encrypted writes waiting for dmcrypt_write, sorted by sector */
+	struct task_struct *write_thread;
+	wait_queue_head_t write_wait;
+	spinlock_t write_lock;
+	struct rb_root write_tree;
+
 	char *cipher;
 	char *cipher_string;
 
@@ -178,15 +198,26 @@ struct crypt_config {
 #define MIN_IOS        16
 #define MIN_POOL_PAGES 32
 
+/*
+ * Bios of at least twice this size are converted in parallel, in
+ * fragments of at least this size, one per online CPU.
+ */
+#define MIN_SPLIT_SIZE (32 * 1024)
+
 static struct kmem_cache *_crypt_io_pool;
 
 static void clone_init(struct dm_crypt_io *, struct bio *);
 static void kcryptd_queue_crypt(struct dm_crypt_io *io);
+static void kcryptd_crypt(struct work_struct *work);
 static u8 *iv_of_dmreq(struct crypt_config *cc, struct dm_crypt_request *dmreq);
 
+/*
+ * Conversion may run preemptible, in the submitter's context, so this
+ * is only a hint of which copy to use: every CPU's state is keyed alike.
+ */
 static struct crypt_cpu *this_crypt_config(struct crypt_config *cc)
 {
-	return this_cpu_ptr(cc->cpu);
+	return __this_cpu_ptr(cc->cpu);
 }
 
 /*
@@ -665,7 +696,10 @@ static void crypt_convert_init(struct crypt_config *cc,
 	ctx->offset_out = 0;
 	ctx->idx_in = bio_in ? bio_in->bi_idx : 0;
 	ctx->idx_out = bio_out ? bio_out->bi_idx : 0;
+	ctx->idx_end = bio_in ? bio_in->bi_vcnt : 0;
 	ctx->sector = sector + cc->iv_offset;
+	ctx->req = NULL;
+	ctx->own_req = 0;
 	init_completion(&ctx->restart);
 }
 
@@ -746,19 +780,47 @@ static int crypt_convert_block(struct crypt_config *cc,
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
 
-static void crypt_alloc_req(struct crypt_config *cc,
-			    struct convert_context *ctx)
+/*
+ * The request belongs to the context rather than the CPU, so that the
+ * conversion may be preempted or move between CPUs.
+ */
+/*
+ * kcryptd runs one work item at a time on each CPU, so conversions there
+ * keep a cached request per CPU across bios. A write encrypted in the
+ * submitter's context (no_write_workqueue) may be preempted by another
+ * one on the same CPU, so it uses a request of its own.
+ */
+static struct ablkcipher_request **crypt_req_slot(struct crypt_config *cc,
+						  struct convert_context *ctx)
+{
+	return ctx->own_req ? &ctx->req : &this_crypt_config(cc)->req;
+}
+
+static struct ablkcipher_request *crypt_alloc_req(struct crypt_config *cc,
+			struct convert_context *ctx,
+			struct ablkcipher_request **slot)
 {
 	struct crypt_cpu *this_cc = this_crypt_config(cc);
 	unsigned key_index = ctx->sector & (cc->tfms_count - 1);
 
-	if (!this_cc->req)
-		this_cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
+	if (!*slot)
+		*slot = mempool_alloc(cc->req_pool, GFP_NOIO);
 
-	ablkcipher_request_set_tfm(this_cc->req, this_cc->tfms[key_index]);
-	ablkcipher_request_set_callback(this_cc->req,
+	ablkcipher_request_set_tfm(*slot, this_cc->tfms[key_index]);
+	ablkcipher_request_set_callback(*slot,
 	    CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
-	    kcryptd_async_done, dmreq_of_req(cc, this_cc->req));
+	    kcryptd_async_done, dmreq_of_req(cc, *slot));
+
+	return *slot;
+}
+
+static void crypt_free_req(struct crypt_config *cc,
+			   struct convert_context *ctx)
+{
+	if (ctx->req) {
+		mempool_free(ctx->req, cc->req_pool);
+		ctx->req = NULL;
+	}
 }
 
 /*
@@ -767,19 +829,20 @@ static void crypt_alloc_req(struct crypt_config *cc,
 static int crypt_convert(struct crypt_config *cc,
 			 struct convert_context *ctx)
 {
-	struct crypt_cpu *this_cc = this_crypt_config(cc);
+	struct ablkcipher_request **slot = crypt_req_slot(cc, ctx);
+	struct ablkcipher_request *req;
 	int r;
 
 	atomic_set(&ctx->pending, 1);
 
-	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
+	while(ctx->idx_in < ctx->idx_end &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 
-		crypt_alloc_req(cc, ctx);
+		req = crypt_alloc_req(cc, ctx, slot);
 
 		atomic_inc(&ctx->pending);
 
-		r = crypt_convert_block(cc, ctx, this_cc->req);
+		r = crypt_convert_block(cc, ctx, req);
 
 		switch (r) {
 		/* async */
@@ -788,7 +851,7 @@ static int crypt_convert(struct crypt_config *cc,
 			INIT_COMPLETION(ctx->restart);
 			/* fall through*/
 		case -EINPROGRESS:
-			this_cc->req = NULL;
+			*slot = NULL;
 			ctx->sector++;
 			continue;
 
@@ -802,10 +865,12 @@ static int crypt_convert(struct crypt_config *cc,
 		/* error */
 		default:
 			atomic_dec(&ctx->pending);
+			crypt_free_req(cc, ctx);
 			return r;
 		}
 	}
 
+	crypt_free_req(cc, ctx);
 	return 0;
 }
 
@@ -824,16 +889,16 @@ static void dm_crypt_bio_destructor(struct bio *bio)
  * *out_of_pages set to 1.
  */
 static struct bio *crypt_alloc_buffer(struct dm_crypt_io *io, unsigned size,
-				      unsigned *out_of_pages)
+				      unsigned *out_of_pages, gfp_t gfp)
 {
 	struct crypt_config *cc = io->target->private;
 	struct bio *clone;
 	unsigned int nr_iovecs = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
-	gfp_t gfp_mask = GFP_NOIO | __GFP_HIGHMEM;
+	gfp_t gfp_mask = gfp | __GFP_HIGHMEM;
 	unsigned i, len;
 	struct page *page;
 
-	clone = bio_alloc_bioset(GFP_NOIO, nr_iovecs, cc->bs);
+	clone = bio_alloc_bioset(gfp, nr_iovecs, cc->bs);
 	if (!clone)
 		return NULL;
 
@@ -897,6 +962,9 @@ static struct dm_crypt_io *crypt_io_alloc(struct dm_target *ti,
 	io->sector = sector;
 	io->error = 0;
 	io->base_io = NULL;
+	io->idx_start = bio->bi_idx;
+	io->idx_end = bio->bi_vcnt;
+	io->size = bio->bi_size;
 	atomic_set(&io->pending, 0);
 
 	return io;
@@ -949,6 +1017,10 @@ static void crypt_dec_pending(struct dm_crypt_io *io)
  *
  * The work is done per CPU global for all dm-crypt instances.
  * They should not depend on each other and do not block.
+ *
+ * Large bios are split into fragments converted on different CPUs
+ * (see crypt_split_io), so encrypted writes finish out of order;
+ * dmcrypt_write puts them back in sector order before submission.
  */
 static void crypt_endio(struct bio *clone, int error)
 {
@@ -1024,6 +1096,67 @@ static void kcryptd_io_write(struct dm_crypt_io *io)
 	generic_make_request(clone);
 }
 
+/*
+ * Submit the encrypted writes queued on write_tree in ascending sector
+ * order, a batch at a time, under a plug so that the fragments of one
+ * bio are merged again below us.
+ */
+static int dmcrypt_write(void *data)
+{
+	struct crypt_config *cc = data;
+	struct dm_crypt_io *io;
+	struct rb_root write_tree;
+	struct blk_plug plug;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(cc->write_wait,
+					 !RB_EMPTY_ROOT(&cc->write_tree) ||
+					 kthread_should_stop());
+
+		spin_lock_irq(&cc->write_lock);
+		write_tree = cc->write_tree;
+		cc->write_tree = RB_ROOT;
+		spin_unlock_irq(&cc->write_lock);
+
+		if (RB_EMPTY_ROOT(&write_tree))
+			continue;
+
+		blk_start_plug(&plug);
+		do {
+			io = rb_entry(rb_first(&write_tree),
+				      struct dm_crypt_io, rb_node);
+			rb_erase(&io->rb_node, &write_tree);
+			kcryptd_io_write(io);
+		} while (!RB_EMPTY_ROOT(&write_tree));
+		blk_finish_plug(&plug);
+	}
+
+	return 0;
+}
+
+static void kcryptd_queue_write(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+	struct rb_node **rbp, *parent = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc->write_lock, flags);
+	rbp = &cc->write_tree.rb_node;
+	while (*rbp) {
+		parent = *rbp;
+		if (io->sector < rb_entry(parent, struct dm_crypt_io,
+					  rb_node)->sector)
+			rbp = &parent->rb_left;
+		else
+			rbp = &parent->rb_right;
+	}
+	rb_link_node(&io->rb_node, parent, rbp);
+	rb_insert_color(&io->rb_node, &cc->write_tree);
+	spin_unlock_irqrestore(&cc->write_lock, flags);
+
+	wake_up(&cc->write_wait);
+}
+
 static void kcryptd_io(struct work_struct *work)
 {
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
@@ -1062,35 +1195,131 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int async)
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
+	if (!async && (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags) ||
+		       test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags)))
+		generic_make_request(clone);
+	else if (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags))
 		kcryptd_queue_io(io);
 	else
-		generic_make_request(clone);
+		kcryptd_queue_write(io);
 }
 
-static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
+/*
+ * Spread the conversion of a large bio over the online CPUs: its bvecs
+ * are cut into runs of roughly equal size, each converted by a fragment
+ * io queued on its own CPU. The fragments hold references on @io, which
+ * completes the bio when the last of them finishes.
+ *
+ * Returns 1 if @io was split.
+ */
+static int crypt_split_io(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+	struct bio *bio = io->base_bio;
+	unsigned nr_cpus = num_online_cpus();
+	unsigned int chunk, size, start, idx;
+	sector_t sector = io->sector;
+	struct dm_crypt_io *frag;
+	int cpu;
+
+	if (io->base_io || nr_cpus < 2 || io->size < 2 * MIN_SPLIT_SIZE ||
+	    test_bit(DM_CRYPT_SAME_CPU, &cc->flags))
+		return 0;
+
+	if (bio_data_dir(bio) == WRITE &&
+	    test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))
+		return 0;
+
+	chunk = max_t(unsigned int, DIV_ROUND_UP(io->size, nr_cpus),
+		      MIN_SPLIT_SIZE);
+
+	/* Fragments may complete before the last one is queued */
+	crypt_inc_pending(io);
+
+	cpu = raw_smp_processor_id();
+	idx = io->idx_start;
+	while (idx < io->idx_end) {
+		start = idx;
+		size = 0;
+		do {
+			size += bio_iovec_idx(bio, idx)->bv_len;
+			idx++;
+		} while (idx < io->idx_end && size < chunk);
+
+		frag = crypt_io_alloc(io->target, bio, sector);
+		frag->idx_start = start;
+		frag->idx_end = idx;
+		frag->size = size;
+		frag->base_io = io;
+		crypt_inc_pending(io);
+
+		/*
+		 * A read io arrives at kcryptd_crypt_read_convert holding
+		 * the reference of its read clone; give the fragment the
+		 * same one.
+		 */
+		if (bio_data_dir(bio) == READ)
+			crypt_inc_pending(frag);
+
+		sector += size >> SECTOR_SHIFT;
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+
+		INIT_WORK(&frag->work, kcryptd_crypt);
+		queue_work_on(cpu, cc->crypt_queue, &frag->work);
+	}
+
+	crypt_dec_pending(io);
+	return 1;
+}
+
+/*
+ * @in_map is set when called from crypt_map() for no_write_workqueue.
+ * The clones submitted there only reach the device once crypt_map()
+ * returns, so waiting on the page or bio pools for pages held by them
+ * would deadlock: unless the whole buffer can be had without waiting,
+ * the io is handed to kcryptd instead.
+ */
+static void kcryptd_crypt_write_convert(struct dm_crypt_io *io, int in_map)
 {
 	struct crypt_config *cc = io->target->private;
 	struct bio *clone;
 	struct dm_crypt_io *new_io;
 	int crypt_finished;
 	unsigned out_of_pages = 0;
-	unsigned remaining = io->base_bio->bi_size;
+	unsigned remaining = io->size;
 	sector_t sector = io->sector;
 	int r;
 
+	if (crypt_split_io(io))
+		return;
+
 	/*
 	 * Prevent io from disappearing until this function completes.
 	 */
 	crypt_inc_pending(io);
 	crypt_convert_init(cc, &io->ctx, NULL, io->base_bio, sector);
+	io->ctx.idx_in = io->idx_start;
+	io->ctx.idx_end = io->idx_end;
+	io->ctx.own_req = in_map;
 
 	/*
 	 * The allocated buffers can be smaller than the whole bio,
 	 * so repeat the whole process until all the data can be handled.
 	 */
 	while (remaining) {
-		clone = crypt_alloc_buffer(io, remaining, &out_of_pages);
+		clone = crypt_alloc_buffer(io, remaining, &out_of_pages,
+					   in_map ? GFP_NOWAIT : GFP_NOIO);
+		if (in_map && (!clone || clone->bi_size < remaining)) {
+			if (clone) {
+				crypt_free_buffer_pages(cc, clone);
+				bio_put(clone);
+			}
+			kcryptd_queue_crypt(io);
+			break;
+		}
 		if (unlikely(!clone)) {
 			io->error = -ENOMEM;
 			break;
@@ -1120,8 +1349,6 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			 */
 			if (unlikely(r < 0))
 				break;
-
-			io->sector = sector;
 		}
 
 		/*
@@ -1133,9 +1360,10 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 
 		/*
 		 * With async crypto it is unsafe to share the crypto context
-		 * between fragments, so switch to a new dm_crypt_io structure.
+		 * between fragments, and a submitted clone may still be
+		 * waiting on write_tree, so switch to a new dm_crypt_io.
 		 */
-		if (unlikely(!crypt_finished && remaining)) {
+		if (unlikely(remaining)) {
 			new_io = crypt_io_alloc(io->target, io->base_bio,
 						sector);
 			crypt_inc_pending(new_io);
@@ -1143,6 +1371,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 					   io->base_bio, sector);
 			new_io->ctx.idx_in = io->ctx.idx_in;
 			new_io->ctx.offset_in = io->ctx.offset_in;
+			new_io->ctx.idx_end = io->ctx.idx_end;
 
 			/*
 			 * Fragments after the first use the base_io
@@ -1173,10 +1402,21 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 	struct crypt_config *cc = io->target->private;
 	int r = 0;
 
+	/* The read clone's (or, for a fragment, crypt_split_io's) reference */
+	BUG_ON(!atomic_read(&io->pending));
+
+	/* The fragments now own the data: drop the read clone's reference */
+	if (crypt_split_io(io)) {
+		crypt_dec_pending(io);
+		return;
+	}
+
 	crypt_inc_pending(io);
 
 	crypt_convert_init(cc, &io->ctx, io->base_bio, io->base_bio,
 			   io->sector);
+	io->ctx.idx_in = io->ctx.idx_out = io->idx_start;
+	io->ctx.idx_end = io->idx_end;
 
 	r = crypt_convert(cc, &io->ctx);
 	if (r < 0)
@@ -1225,7 +1465,7 @@ static void kcryptd_crypt(struct work_struct *work)
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_crypt_read_convert(io);
 	else
-		kcryptd_crypt_write_convert(io);
+		kcryptd_crypt_write_convert(io, 0);
 }
 
 static void kcryptd_queue_crypt(struct dm_crypt_io *io)
@@ -1293,10 +1533,15 @@ static int crypt_alloc_tfms(struct crypt_config *cc, int cpu, char *ciphermode)
 {
 	struct crypt_cpu *cpu_cc = per_cpu_ptr(cc->cpu, cpu);
 	unsigned i;
+	u32 mask = 0;
 	int err;
 
+	/* Converting in the submitter's context needs a synchronous cipher */
+	if (test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))
+		mask = CRYPTO_ALG_ASYNC;
+
 	for (i = 0; i < cc->tfms_count; i++) {
-		cpu_cc->tfms[i] = crypto_alloc_ablkcipher(ciphermode, 0, 0);
+		cpu_cc->tfms[i] = crypto_alloc_ablkcipher(ciphermode, 0, mask);
 		if (IS_ERR(cpu_cc->tfms[i])) {
 			err = PTR_ERR(cpu_cc->tfms[i]);
 			crypt_free_tfms(cc, cpu);
@@ -1370,6 +1615,9 @@ static void crypt_dtr(struct dm_target *ti)
 	if (!cc)
 		return;
 
+	if (cc->write_thread)
+		kthread_stop(cc->write_thread);
+
 	if (cc->io_queue)
 		destroy_workqueue(cc->io_queue);
 	if (cc->crypt_queue)
@@ -1570,9 +1818,51 @@ bad_mem:
 	return -ENOMEM;
 }
 
+/*
+ * Optional feature arguments:
+ * [<#opt_params> <opt_params>]
+ *
+ *   same_cpu_crypt		convert each bio on the CPU it was mapped on
+ *   submit_from_crypt_cpus	submit writes as soon as they are encrypted,
+ *				without sorting them
+ *   no_write_workqueue		encrypt writes in the submitter's context,
+ *				using synchronous ciphers only
+ */
+static int crypt_ctr_optional(struct dm_target *ti, unsigned int argc,
+			      char **argv)
+{
+	struct crypt_config *cc = ti->private;
+	unsigned int opt_params;
+
+	if (!argc)
+		return 0;
+
+	if (sscanf(argv[0], "%u", &opt_params) != 1 ||
+	    opt_params != argc - 1) {
+		ti->error = "Invalid number of feature args";
+		return -EINVAL;
+	}
+
+	while (opt_params--) {
+		argv++;
+		if (!strcasecmp(*argv, "same_cpu_crypt"))
+			set_bit(DM_CRYPT_SAME_CPU, &cc->flags);
+		else if (!strcasecmp(*argv, "submit_from_crypt_cpus"))
+			set_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
+		else if (!strcasecmp(*argv, "no_write_workqueue"))
+			set_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags);
+		else {
+			ti->error = "Invalid feature arguments";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Construct an encryption mapping:
- * <cipher> <key> <iv_offset> <dev_path> <start>
+ * <cipher> <key> <iv_offset> <dev_path> <start> [<#opt_params> <opt_params>]
  */
 static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -1581,7 +1871,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	unsigned long long tmpll;
 	int ret;
 
-	if (argc != 5) {
+	if (argc < 5) {
 		ti->error = "Not enough arguments";
 		return -EINVAL;
 	}
@@ -1596,6 +1886,15 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	cc->key_size = key_size;
 
 	ti->private = cc;
+	init_waitqueue_head(&cc->write_wait);
+	spin_lock_init(&cc->write_lock);
+	cc->write_tree = RB_ROOT;
+
+	/* Needed before the ciphers are allocated */
+	ret = crypt_ctr_optional(ti, argc - 5, argv + 5);
+	if (ret < 0)
+		goto bad;
+
 	ret = crypt_ctr_cipher(ti, argv[0], argv[1]);
 	if (ret < 0)
 		goto bad;
@@ -1670,6 +1969,14 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad;
 	}
 
+	cc->write_thread = kthread_run(dmcrypt_write, cc, "dmcrypt_write");
+	if (IS_ERR(cc->write_thread)) {
+		ret = PTR_ERR(cc->write_thread);
+		cc->write_thread = NULL;
+		ti->error = "Couldn't spawn write thread";
+		goto bad;
+	}
+
 	ti->num_flush_requests = 1;
 	return 0;
 
@@ -1681,11 +1988,10 @@ bad:
 static int crypt_map(struct dm_target *ti, struct bio *bio,
 		     union map_info *map_context)
 {
+	struct crypt_config *cc = ti->private;
 	struct dm_crypt_io *io;
-	struct crypt_config *cc;
 
 	if (bio->bi_rw & REQ_FLUSH) {
-		cc = ti->private;
 		bio->bi_bdev = cc->dev->bdev;
 		return DM_MAPIO_REMAPPED;
 	}
@@ -1695,7 +2001,9 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 	if (bio_data_dir(io->base_bio) == READ) {
 		if (kcryptd_io_read(io, GFP_NOWAIT))
 			kcryptd_queue_io(io);
-	} else
+	} else if (test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))
+		kcryptd_crypt_write_convert(io, 1);
+	else
 		kcryptd_queue_crypt(io);
 
 	return DM_MAPIO_SUBMITTED;
@@ -1706,6 +2014,7 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 {
 	struct crypt_config *cc = ti->private;
 	unsigned int sz = 0;
+	int num_feature_args;
 
 	switch (type) {
 	case STATUSTYPE_INFO:
@@ -1729,6 +2038,19 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 
 		DMEMIT(" %llu %s %llu", (unsigned long long)cc->iv_offset,
 				cc->dev->name, (unsigned long long)cc->start);
+
+		num_feature_args = test_bit(DM_CRYPT_SAME_CPU, &cc->flags) +
+			test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags) +
+			test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags);
+		if (num_feature_args) {
+			DMEMIT(" %d", num_feature_args);
+			if (test_bit(DM_CRYPT_SAME_CPU, &cc->flags))
+				DMEMIT(" same_cpu_crypt");
+			if (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags))
+				DMEMIT(" submit_from_crypt_cpus");
+			if (test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))
+				DMEMIT(" no_write_workqueue");
+		}
 		break;
 	}
 	return 0;
@@ -1825,7 +2147,7 @@ static int crypt_iterate_devices(struct dm_target *ti,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 10, 0},
+	.version = {1, 11, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
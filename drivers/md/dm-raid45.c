@@ -35,6 +35,7 @@
  *	o recovery of out of sync device for initial
  *	  RAID set creation or after dead drive replacement
  *	o run time optimization of xor algorithm used to calculate parity
+ *	o stripe io and parity calculation spread over worker threads
  *
  *
  * Thanks to MD for:
@@ -67,6 +68,7 @@ static const char *version = "v0.2597k";
 #include <linux/kernel.h>
 #include <linux/vmalloc.h>
 #include <linux/raid/xor.h>
+#include <linux/async_tx.h>
 #include <linux/slab.h>
 
 #include <linux/bio.h>
@@ -112,6 +114,7 @@ static const char *version = "v0.2597k";
 
 #define	TARGET	"dm-raid45"
 #define	DAEMON	"kraid45d"
+#define	WORKER	"kraid45w"
 #define	DM_MSG_PREFIX	TARGET
 
 #define	SECTORS_PER_PAGE	(PAGE_SIZE >> SECTOR_SHIFT)
@@ -322,6 +325,7 @@ struct stripe_hash {
 
 enum sc_lock_types {
 	LOCK_ENDIO,	/* Protect endio list. */
+	LOCK_LRU,	/* Protect LRU list vs. stripe workers. */
 	NR_LOCKS,       /* To size array in struct stripe_cache. */
 };
 
@@ -487,7 +491,7 @@ struct raid_set {
 	struct {
 		unsigned long flags;	/* State flags. */
 		struct mutex in_lock;	/* Protects central input list below. */
-		struct mutex xor_lock;	/* Protects xor algorithm set. */
+		struct rw_semaphore xor_lock; /* Protects xor algorithm set. */
 		struct bio_list in;	/* Pending ios (central input list). */
 		struct bio_list work;	/* ios work set. */
 		wait_queue_head_t suspendq;	/* suspend synchronization. */
@@ -498,6 +502,13 @@ struct raid_set {
 		struct workqueue_struct *wq;
 		struct delayed_work dws_do_raid;	/* For main worker. */
 		struct work_struct ws_do_table_event;	/* For event worker. */
+
+		/* Stripe workers do_flush() hands stripes to. */
+		struct workqueue_struct *worker_wq;
+		struct raid_worker *workers;
+		unsigned nr_workers;		/* # of workers in use. */
+		atomic_t workers_busy;
+		struct completion workers_done;
 	} io;
 
 	/* Stripe locking abstraction. */
@@ -578,9 +589,6 @@ struct raid_set {
 	/* REMOVEME: devel stats counters. */
 	atomic_t stats[S_NR_STATS];
 
-	/* Dynamically allocated temporary pointers for xor(). */
-	unsigned long **data;
-
 	/* Dynamically allocated RAID devices. Alignment? */
 	struct raid_dev dev[0];
 };
@@ -641,13 +649,46 @@ struct raid_address {
 	unsigned di, pi;	/* Data and parity disks index. */
 };
 
+/*
+ * A stripe worker.
+ *
+ * do_flush() deals the stripes on the io list out to the workers,
+ * which run stripe_rw() (write merging, parity calculation and io
+ * submission) on them in parallel, and waits for all of them to finish.
+ * Stripe hash and io lists stay owned by the daemon, which is blocked
+ * meanwhile; the workers only touch the stripes they've been handed
+ * plus the LRU list, which is locked for that reason.
+ */
+enum worker_stats_types {
+	W_RUNS,		/* # of batches run. */
+	W_STRIPES,	/* # of stripes handled. */
+	W_IOS,		/* # of chunk ios submitted. */
+	W_NR_STATS,
+};
+
+struct raid_worker {
+	struct work_struct ws;
+	struct raid_set *rs;
+	struct list_head stripes;	/* Stripes handed to the worker. */
+	int r;				/* Chunk ios submitted. */
+
+	/* REMOVEME: devel stats counters. */
+	atomic_t stats[W_NR_STATS];
+};
+
 /* REMOVEME: reset statistics counters. */
 static void stats_reset(struct raid_set *rs)
 {
-	unsigned s = S_NR_STATS;
+	unsigned s = S_NR_STATS, w;
 
 	while (s--)
 		atomic_set(rs->stats + s, 0);
+
+	for (w = 0; w < num_possible_cpus(); w++) {
+		s = W_NR_STATS;
+		while (s--)
+			atomic_set(rs->io.workers[w].stats + s, 0);
+	}
 }
 
 /*----------------------------------------------------------------
@@ -1071,15 +1112,19 @@ static void stripe_flush_add(struct stripe *stripe)
 /*
  * Add stripe to LRU (inactive) list.
  *
- * Need lock, because of concurrent access from message interface.
+ * Need lock, because of concurrent access from message interface
+ * and from stripe workers taking references out in stripe_get().
  */
 static void stripe_lru_add(struct stripe *stripe)
 {
 	if (!StripeRecover(stripe)) {
+		struct stripe_cache *sc = stripe->sc;
 		struct list_head *lh = stripe->lists + LIST_LRU;
 
+		spin_lock(sc->locks + LOCK_LRU);
 		if (list_empty(lh))
-			list_add_tail(lh, stripe->sc->lists + LIST_LRU);
+			list_add_tail(lh, sc->lists + LIST_LRU);
+		spin_unlock(sc->locks + LOCK_LRU);
 	}
 }
 
@@ -1100,7 +1145,9 @@ static struct stripe *stripe_lru_pop(struct stripe_cache *sc)
 {
 	struct stripe *stripe;
 
+	spin_lock(sc->locks + LOCK_LRU);
 	POP_LIST(LIST_LRU);
+	spin_unlock(sc->locks + LOCK_LRU);
 	return stripe;
 }
 
@@ -1216,9 +1263,12 @@ static int stripe_get(struct stripe *stripe)
 {
 	int r;
 	struct list_head *lh = stripe->lists + LIST_LRU;
+	spinlock_t *lock = stripe->sc->locks + LOCK_LRU;
 
 	/* Delete stripe from LRU (inactive) list if on. */
+	spin_lock(lock);
 	DEL_LIST(lh);
+	spin_unlock(lock);
 	BUG_ON(stripe_ref(stripe) < 0);
 
 	/* Lock stripe on first reference */
@@ -1856,6 +1906,33 @@ static void xor_blocks_wrapper(unsigned n, unsigned long **data)
 	xor_blocks(n - 1, XOR_SIZE, (void *) data[0], (void **) data + 1);
 }
 
+/*
+ * async_xor wrapper to offload to a dma engine with xor capability.
+ *
+ * Without one, async_xor() falls back to xor_blocks() synchronously.
+ */
+static void xor_async_wrapper(unsigned n, unsigned long **data)
+{
+	struct page *pages[XOR_CHUNKS_MAX];
+	struct dma_async_tx_descriptor *tx;
+	struct async_submit_ctl submit;
+	unsigned i;
+
+	BUG_ON(n < 2 || n > XOR_CHUNKS_MAX);
+	for (i = 0; i < n; i++)
+		pages[i] = virt_to_page(data[i]);
+
+	/*
+	 * The parity page is the first source as well.  No ASYNC_TX_ACK:
+	 * async_tx_quiesce() acks the descriptor once it has completed.
+	 */
+	init_async_submit(&submit, ASYNC_TX_XOR_DROP_DST,
+			  NULL, NULL, NULL, NULL);
+	tx = async_xor(pages[0], pages, 0, n, XOR_SIZE, &submit);
+	async_tx_issue_pending(tx);
+	async_tx_quiesce(&tx);
+}
+
 struct xor_func {
 	xor_function_t f;
 	const char *name;
@@ -1865,6 +1942,7 @@ struct xor_func {
 	{ xor_16,  "xor_16" },
 	{ xor_8,   "xor_8"  },
 	{ xor_blocks_wrapper, "xor_blocks" },
+	{ xor_async_wrapper, "xor_async" },
 };
 
 /*
@@ -1901,6 +1979,8 @@ static inline int chunk_must_xor(struct stripe_chunk *chunk)
  * All chunks will be xored into the indexed (@pi)
  * chunk in maximum groups of xor.chunks.
  *
+ * Called with xor_lock held for read by common_xor(). The pointer
+ * array lives on the stack because stripe workers xor in parallel.
  */
 static void xor(struct stripe *stripe, unsigned pi, unsigned sector)
 {
@@ -1908,7 +1988,7 @@ static void xor(struct stripe *stripe, unsigned pi, unsigned sector)
 	unsigned max_chunks = rs->xor.chunks, n = 1,
 		 o = sector / SECTORS_PER_PAGE, /* Offset into the page_list. */
 		 p = rs->set.raid_devs;
-	unsigned long **d = rs->data;
+	unsigned long *d[XOR_CHUNKS_MAX];
 	xor_function_t xor_f = rs->xor.f->f;
 
 	BUG_ON(sector > stripe->io.size);
@@ -1923,30 +2003,28 @@ static void xor(struct stripe *stripe, unsigned pi, unsigned sector)
 
 		/* If max chunks -> xor. */
 		if (n == max_chunks) {
-			mutex_lock(&rs->io.xor_lock);
 			xor_f(n, d);
-			mutex_unlock(&rs->io.xor_lock);
 			n = 1;
 		}
 	}
 
 	/* If chunks -> xor. */
-	if (n > 1) {
-		mutex_lock(&rs->io.xor_lock);
+	if (n > 1)
 		xor_f(n, d);
-		mutex_unlock(&rs->io.xor_lock);
-	}
 }
 
 /* Common xor loop through all stripe page lists. */
 static void common_xor(struct stripe *stripe, sector_t count,
 		       unsigned off, unsigned pi)
 {
+	struct raid_set *rs = RS(stripe->sc);
 	unsigned sector;
 
 	BUG_ON(!count);
+	down_read(&rs->io.xor_lock);
 	for (sector = off; sector < count; sector += SECTORS_PER_PAGE)
 		xor(stripe, pi, sector);
+	up_read(&rs->io.xor_lock);
 
 	/* Set parity page uptodate and clean. */
 	chunk_set(CHUNK(stripe, pi), CLEAN);
@@ -3201,14 +3279,68 @@ static void do_endios(struct raid_set *rs)
 	list_splice(&flush_list, sc->lists + LIST_FLUSH);
 }
 
-/* Flush any stripes on the io list. */
+/* Stripe worker: read/write all stripes handed in by do_flush(). */
+static void do_stripes(struct work_struct *ws)
+{
+	struct raid_worker *worker = container_of(ws, struct raid_worker, ws);
+	struct raid_set *rs = worker->rs;
+	struct stripe *stripe;
+
+	worker->r = 0;
+	while (!list_empty(&worker->stripes)) {
+		stripe = list_first_entry(&worker->stripes, struct stripe,
+					  lists[LIST_FLUSH]);
+		list_del_init(stripe->lists + LIST_FLUSH);
+		worker->r += stripe_rw(stripe);
+		atomic_inc(worker->stats + W_STRIPES); /* REMOVEME: stats. */
+	}
+
+	/* REMOVEME: statistics. */
+	atomic_inc(worker->stats + W_RUNS);
+	atomic_add(worker->r, worker->stats + W_IOS);
+
+	if (atomic_dec_and_test(&rs->io.workers_busy))
+		complete(&rs->io.workers_done);
+}
+
+/*
+ * Flush any stripes on the io list.
+ *
+ * Stripes are dealt out round robin to the stripe workers unless
+ * there's just one of either, in which case we do it ourselves.
+ */
 static int do_flush(struct raid_set *rs)
 {
 	int r = 0;
+	unsigned nr = 0, w, workers = ACCESS_ONCE(rs->io.nr_workers);
 	struct stripe *stripe;
+	struct list_head *pos, *lh = rs->sc.lists + LIST_FLUSH;
+
+	list_for_each(pos, lh) {
+		if (++nr == workers)
+			break;
+	}
+
+	if (nr < 2) {
+		while ((stripe = stripe_io_pop(&rs->sc)))
+			r += stripe_rw(stripe); /* Read/write stripe. */
+
+		return r;
+	}
+
+	for (w = 0; (stripe = stripe_io_pop(&rs->sc)); w = (w + 1) % nr)
+		list_add_tail(stripe->lists + LIST_FLUSH,
+			      &rs->io.workers[w].stripes);
+
+	atomic_set(&rs->io.workers_busy, nr);
+	INIT_COMPLETION(rs->io.workers_done);
+	for (w = 0; w < nr; w++)
+		queue_work(rs->io.worker_wq, &rs->io.workers[w].ws);
 
-	while ((stripe = stripe_io_pop(&rs->sc)))
-		r += stripe_rw(stripe); /* Read/write stripe. */
+	wait_for_completion(&rs->io.workers_done);
+
+	for (w = 0; w < nr; w++)
+		r += rs->io.workers[w].r;
 
 	return r;
 }
@@ -3587,7 +3719,7 @@ context_alloc(struct raid_type *raid_type, struct variable_parms *p,
 		goto bad_recover_io_size;
 
 	/* Size and allocate the RAID set structure. */
-	len = sizeof(*rs->data) + sizeof(*rs->dev);
+	len = sizeof(*rs->dev);
 	if (dm_array_too_big(sizeof(*rs), len, raid_devs))
 		goto bad_array;
 
@@ -3596,14 +3728,19 @@ context_alloc(struct raid_type *raid_type, struct variable_parms *p,
 	if (!rs)
 		goto bad_alloc;
 
+	/* One stripe worker per possible cpu at most. */
+	rs->io.workers = kcalloc(num_possible_cpus(), sizeof(*rs->io.workers),
+				 GFP_KERNEL);
+	if (!rs->io.workers) {
+		kfree(rs);
+		goto bad_alloc;
+	}
+
 	rec = &rs->recover;
 	atomic_set(&rs->io.in_process, 0);
 	atomic_set(&rs->io.in_process_max, 0);
 	rec->io_size = p->recover_io_size;
 
-	/* Pointer to data array. */
-	rs->data = (unsigned long **)
-		   ((void *) rs->dev + raid_devs * sizeof(*rs->dev));
 	rec->dl = dl;
 	rs->set.raid_devs = raid_devs;
 	rs->set.data_devs = raid_devs - raid_type->parity_devs;
@@ -3642,7 +3779,7 @@ context_alloc(struct raid_type *raid_type, struct variable_parms *p,
 
 	/* Initialize io lock and queues. */
 	mutex_init(&rs->io.in_lock);
-	mutex_init(&rs->io.xor_lock);
+	init_rwsem(&rs->io.xor_lock);
 	bio_list_init(&rs->io.in);
 	bio_list_init(&rs->io.work);
 
@@ -3695,6 +3832,7 @@ bad_sc:
 	sc_exit(&rs->sc);
 	ti->error = DM_MSG_PREFIX "Error creating stripe cache";
 free_rs:
+	kfree(rs->io.workers);
 	kfree(rs);
 	return ERR_PTR(-ENOMEM);
 }
@@ -3707,18 +3845,40 @@ static void context_free(struct raid_set *rs, unsigned p)
 
 	sc_exit(&rs->sc);
 	dm_region_hash_destroy(rs->recover.rh); /* Destroys dirty log too. */
+	kfree(rs->io.workers);
 	kfree(rs);
 }
 
-/* Create work queue and initialize delayed work. */
+/* Create work queues and initialize delayed work. */
 static int rs_workqueue_init(struct raid_set *rs)
 {
+	unsigned w;
 	struct dm_target *ti = rs->ti;
 
 	rs->io.wq = create_singlethread_workqueue(DAEMON);
 	if (!rs->io.wq)
 		TI_ERR_RET("failed to create " DAEMON, -ENOMEM);
 
+	/* Unbound, so that the workers spread over all cpus. */
+	rs->io.worker_wq = alloc_workqueue(WORKER, WQ_UNBOUND | WQ_MEM_RECLAIM,
+					   num_possible_cpus());
+	if (!rs->io.worker_wq) {
+		destroy_workqueue(rs->io.wq);
+		TI_ERR_RET("failed to create " WORKER, -ENOMEM);
+	}
+
+	for (w = 0; w < num_possible_cpus(); w++) {
+		struct raid_worker *worker = rs->io.workers + w;
+
+		INIT_WORK(&worker->ws, do_stripes);
+		worker->rs = rs;
+		INIT_LIST_HEAD(&worker->stripes);
+	}
+
+	rs->io.nr_workers = num_online_cpus();
+	atomic_set(&rs->io.workers_busy, 0);
+	init_completion(&rs->io.workers_done);
+
 	INIT_DELAYED_WORK(&rs->io.dws_do_raid, do_raid);
 	INIT_WORK(&rs->io.ws_do_table_event, do_table_event);
 	return 0;
@@ -4189,6 +4349,7 @@ static void raid_dtr(struct dm_target *ti)
 	struct raid_set *rs = ti->private;
 
 	destroy_workqueue(rs->io.wq);
+	destroy_workqueue(rs->io.worker_wq);
 	context_free(rs, rs->set.raid_devs);
 }
 
@@ -4298,7 +4459,7 @@ static unsigned sc_size(struct raid_set *rs)
 static void raid_devel_stats(struct dm_target *ti, char *result,
 			     unsigned *size, unsigned maxlen)
 {
-	unsigned sz = *size;
+	unsigned sz = *size, w;
 	unsigned long j;
 	char buf[BDEVNAME_SIZE], *p;
 	struct stats_map *sm;
@@ -4318,6 +4479,20 @@ static void raid_devel_stats(struct dm_target *ti, char *result,
 		DMEMIT("%s%d", sm->str, atomic_read(rs->stats + sm->type));
 
 	DMEMIT(" checkovr=%s\n", RSCheckOverwrite(rs) ? "on" : "off");
+
+	DMEMIT("workers=%u", rs->io.nr_workers);
+	for (w = 0; w < num_possible_cpus(); w++) {
+		struct raid_worker *worker = rs->io.workers + w;
+
+		if (!atomic_read(worker->stats + W_RUNS))
+			continue;
+
+		DMEMIT(" w%u=%d/%d/%d", w,
+		       atomic_read(worker->stats + W_RUNS),
+		       atomic_read(worker->stats + W_STRIPES),
+		       atomic_read(worker->stats + W_IOS));
+	}
+	DMEMIT("\n");
 	DMEMIT("sc=%u/%u/%u/%u/%u/%u/%u\n", rs->set.chunk_size,
 	       atomic_read(&rs->sc.stripes), rs->set.io_size,
 	       rec->recovery_stripes, rec->io_size, rs->sc.hash.buckets,
@@ -4549,11 +4724,11 @@ static int xor_set(struct raid_set *rs, int argc, char **argv,
 						break;
 					}
 
-					mutex_lock(&rs->io.xor_lock);
+					down_write(&rs->io.xor_lock);
 					rs->xor.f = f;
 					rs->xor.chunks = chunks;
 					rs->xor.speed = 0;
-					mutex_unlock(&rs->io.xor_lock);
+					up_write(&rs->io.xor_lock);
 
 					if (stripe) {
 						rs->xor.speed = xor_speed(stripe);
@@ -4571,6 +4746,21 @@ static int xor_set(struct raid_set *rs, int argc, char **argv,
 	return -EINVAL;
 }
 
+/* Change the number of stripe workers. */
+static int workers_set(struct raid_set *rs, int argc, char **argv,
+		       enum raid_set_flags flag)
+{
+	int workers;
+
+	if (argc != 1 || sscanf(argv[0], "%d", &workers) != 1 ||
+	    !range_ok(workers, 1, num_possible_cpus()))
+		return -EINVAL;
+
+	/* Picked up by the next do_flush() run. */
+	rs->io.nr_workers = workers;
+	return 0;
+}
+
 /*
  * Allow writes after they got prohibited because of a device failure.
  *
@@ -4596,6 +4786,7 @@ DMINFO("%s waking", __func__);
  * "o[verwrite]  {on,of[f],r[eset]}'		# e.g. 'o of'
  * 'sta[tistics] {on,of[f],r[eset]}'		# e.g. 'stat of'
  * 'str[ipecache] {se[t],g[row],sh[rink]} #'	# e.g. 'stripe set 1024'
+ * 'wor[kers] #'				# e.g. 'workers 4'
  * 'xor algorithm #chunks'			# e.g. 'xor xor_8 5'
  *
  */
@@ -4615,6 +4806,7 @@ static int raid_message(struct dm_target *ti, unsigned argc, char **argv)
 			{ "overwrite", devel_flags, RS_CHECK_OVERWRITE },
 			{ "statistics", devel_flags, RS_DEVEL_STATS },
 			{ "stripe_cache", sc_resize, 0 },
+			{ "workers", workers_set, 0 },
 			{ "xor", xor_set, 0 },
 		}, *m = ARRAY_END(msg_descr);
 
@@ -4645,7 +4837,7 @@ static void raid_io_hints(struct dm_target *ti, struct queue_limits *limits)
 
 static struct target_type raid_target = {
 	.name = "raid45",
-	.version = {1, 0, 0},
+	.version = {1, 1, 0},
 	.module = THIS_MODULE,
 	.ctr = raid_ctr,
 	.dtr = raid_dtr,
@@ -98,6 +98,9 @@
 
 #define printk_rl(args...) ((void) (printk_ratelimit() && printk(args)))
 
+/* Shared by the stripe handling threads of all arrays. */
+static struct workqueue_struct *raid5_wq;
+
 /*
  * We maintain a biased count of active stripes in the bottom 16 bits of
  * bi_phys_segments, and a count of processed stripes in the upper 16 bits
@@ -193,6 +196,28 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+/* Queue a stripe for handling by its worker, or by raid5d if there are
+ * no workers.  device_lock is held.
+ */
+static void raid5_wakeup_stripe_thread(struct stripe_head *sh)
+{
+	raid5_conf_t *conf = sh->raid_conf;
+	struct r5worker *worker;
+
+	if (!conf->group_thread_cnt) {
+		list_add_tail(&sh->lru, &conf->handle_list);
+		md_wakeup_thread(conf->mddev->thread);
+		return;
+	}
+
+	worker = conf->workers + sh->cpu % conf->group_thread_cnt;
+	list_add_tail(&sh->lru, &worker->handle_list);
+	if (cpu_online(sh->cpu))
+		queue_work_on(sh->cpu, raid5_wq, &worker->work);
+	else
+		queue_work(raid5_wq, &worker->work);
+}
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -208,7 +233,8 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 			else {
 				clear_bit(STRIPE_DELAYED, &sh->state);
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
-				list_add_tail(&sh->lru, &conf->handle_list);
+				raid5_wakeup_stripe_thread(sh);
+				return;
 			}
 			md_wakeup_thread(conf->mddev->thread);
 		} else {
@@ -332,6 +358,7 @@ static void init_stripe(struct stripe_head *sh, sector_t sector, int previous)
 	sh->sector = sector;
 	stripe_set_idx(sector, conf, previous, sh);
 	sh->state = 0;
+	sh->cpu = smp_processor_id();
 
 
 	for (i = sh->disks; i--; ) {
@@ -3886,19 +3913,23 @@ static int chunk_aligned_read(mddev_t *mddev, struct bio * raid_bio)
  * stripe with in flight i/o.  The bypass_count will be reset when the
  * head of the hold_list has changed, i.e. the head was promoted to the
  * handle_list.
+ *
+ * @handle_list is the caller's: conf->handle_list for raid5d, or the
+ * worker's own list.  The hold_list is shared by all of them.
  */
-static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
+static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf,
+						 struct list_head *handle_list)
 {
 	struct stripe_head *sh;
 
 	pr_debug("%s: handle: %s hold: %s full_writes: %d bypass_count: %d\n",
 		  __func__,
-		  list_empty(&conf->handle_list) ? "empty" : "busy",
+		  list_empty(handle_list) ? "empty" : "busy",
 		  list_empty(&conf->hold_list) ? "empty" : "busy",
 		  atomic_read(&conf->pending_full_writes), conf->bypass_count);
 
-	if (!list_empty(&conf->handle_list)) {
-		sh = list_entry(conf->handle_list.next, typeof(*sh), lru);
+	if (!list_empty(handle_list)) {
+		sh = list_entry(handle_list->next, typeof(*sh), lru);
 
 		if (list_empty(&conf->hold_list))
 			conf->bypass_count = 0;
@@ -4512,7 +4543,7 @@ static void raid5d(mddev_t *mddev)
 			handled++;
 		}
 
-		sh = __get_priority_stripe(conf);
+		sh = __get_priority_stripe(conf, &conf->handle_list);
 
 		if (!sh)
 			break;
@@ -4535,6 +4566,81 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("--- raid5d inactive\n");
 }
 
+/*
+ * Stripe handling thread, see struct r5worker.  raid5d keeps the
+ * bitmap, delayed stripes and aligned read retries to itself.
+ */
+static void raid5_do_work(struct work_struct *work)
+{
+	struct r5worker *worker = container_of(work, struct r5worker, work);
+	raid5_conf_t *conf = worker->conf;
+	struct stripe_head *sh;
+	int handled = 0;
+	struct blk_plug plug;
+
+	blk_start_plug(&plug);
+	spin_lock_irq(&conf->device_lock);
+	while ((sh = __get_priority_stripe(conf, &worker->handle_list))) {
+		spin_unlock_irq(&conf->device_lock);
+
+		handled++;
+		handle_stripe(sh);
+		release_stripe(sh);
+		cond_resched();
+
+		spin_lock_irq(&conf->device_lock);
+	}
+	worker->runs++;
+	worker->handled += handled;
+	spin_unlock_irq(&conf->device_lock);
+
+	async_tx_issue_pending_all();
+	blk_finish_plug(&plug);
+}
+
+static struct r5worker *alloc_thread_groups(raid5_conf_t *conf, int cnt)
+{
+	struct r5worker *workers;
+	int i;
+
+	workers = kcalloc(cnt, sizeof(*workers), GFP_KERNEL);
+	if (!workers)
+		return NULL;
+	for (i = 0; i < cnt; i++) {
+		INIT_WORK(&workers[i].work, raid5_do_work);
+		workers[i].conf = conf;
+		INIT_LIST_HEAD(&workers[i].handle_list);
+	}
+	return workers;
+}
+
+/* Swap in @cnt workers.  Stripes queued to the old ones are handed to
+ * raid5d.
+ */
+static void raid5_set_thread_groups(raid5_conf_t *conf,
+				    struct r5worker *workers, int cnt)
+{
+	struct r5worker *old;
+	int i, old_cnt;
+
+	spin_lock_irq(&conf->device_lock);
+	old = conf->workers;
+	old_cnt = conf->group_thread_cnt;
+	for (i = 0; i < old_cnt; i++)
+		list_splice_tail_init(&old[i].handle_list, &conf->handle_list);
+	conf->workers = workers;
+	conf->group_thread_cnt = cnt;
+	spin_unlock_irq(&conf->device_lock);
+
+	/* Their lists are empty now, so they can't get requeued */
+	for (i = 0; i < old_cnt; i++)
+		cancel_work_sync(&old[i].work);
+	kfree(old);
+
+	if (old_cnt && conf->mddev->thread)
+		md_wakeup_thread(conf->mddev->thread);
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -4643,10 +4749,77 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%d\n", conf->group_thread_cnt);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	struct r5worker *workers = NULL;
+	unsigned long new;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > num_possible_cpus())
+		return -EINVAL;
+	if (new == conf->group_thread_cnt)
+		return len;
+
+	if (new) {
+		workers = alloc_thread_groups(conf, new);
+		if (!workers)
+			return -ENOMEM;
+	}
+	raid5_set_thread_groups(conf, workers, new);
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
+static ssize_t
+group_thread_stats_show(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	ssize_t len = 0;
+	int i;
+
+	if (!conf)
+		return 0;
+
+	spin_lock_irq(&conf->device_lock);
+	for (i = 0; i < conf->group_thread_cnt; i++)
+		len += scnprintf(page + len, PAGE_SIZE - len, "%d %lu %lu\n", i,
+				 conf->workers[i].runs,
+				 conf->workers[i].handled);
+	spin_unlock_irq(&conf->device_lock);
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_stats = __ATTR_RO(group_thread_stats);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_group_thread_cnt.attr,
+	&raid5_group_thread_stats.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4694,6 +4867,8 @@ static void raid5_free_percpu(raid5_conf_t *conf)
 
 static void free_conf(raid5_conf_t *conf)
 {
+	if (conf->group_thread_cnt)
+		raid5_set_thread_groups(conf, NULL, 0);
 	shrink_stripes(conf);
 	raid5_free_percpu(conf);
 	kfree(conf->disks);
@@ -5994,6 +6169,10 @@ static struct mdk_personality raid4_personality =
 
 static int __init raid5_init(void)
 {
+	raid5_wq = alloc_workqueue("raid5wq", WQ_NON_REENTRANT |
+				   WQ_MEM_RECLAIM | WQ_CPU_INTENSIVE, 0);
+	if (!raid5_wq)
+		return -ENOMEM;
 	register_md_personality(&raid6_personality);
 	register_md_personality(&raid5_personality);
 	register_md_personality(&raid4_personality);
@@ -6005,6 +6184,7 @@ static void raid5_exit(void)
 	unregister_md_personality(&raid6_personality);
 	unregister_md_personality(&raid5_personality);
 	unregister_md_personality(&raid4_personality);
+	destroy_workqueue(raid5_wq);
 }
 
 module_init(raid5_init);
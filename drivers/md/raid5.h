@@ -3,6 +3,7 @@
 
 #include <linux/raid/xor.h>
 #include <linux/dmaengine.h>
+#include <linux/workqueue.h>
 
 /*
  *
@@ -212,6 +213,8 @@ struct stripe_head {
 	spinlock_t		lock;
 	int			bm_seq;	/* sequence number for bitmap flushes */
 	int			disks;		/* disks in stripe */
+	int			cpu;		/* cpu that activated the stripe,
+						 * selects its worker thread */
 	enum check_states	check_state;
 	enum reconstruct_states reconstruct_state;
 	/**
@@ -373,6 +376,11 @@ struct raid5_private_data {
 
 	struct list_head	handle_list; /* stripes needing handling */
 	struct list_head	hold_list; /* preread ready stripes */
+	struct r5worker		*workers; /* stripe handling threads, which
+					   * take over the handle_list from
+					   * raid5d when group_thread_cnt
+					   * is set */
+	int			group_thread_cnt;
 	struct list_head	delayed_list; /* stripes that have plugged requests */
 	struct list_head	bitmap_list; /* stripes delaying awaiting bitmap update */
 	struct bio		*retry_read_aligned; /* currently retrying aligned bios   */
@@ -439,6 +447,18 @@ struct raid5_private_data {
 
 typedef struct raid5_private_data raid5_conf_t;
 
+/*
+ * Stripe handling thread.  Stripes activated on cpu N are handled by
+ * worker N % group_thread_cnt, on one of the cpus of that set.
+ */
+struct r5worker {
+	struct work_struct	work;
+	raid5_conf_t		*conf;
+	struct list_head	handle_list; /* stripes needing handling */
+	unsigned long		runs;	     /* stats, under device_lock */
+	unsigned long		handled;
+};
+
 /*
  * Our supported algorithms
  */
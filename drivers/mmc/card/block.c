@@ -80,6 +80,16 @@ static DECLARE_BITMAP(name_use, 256);
 /*
  * There is one mmc_blk_data per slot.
  */
+/* Why a packed write did not take in more requests */
+enum mmc_blk_packed_stop {
+	MMC_BLK_PACKED_STOP_EMPTY,	/* nothing else queued */
+	MMC_BLK_PACKED_STOP_COUNT,	/* packed_max_count reached */
+	MMC_BLK_PACKED_STOP_SIZE,	/* packed_max_sectors reached */
+	MMC_BLK_PACKED_STOP_SEGS,	/* out of sg entries */
+	MMC_BLK_PACKED_STOP_TYPE,	/* next is a read, flush, discard */
+	MMC_BLK_PACKED_STOP_NR,
+};
+
 struct mmc_blk_data {
 	spinlock_t	lock;
 	struct gendisk	*disk;
@@ -89,6 +99,7 @@ struct mmc_blk_data {
 	unsigned int	flags;
 #define MMC_BLK_CMD23	(1 << 0)	/* Can do SET_BLOCK_COUNT for multiblock */
 #define MMC_BLK_REL_WR	(1 << 1)	/* MMC Reliable write support */
+#define MMC_BLK_PACKED_CMD	(1 << 2)	/* MMC packed write support */
 
 	unsigned int	usage;
 	unsigned int	read_only;
@@ -102,6 +113,16 @@ struct mmc_blk_data {
 	 */
 	unsigned int	part_curr;
 	struct device_attribute force_ro;
+
+	/* Packed writes, see mmc_blk_prep_packed_list() */
+	unsigned int	packed_max_count;	/* entries per packed write */
+	unsigned int	packed_max_sectors;	/* data per packed write */
+	struct mmc_blk_packed_stats {
+		unsigned long	cmds;		/* packed writes issued */
+		unsigned long	reqs;		/* requests they carried */
+		unsigned long	fails;		/* ... that reported a failure */
+		unsigned long	stop[MMC_BLK_PACKED_STOP_NR];
+	} packed_stats;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -182,6 +203,120 @@ out:
 	return ret;
 }
 
+static ssize_t packed_max_count_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	int ret;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	ret = snprintf(buf, PAGE_SIZE, "%u\n", md->packed_max_count);
+	mmc_blk_put(md);
+	return ret;
+}
+
+/* 0 or 1 turns packing off */
+static ssize_t packed_max_count_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	int ret;
+	char *end;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	unsigned long set = simple_strtoul(buf, &end, 0);
+	if (end == buf) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	md->packed_max_count = min_t(unsigned long, set,
+		min_t(unsigned int, md->queue.card->ext_csd.max_packed_writes,
+		      PACKED_CMD_MAX_ENTRIES));
+	ret = count;
+out:
+	mmc_blk_put(md);
+	return ret;
+}
+
+static DEVICE_ATTR(packed_max_count, S_IRUGO | S_IWUSR,
+		   packed_max_count_show, packed_max_count_store);
+
+static ssize_t packed_max_sectors_show(struct device *dev,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	int ret;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	ret = snprintf(buf, PAGE_SIZE, "%u\n", md->packed_max_sectors);
+	mmc_blk_put(md);
+	return ret;
+}
+
+static unsigned int mmc_blk_packed_hw_max_sectors(struct mmc_card *card)
+{
+	/* CMD23 carries a 16-bit block count, header included */
+	return min3(card->host->max_blk_count,
+		    card->host->max_req_size >> 9, 0xffffu) - 1;
+}
+
+static ssize_t packed_max_sectors_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	int ret;
+	char *end;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	unsigned long set = simple_strtoul(buf, &end, 0);
+	if (end == buf) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	md->packed_max_sectors = min_t(unsigned long, set,
+		mmc_blk_packed_hw_max_sectors(md->queue.card));
+	ret = count;
+out:
+	mmc_blk_put(md);
+	return ret;
+}
+
+static DEVICE_ATTR(packed_max_sectors, S_IRUGO | S_IWUSR,
+		   packed_max_sectors_show, packed_max_sectors_store);
+
+static ssize_t packed_stats_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	int ret;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_blk_packed_stats *st = &md->packed_stats;
+
+	ret = snprintf(buf, PAGE_SIZE,
+		       "cmds %lu\nreqs %lu\nfails %lu\n"
+		       "stop_empty %lu\nstop_count %lu\nstop_size %lu\n"
+		       "stop_segs %lu\nstop_type %lu\n",
+		       st->cmds, st->reqs, st->fails,
+		       st->stop[MMC_BLK_PACKED_STOP_EMPTY],
+		       st->stop[MMC_BLK_PACKED_STOP_COUNT],
+		       st->stop[MMC_BLK_PACKED_STOP_SIZE],
+		       st->stop[MMC_BLK_PACKED_STOP_SEGS],
+		       st->stop[MMC_BLK_PACKED_STOP_TYPE]);
+	mmc_blk_put(md);
+	return ret;
+}
+
+static DEVICE_ATTR(packed_stats, S_IRUGO, packed_stats_show, NULL);
+
+static struct attribute *mmc_blk_packed_attrs[] = {
+	&dev_attr_packed_max_count.attr,
+	&dev_attr_packed_max_sectors.attr,
+	&dev_attr_packed_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group mmc_blk_packed_attr_group = {
+	.attrs = mmc_blk_packed_attrs,
+};
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -435,14 +570,6 @@ static const struct block_device_operations mmc_bdops = {
 #endif
 };
 
-struct mmc_blk_request {
-	struct mmc_request	mrq;
-	struct mmc_command	sbc;
-	struct mmc_command	cmd;
-	struct mmc_command	stop;
-	struct mmc_data		data;
-};
-
 static inline int mmc_blk_part_switch(struct mmc_card *card,
 				      struct mmc_blk_data *md)
 {
@@ -677,240 +804,654 @@ static inline void mmc_apply_rel_rw(struct mmc_blk_request *brq,
 	}
 }
 
-static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
+static inline bool mmc_req_rel_wr(struct request *req)
 {
+	return ((req->cmd_flags & REQ_FUA) ||
+		(req->cmd_flags & REQ_META)) &&
+		(rq_data_dir(req) == WRITE);
+}
+
+enum mmc_blk_status {
+	MMC_BLK_SUCCESS = 0,
+	MMC_BLK_PARTIAL,
+	MMC_BLK_RETRY_SINGLE,
+	MMC_BLK_CMD_ERR,
+	MMC_BLK_DATA_ERR,
+};
+
+/*
+ * Called by mmc_start_req() once the request has left the bus, before
+ * the next one is started, so the card may still be polled here.
+ */
+static int mmc_blk_err_check(struct mmc_card *card,
+			     struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_mrq = container_of(areq, struct mmc_queue_req,
+						    mmc_active);
+	struct mmc_blk_request *brq = &mq_mrq->brq;
+	struct request *req = mq_mrq->req;
+	u32 status = 0;
+
+	/*
+	 * Check for errors here, but don't jump to cmd_err
+	 * until later as we need to wait for the card to leave
+	 * programming mode even when things go wrong.
+	 */
+	if (brq->sbc.error || brq->cmd.error ||
+	    brq->data.error || brq->stop.error) {
+		if (brq->data.blocks > 1 && rq_data_dir(req) == READ) {
+			/* Redo read one sector at a time */
+			printk(KERN_WARNING "%s: retrying using single "
+			       "block read\n", req->rq_disk->disk_name);
+			return MMC_BLK_RETRY_SINGLE;
+		}
+		status = get_card_status(card, req);
+	}
+
+	if (brq->sbc.error) {
+		printk(KERN_ERR "%s: error %d sending SET_BLOCK_COUNT "
+		       "command, response %#x, card status %#x\n",
+		       req->rq_disk->disk_name, brq->sbc.error,
+		       brq->sbc.resp[0], status);
+	}
+
+	if (brq->cmd.error) {
+		printk(KERN_ERR "%s: error %d sending read/write "
+		       "command, response %#x, card status %#x\n",
+		       req->rq_disk->disk_name, brq->cmd.error,
+		       brq->cmd.resp[0], status);
+	}
+
+	if (brq->data.error) {
+		if (brq->data.error == -ETIMEDOUT && brq->mrq.stop)
+			/* 'Stop' response contains card status */
+			status = brq->mrq.stop->resp[0];
+		printk(KERN_ERR "%s: error %d transferring data,"
+		       " sector %u, nr %u, card status %#x\n",
+		       req->rq_disk->disk_name, brq->data.error,
+		       (unsigned)blk_rq_pos(req),
+		       (unsigned)blk_rq_sectors(req), status);
+	}
+
+	if (brq->stop.error) {
+		printk(KERN_ERR "%s: error %d sending stop command, "
+		       "response %#x, card status %#x\n",
+		       req->rq_disk->disk_name, brq->stop.error,
+		       brq->stop.resp[0], status);
+	}
+
+	if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
+		struct mmc_command cmd = {0};
+
+		do {
+			int err;
+
+			cmd.opcode = MMC_SEND_STATUS;
+			cmd.arg = card->rca << 16;
+			cmd.flags = MMC_RSP_R1 | MMC_CMD_AC;
+			err = mmc_wait_for_cmd(card->host, &cmd, 5);
+			if (err) {
+				printk(KERN_ERR "%s: error %d requesting status\n",
+				       req->rq_disk->disk_name, err);
+				return MMC_BLK_CMD_ERR;
+			}
+			/*
+			 * Some cards mishandle the status bits,
+			 * so make sure to check both the busy
+			 * indication and the card state.
+			 */
+		} while (!(cmd.resp[0] & R1_READY_FOR_DATA) ||
+			(R1_CURRENT_STATE(cmd.resp[0]) == 7));
+
+#if 0
+		if (cmd.resp[0] & ~0x00000900)
+			printk(KERN_ERR "%s: status = %08x\n",
+			       req->rq_disk->disk_name, cmd.resp[0]);
+		if (mmc_decode_status(cmd.resp))
+			return MMC_BLK_CMD_ERR;
+#endif
+	}
+
+	if (brq->cmd.error || brq->stop.error || brq->data.error) {
+		if (rq_data_dir(req) == READ)
+			return MMC_BLK_DATA_ERR;
+		else
+			return MMC_BLK_CMD_ERR;
+	}
+
+	if (blk_rq_bytes(req) != brq->data.bytes_xfered)
+		return MMC_BLK_PARTIAL;
+
+	return MMC_BLK_SUCCESS;
+}
+
+static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
+			       struct mmc_card *card,
+			       int disable_multi,
+			       struct mmc_queue *mq)
+{
+	u32 readcmd, writecmd;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
 	struct mmc_blk_data *md = mq->data;
-	struct mmc_card *card = md->queue.card;
-	struct mmc_blk_request brq;
-	int ret = 1, disable_multi = 0;
 
 	/*
 	 * Reliable writes are used to implement Forced Unit Access and
 	 * REQ_META accesses, and are supported only on MMCs.
 	 */
-	bool do_rel_wr = ((req->cmd_flags & REQ_FUA) ||
-			  (req->cmd_flags & REQ_META)) &&
-		(rq_data_dir(req) == WRITE) &&
+	bool do_rel_wr = mmc_req_rel_wr(req) &&
 		(md->flags & MMC_BLK_REL_WR);
 
-	do {
-		struct mmc_command cmd = {0};
-		u32 readcmd, writecmd, status = 0;
-
-		memset(&brq, 0, sizeof(struct mmc_blk_request));
-		brq.mrq.cmd = &brq.cmd;
-		brq.mrq.data = &brq.data;
-
-		brq.cmd.arg = blk_rq_pos(req);
-		if (!mmc_card_blockaddr(card))
-			brq.cmd.arg <<= 9;
-		brq.cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
-		brq.data.blksz = 512;
-		brq.stop.opcode = MMC_STOP_TRANSMISSION;
-		brq.stop.arg = 0;
-		brq.stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
-		brq.data.blocks = blk_rq_sectors(req);
-
-		/*
-		 * The block layer doesn't support all sector count
-		 * restrictions, so we need to be prepared for too big
-		 * requests.
-		 */
-		if (brq.data.blocks > card->host->max_blk_count)
-			brq.data.blocks = card->host->max_blk_count;
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
 
-		/*
-		 * After a read error, we redo the request one sector at a time
-		 * in order to accurately determine which sectors can be read
-		 * successfully.
-		 */
-		if (disable_multi && brq.data.blocks > 1)
-			brq.data.blocks = 1;
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->data.blksz = 512;
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+	brq->data.blocks = blk_rq_sectors(req);
 
-		if (brq.data.blocks > 1 || do_rel_wr) {
-			/* SPI multiblock writes terminate using a special
-			 * token, not a STOP_TRANSMISSION request.
-			 */
-			if (!mmc_host_is_spi(card->host) ||
-			    rq_data_dir(req) == READ)
-				brq.mrq.stop = &brq.stop;
-			readcmd = MMC_READ_MULTIPLE_BLOCK;
-			writecmd = MMC_WRITE_MULTIPLE_BLOCK;
-		} else {
-			brq.mrq.stop = NULL;
-			readcmd = MMC_READ_SINGLE_BLOCK;
-			writecmd = MMC_WRITE_BLOCK;
-		}
-		if (rq_data_dir(req) == READ) {
-			brq.cmd.opcode = readcmd;
-			brq.data.flags |= MMC_DATA_READ;
-		} else {
-			brq.cmd.opcode = writecmd;
-			brq.data.flags |= MMC_DATA_WRITE;
-		}
+	/*
+	 * The block layer doesn't support all sector count
+	 * restrictions, so we need to be prepared for too big
+	 * requests.
+	 */
+	if (brq->data.blocks > card->host->max_blk_count)
+		brq->data.blocks = card->host->max_blk_count;
 
-		if (do_rel_wr)
-			mmc_apply_rel_rw(&brq, card, req);
+	/*
+	 * After a read error, we redo the request one sector at a time
+	 * in order to accurately determine which sectors can be read
+	 * successfully.
+	 */
+	if (disable_multi && brq->data.blocks > 1)
+		brq->data.blocks = 1;
 
-		/*
-		 * Pre-defined multi-block transfers are preferable to
-		 * open ended-ones (and necessary for reliable writes).
-		 * However, it is not sufficient to just send CMD23,
-		 * and avoid the final CMD12, as on an error condition
-		 * CMD12 (stop) needs to be sent anyway. This, coupled
-		 * with Auto-CMD23 enhancements provided by some
-		 * hosts, means that the complexity of dealing
-		 * with this is best left to the host. If CMD23 is
-		 * supported by card and host, we'll fill sbc in and let
-		 * the host deal with handling it correctly. This means
-		 * that for hosts that don't expose MMC_CAP_CMD23, no
-		 * change of behavior will be observed.
-		 *
-		 * N.B: Some MMC cards experience perf degradation.
-		 * We'll avoid using CMD23-bounded multiblock writes for
-		 * these, while retaining features like reliable writes.
+	if (brq->data.blocks > 1 || do_rel_wr) {
+		/* SPI multiblock writes terminate using a special
+		 * token, not a STOP_TRANSMISSION request.
 		 */
+		if (!mmc_host_is_spi(card->host) ||
+		    rq_data_dir(req) == READ)
+			brq->mrq.stop = &brq->stop;
+		readcmd = MMC_READ_MULTIPLE_BLOCK;
+		writecmd = MMC_WRITE_MULTIPLE_BLOCK;
+	} else {
+		brq->mrq.stop = NULL;
+		readcmd = MMC_READ_SINGLE_BLOCK;
+		writecmd = MMC_WRITE_BLOCK;
+	}
+	if (rq_data_dir(req) == READ) {
+		brq->cmd.opcode = readcmd;
+		brq->data.flags |= MMC_DATA_READ;
+	} else {
+		brq->cmd.opcode = writecmd;
+		brq->data.flags |= MMC_DATA_WRITE;
+	}
 
-		if ((md->flags & MMC_BLK_CMD23) &&
-		    mmc_op_multi(brq.cmd.opcode) &&
-		    (do_rel_wr || !(card->quirks & MMC_QUIRK_BLK_NO_CMD23))) {
-			brq.sbc.opcode = MMC_SET_BLOCK_COUNT;
-			brq.sbc.arg = brq.data.blocks |
-				(do_rel_wr ? (1 << 31) : 0);
-			brq.sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
-			brq.mrq.sbc = &brq.sbc;
-		}
+	if (do_rel_wr)
+		mmc_apply_rel_rw(brq, card, req);
 
-		mmc_set_data_timeout(&brq.data, card);
+	/*
+	 * Pre-defined multi-block transfers are preferable to
+	 * open ended-ones (and necessary for reliable writes).
+	 * However, it is not sufficient to just send CMD23,
+	 * and avoid the final CMD12, as on an error condition
+	 * CMD12 (stop) needs to be sent anyway. This, coupled
+	 * with Auto-CMD23 enhancements provided by some
+	 * hosts, means that the complexity of dealing
+	 * with this is best left to the host. If CMD23 is
+	 * supported by card and host, we'll fill sbc in and let
+	 * the host deal with handling it correctly. This means
+	 * that for hosts that don't expose MMC_CAP_CMD23, no
+	 * change of behavior will be observed.
+	 *
+	 * N.B: Some MMC cards experience perf degradation.
+	 * We'll avoid using CMD23-bounded multiblock writes for
+	 * these, while retaining features like reliable writes.
+	 */
 
-		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+	if ((md->flags & MMC_BLK_CMD23) &&
+	    mmc_op_multi(brq->cmd.opcode) &&
+	    (do_rel_wr || !(card->quirks & MMC_QUIRK_BLK_NO_CMD23))) {
+		brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+		brq->sbc.arg = brq->data.blocks |
+			(do_rel_wr ? (1 << 31) : 0);
+		brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+		brq->mrq.sbc = &brq->sbc;
+	}
 
-		/*
-		 * Adjust the sg list so it is the same size as the
-		 * request.
-		 */
-		if (brq.data.blocks != blk_rq_sectors(req)) {
-			int i, data_size = brq.data.blocks << 9;
-			struct scatterlist *sg;
-
-			for_each_sg(brq.data.sg, sg, brq.data.sg_len, i) {
-				data_size -= sg->length;
-				if (data_size <= 0) {
-					sg->length += data_size;
-					i++;
-					break;
-				}
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	/*
+	 * Adjust the sg list so it is the same size as the
+	 * request.
+	 */
+	if (brq->data.blocks != blk_rq_sectors(req)) {
+		int i, data_size = brq->data.blocks << 9;
+		struct scatterlist *sg;
+
+		for_each_sg(brq->data.sg, sg, brq->data.sg_len, i) {
+			data_size -= sg->length;
+			if (data_size <= 0) {
+				sg->length += data_size;
+				i++;
+				break;
 			}
-			brq.data.sg_len = i;
 		}
+		brq->data.sg_len = i;
+	}
 
-		mmc_queue_bounce_pre(mq);
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_err_check;
 
-		mmc_wait_for_req(card->host, &brq.mrq);
+	mmc_queue_bounce_pre(mqrq);
+}
 
-		mmc_queue_bounce_post(mq);
+static void mmc_blk_clear_packed(struct mmc_queue_req *mqrq)
+{
+	mqrq->cmd_type = MMC_PACKED_NONE;
+	mqrq->packed_num = 0;
+	mqrq->packed_blocks = 0;
+	mqrq->packed_retries = 0;
+	mqrq->packed_fail_idx = -1;
+}
 
-		/*
-		 * Check for errors here, but don't jump to cmd_err
-		 * until later as we need to wait for the card to leave
-		 * programming mode even when things go wrong.
-		 */
-		if (brq.sbc.error || brq.cmd.error ||
-		    brq.data.error || brq.stop.error) {
-			if (brq.data.blocks > 1 && rq_data_dir(req) == READ) {
-				/* Redo read one sector at a time */
-				printk(KERN_WARNING "%s: retrying using single "
-				       "block read\n", req->rq_disk->disk_name);
-				disable_multi = 1;
-				continue;
-			}
-			status = get_card_status(card, req);
+/*
+ * Pull more writes off the queue to go out with @req in one packed
+ * write. Each one saves a command round trip and a busy wait, which is
+ * most of the cost of the small synchronous writes databases issue.
+ * Returns the number of requests packed, or 0 if @req goes on its own.
+ */
+static unsigned int mmc_blk_prep_packed_list(struct mmc_queue *mq,
+					     struct request *req)
+{
+	struct request_queue *q = mq->queue;
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct request *next = NULL;
+	bool en_rel_wr = card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN;
+	unsigned int reqs = 1, sectors, segs, max_segs;
+	enum mmc_blk_packed_stop stop;
+
+	mmc_blk_clear_packed(mqrq);
+
+	if (!(md->flags & MMC_BLK_PACKED_CMD) || rq_data_dir(req) != WRITE ||
+	    md->packed_max_count < 2)
+		return 0;
+
+	/* Entries are reliable only with enhanced reliable write */
+	if (mmc_req_rel_wr(req) && (md->flags & MMC_BLK_REL_WR) && !en_rel_wr)
+		return 0;
+
+	/* The header takes a block and an sg entry */
+	sectors = blk_rq_sectors(req);
+	segs = req->nr_phys_segments + 1;
+	max_segs = queue_max_segments(q);
+
+	do {
+		if (reqs >= md->packed_max_count) {
+			stop = MMC_BLK_PACKED_STOP_COUNT;
+			break;
 		}
 
-		if (brq.sbc.error) {
-			printk(KERN_ERR "%s: error %d sending SET_BLOCK_COUNT "
-			       "command, response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.sbc.error,
-			       brq.sbc.resp[0], status);
+		spin_lock_irq(q->queue_lock);
+		next = blk_fetch_request(q);
+		spin_unlock_irq(q->queue_lock);
+		if (!next) {
+			stop = MMC_BLK_PACKED_STOP_EMPTY;
+			break;
 		}
 
-		if (brq.cmd.error) {
-			printk(KERN_ERR "%s: error %d sending read/write "
-			       "command, response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.cmd.error,
-			       brq.cmd.resp[0], status);
+		if ((next->cmd_flags & (REQ_DISCARD | REQ_FLUSH)) ||
+		    rq_data_dir(next) != WRITE ||
+		    (mmc_req_rel_wr(next) && (md->flags & MMC_BLK_REL_WR) &&
+		     !en_rel_wr)) {
+			stop = MMC_BLK_PACKED_STOP_TYPE;
+			break;
 		}
 
-		if (brq.data.error) {
-			if (brq.data.error == -ETIMEDOUT && brq.mrq.stop)
-				/* 'Stop' response contains card status */
-				status = brq.mrq.stop->resp[0];
-			printk(KERN_ERR "%s: error %d transferring data,"
-			       " sector %u, nr %u, card status %#x\n",
-			       req->rq_disk->disk_name, brq.data.error,
-			       (unsigned)blk_rq_pos(req),
-			       (unsigned)blk_rq_sectors(req), status);
+		if (sectors + blk_rq_sectors(next) > md->packed_max_sectors) {
+			stop = MMC_BLK_PACKED_STOP_SIZE;
+			break;
 		}
 
-		if (brq.stop.error) {
-			printk(KERN_ERR "%s: error %d sending stop command, "
-			       "response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.stop.error,
-			       brq.stop.resp[0], status);
+		if (segs + next->nr_phys_segments > max_segs) {
+			stop = MMC_BLK_PACKED_STOP_SEGS;
+			break;
 		}
 
-		if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
-			do {
-				int err;
-
-				cmd.opcode = MMC_SEND_STATUS;
-				cmd.arg = card->rca << 16;
-				cmd.flags = MMC_RSP_R1 | MMC_CMD_AC;
-				err = mmc_wait_for_cmd(card->host, &cmd, 5);
-				if (err) {
-					printk(KERN_ERR "%s: error %d requesting status\n",
-					       req->rq_disk->disk_name, err);
-					goto cmd_err;
-				}
-				/*
-				 * Some cards mishandle the status bits,
-				 * so make sure to check both the busy
-				 * indication and the card state.
-				 */
-			} while (!(cmd.resp[0] & R1_READY_FOR_DATA) ||
-				(R1_CURRENT_STATE(cmd.resp[0]) == 7));
+		sectors += blk_rq_sectors(next);
+		segs += next->nr_phys_segments;
+		list_add_tail(&next->queuelist, &mqrq->packed_list);
+		next = NULL;
+		reqs++;
+	} while (1);
+
+	/* Put back the request that did not fit */
+	if (next) {
+		spin_lock_irq(q->queue_lock);
+		blk_requeue_request(q, next);
+		spin_unlock_irq(q->queue_lock);
+	}
 
-#if 0
-			if (cmd.resp[0] & ~0x00000900)
-				printk(KERN_ERR "%s: status = %08x\n",
-				       req->rq_disk->disk_name, cmd.resp[0]);
-			if (mmc_decode_status(cmd.resp))
-				goto cmd_err;
-#endif
+	if (reqs < 2)
+		return 0;
+
+	md->packed_stats.cmds++;
+	md->packed_stats.reqs += reqs;
+	md->packed_stats.stop[stop]++;
+
+	list_add(&req->queuelist, &mqrq->packed_list);
+	mqrq->cmd_type = MMC_PACKED_WRITE;
+	mqrq->packed_num = reqs;
+	mqrq->packed_retries = reqs;
+	return reqs;
+}
+
+/*
+ * On top of the usual checks, find out from EXT_CSD which entry of a
+ * failed packed write went wrong; the ones before it were written.
+ */
+static int mmc_blk_packed_err_check(struct mmc_card *card,
+				    struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_rq = container_of(areq, struct mmc_queue_req,
+						   mmc_active);
+	struct mmc_blk_request *brq = &mq_rq->brq;
+	struct request *req = mq_rq->req;
+	struct mmc_blk_data *md = req->rq_disk->private_data;
+	int check, err;
+	u32 status;
+	u8 *ext_csd;
+
+	mq_rq->packed_retries--;
+	check = mmc_blk_err_check(card, areq);
+
+	/* mmc_blk_err_check() measures against the first request only */
+	if (check == MMC_BLK_PARTIAL) {
+		if (brq->data.bytes_xfered ==
+		    brq->data.blocks * brq->data.blksz)
+			return MMC_BLK_SUCCESS;
+		check = MMC_BLK_CMD_ERR;
+	}
+
+	status = get_card_status(card, req);
+	if (!(status & R1_EXCEPTION_EVENT))
+		return check;
+
+	ext_csd = kzalloc(512, GFP_KERNEL);
+	if (!ext_csd)
+		return MMC_BLK_CMD_ERR;
+
+	err = mmc_send_ext_csd(card, ext_csd);
+	if (err) {
+		printk(KERN_ERR "%s: error %d sending ext_csd\n",
+		       req->rq_disk->disk_name, err);
+		check = MMC_BLK_CMD_ERR;
+		goto out;
+	}
+
+	if ((ext_csd[EXT_CSD_EXP_EVENTS_STATUS] & EXT_CSD_PACKED_FAILURE) &&
+	    (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+	     EXT_CSD_PACKED_GENERIC_ERROR)) {
+		md->packed_stats.fails++;
+		/* The index is 1-based */
+		if ((ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+		     EXT_CSD_PACKED_INDEXED_ERROR) &&
+		    ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] >= 1 &&
+		    ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] <=
+		    mq_rq->packed_num) {
+			mq_rq->packed_fail_idx =
+				ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] - 1;
+			check = MMC_BLK_PARTIAL;
+		} else if (check == MMC_BLK_SUCCESS) {
+			check = MMC_BLK_CMD_ERR;
 		}
+		printk(KERN_ERR "%s: packed write failed, nr %u, sectors %u, "
+		       "failure index %d\n", req->rq_disk->disk_name,
+		       mq_rq->packed_num, mq_rq->packed_blocks,
+		       mq_rq->packed_fail_idx);
+	}
+out:
+	kfree(ext_csd);
+	return check;
+}
 
-		if (brq.cmd.error || brq.stop.error || brq.data.error) {
-			if (rq_data_dir(req) == READ) {
+static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
+					struct mmc_card *card,
+					struct mmc_queue *mq)
+{
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+	struct request *prq;
+	struct mmc_blk_data *md = mq->data;
+	__le32 *hdr = mqrq->packed_cmd_hdr;
+	bool do_rel_wr;
+	int i = 1;
+
+	memset(hdr, 0, PACKED_CMD_HDR_WORDS * sizeof(*hdr));
+	hdr[0] = cpu_to_le32((mqrq->packed_num << 16) |
+			     (PACKED_CMD_WR << 8) | PACKED_CMD_VER);
+
+	mqrq->packed_blocks = 0;
+	list_for_each_entry(prq, &mqrq->packed_list, queuelist) {
+		do_rel_wr = mmc_req_rel_wr(prq) && (md->flags & MMC_BLK_REL_WR);
+		/* Argument of CMD23 */
+		hdr[i * 2] = cpu_to_le32(blk_rq_sectors(prq) |
+				(do_rel_wr ? MMC_CMD23_ARG_REL_WR : 0));
+		/* Argument of CMD25 */
+		hdr[i * 2 + 1] = cpu_to_le32(mmc_card_blockaddr(card) ?
+				blk_rq_pos(prq) : blk_rq_pos(prq) << 9);
+		mqrq->packed_blocks += blk_rq_sectors(prq);
+		i++;
+	}
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+	brq->mrq.sbc = &brq->sbc;
+	brq->mrq.stop = &brq->stop;
+
+	brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+	brq->sbc.arg = MMC_CMD23_ARG_PACKED | (mqrq->packed_blocks + 1);
+	brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	brq->cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	brq->data.blksz = 512;
+	brq->data.blocks = mqrq->packed_blocks + 1;
+	brq->data.flags |= MMC_DATA_WRITE;
+
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_packed_map_sg(mq, mqrq);
+
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_packed_err_check;
+}
+
+/*
+ * Complete the entries of a packed write up to the failed one, if any.
+ * Returns 1 if entries are left to be sent again.
+ */
+static int mmc_blk_end_packed_req(struct mmc_blk_data *md,
+				  struct mmc_queue_req *mq_rq)
+{
+	struct request *prq;
+	int idx = mq_rq->packed_fail_idx, i = 0;
+
+	while (!list_empty(&mq_rq->packed_list)) {
+		prq = list_entry_rq(mq_rq->packed_list.next);
+		if (idx == i) {
+			/* retry from error index */
+			mq_rq->packed_num -= idx;
+			mq_rq->packed_fail_idx = -1;
+			mq_rq->req = prq;
+
+			if (mq_rq->packed_num == 1) {
+				list_del_init(&prq->queuelist);
+				mmc_blk_clear_packed(mq_rq);
+			}
+			return 1;
+		}
+		list_del_init(&prq->queuelist);
+		spin_lock_irq(&md->lock);
+		__blk_end_request(prq, 0, blk_rq_bytes(prq));
+		spin_unlock_irq(&md->lock);
+		i++;
+	}
+
+	mmc_blk_clear_packed(mq_rq);
+	return 0;
+}
+
+static void mmc_blk_abort_packed_req(struct mmc_blk_data *md,
+				     struct mmc_queue_req *mq_rq)
+{
+	struct request *prq;
+
+	while (!list_empty(&mq_rq->packed_list)) {
+		prq = list_entry_rq(mq_rq->packed_list.next);
+		list_del_init(&prq->queuelist);
+		spin_lock_irq(&md->lock);
+		__blk_end_request(prq, -EIO, blk_rq_bytes(prq));
+		spin_unlock_irq(&md->lock);
+	}
+
+	mmc_blk_clear_packed(mq_rq);
+}
+
+static void mmc_blk_rq_prep(struct mmc_queue_req *mqrq,
+			    struct mmc_card *card, int disable_multi,
+			    struct mmc_queue *mq)
+{
+	if (mqrq->cmd_type == MMC_PACKED_WRITE)
+		mmc_blk_packed_hdr_wrq_prep(mqrq, card, mq);
+	else
+		mmc_blk_rw_rq_prep(mqrq, card, disable_multi, mq);
+}
+
+/*
+ * Start @rqc, if any, and complete the request that was on the bus
+ * before it. @rqc is prepared while the previous request is still
+ * transferring and goes out as soon as that one has been checked, so
+ * the host never idles between the two. Called with a NULL @rqc to
+ * drain the pipeline.
+ */
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_request *brq = &mq->mqrq_cur->brq;
+	int ret = 1, disable_multi = 0;
+	int status;
+	struct mmc_queue_req *mq_rq;
+	struct request *req;
+	struct mmc_async_req *areq;
+
+	if (!rqc && !mq->mqrq_prev->req)
+		return 0;
+
+	if (rqc)
+		mmc_blk_prep_packed_list(mq, rqc);
+
+	do {
+		if (rqc) {
+			mmc_blk_rq_prep(mq->mqrq_cur, card, 0, mq);
+			areq = &mq->mqrq_cur->mmc_active;
+		} else
+			areq = NULL;
+		areq = mmc_start_req(card->host, areq, &status);
+		if (!areq)
+			return 0;
+
+		mq_rq = container_of(areq, struct mmc_queue_req, mmc_active);
+		brq = &mq_rq->brq;
+		req = mq_rq->req;
+		mmc_queue_bounce_post(mq_rq);
+
+		switch (status) {
+		case MMC_BLK_SUCCESS:
+		case MMC_BLK_PARTIAL:
+			if (mq_rq->cmd_type == MMC_PACKED_WRITE) {
+				ret = mmc_blk_end_packed_req(md, mq_rq);
+				break;
+			}
+			/*
+			 * A block was successfully transferred.
+			 */
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, 0,
+						brq->data.bytes_xfered);
+			spin_unlock_irq(&md->lock);
+			if (status == MMC_BLK_SUCCESS && ret) {
 				/*
-				 * After an error, we redo I/O one sector at a
-				 * time, so we only reach here after trying to
-				 * read a single sector.
+				 * blk_end_request has returned non zero
+				 * even though all data was transferred
+				 * and the host reported no error.
 				 */
-				spin_lock_irq(&md->lock);
-				ret = __blk_end_request(req, -EIO, brq.data.blksz);
-				spin_unlock_irq(&md->lock);
-				continue;
+				printk(KERN_ERR "%s BUG rq_tot %d d_xfer %d\n",
+				       __func__, blk_rq_bytes(req),
+				       brq->data.bytes_xfered);
+				rqc = NULL;
+				goto cmd_abort;
+			}
+			break;
+		case MMC_BLK_CMD_ERR:
+			/* Send a failed packed write again as a whole */
+			if (mq_rq->cmd_type == MMC_PACKED_WRITE) {
+				ret = 1;
+				break;
 			}
 			goto cmd_err;
+		case MMC_BLK_RETRY_SINGLE:
+			disable_multi = 1;
+			break;
+		case MMC_BLK_DATA_ERR:
+			/*
+			 * After an error, we redo I/O one sector at a
+			 * time, so we only reach here after trying to
+			 * read a single sector.
+			 */
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, -EIO,
+						brq->data.blksz);
+			spin_unlock_irq(&md->lock);
+			if (!ret)
+				goto start_new_req;
+			break;
 		}
 
-		/*
-		 * A block was successfully transferred.
-		 */
-		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
-		spin_unlock_irq(&md->lock);
+		if (ret) {
+			/*
+			 * In case of a incomplete request
+			 * prepare it again and resend.
+			 */
+			if (mq_rq->cmd_type == MMC_PACKED_WRITE &&
+			    !mq_rq->packed_retries)
+				goto cmd_abort;
+			mmc_blk_rq_prep(mq_rq, card, disable_multi, mq);
+			mmc_start_req(card->host, &mq_rq->mmc_active, NULL);
+		}
 	} while (ret);
 
 	return 1;
@@ -935,14 +1476,27 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		}
 	} else {
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	}
 
-	spin_lock_irq(&md->lock);
-	while (ret)
-		ret = __blk_end_request(req, -EIO, blk_rq_cur_bytes(req));
-	spin_unlock_irq(&md->lock);
+ cmd_abort:
+	if (mq_rq->cmd_type == MMC_PACKED_WRITE) {
+		mmc_blk_abort_packed_req(md, mq_rq);
+	} else {
+		spin_lock_irq(&md->lock);
+		while (ret)
+			ret = __blk_end_request(req, -EIO,
+						blk_rq_cur_bytes(req));
+		spin_unlock_irq(&md->lock);
+	}
+
+ start_new_req:
+	/* The failed request held back @rqc; send it on its way now */
+	if (rqc) {
+		mmc_blk_rq_prep(mq->mqrq_cur, card, 0, mq);
+		mmc_start_req(card->host, &mq->mqrq_cur->mmc_active, NULL);
+	}
 
 	return 0;
 }
@@ -953,26 +1507,37 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 	struct mmc_blk_data *md = mq->data;
 	struct mmc_card *card = md->queue.card;
 
-	mmc_claim_host(card->host);
+	if (req && !mq->mqrq_prev->req)
+		/* claim host only for the first request */
+		mmc_claim_host(card->host);
+
 	ret = mmc_blk_part_switch(card, md);
 	if (ret) {
 		ret = 0;
 		goto out;
 	}
 
-	if (req->cmd_flags & REQ_DISCARD) {
+	if (req && req->cmd_flags & REQ_DISCARD) {
+		/* complete ongoing async transfer before issuing discard */
+		if (card->host->areq)
+			mmc_blk_issue_rw_rq(mq, NULL);
 		if (req->cmd_flags & REQ_SECURE)
 			ret = mmc_blk_issue_secdiscard_rq(mq, req);
 		else
 			ret = mmc_blk_issue_discard_rq(mq, req);
-	} else if (req->cmd_flags & REQ_FLUSH) {
+	} else if (req && req->cmd_flags & REQ_FLUSH) {
+		/* complete ongoing async transfer before issuing flush */
+		if (card->host->areq)
+			mmc_blk_issue_rw_rq(mq, NULL);
 		ret = mmc_blk_issue_flush(mq, req);
 	} else {
 		ret = mmc_blk_issue_rw_rq(mq, req);
 	}
 
 out:
-	mmc_release_host(card->host);
+	if (!req)
+		/* release host only when there are no more requests */
+		mmc_release_host(card->host);
 	return ret;
 }
 
@@ -1080,6 +1645,14 @@ static struct mmc_blk_data *mmc_blk_alloc_req(struct mmc_card *card,
 		blk_queue_flush(md->queue.queue, REQ_FLUSH | REQ_FUA);
 	}
 
+	if (md->flags & MMC_BLK_CMD23 && !mmc_host_is_spi(card->host) &&
+	    md->queue.mqrq_cur->packed_cmd_hdr) {
+		md->flags |= MMC_BLK_PACKED_CMD;
+		md->packed_max_count = min_t(unsigned int, PACKED_CMD_MAX_ENTRIES,
+					     card->ext_csd.max_packed_writes);
+		md->packed_max_sectors = mmc_blk_packed_hw_max_sectors(card);
+	}
+
 	return md;
 
  err_putdisk:
@@ -1186,6 +1759,9 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 	if (md) {
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+			if (md->flags & MMC_BLK_PACKED_CMD)
+				sysfs_remove_group(&disk_to_dev(md->disk)->kobj,
+						   &mmc_blk_packed_attr_group);
 
 			/* Stop new requests from getting into the queue */
 			del_gendisk(md->disk);
@@ -1223,8 +1799,22 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	md->force_ro.attr.mode = S_IRUGO | S_IWUSR;
 	ret = device_create_file(disk_to_dev(md->disk), &md->force_ro);
 	if (ret)
-		del_gendisk(md->disk);
+		goto del_disk;
+
+	if (md->flags & MMC_BLK_PACKED_CMD) {
+		ret = sysfs_create_group(&disk_to_dev(md->disk)->kobj,
+					 &mmc_blk_packed_attr_group);
+		if (ret) {
+			device_remove_file(disk_to_dev(md->disk),
+					   &md->force_ro);
+			goto del_disk;
+		}
+	}
+
+	return 0;
 
+del_disk:
+	del_gendisk(md->disk);
 	return ret;
 }
 
@@ -1954,6 +1954,153 @@ static int mmc_test_large_seq_write_perf(struct mmc_test_card *test)
 	return mmc_test_large_seq_perf(test, 1);
 }
 
+/*
+ * Contents written to byte @off of sector @sect by the packed tests
+ */
+#define PACKED_PATTERN(sect, off)	((u8)((sect) * 37 + (off)))
+
+/*
+ * Write @nr entries of @blocks[i] sectors at @addr[i] in one packed
+ * write, then read back the first BUFFER_SIZE of the card and check
+ * that exactly those sectors changed.
+ *
+ * Note: mmc_test_prepare_write() must have been done before this call
+ */
+static int mmc_test_packed_write(struct mmc_test_card *test,
+	const unsigned *addr, const unsigned *blocks, unsigned nr)
+{
+	struct mmc_card *card = test->card;
+	struct mmc_request mrq = {0};
+	struct mmc_command sbc = {0};
+	struct mmc_command cmd = {0};
+	struct mmc_command stop = {0};
+	struct mmc_data data = {0};
+	struct scatterlist sg[2];
+	unsigned i, j, total = 0;
+	__le32 *hdr;
+	u8 *p;
+	int ret;
+
+	if (!mmc_card_mmc(card) || card->ext_csd.max_packed_writes < nr)
+		return RESULT_UNSUP_CARD;
+
+	for (i = 0; i < nr; i++)
+		total += blocks[i];
+
+	if (!mmc_host_cmd23(card->host) || card->host->max_segs < 2 ||
+	    card->host->max_seg_size < total * 512 ||
+	    card->host->max_blk_count < total + 1)
+		return RESULT_UNSUP_HOST;
+
+	if (total * 512 > BUFFER_SIZE)
+		return -EINVAL;
+
+	ret = mmc_test_set_blksize(test, 512);
+	if (ret)
+		return ret;
+
+	hdr = kzalloc(PACKED_CMD_HDR_WORDS * sizeof(*hdr), GFP_KERNEL);
+	if (!hdr)
+		return -ENOMEM;
+
+	hdr[0] = cpu_to_le32((nr << 16) | (PACKED_CMD_WR << 8) |
+			     PACKED_CMD_VER);
+	p = test->buffer;
+	for (i = 0; i < nr; i++) {
+		hdr[(i + 1) * 2] = cpu_to_le32(blocks[i]);
+		hdr[(i + 1) * 2 + 1] = cpu_to_le32(mmc_card_blockaddr(card) ?
+						   addr[i] : addr[i] << 9);
+		for (j = 0; j < blocks[i] * 512; j++)
+			*p++ = PACKED_PATTERN(addr[i] + j / 512, j % 512);
+	}
+
+	sg_init_table(sg, 2);
+	sg_set_buf(&sg[0], hdr, PACKED_CMD_HDR_WORDS * sizeof(*hdr));
+	sg_set_buf(&sg[1], test->buffer, total * 512);
+
+	mrq.sbc = &sbc;
+	mrq.cmd = &cmd;
+	mrq.data = &data;
+	mrq.stop = &stop;
+
+	mmc_test_prepare_mrq(test, &mrq, sg, 2, addr[0], total + 1, 512, 1);
+
+	sbc.opcode = MMC_SET_BLOCK_COUNT;
+	sbc.arg = MMC_CMD23_ARG_PACKED | (total + 1);
+	sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	mmc_wait_for_req(card->host, &mrq);
+
+	mmc_test_wait_busy(test);
+
+	kfree(hdr);
+
+	if (sbc.error)
+		return sbc.error == -EINVAL ? RESULT_UNSUP_HOST : sbc.error;
+	ret = mmc_test_check_result(test, &mrq);
+	if (ret)
+		return ret;
+
+	memset(test->buffer, 0, BUFFER_SIZE);
+	for (i = 0; i < BUFFER_SIZE / 512; i++) {
+		ret = mmc_test_buffer_transfer(test, test->buffer + i * 512,
+			i, 512, 0);
+		if (ret)
+			return ret;
+	}
+
+	p = test->buffer;
+	for (i = 0; i < BUFFER_SIZE / 512; i++, p += 512) {
+		bool written = false;
+
+		for (j = 0; j < nr; j++) {
+			if (i >= addr[j] && i < addr[j] + blocks[j])
+				written = true;
+		}
+
+		for (j = 0; j < 512; j++) {
+			if (p[j] != (written ? PACKED_PATTERN(i, j) : 0xDF))
+				return RESULT_FAIL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Packed write of a few out of order entries of different sizes.
+ */
+static int mmc_test_packed_write_basic(struct mmc_test_card *test)
+{
+	static const unsigned addr[] = { 9, 1, 20 };
+	static const unsigned blocks[] = { 3, 2, 1 };
+
+	return mmc_test_packed_write(test, addr, blocks, ARRAY_SIZE(addr));
+}
+
+/*
+ * Packed write of as many single sector entries as the card allows, in
+ * descending sector order.
+ */
+static int mmc_test_packed_write_max(struct mmc_test_card *test)
+{
+	unsigned addr[BUFFER_SIZE / 512 / 2], blocks[BUFFER_SIZE / 512 / 2];
+	unsigned i, nr;
+
+	nr = min_t(unsigned, test->card->ext_csd.max_packed_writes,
+		   ARRAY_SIZE(addr));
+	nr = min_t(unsigned, nr, PACKED_CMD_MAX_ENTRIES);
+	if (nr < 2)
+		return RESULT_UNSUP_CARD;
+
+	for (i = 0; i < nr; i++) {
+		addr[i] = (nr - 1 - i) * 2 + 1;
+		blocks[i] = 1;
+	}
+
+	return mmc_test_packed_write(test, addr, blocks, nr);
+}
+
 static const struct mmc_test_case mmc_test_cases[] = {
 	{
 		.name = "Basic write (no data verification)",
@@ -2221,6 +2368,20 @@ static const struct mmc_test_case mmc_test_cases[] = {
 		.cleanup = mmc_test_area_cleanup,
 	},
 
+	{
+		.name = "Packed write",
+		.prepare = mmc_test_prepare_write,
+		.run = mmc_test_packed_write_basic,
+		.cleanup = mmc_test_cleanup,
+	},
+
+	{
+		.name = "Packed write of maximum entries",
+		.prepare = mmc_test_prepare_write,
+		.run = mmc_test_packed_write_max,
+		.cleanup = mmc_test_cleanup,
+	},
+
 };
 
 static DEFINE_MUTEX(mmc_test_lock);
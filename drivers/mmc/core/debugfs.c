@@ -188,6 +188,18 @@ void mmc_add_host_debugfs(struct mmc_host *host)
 				root, &host->clk_delay))
 		goto err_node;
 #endif
+
+	/*
+	 * Requests started through mmc_start_req(), and how many of them
+	 * were prepared while the previous one was still on the bus.
+	 */
+	if (!debugfs_create_u32("areq_started", S_IRUSR, root,
+				&host->areq_started))
+		goto err_node;
+
+	if (!debugfs_create_u32("areq_overlapped", S_IRUSR, root,
+				&host->areq_overlapped))
+		goto err_node;
 	return;
 
 err_node:
@@ -0,0 +1,291 @@
+/*
+ * Compressed RAM block device - same page deduplication
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/highmem.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/*
+ * Number of u32 words of a page fed to the checksum. As in UKSM's
+ * random_sample_hash(), a random sample of the page is hashed instead
+ * of the whole of it: candidates are verified by a full comparison
+ * anyway, so the hash only has to be good enough to keep false matches
+ * rare.
+ */
+#define DEDUP_HASH_STRENGTH	(PAGE_SIZE / sizeof(u32) / 4)
+
+/* Average number of stored pages per hash bucket */
+#define DEDUP_PAGES_PER_BUCKET	32
+
+static struct kmem_cache *dedup_entry_cache;
+
+/* Word offsets sampled by zram_dedup_checksum(), in ascending order */
+static u16 dedup_sample[DEDUP_HASH_STRENGTH];
+
+static int cmp_u16(const void *a, const void *b)
+{
+	return *(const u16 *)a - *(const u16 *)b;
+}
+
+/*
+ * Pick DEDUP_HASH_STRENGTH distinct word offsets with a partial
+ * Fisher-Yates shuffle. They are sorted so that hashing walks the page
+ * front to back, which the prefetcher handles much better than the
+ * random order UKSM uses.
+ */
+static int __init dedup_init_sample(void)
+{
+	u16 *perm;
+	unsigned int i, j, nr = PAGE_SIZE / sizeof(u32);
+
+	perm = kmalloc(nr * sizeof(*perm), GFP_KERNEL);
+	if (!perm)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++)
+		perm[i] = i;
+
+	for (i = 0; i < DEDUP_HASH_STRENGTH; i++) {
+		j = i + random32() % (nr - i);
+		swap(perm[i], perm[j]);
+	}
+
+	memcpy(dedup_sample, perm, sizeof(dedup_sample));
+	sort(dedup_sample, DEDUP_HASH_STRENGTH, sizeof(dedup_sample[0]),
+		cmp_u16, NULL);
+
+	kfree(perm);
+	return 0;
+}
+
+/* Same mixing steps as UKSM's HASH_FROM_TO() */
+u32 zram_dedup_checksum(void *mem)
+{
+	unsigned int i;
+	u32 *key = mem;
+	u32 hash = 0xdeadbeef;
+
+	for (i = 0; i < DEDUP_HASH_STRENGTH; i++) {
+		hash += key[dedup_sample[i]];
+		hash += (hash << 8);
+		hash ^= (hash >> 12);
+	}
+
+	return hash;
+}
+
+static struct zram_dedup_bucket *dedup_bucket(struct zram *zram,
+						u32 checksum)
+{
+	return &zram->dedup_buckets[checksum & zram->dedup_mask];
+}
+
+/*
+ * Check if the object behind @entry decompresses to the page at @mem.
+ * Decompression is much cheaper than compression for LZO and LZ4, so
+ * a hit is still a win even though the candidate has to be expanded.
+ */
+static bool dedup_match(struct zram *zram, struct zram_strm *zstrm,
+			struct zram_dedup_entry *entry, void *mem)
+{
+	int ret;
+	bool match;
+	unsigned char *cmem;
+	unsigned int dlen = PAGE_SIZE;
+
+	if (entry->uncompressed) {
+		cmem = kmap_atomic((struct page *)entry->handle, KM_USER1);
+		match = !memcmp(cmem, mem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		return match;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle);
+	ret = crypto_comp_decompress(zstrm->tfm, cmem, entry->size,
+				zstrm->buffer, &dlen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return !ret && dlen == PAGE_SIZE &&
+		!memcmp(zstrm->buffer, mem, PAGE_SIZE);
+}
+
+/*
+ * Look for a stored page identical to the one at @mem. On success a
+ * reference is taken on the returned entry. @zstrm provides scratch
+ * space and a transform for decompressing candidates.
+ */
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		struct zram_strm *zstrm, void *mem, u32 checksum)
+{
+	struct rb_node *rb;
+	struct zram_dedup_entry *entry, *first = NULL;
+	struct zram_dedup_bucket *bucket = dedup_bucket(zram, checksum);
+
+	spin_lock(&bucket->lock);
+
+	/* Entries with equal checksums are adjacent; find the leftmost */
+	rb = bucket->root.rb_node;
+	while (rb) {
+		entry = rb_entry(rb, struct zram_dedup_entry, node);
+		if (checksum <= entry->checksum) {
+			if (checksum == entry->checksum)
+				first = entry;
+			rb = rb->rb_left;
+		} else {
+			rb = rb->rb_right;
+		}
+	}
+
+	for (entry = first; entry; ) {
+		if (dedup_match(zram, zstrm, entry, mem)) {
+			entry->refcount++;
+			spin_unlock(&bucket->lock);
+			return entry;
+		}
+
+		rb = rb_next(&entry->node);
+		entry = rb ? rb_entry(rb, struct zram_dedup_entry, node) : NULL;
+		if (entry && entry->checksum != checksum)
+			break;
+	}
+
+	spin_unlock(&bucket->lock);
+	return NULL;
+}
+
+/*
+ * Make a newly stored object available for deduplication. Returns the
+ * entry, holding one reference, or NULL if no memory was available in
+ * which case the caller keeps the object to itself.
+ */
+struct zram_dedup_entry *zram_dedup_add(struct zram *zram,
+		u32 checksum, unsigned long handle, u16 size,
+		bool uncompressed)
+{
+	struct rb_node **link, *parent = NULL;
+	struct zram_dedup_entry *entry, *tmp;
+	struct zram_dedup_bucket *bucket = dedup_bucket(zram, checksum);
+
+	entry = kmem_cache_alloc(dedup_entry_cache, GFP_NOIO | __GFP_NOWARN);
+	if (!entry)
+		return NULL;
+
+	entry->checksum = checksum;
+	entry->size = size;
+	entry->uncompressed = uncompressed;
+	entry->handle = handle;
+	entry->refcount = 1;
+
+	spin_lock(&bucket->lock);
+	link = &bucket->root.rb_node;
+	while (*link) {
+		parent = *link;
+		tmp = rb_entry(parent, struct zram_dedup_entry, node);
+		if (checksum < tmp->checksum)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&entry->node, parent, link);
+	rb_insert_color(&entry->node, &bucket->root);
+	spin_unlock(&bucket->lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference on @entry. The last reference frees the object as
+ * well; returns true in that case.
+ */
+bool zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry)
+{
+	struct zram_dedup_bucket *bucket = dedup_bucket(zram, entry->checksum);
+
+	spin_lock(&bucket->lock);
+	if (--entry->refcount) {
+		spin_unlock(&bucket->lock);
+		return false;
+	}
+	rb_erase(&entry->node, &bucket->root);
+	spin_unlock(&bucket->lock);
+
+	if (entry->uncompressed)
+		__free_page((struct page *)entry->handle);
+	else
+		zs_free(zram->mem_pool, entry->handle);
+
+	kmem_cache_free(dedup_entry_cache, entry);
+	return true;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i, nr_buckets;
+
+	nr_buckets = roundup_pow_of_two(max_t(size_t,
+				num_pages / DEDUP_PAGES_PER_BUCKET, 1));
+	zram->dedup_buckets = vmalloc(nr_buckets *
+				sizeof(*zram->dedup_buckets));
+	if (!zram->dedup_buckets)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_buckets; i++) {
+		spin_lock_init(&zram->dedup_buckets[i].lock);
+		zram->dedup_buckets[i].root = RB_ROOT;
+	}
+	zram->dedup_mask = nr_buckets - 1;
+
+	return 0;
+}
+
+/* All entries must have been put by now */
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->dedup_buckets);
+	zram->dedup_buckets = NULL;
+	zram->dedup_mask = 0;
+}
+
+int __init zram_dedup_module_init(void)
+{
+	int ret;
+
+	ret = dedup_init_sample();
+	if (ret)
+		return ret;
+
+	dedup_entry_cache = kmem_cache_create("zram_dedup_entry",
+				sizeof(struct zram_dedup_entry), 0, 0, NULL);
+	if (!dedup_entry_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void zram_dedup_module_exit(void)
+{
+	kmem_cache_destroy(dedup_entry_cache);
+}
@@ -25,13 +25,17 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 #include "zram_drv.h"
 
@@ -104,6 +108,130 @@ static int page_zero_filled(void *ptr)
 	return 1;
 }
 
+static int zram_strm_available(struct zram *zram)
+{
+	return find_first_zero_bit(zram->strm_busy, zram->max_strm) <
+		zram->max_strm;
+}
+
+/*
+ * Grab an idle compression stream for a write. The search starts at the
+ * stream "owned" by the current CPU so that, with one stream per CPU,
+ * callers normally find their own stream free at the first
+ * test_and_set_bit. If every stream is busy, sleep until one is released.
+ */
+static struct zram_strm *zram_strm_get(struct zram *zram)
+{
+	unsigned int i, start;
+
+	start = raw_smp_processor_id() % zram->max_strm;
+	for (;;) {
+		i = start;
+		do {
+			if (!test_and_set_bit_lock(i, zram->strm_busy))
+				return &zram->streams[i];
+			if (++i == zram->max_strm)
+				i = 0;
+		} while (i != start);
+
+		zram_stat64_inc(zram, &zram->stats.strm_waits);
+		wait_event(zram->strm_wait, zram_strm_available(zram));
+	}
+}
+
+static void zram_strm_put(struct zram *zram, struct zram_strm *zstrm)
+{
+	clear_bit_unlock(zstrm - zram->streams, zram->strm_busy);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&zram->strm_wait))
+		wake_up(&zram->strm_wait);
+}
+
+static void zram_destroy_streams(struct zram *zram)
+{
+	unsigned int i;
+
+	if (zram->dtfm) {
+		for_each_possible_cpu(i) {
+			struct crypto_comp *tfm = *per_cpu_ptr(zram->dtfm, i);
+
+			if (!IS_ERR_OR_NULL(tfm))
+				crypto_free_comp(tfm);
+		}
+		free_percpu(zram->dtfm);
+		zram->dtfm = NULL;
+	}
+
+	if (!zram->streams)
+		return;
+
+	for (i = 0; i < zram->max_strm; i++) {
+		if (!IS_ERR_OR_NULL(zram->streams[i].tfm))
+			crypto_free_comp(zram->streams[i].tfm);
+		free_pages((unsigned long)zram->streams[i].buffer, 1);
+	}
+
+	kfree(zram->streams);
+	kfree(zram->strm_busy);
+	zram->streams = NULL;
+	zram->strm_busy = NULL;
+}
+
+static int zram_create_streams(struct zram *zram)
+{
+	unsigned int i;
+
+	zram->streams = kcalloc(zram->max_strm, sizeof(*zram->streams),
+				GFP_KERNEL);
+	zram->strm_busy = kcalloc(BITS_TO_LONGS(zram->max_strm),
+				sizeof(long), GFP_KERNEL);
+	if (!zram->streams || !zram->strm_busy)
+		goto fail;
+
+	for (i = 0; i < zram->max_strm; i++) {
+		struct zram_strm *zstrm = &zram->streams[i];
+
+		zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(zstrm->tfm)) {
+			pr_err("Error allocating %s compressor: %ld\n",
+				zram->compressor, PTR_ERR(zstrm->tfm));
+			goto fail;
+		}
+
+		/*
+		 * Allocate 2 pages: compressed output of an incompressible
+		 * page can be larger than PAGE_SIZE.
+		 */
+		zstrm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!zstrm->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			goto fail;
+		}
+	}
+
+	zram->dtfm = alloc_percpu(struct crypto_comp *);
+	if (!zram->dtfm)
+		goto fail;
+
+	for_each_possible_cpu(i) {
+		struct crypto_comp *tfm = crypto_alloc_comp(zram->compressor,
+							    0, 0);
+
+		*per_cpu_ptr(zram->dtfm, i) = tfm;
+		if (IS_ERR(tfm)) {
+			pr_err("Error allocating %s decompressor: %ld\n",
+				zram->compressor, PTR_ERR(tfm));
+			goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	zram_destroy_streams(zram);
+	return -ENOMEM;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,15 +261,135 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static void zram_clear_idle(struct zram *zram, u32 index)
+{
+	if (zram->idle_map && test_bit(index, zram->idle_map))
+		clear_bit(index, zram->idle_map);
+}
+
+/* Returns 0 if the backing device is full */
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk, start = zram->bd_cursor;
+
+retry:
+	blk = find_next_zero_bit(zram->bd_bitmap, zram->bd_pages, start);
+	if (blk >= zram->bd_pages) {
+		if (start == 1)
+			return 0;
+		start = 1;
+		goto retry;
+	}
+
+	/* Allocations are serialized by init_lock, frees are not */
+	set_bit(blk, zram->bd_bitmap);
+	zram->bd_cursor = blk + 1;
+
+	return blk;
+}
+
+/*
+ * A block being read from the backing device stays allocated until the
+ * read completes, even if its page is freed in the meantime, so that
+ * writeback cannot reuse it under the read.
+ */
+struct zram_bd_page {
+	struct list_head list;		/* on zram->bd_reading */
+	struct zram *zram;
+	struct zram_bd_read *rd;
+	unsigned long blk;
+	bool freed;			/* free blk once the read is done */
+};
+
+static void zram_free_block(struct zram *zram, unsigned long blk)
+{
+	struct zram_bd_page *bp;
+	unsigned long flags;
+	bool busy = false;
+
+	spin_lock_irqsave(&zram->bd_lock, flags);
+	list_for_each_entry(bp, &zram->bd_reading, list) {
+		if (bp->blk == blk) {
+			bp->freed = true;
+			busy = true;
+		}
+	}
+	if (!busy)
+		clear_bit(blk, zram->bd_bitmap);
+	spin_unlock_irqrestore(&zram->bd_lock, flags);
+}
+
+/* Caller must hold zram->tb_lock, so that blk can't be freed yet */
+static void zram_pin_block(struct zram *zram, struct zram_bd_page *bp,
+				struct zram_bd_read *rd, unsigned long blk)
+{
+	bp->zram = zram;
+	bp->rd = rd;
+	bp->blk = blk;
+	bp->freed = false;
+
+	spin_lock_irq(&zram->bd_lock);
+	list_add(&bp->list, &zram->bd_reading);
+	spin_unlock_irq(&zram->bd_lock);
+}
+
+static void zram_unpin_block(struct zram_bd_page *bp)
+{
+	struct zram *zram = bp->zram;
+	struct zram_bd_page *other;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zram->bd_lock, flags);
+	list_del(&bp->list);
+	if (bp->freed) {
+		list_for_each_entry(other, &zram->bd_reading, list) {
+			if (other->blk == bp->blk)
+				goto out;
+		}
+		clear_bit(bp->blk, zram->bd_bitmap);
+	}
+out:
+	spin_unlock_irqrestore(&zram->bd_lock, flags);
+	kfree(bp);
+}
+
+static void zram_obj_stats_dec(struct zram *zram, u32 clen,
+				bool uncompressed)
+{
+	if (unlikely(uncompressed))
+		zram_stat_dec(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_dec(&zram->stats.good_compress);
+	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+}
+
+/*
+ * Free the memory holding the data of a table entry that is neither
+ * shared nor written back. Caller must hold zram->tb_lock for writing.
+ */
+static void zram_free_obj(struct zram *zram, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
+	u32 clen = zram->table[index].size;
+	bool uncompressed = zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+	if (unlikely(uncompressed))
+		__free_page((struct page *)handle);
+	else
+		zs_free(zram->mem_pool, handle);
+
+	zram_obj_stats_dec(zram, clen, uncompressed);
+}
+
+/* Caller must hold zram->tb_lock for writing */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	bool uncompressed;
+	unsigned long handle = zram->table[index].handle;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
-
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -153,28 +401,43 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_clear_idle(zram, index);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, handle);
+		zram_stat64_sub(zram, &zram->stats.bd_count, 1);
+	} else if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		clen = zram->table[index].size;
+		uncompressed = zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+
+		/* Object may still be used by other table entries */
+		if (zram_dedup_put(zram, (struct zram_dedup_entry *)handle))
+			zram_obj_stats_dec(zram, clen, uncompressed);
+		else
+			zram_stat64_sub(zram, &zram->stats.dedup_saved, clen);
+	} else {
+		zram_free_obj(zram, index);
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	zram_stat_dec(&zram->stats.pages_stored);
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
+}
 
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+/* Caller must hold zram->tb_lock */
+static unsigned long zram_get_handle(struct zram *zram, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		handle = ((struct zram_dedup_entry *)handle)->handle;
+
+	return handle;
 }
 
 static void handle_zero_page(struct page *page)
@@ -194,8 +457,8 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic((struct page *)zram_get_handle(zram, index),
+			KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -204,33 +467,112 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
+/*
+ * Pages on the backing device are read with child bios. The request
+ * completes once zram_read() and all of its children are done.
+ */
+struct zram_bd_read {
+	struct bio *parent;
+	atomic_t pending;	/* child bios + 1 for zram_read() */
+	int error;
+};
+
+static void zram_bd_read_put(struct zram_bd_read *rd)
+{
+	if (!atomic_dec_and_test(&rd->pending))
+		return;
+
+	if (rd->error) {
+		bio_io_error(rd->parent);
+	} else {
+		set_bit(BIO_UPTODATE, &rd->parent->bi_flags);
+		bio_endio(rd->parent, 0);
+	}
+	kfree(rd);
+}
+
+static void zram_bd_read_end_io(struct bio *bio, int err)
+{
+	struct zram_bd_page *bp = bio->bi_private;
+	struct zram_bd_read *rd = bp->rd;
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		rd->error = -EIO;
+	else
+		flush_dcache_page(bio->bi_io_vec[0].bv_page);
+
+	bio_put(bio);
+	zram_unpin_block(bp);
+	zram_bd_read_put(rd);
+}
+
+/* Consumes @bp, which must be pinned, whether or not this succeeds */
+static int zram_read_from_bdev(struct zram *zram, struct zram_bd_page *bp,
+				struct page *page)
+{
+	struct zram_bd_read *rd = bp->rd;
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio) {
+		zram_unpin_block(bp);
+		return -ENOMEM;
+	}
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = bp->blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_read_end_io;
+	bio->bi_private = bp;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		zram_unpin_block(bp);
+		return -EIO;
+	}
+
+	atomic_inc(&rd->pending);
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	submit_bio(READ, bio);
+
+	return 0;
+}
+
 static void zram_read(struct zram *zram, struct bio *bio)
 {
 
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_bd_read *rd = NULL;
+	struct zram_bd_page *bp = NULL;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
+		unsigned int clen;
+		unsigned long handle;
+		ktime_t start;
 		struct page *page;
-		struct zobj_header *zheader;
+		struct crypto_comp **dtfm;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
+		zram_clear_idle(zram, index);
+again:
+		read_lock(&zram->tb_lock);
+
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			read_unlock(&zram->tb_lock);
 			handle_zero_page(page);
 			index++;
 			continue;
 		}
 
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		if (unlikely(!zram->table[index].handle)) {
+			read_unlock(&zram->tb_lock);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			handle_zero_page(page);
@@ -238,44 +580,96 @@ static void zram_read(struct zram *zram, struct bio *bio)
 			continue;
 		}
 
+		/* Page was written back to the backing device */
+		if (zram_test_flag(zram, index, ZRAM_WB)) {
+			/* Allocate without the lock, then look again */
+			if (!rd || !bp) {
+				read_unlock(&zram->tb_lock);
+				if (!rd) {
+					rd = kmalloc(sizeof(*rd), GFP_NOIO);
+					if (!rd)
+						goto out_nomem;
+					rd->parent = bio;
+					atomic_set(&rd->pending, 1);
+					rd->error = 0;
+				}
+				bp = kmalloc(sizeof(*bp), GFP_NOIO);
+				if (!bp)
+					goto out_nomem;
+				goto again;
+			}
+
+			zram_pin_block(zram, bp, rd, zram->table[index].handle);
+			read_unlock(&zram->tb_lock);
+
+			ret = zram_read_from_bdev(zram, bp, page);
+			bp = NULL;
+			if (ret) {
+				pr_err("Backing device read failed! err=%d, "
+					"page=%u\n", ret, index);
+				zram_stat64_inc(zram, &zram->stats.failed_reads);
+				goto out;
+			}
+			index++;
+			continue;
+		}
+
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			read_unlock(&zram->tb_lock);
 			index++;
 			continue;
 		}
 
+		handle = zram_get_handle(zram, index);
+		cmem = zs_map_object(zram->mem_pool, handle);
 		user_mem = kmap_atomic(page, KM_USER0);
 		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
-
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		dtfm = get_cpu_ptr(zram->dtfm);
+		start = ktime_get();
+		ret = crypto_comp_decompress(*dtfm, cmem,
+			zram->table[index].size, user_mem, &clen);
+		zram_stat64_add(zram, &zram->stats.decompr_ns,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+		put_cpu_ptr(zram->dtfm);
 
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		zs_unmap_object(zram->mem_pool, handle);
+		read_unlock(&zram->tb_lock);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret || clen != PAGE_SIZE)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
 
+		zram_stat64_inc(zram, &zram->stats.num_decompr);
 		flush_dcache_page(page);
 		index++;
 	}
 
+	kfree(bp);
+	if (rd) {
+		zram_bd_read_put(rd);
+		return;
+	}
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
 
+out_nomem:
+	zram_stat64_inc(zram, &zram->stats.failed_reads);
 out:
+	kfree(bp);
+	if (rd) {
+		rd->error = -EIO;
+		zram_bd_read_put(rd);
+		return;
+	}
 	bio_io_error(bio);
 }
 
@@ -290,42 +684,70 @@ static void zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
+		u32 checksum = 0;
+		unsigned int clen;
+		unsigned long handle;
+		bool uncompressed = false, dedup = false;
+		ktime_t start;
+		struct zram_strm *zstrm;
+		struct zram_dedup_entry *entry = NULL;
 		struct page *page, *page_store;
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
+		ret = page_zero_filled(user_mem);
+		kunmap_atomic(user_mem, KM_USER0);
+		if (ret) {
+			/*
+			 * System overwrites unused sectors. Free memory
+			 * associated with this sector now.
+			 */
+			write_lock(&zram->tb_lock);
+			zram_free_page(zram, index);
 			zram_stat_inc(&zram->stats.pages_zero);
 			zram_set_flag(zram, index, ZRAM_ZERO);
+			write_unlock(&zram->tb_lock);
 			index++;
 			continue;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		/* May sleep for a stream, so not under kmap_atomic() */
+		zstrm = zram_strm_get(zram);
+		src = zstrm->buffer;
+		user_mem = kmap_atomic(page, KM_USER0);
+
+		if (zram_dedup_enabled(zram)) {
+			checksum = zram_dedup_checksum(user_mem);
+			entry = zram_dedup_find(zram, zstrm, user_mem,
+						checksum);
+			if (entry) {
+				kunmap_atomic(user_mem, KM_USER0);
+				zram_strm_put(zram, zstrm);
+				zram_stat64_inc(zram,
+					&zram->stats.dedup_hits);
+				handle = (unsigned long)entry;
+				dedup = true;
+				clen = entry->size;
+				uncompressed = entry->uncompressed;
+				goto publish;
+			}
+		}
+
+		/* Stream buffers are 2 pages, enough for any worst case */
+		clen = 2 * PAGE_SIZE;
+		start = ktime_get();
+		ret = crypto_comp_compress(zstrm->tfm, user_mem, PAGE_SIZE,
+					src, &clen);
+		zram_stat64_add(zram, &zram->stats.compr_ns,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+		zram_stat64_inc(zram, &zram->stats.num_compr);
 
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zram_strm_put(zram, zstrm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -340,7 +762,7 @@ static void zram_write(struct zram *zram, struct bio *bio)
 			clen = PAGE_SIZE;
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
+				zram_strm_put(zram, zstrm);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -348,52 +770,74 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				goto out;
 			}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
+			uncompressed = true;
+			handle = (unsigned long)page_store;
 			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+			cmem = kmap_atomic(page_store, KM_USER1);
+			memcpy(cmem, src, clen);
+			kunmap_atomic(cmem, KM_USER1);
+			kunmap_atomic(src, KM_USER0);
+		} else {
+			handle = zs_malloc(zram->mem_pool, clen);
+			if (unlikely(!handle)) {
+				zram_strm_put(zram, zstrm);
+				pr_info("Error allocating memory for "
+					"compressed page: %u, size=%u\n",
+					index, clen);
+				zram_stat64_inc(zram,
+					&zram->stats.failed_writes);
+				goto out;
+			}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+			cmem = zs_map_object(zram->mem_pool, handle);
+			memcpy(cmem, src, clen);
+			zs_unmap_object(zram->mem_pool, handle);
 		}
 
-memstore:
-		zram->table[index].offset = offset;
+		zram_strm_put(zram, zstrm);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		/* Let later writes of the same content share this object */
+		if (zram_dedup_enabled(zram)) {
+			struct zram_dedup_entry *new;
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+			new = zram_dedup_add(zram, checksum, handle, clen,
+						uncompressed);
+			if (new) {
+				handle = (unsigned long)new;
+				dedup = true;
+			}
 		}
-#endif
 
-		memcpy(cmem, src, clen);
+publish:
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector and publish the new object in its place.
+		 */
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+		zram->table[index].handle = handle;
+		zram->table[index].size = clen;
+		zram_clear_idle(zram, index);
+		if (unlikely(uncompressed))
+			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		if (dedup)
+			zram_set_flag(zram, index, ZRAM_DEDUP);
+		zram_stat_inc(&zram->stats.pages_stored);
 
 		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+		if (entry) {
+			/* Nothing new was stored */
+			zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+		} else {
+			if (unlikely(uncompressed))
+				zram_stat_inc(&zram->stats.pages_expand);
+			else if (clen <= PAGE_SIZE / 2)
+				zram_stat_inc(&zram->stats.good_compress);
+			zram_stat64_add(zram, &zram->stats.compr_size, clen);
+		}
+		write_unlock(&zram->tb_lock);
 
-		mutex_unlock(&zram->lock);
 		index++;
 	}
 
@@ -461,33 +905,40 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_destroy_streams(zram);
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+	for (index = 0; zram->table &&
+			index < zram->disksize >> PAGE_SHIFT; index++) {
+		unsigned long handle = zram->table[index].handle;
 
-		if (!page)
+		if (!handle || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+		if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, (struct zram_dedup_entry *)handle);
+		else if (unlikely(zram_test_flag(zram, index,
+						ZRAM_UNCOMPRESSED)))
+			__free_page((struct page *)handle);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	zram_dedup_fini(zram);
 
-	xv_destroy_pool(zram->mem_pool);
+	/* Everything written back is gone too; keep the device itself */
+	if (zram->bd_bitmap) {
+		bitmap_zero(zram->bd_bitmap, zram->bd_pages);
+		set_bit(0, zram->bd_bitmap);
+		zram->bd_cursor = 1;
+	}
+	vfree(zram->idle_map);
+	zram->idle_map = NULL;
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,19 +962,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_create_streams(zram);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,12 +976,31 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	if (zram->bdev) {
+		zram->idle_map = vzalloc(BITS_TO_LONGS(num_pages) *
+					sizeof(long));
+		if (!zram->idle_map) {
+			pr_err("Error allocating idle page map\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
+	if (zram_dedup_enabled(zram)) {
+		ret = zram_dedup_init(zram, num_pages);
+		if (ret) {
+			pr_err("Error allocating dedup hash table\n");
+			goto fail;
+		}
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -561,12 +1021,310 @@ fail:
 	return ret;
 }
 
+static void zram_put_backing_dev(struct zram *zram)
+{
+	if (zram->bdev)
+		blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bd_bitmap);
+	kfree(zram->bdev_path);
+
+	zram->bdev = NULL;
+	zram->bd_bitmap = NULL;
+	zram->bdev_path = NULL;
+	zram->bd_pages = 0;
+}
+
+/*
+ * Use the block device at @path ("none" to detach) as backing device.
+ * Caller must hold init_lock and the device must not be initialized.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	char *name;
+	unsigned long nr_pages, *bitmap;
+	struct block_device *bdev;
+
+	if (!strcmp(path, "none")) {
+		zram_put_backing_dev(zram);
+		return 0;
+	}
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				zram);
+	if (IS_ERR(bdev)) {
+		kfree(name);
+		return PTR_ERR(bdev);
+	}
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = nr_pages > 1 ?
+		vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long)) : NULL;
+	if (!bitmap) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		kfree(name);
+		return nr_pages > 1 ? -ENOMEM : -EINVAL;
+	}
+	/* Block 0 is reserved, see struct zram */
+	set_bit(0, bitmap);
+
+	zram_put_backing_dev(zram);
+	zram->bdev = bdev;
+	zram->bdev_path = name;
+	zram->bd_bitmap = bitmap;
+	zram->bd_pages = nr_pages;
+	zram->bd_cursor = 1;
+
+	return 0;
+}
+
+/* Caller must hold init_lock and the device must be initialized */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	read_lock(&zram->tb_lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (zram->table[index].handle &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			set_bit(index, zram->idle_map);
+	}
+	read_unlock(&zram->tb_lock);
+}
+
+/* Caller must hold zram->tb_lock for writing */
+static bool zram_wb_candidate(struct zram *zram, u32 index,
+				enum zram_wb_mode mode)
+{
+	if (!zram->table[index].handle ||
+			zram_test_flag(zram, index, ZRAM_DEDUP) ||
+			zram_test_flag(zram, index, ZRAM_WB) ||
+			zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return false;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return test_bit(index, zram->idle_map);
+}
+
+/* Copy the uncompressed data of a table entry to @page */
+static int zram_copy_page(struct zram *zram, struct zram_strm *zstrm,
+			u32 index, struct page *page)
+{
+	int ret = 0;
+	unsigned int clen = PAGE_SIZE;
+	unsigned char *dst, *src;
+	unsigned long handle = zram->table[index].handle;
+
+	dst = kmap_atomic(page, KM_USER0);
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		src = kmap_atomic((struct page *)handle, KM_USER1);
+		memcpy(dst, src, PAGE_SIZE);
+		kunmap_atomic(src, KM_USER1);
+	} else {
+		src = zs_map_object(zram->mem_pool, handle);
+		ret = crypto_comp_decompress(zstrm->tfm, src,
+				zram->table[index].size, dst, &clen);
+		zs_unmap_object(zram->mem_pool, handle);
+		if (!ret && clen != PAGE_SIZE)
+			ret = -EINVAL;
+	}
+	kunmap_atomic(dst, KM_USER0);
+
+	return ret;
+}
+
+struct zram_wb_ctl {
+	atomic_t pending;	/* bios in flight + 1 for the submitter */
+	int error;
+	struct completion done;
+};
+
+static void zram_wb_end_io(struct bio *bio, int err)
+{
+	struct zram_wb_ctl *wb = bio->bi_private;
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		wb->error = -EIO;
+
+	bio_put(bio);
+	if (atomic_dec_and_test(&wb->pending))
+		complete(&wb->done);
+}
+
+/*
+ * Write @pages to blocks @blks (0: skip), using one bio for each run
+ * of consecutive blocks, and wait for the I/O to finish.
+ */
+static int zram_bd_write(struct zram *zram, struct page **pages,
+			unsigned long *blks, int nr)
+{
+	int i;
+	unsigned long next = 0;
+	struct bio *bio = NULL;
+	struct blk_plug plug;
+	struct zram_wb_ctl wb;
+
+	atomic_set(&wb.pending, 1);
+	wb.error = 0;
+	init_completion(&wb.done);
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		if (!blks[i])
+			continue;
+
+		if (bio && blks[i] == next &&
+				bio_add_page(bio, pages[i], PAGE_SIZE, 0)) {
+			next++;
+			continue;
+		}
+
+		if (bio)
+			submit_bio(WRITE, bio);
+
+		bio = bio_alloc(GFP_KERNEL, ZRAM_WB_BATCH);
+		bio->bi_bdev = zram->bdev;
+		bio->bi_sector = blks[i] << SECTORS_PER_PAGE_SHIFT;
+		bio->bi_end_io = zram_wb_end_io;
+		bio->bi_private = &wb;
+		atomic_inc(&wb.pending);
+		if (!bio_add_page(bio, pages[i], PAGE_SIZE, 0)) {
+			bio_put(bio);
+			bio = NULL;
+			atomic_dec(&wb.pending);
+			wb.error = -EIO;
+			break;
+		}
+		next = blks[i] + 1;
+	}
+	if (bio)
+		submit_bio(WRITE, bio);
+	blk_finish_plug(&plug);
+
+	if (!atomic_dec_and_test(&wb.pending))
+		wait_for_completion(&wb.done);
+
+	return wb.error;
+}
+
+/*
+ * Move incompressible or idle pages to the backing device, in batches
+ * of ZRAM_WB_BATCH. Pages are marked ZRAM_UNDER_WB while their data is
+ * copied out and written; if one is freed or overwritten meanwhile the
+ * flag is gone and the written block is simply dropped.
+ *
+ * Caller must hold init_lock and the device must be initialized.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int i, n, err, ret = 0;
+	u32 index = 0, nr_index = zram->disksize >> PAGE_SHIFT;
+	u32 idx[ZRAM_WB_BATCH];
+	unsigned long blks[ZRAM_WB_BATCH];
+	struct page *pages[ZRAM_WB_BATCH] = { NULL };
+	struct zram_strm *zstrm;
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	while (!ret && index < nr_index) {
+		u64 written = 0;
+
+		/* Pick the next batch */
+		n = 0;
+		write_lock(&zram->tb_lock);
+		for (; index < nr_index && n < ZRAM_WB_BATCH; index++) {
+			if (!zram_wb_candidate(zram, index, mode))
+				continue;
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+			idx[n++] = index;
+		}
+		write_unlock(&zram->tb_lock);
+
+		if (!n)
+			break;
+
+		/* Copy the data out and give each page a block */
+		zstrm = zram_strm_get(zram);
+		for (i = 0; i < n; i++) {
+			blks[i] = 0;
+			if (ret)
+				continue;
+
+			read_lock(&zram->tb_lock);
+			if (zram_test_flag(zram, idx[i], ZRAM_UNDER_WB) &&
+			    !zram_copy_page(zram, zstrm, idx[i], pages[i])) {
+				blks[i] = zram_alloc_block(zram);
+				if (!blks[i])
+					ret = -ENOSPC;
+			}
+			read_unlock(&zram->tb_lock);
+		}
+		zram_strm_put(zram, zstrm);
+
+		err = zram_bd_write(zram, pages, blks, n);
+		if (err) {
+			pr_err("Backing device write failed! err=%d\n", err);
+			ret = err;
+		}
+
+		/* Replace the in-memory copies that are still current */
+		write_lock(&zram->tb_lock);
+		for (i = 0; i < n; i++) {
+			bool under_wb;
+
+			under_wb = zram_test_flag(zram, idx[i], ZRAM_UNDER_WB);
+			zram_clear_flag(zram, idx[i], ZRAM_UNDER_WB);
+			if (!blks[i])
+				continue;
+
+			if (err || !under_wb) {
+				zram_free_block(zram, blks[i]);
+				continue;
+			}
+
+			zram_free_obj(zram, idx[i]);
+			zram->table[idx[i]].handle = blks[i];
+			zram_set_flag(zram, idx[i], ZRAM_WB);
+			written++;
+		}
+		write_unlock(&zram->tb_lock);
+
+		zram_stat64_add(zram, &zram->stats.bd_count, written);
+		zram_stat64_add(zram, &zram->stats.bd_writes, written);
+		cond_resched();
+	}
+
+out:
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		if (pages[i])
+			__free_page(pages[i]);
+	}
+
+	return ret;
+}
+
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1337,17 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
+	rwlock_init(&zram->tb_lock);
 	spin_lock_init(&zram->stat64_lock);
+	init_waitqueue_head(&zram->strm_wait);
+	spin_lock_init(&zram->bd_lock);
+	INIT_LIST_HEAD(&zram->bd_reading);
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
+
+	/* One compression stream per CPU unless told otherwise via sysfs */
+	zram->max_strm = num_online_cpus();
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1430,15 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_dedup_module_init();
+	if (ret)
+		goto out;
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto dedup_exit;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1468,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+dedup_exit:
+	zram_dedup_module_exit();
 out:
 	return ret;
 }
@@ -713,9 +1485,11 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_put_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	zram_dedup_module_exit();
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
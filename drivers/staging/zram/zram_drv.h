@@ -17,8 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,23 +29,14 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compression algorithm (any crypto API compressor can be used) */
+static const char default_compressor[] = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -51,8 +45,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -63,6 +57,9 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
+/* Max no. of pages written to the backing device in one go */
+#define ZRAM_WB_BATCH		32
+
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
@@ -71,6 +68,15 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* handle points to a (possibly shared) struct zram_dedup_entry */
+	ZRAM_DEDUP,
+
+	/* Page lives on the backing device; handle is its block index */
+	ZRAM_WB,
+
+	/* Page is being copied to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -78,8 +84,9 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	/* zsmalloc handle, or struct page * if ZRAM_UNCOMPRESSED */
+	unsigned long handle;
+	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -96,16 +103,83 @@ struct zram_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u64 strm_waits;		/* no. of times a writer had to wait
+				 * for an idle compression stream */
+	u64 num_compr;		/* no. of pages compressed */
+	u64 num_decompr;	/* no. of pages decompressed */
+	u64 compr_ns;		/* total time spent compressing */
+	u64 decompr_ns;		/* total time spent decompressing */
+	u64 pages_compacted;	/* pages freed by compaction */
+	u64 dedup_hits;		/* no. of writes that found an identical
+				 * page already stored */
+	u64 dedup_saved;	/* bytes not stored thanks to dedup */
+	u64 bd_count;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_writes;		/* no. of pages written back */
+};
+
+/* Page selection for zram_writeback() */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,		/* incompressible pages */
+	ZRAM_WB_IDLE,		/* pages not accessed since marked idle */
+};
+
+/*
+ * With deduplication enabled every stored object is described by one
+ * of these, hashed by the content of the uncompressed page. Table
+ * entries holding identical pages share it and the underlying object.
+ */
+struct zram_dedup_entry {
+	struct rb_node node;
+	u32 checksum;		/* sampled hash of the uncompressed page */
+	u16 size;		/* object size */
+	u8 uncompressed;	/* handle is a struct page * */
+	unsigned long handle;
+	unsigned long refcount;	/* protected by the bucket lock */
+};
+
+struct zram_dedup_bucket {
+	spinlock_t lock;
+	struct rb_root root;	/* entries, sorted by checksum */
+};
+
+/*
+ * Compression stream: buffer + compressor transform. A device has
+ * max_strm of these so that concurrent writers can compress in parallel.
+ */
+struct zram_strm {
+	void *buffer;		/* compressed output (2 pages) */
+	struct crypto_comp *tfm;	/* compressor instance */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_strm *streams;
+	unsigned long *strm_busy;	/* bitmap of streams in use */
+	wait_queue_head_t strm_wait;	/* writers waiting for a stream */
+	unsigned int max_strm;	/* no. of compression streams */
+	/* Reads decompress with these and never wait for a stream */
+	struct crypto_comp * __percpu *dtfm;
+	char compressor[CRYPTO_MAX_ALG_NAME];	/* crypto API algorithm */
+	bool use_dedup;		/* deduplicate identical pages */
+	struct zram_dedup_bucket *dedup_buckets;
+	unsigned long dedup_mask;	/* no. of dedup buckets - 1 */
+	/*
+	 * Optional backing device. Incompressible or idle pages can be
+	 * written back to it to free memory; block 0 is never used so
+	 * that a table handle of 0 still means "no data".
+	 */
+	struct block_device *bdev;
+	char *bdev_path;
+	unsigned long *bd_bitmap;	/* blocks in use */
+	unsigned long bd_pages;		/* size of backing device */
+	unsigned long bd_cursor;	/* next-fit block allocation */
+	struct list_head bd_reading;	/* blocks being read, see bd_lock */
+	spinlock_t bd_lock;	/* protect bd_reading, taken from end_io */
+	unsigned long *idle_map;	/* pages not accessed since marked */
 	struct table *table;
+	rwlock_t tb_lock;	/* protect table entries and page stats */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -128,5 +202,66 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+
+#ifdef CONFIG_ZRAM_DEDUP
+static inline bool zram_dedup_enabled(struct zram *zram)
+{
+	return zram->use_dedup;
+}
+
+extern u32 zram_dedup_checksum(void *mem);
+extern struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		struct zram_strm *zstrm, void *mem, u32 checksum);
+extern struct zram_dedup_entry *zram_dedup_add(struct zram *zram,
+		u32 checksum, unsigned long handle, u16 size,
+		bool uncompressed);
+extern bool zram_dedup_put(struct zram *zram,
+		struct zram_dedup_entry *entry);
+extern int zram_dedup_init(struct zram *zram, size_t num_pages);
+extern void zram_dedup_fini(struct zram *zram);
+extern int zram_dedup_module_init(void);
+extern void zram_dedup_module_exit(void);
+#else
+static inline bool zram_dedup_enabled(struct zram *zram)
+{
+	return false;
+}
+
+static inline u32 zram_dedup_checksum(void *mem)
+{
+	return 0;
+}
+
+static inline struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		struct zram_strm *zstrm, void *mem, u32 checksum)
+{
+	return NULL;
+}
+
+static inline struct zram_dedup_entry *zram_dedup_add(struct zram *zram,
+		u32 checksum, unsigned long handle, u16 size,
+		bool uncompressed)
+{
+	return NULL;
+}
+
+static inline bool zram_dedup_put(struct zram *zram,
+		struct zram_dedup_entry *entry)
+{
+	return true;
+}
+
+static inline int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	return 0;
+}
+
+static inline void zram_dedup_fini(struct zram *zram) { }
+static inline int zram_dedup_module_init(void) { return 0; }
+static inline void zram_dedup_module_exit(void) { }
+#endif
 
 #endif
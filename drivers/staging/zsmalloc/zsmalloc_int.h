@@ -0,0 +1,121 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/*
+ * Size of the handle back-reference stored at the start of every
+ * allocated object. Free objects keep the index of the next free
+ * object in the same place.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
+/* Must be large enough to hold ZS_HANDLE_SIZE and a multiple of it */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_CLASS_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes. This value
+ * is 16 for 4k pages, so that no object header straddles two pages.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_CLASS_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is a group of up to this many (not necessarily physically
+ * contiguous) 0-order pages that objects of one size class are carved
+ * from. Larger groups waste less space at the page tail.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * A zspage whose fraction of used objects is at least this (in percent)
+ * is considered almost full: allocations prefer it, and compaction
+ * moves objects into it.
+ */
+#define ZS_ALMOST_FULL_PERCENT	75
+
+/* End of user params */
+
+/* Bit 0 of an object's first word: set if the object is allocated */
+#define ZS_OBJ_ALLOCATED	1UL
+#define ZS_OBJ_TAG_BITS		1
+
+/* Bit 0 of zs_handle->idx_pin: object is mapped or being moved/freed */
+#define ZS_HANDLE_PIN_BIT	0
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+/*
+ * Handles returned by zs_malloc() point to one of these. Object users
+ * never see the object's location, so zs_compact() can move it.
+ */
+struct zs_handle {
+	/* object index in zspage << 1 | pin bit */
+	unsigned long idx_pin;
+	struct zspage *zspage;
+};
+
+struct zspage {
+	struct list_head list;		/* fullness list of owning class */
+	struct size_class *class;
+	unsigned int inuse;		/* no. of allocated objects */
+	unsigned int freeobj;		/* first free object index */
+	enum fullness_group fullness;
+	struct page *pages[0];		/* class->pages_per_zspage pages */
+};
+
+struct size_class {
+	/* protects all zspages (and their objects) of this class */
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	/* object size, including the handle back-reference */
+	unsigned int size;
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;	/* also marks end of freelist */
+
+	unsigned long nr_zspages;
+	unsigned long objs_inuse;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	gfp_t flags;	/* allocation flags used when growing pool */
+	atomic_long_t pages_allocated;
+	const char *name;
+};
+
+/*
+ * Per-cpu state of the (single) object mapped on that cpu. Objects
+ * spanning two pages are copied into vm_buf while mapped.
+ */
+struct mapping_area {
+	char *vm_buf;
+	char *vm_addr;	/* address of kmap_atomic()'ed page */
+};
+
+#endif
@@ -0,0 +1,707 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped in size classes ZS_SIZE_CLASS_DELTA bytes apart.
+ * Each class carves its objects out of "zspages": groups of 0-order
+ * pages that need not be physically contiguous, so the pool can grow
+ * without high-order allocations and from highmem. An object may
+ * straddle two pages of its zspage; such objects are copied to a
+ * per-cpu buffer while mapped.
+ *
+ * Callers only ever hold an opaque handle. The first word of each
+ * allocated object points back to its handle, which lets zs_compact()
+ * move objects from sparse zspages into fuller ones and return the
+ * emptied pages to the buddy allocator.
+ *
+ * Locking: each size class has its own spinlock. A handle is pinned
+ * (bit spinlock in zs_handle->idx_pin) while its object is mapped or
+ * freed; compaction skips pinned objects.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *zs_handle_cachep;
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static unsigned int get_size_class_index(unsigned int size)
+{
+	unsigned int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage for which the unusable space at
+ * the end of the zspage is smallest, relative to the zspage size.
+ */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, max_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int zspage_size = i * PAGE_SIZE;
+		unsigned int usedpc;
+
+		usedpc = (zspage_size - zspage_size % size) * 100 /
+				zspage_size;
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static struct zs_handle *handle_to_zs(unsigned long handle)
+{
+	return (struct zs_handle *)handle;
+}
+
+static unsigned int handle_obj_idx(struct zs_handle *zh)
+{
+	return zh->idx_pin >> 1;
+}
+
+static void pin_handle(struct zs_handle *zh)
+{
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &zh->idx_pin);
+}
+
+static int trypin_handle(struct zs_handle *zh)
+{
+	return bit_spin_trylock(ZS_HANDLE_PIN_BIT, &zh->idx_pin);
+}
+
+static void unpin_handle(struct zs_handle *zh)
+{
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &zh->idx_pin);
+}
+
+/* Page holding the start of object @idx, and its offset in that page */
+static void obj_location(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, struct page **page,
+			unsigned int *offset)
+{
+	unsigned long off = (unsigned long)idx * class->size;
+
+	*page = zspage->pages[off >> PAGE_SHIFT];
+	*offset = off & ~PAGE_MASK;
+}
+
+/* Read the first word (handle or freelist link) of object @idx */
+static unsigned long obj_read_link(struct size_class *class,
+			struct zspage *zspage, unsigned int idx)
+{
+	struct page *page;
+	unsigned int offset;
+	unsigned long *link, val;
+
+	obj_location(class, zspage, idx, &page, &offset);
+	link = kmap_atomic(page, KM_USER0) + offset;
+	val = *link;
+	kunmap_atomic(link, KM_USER0);
+
+	return val;
+}
+
+static void obj_write_link(struct size_class *class,
+			struct zspage *zspage, unsigned int idx,
+			unsigned long val)
+{
+	struct page *page;
+	unsigned int offset;
+	unsigned long *link;
+
+	obj_location(class, zspage, idx, &page, &offset);
+	link = kmap_atomic(page, KM_USER0) + offset;
+	*link = val;
+	kunmap_atomic(link, KM_USER0);
+}
+
+/*
+ * Copy object @idx out to (@write == 0) or in from (@write == 1) the
+ * linear buffer @buf, a page at a time since the object may span two.
+ */
+static void obj_copy(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, char *buf, int write)
+{
+	unsigned long off = (unsigned long)idx * class->size;
+	unsigned int done = 0;
+
+	while (done < class->size) {
+		struct page *page = zspage->pages[(off + done) >> PAGE_SHIFT];
+		unsigned int poff = (off + done) & ~PAGE_MASK;
+		unsigned int len = min_t(unsigned int, class->size - done,
+					PAGE_SIZE - poff);
+		char *addr = kmap_atomic(page, KM_USER1);
+
+		if (write)
+			memcpy(addr + poff, buf + done, len);
+		else
+			memcpy(buf + done, addr + poff, len);
+		kunmap_atomic(addr, KM_USER1);
+		done += len;
+	}
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	if (zspage->inuse == 0)
+		return ZS_EMPTY;
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * 100 >=
+			class->objs_per_zspage * ZS_ALMOST_FULL_PERCENT)
+		return ZS_ALMOST_FULL;
+
+	return ZS_ALMOST_EMPTY;
+}
+
+/*
+ * Move @zspage to the list matching its current usage. Empty zspages
+ * are taken off the lists and must be freed by the caller.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	list_del_init(&zspage->list);
+	if (newfg != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static void free_zspage(struct size_class *class, struct zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class)
+{
+	unsigned int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) + class->pages_per_zspage *
+			sizeof(struct page *), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	/* Link all objects into the freelist */
+	for (i = 0; i < class->objs_per_zspage; i++)
+		obj_write_link(class, zspage, i,
+			(unsigned long)(i + 1) << ZS_OBJ_TAG_BITS);
+	zspage->freeobj = 0;
+
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	struct list_head *head;
+
+	head = &class->fullness_list[ZS_ALMOST_FULL];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zspage, list);
+
+	head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zspage, list);
+
+	return NULL;
+}
+
+/* Take a free object from @zspage and bind it to @zh */
+static void obj_malloc(struct size_class *class, struct zspage *zspage,
+			struct zs_handle *zh)
+{
+	unsigned int idx = zspage->freeobj;
+
+	BUG_ON(idx >= class->objs_per_zspage);
+
+	zspage->freeobj = obj_read_link(class, zspage, idx) >>
+				ZS_OBJ_TAG_BITS;
+	obj_write_link(class, zspage, idx,
+			(unsigned long)zh | ZS_OBJ_ALLOCATED);
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	zh->zspage = zspage;
+	zh->idx_pin = (zh->idx_pin & BIT(ZS_HANDLE_PIN_BIT)) |
+			((unsigned long)idx << 1);
+}
+
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int idx)
+{
+	obj_write_link(class, zspage, idx,
+			(unsigned long)zspage->freeobj << ZS_OBJ_TAG_BITS);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, for messages only
+ * @flags: allocation flags used to allocate pool pages
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	unsigned int i, fg;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+						class->size;
+	}
+
+	pool->flags = flags;
+	pool->name = name;
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/**
+ * zs_destroy_pool - Destroys a pool created by zs_create_pool().
+ * @pool: pool to destroy
+ *
+ * All objects must have been freed; leaked zspages are reported and
+ * released anyway.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	unsigned int i, fg;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("%s: freeing non-empty zspage "
+					"(class size %u, %u objects)\n",
+					pool->name, class->size, zspage->inuse);
+				list_del(&zspage->list);
+				free_zspage(class, zspage);
+			}
+		}
+	}
+
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, a handle to the allocated object is returned,
+ * otherwise 0. The object must be mapped with zs_map_object()
+ * before it can be accessed.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct zs_handle *zh;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size +
+				ZS_HANDLE_SIZE)];
+
+	zh = kmem_cache_alloc(zs_handle_cachep, pool->flags & ~__GFP_HIGHMEM);
+	if (!zh)
+		return 0;
+	zh->idx_pin = 0;
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, zh);
+			return 0;
+		}
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+
+		spin_lock(&class->lock);
+		class->nr_zspages++;
+	}
+
+	obj_malloc(class, zspage, zh);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)zh;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/**
+ * zs_free - Free object allocated using zs_malloc().
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ *
+ * The object must not be mapped.
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = handle_to_zs(handle);
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fg;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Keeps compaction from moving the object under us */
+	pin_handle(zh);
+	zspage = zh->zspage;
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, handle_obj_idx(zh));
+	fg = fix_fullness_group(class, zspage);
+	if (fg == ZS_EMPTY)
+		class->nr_zspages--;
+	spin_unlock(&class->lock);
+	unpin_handle(zh);
+
+	if (fg == ZS_EMPTY) {
+		free_zspage(class, zspage);
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+	}
+
+	kmem_cache_free(zs_handle_cachep, zh);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done with the object, it must be unmapped
+ * using zs_unmap_object.
+ *
+ * Only one object can be mapped per cpu at a time. This function
+ * returns with preemption disabled, so the caller must not sleep
+ * until the object is unmapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = handle_to_zs(handle);
+	struct mapping_area *area;
+	struct size_class *class;
+	struct page *page;
+	unsigned int offset;
+
+	BUG_ON(!handle);
+
+	pin_handle(zh);
+	class = zh->zspage->class;
+	obj_location(class, zh->zspage, handle_obj_idx(zh), &page, &offset);
+
+	area = &get_cpu_var(zs_map_area);
+	if (offset + class->size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->vm_addr = kmap_atomic(page, KM_USER1);
+		return area->vm_addr + offset + ZS_HANDLE_SIZE;
+	}
+
+	/* this object spans two pages */
+	area->vm_addr = NULL;
+	obj_copy(class, zh->zspage, handle_obj_idx(zh), area->vm_buf, 0);
+
+	return area->vm_buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+/**
+ * zs_unmap_object - unmap an object mapped by zs_map_object().
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ */
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = handle_to_zs(handle);
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr)
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	else
+		obj_copy(zh->zspage->class, zh->zspage, handle_obj_idx(zh),
+			area->vm_buf, 1);
+	put_cpu_var(zs_map_area);
+
+	unpin_handle(zh);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * zs_get_total_size_bytes - Get total memory used by the pool
+ *
+ * Returns the size of all pages backing the pool, including the space
+ * that is not (or no longer) used by live objects.
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * Move as many objects as possible from @src to @dst, using @buf as
+ * bounce buffer. Returns -EBUSY if a pinned (mapped) object was found.
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *dst,
+			struct zspage *src, char *buf)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		unsigned long link;
+		struct zs_handle *zh;
+
+		if (!src->inuse || dst->inuse == class->objs_per_zspage)
+			break;
+
+		link = obj_read_link(class, src, idx);
+		if (!(link & ZS_OBJ_ALLOCATED))
+			continue;
+
+		zh = (struct zs_handle *)(link & ~ZS_OBJ_ALLOCATED);
+		if (!trypin_handle(zh))
+			return -EBUSY;
+
+		obj_copy(class, src, idx, buf, 0);
+		obj_malloc(class, dst, zh);
+		obj_copy(class, dst, handle_obj_idx(zh), buf, 1);
+		obj_free(class, src, idx);
+
+		unpin_handle(zh);
+	}
+
+	return 0;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+			struct size_class *class, char *buf)
+{
+	unsigned long freed = 0;
+
+	spin_lock(&class->lock);
+	for (;;) {
+		struct list_head *sparse = &class->fullness_list[ZS_ALMOST_EMPTY];
+		struct zspage *src, *dst;
+		unsigned long free_objs;
+		int ret;
+
+		if (list_empty(sparse))
+			break;
+		src = list_entry(sparse->prev, struct zspage, list);
+
+		/*
+		 * Only worth it if the other zspages have room for all
+		 * objects of src, so that src can be released.
+		 */
+		free_objs = class->nr_zspages * class->objs_per_zspage -
+				class->objs_inuse;
+		if (free_objs - (class->objs_per_zspage - src->inuse) <
+				src->inuse)
+			break;
+
+		dst = find_get_zspage(class);
+		if (dst == src)
+			dst = list_entry(src->list.next, struct zspage, list);
+		if (&dst->list == sparse || dst == src)
+			break;
+
+		ret = migrate_zspage(class, dst, src, buf);
+		fix_fullness_group(class, dst);
+		if (fix_fullness_group(class, src) == ZS_EMPTY) {
+			class->nr_zspages--;
+			free_zspage(class, src);
+			atomic_long_sub(class->pages_per_zspage,
+					&pool->pages_allocated);
+			freed += class->pages_per_zspage;
+		}
+
+		if (ret)
+			break;
+
+		/* Let zs_malloc()/zs_free() in, and other tasks run */
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Return fragmented pages to the system.
+ * @pool: pool to compact
+ *
+ * Moves objects from sparsely used zspages into fuller ones of the
+ * same size class and frees the zspages that become empty. Objects
+ * that are mapped at the time are skipped. May sleep.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned int i;
+	unsigned long freed = 0;
+	char *buf;
+
+	buf = kmalloc(ZS_MAX_CLASS_SIZE, GFP_NOIO | __GFP_NOWARN);
+	if (!buf)
+		return 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		freed += compact_class(pool, &pool->size_class[i], buf);
+		cond_resched();
+	}
+
+	kfree(buf);
+	pr_debug("%s: compaction freed %lu pages\n", pool->name, freed);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		kfree(area->vm_buf);
+		area->vm_buf = NULL;
+	}
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_CLASS_SIZE, GFP_KERNEL);
+		if (!area->vm_buf) {
+			zs_free_map_areas();
+			kmem_cache_destroy(zs_handle_cachep);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit zs_exit(void)
+{
+	zs_free_map_areas();
+	kmem_cache_destroy(zs_handle_cachep);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("zsmalloc memory allocator");
@@ -25,6 +25,8 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/buffer_head.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -77,34 +79,130 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
-void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
+/*
+ * A filesystem has msblk->max_streams decompressor streams, one by
+ * default. With more, that many blocks can be decompressed at the same
+ * time; a reader takes an idle stream, preferably the one "owned" by
+ * its CPU, and sleeps only if every stream is busy.
+ */
+static int squashfs_stream_available(struct squashfs_sb_info *msblk)
+{
+	return find_first_zero_bit(msblk->stream_busy, msblk->max_streams) <
+		msblk->max_streams;
+}
+
+
+static int squashfs_get_stream(struct squashfs_sb_info *msblk)
+{
+	int i, start;
+
+	start = raw_smp_processor_id() % msblk->max_streams;
+	for (;;) {
+		i = start;
+		do {
+			if (!test_and_set_bit_lock(i, msblk->stream_busy))
+				return i;
+			if (++i == msblk->max_streams)
+				i = 0;
+		} while (i != start);
+
+		atomic_long_inc(&msblk->stream_waits);
+		wait_event(msblk->stream_wait,
+			squashfs_stream_available(msblk));
+	}
+}
+
+
+static void squashfs_put_stream(struct squashfs_sb_info *msblk, int i)
+{
+	clear_bit_unlock(i, msblk->stream_busy);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&msblk->stream_wait))
+		wake_up(&msblk->stream_wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	int i = squashfs_get_stream(msblk);
+	int res = msblk->decompressor->decompress(msblk, msblk->stream[i],
+		buffer, bh, b, offset, length, srclength, pages);
+
+	squashfs_put_stream(msblk, i);
+	return res;
+}
+
+
+int squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
-	int length = 0;
+	void *buffer = NULL;
+	int i, err, length = 0;
+
+	msblk->stream = kcalloc(msblk->max_streams, sizeof(*msblk->stream),
+		GFP_KERNEL);
+	msblk->stream_busy = kcalloc(BITS_TO_LONGS(msblk->max_streams),
+		sizeof(long), GFP_KERNEL);
+	if (msblk->stream == NULL || msblk->stream_busy == NULL) {
+		err = -ENOMEM;
+		goto failed;
+	}
+	init_waitqueue_head(&msblk->stream_wait);
 
 	/*
 	 * Read decompressor specific options from file system if present
 	 */
 	if (SQUASHFS_COMP_OPTS(flags)) {
 		buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
-		if (buffer == NULL)
-			return ERR_PTR(-ENOMEM);
+		if (buffer == NULL) {
+			err = -ENOMEM;
+			goto failed;
+		}
 
 		length = squashfs_read_data(sb, &buffer,
 			sizeof(struct squashfs_super_block), 0, NULL,
 			PAGE_CACHE_SIZE, 1);
 
 		if (length < 0) {
-			strm = ERR_PTR(length);
-			goto finished;
+			err = length;
+			goto failed;
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	for (i = 0; i < msblk->max_streams; i++) {
+		void *strm = msblk->decompressor->init(msblk, buffer, length);
+
+		if (IS_ERR(strm)) {
+			err = PTR_ERR(strm);
+			goto failed;
+		}
+		msblk->stream[i] = strm;
+	}
 
-finished:
 	kfree(buffer);
+	return 0;
+
+failed:
+	kfree(buffer);
+	squashfs_decompressor_destroy(msblk);
+	return err;
+}
+
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	int i;
+
+	if (msblk->stream) {
+		for (i = 0; i < msblk->max_streams; i++)
+			if (msblk->stream[i])
+				msblk->decompressor->free(msblk->stream[i]);
+		kfree(msblk->stream);
+		msblk->stream = NULL;
+	}
 
-	return strm;
+	kfree(msblk->stream_busy);
+	msblk->stream_busy = NULL;
 }
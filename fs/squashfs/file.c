@@ -38,6 +38,10 @@
  * Larger files use multiple slots, with 1.75 TiB files using all 8 slots.
  * The index cache is designed to be memory efficient, and by default uses
  * 16 KiB.
+ *
+ * Datablocks are decompressed straight into the page cache pages they
+ * cover.  Only fragments, and datablocks when memory is short, go through
+ * the read_page and fragment caches and are copied from there.
  */
 
 #include <linux/fs.h>
@@ -47,6 +51,8 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -371,7 +377,174 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
-static int squashfs_readpage(struct file *file, struct page *page)
+#ifdef CONFIG_HIGHMEM
+/*
+ * Page cache pages may be in highmem.  A block is up to 256 pages, so
+ * kmap()ing one for each reader could use up the pkmap area; map it into
+ * vmalloc space instead.
+ */
+static void *squashfs_map_block(struct page **map, int pages, void **buffer)
+{
+	int i;
+	void *base = vmap(map, pages, VM_MAP, PAGE_KERNEL);
+
+	if (base == NULL)
+		return NULL;
+
+	for (i = 0; i < pages; i++)
+		buffer[i] = base + (i << PAGE_CACHE_SHIFT);
+	return base;
+}
+
+
+static void squashfs_unmap_block(void *base, int pages)
+{
+	flush_kernel_vmap_range(base, pages << PAGE_CACHE_SHIFT);
+	vunmap(base);
+}
+#else
+static void *squashfs_map_block(struct page **map, int pages, void **buffer)
+{
+	int i;
+
+	for (i = 0; i < pages; i++)
+		buffer[i] = page_address(map[i]);
+	return buffer;
+}
+
+
+static void squashfs_unmap_block(void *base, int pages)
+{
+}
+#endif
+
+
+/*
+ * Take the page cache page at @index to decompress into, locked, or
+ * return NULL if it is already uptodate or cannot be had without
+ * waiting.  Readahead passes the pages it allocated in @readahead,
+ * lowest index last; those are used rather than allocating new ones.
+ */
+static struct page *squashfs_grab_page(struct address_space *mapping,
+	pgoff_t index, struct list_head *readahead)
+{
+	struct page *page;
+
+	if (readahead && !list_empty(readahead)) {
+		page = list_entry(readahead->prev, struct page, lru);
+		if (page->index == index) {
+			list_del(&page->lru);
+			if (!add_to_page_cache_lru(page, mapping, index,
+							GFP_KERNEL))
+				return page;
+			page_cache_release(page);
+		}
+	}
+
+	page = grab_cache_page_nowait(mapping, index);
+	if (page && PageUptodate(page)) {
+		unlock_page(page);
+		page_cache_release(page);
+		page = NULL;
+	}
+
+	return page;
+}
+
+
+/*
+ * Decompress the datablock containing @page straight into the page cache,
+ * filling as many of the other pages of the block as are available too.
+ * Pages that could not be had are decompressed into a scratch page and
+ * thrown away.  @page is left locked on error; -ENOMEM means the caller
+ * should fall back to reading through the read_page cache.
+ */
+static int squashfs_readpage_block(struct page *page, u64 block, int bsize,
+	struct list_head *readahead)
+{
+	struct inode *inode = page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int pages_per_block = msblk->block_size >> PAGE_CACHE_SHIFT;
+	int mask = pages_per_block - 1;
+	pgoff_t start_index = page->index & ~mask;
+	pgoff_t file_pages = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	int i, avail, bytes, res = -ENOMEM;
+	int pages = min_t(pgoff_t, pages_per_block, file_pages - start_index);
+	struct page **map, **push_page, *scratch = NULL;
+	void **buffer, *base;
+
+	map = kcalloc(pages_per_block * 2, sizeof(*map), GFP_KERNEL);
+	buffer = kcalloc(pages_per_block, sizeof(*buffer), GFP_KERNEL);
+	if (map == NULL || buffer == NULL)
+		goto out;
+	push_page = map + pages_per_block;
+
+	for (i = 0; i < pages; i++)
+		push_page[i] = start_index + i == page->index ? page :
+			squashfs_grab_page(page->mapping, start_index + i,
+				readahead);
+
+	for (i = 0; i < pages_per_block; i++) {
+		if (i < pages && push_page[i]) {
+			map[i] = push_page[i];
+			continue;
+		}
+		if (scratch == NULL) {
+			scratch = alloc_page(GFP_KERNEL);
+			if (scratch == NULL)
+				goto release;
+		}
+		map[i] = scratch;
+	}
+
+	base = squashfs_map_block(map, pages_per_block, buffer);
+	if (base == NULL)
+		goto release;
+
+	res = squashfs_read_data(inode->i_sb, buffer, block, bsize, NULL,
+		msblk->block_size, pages_per_block);
+
+	if (res >= 0)
+		for (i = 0, bytes = res; i < pages; i++,
+				bytes -= PAGE_CACHE_SIZE) {
+			avail = clamp_t(int, bytes, 0, PAGE_CACHE_SIZE);
+			if (push_page[i] && avail < PAGE_CACHE_SIZE)
+				memset(buffer[i] + avail, 0,
+					PAGE_CACHE_SIZE - avail);
+		}
+
+	squashfs_unmap_block(base, pages_per_block);
+
+	if (res < 0)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+
+release:
+	for (i = 0; i < pages; i++) {
+		if (push_page[i] == NULL)
+			continue;
+		if (res >= 0) {
+			flush_dcache_page(push_page[i]);
+			SetPageUptodate(push_page[i]);
+		} else if (push_page[i] == page)
+			continue;
+		unlock_page(push_page[i]);
+		if (push_page[i] != page)
+			page_cache_release(push_page[i]);
+	}
+
+out:
+	if (scratch)
+		__free_page(scratch);
+	kfree(buffer);
+	kfree(map);
+
+	return res < 0 ? res : 0;
+}
+
+
+static int __squashfs_readpage(struct page *page, struct list_head *readahead)
 {
 	struct inode *inode = page->mapping->host;
 	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
@@ -399,7 +572,7 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		 * to get location and block size.
 		 */
 		u64 block = 0;
-		int bsize = read_blocklist(inode, index, &block);
+		int res, bsize = read_blocklist(inode, index, &block);
 		if (bsize < 0)
 			goto error_out;
 
@@ -409,8 +582,16 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				 msblk->block_size;
 			sparse = 1;
 		} else {
+			res = squashfs_readpage_block(page, block, bsize,
+				readahead);
+			if (res == 0)
+				return 0;
+			if (res != -ENOMEM)
+				goto error_out;
+
 			/*
-			 * Read and decompress datablock.
+			 * Short of memory, read and decompress datablock
+			 * through the cache.
 			 */
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
@@ -496,6 +677,36 @@ out:
 }
 
 
+static int squashfs_readpage(struct file *file, struct page *page)
+{
+	return __squashfs_readpage(page, NULL);
+}
+
+
+/*
+ * Readahead hands over the pages of a whole window at once.  Each call to
+ * __squashfs_readpage() fills the pages of a datablock taken from the
+ * list, so every block in the window is only decompressed once.
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct page *page;
+
+	while (!list_empty(pages)) {
+		page = list_entry(pages->prev, struct page, lru);
+		list_del(&page->lru);
+		if (!add_to_page_cache_lru(page, mapping, page->index,
+						GFP_KERNEL))
+			__squashfs_readpage(page, pages);
+		page_cache_release(page);
+	}
+
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
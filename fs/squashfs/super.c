@@ -36,6 +36,10 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/parser.h>
+#include <linux/mount.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -46,6 +50,92 @@
 
 static struct file_system_type squashfs_fs_type;
 static const struct super_operations squashfs_super_ops;
+static struct proc_dir_entry *squashfs_proc_root;
+
+enum {
+	Opt_threads_single, Opt_threads_percpu, Opt_threads, Opt_err
+};
+
+static const match_table_t tokens = {
+	{Opt_threads_single, "threads=single"},
+	{Opt_threads_percpu, "threads=percpu"},
+	{Opt_threads, "threads=%u"},
+	{Opt_err, NULL}
+};
+
+
+/*
+ * The number of blocks that can be decompressed at the same time:
+ * threads=single (the default) uses one decompressor stream,
+ * threads=percpu one per possible CPU and threads=<n> n of them.
+ * Unknown options are ignored, as squashfs used to take no options.
+ */
+static int squashfs_parse_options(struct squashfs_sb_info *msblk,
+	char *options)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p;
+	int n;
+
+	msblk->max_streams = 1;
+	if (options == NULL)
+		return 0;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, tokens, args)) {
+		case Opt_threads_single:
+			msblk->max_streams = 1;
+			break;
+		case Opt_threads_percpu:
+			msblk->max_streams = num_possible_cpus();
+			break;
+		case Opt_threads:
+			if (match_int(&args[0], &n) || n < 1 ||
+					n > num_possible_cpus()) {
+				ERROR("threads must be between 1 and %d\n",
+					num_possible_cpus());
+				return -EINVAL;
+			}
+			msblk->max_streams = n;
+			break;
+		default:
+			WARNING("ignoring unknown mount option \"%s\"\n", p);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+static int squashfs_stats_show(struct seq_file *m, void *v)
+{
+	struct squashfs_sb_info *msblk = m->private;
+
+	seq_printf(m, "streams %d\n", msblk->max_streams);
+	seq_printf(m, "stream_waits %ld\n",
+		atomic_long_read(&msblk->stream_waits));
+
+	return 0;
+}
+
+
+static int squashfs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, squashfs_stats_show, PDE(inode)->data);
+}
+
+
+static const struct file_operations squashfs_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = squashfs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
 static const struct squashfs_decompressor *supported_squashfs_filesystem(short
 	major, short minor, short id)
@@ -98,9 +188,12 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	msblk->devblksize = sb_min_blocksize(sb, BLOCK_SIZE);
 	msblk->devblksize_log2 = ffz(~msblk->devblksize);
 
-	mutex_init(&msblk->read_data_mutex);
 	mutex_init(&msblk->meta_index_mutex);
 
+	err = squashfs_parse_options(msblk, data);
+	if (err)
+		goto failed_mount;
+
 	/*
 	 * msblk->bytes_used is checked in squashfs_read_table to ensure reads
 	 * are not beyond filesystem end.  But as we're using
@@ -200,19 +293,20 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
-	/* Allocate read_page block */
+	/*
+	 * Allocate read_page block.  Datablocks are normally decompressed
+	 * straight into the page cache; this is only used when short of
+	 * memory.
+	 */
 	msblk->read_page = squashfs_cache_init("data", 1, msblk->block_size);
 	if (msblk->read_page == NULL) {
 		ERROR("Failed to allocate read_page block\n");
 		goto failed_mount;
 	}
 
-	msblk->stream = squashfs_decompressor_init(sb, flags);
-	if (IS_ERR(msblk->stream)) {
-		err = PTR_ERR(msblk->stream);
-		msblk->stream = NULL;
+	err = squashfs_decompressor_init(sb, flags);
+	if (err)
 		goto failed_mount;
-	}
 
 	/* Handle xattrs */
 	sb->s_xattr = squashfs_xattr_handlers;
@@ -324,6 +418,10 @@ check_directory_table:
 		goto failed_mount;
 	}
 
+	if (squashfs_proc_root)
+		proc_create_data(sb->s_id, S_IRUGO, squashfs_proc_root,
+			&squashfs_stats_fops, msblk);
+
 	TRACE("Leaving squashfs_fill_super\n");
 	kfree(sblk);
 	return 0;
@@ -332,7 +430,7 @@ failed_mount:
 	squashfs_cache_delete(msblk->block_cache);
 	squashfs_cache_delete(msblk->fragment_cache);
 	squashfs_cache_delete(msblk->read_page);
-	squashfs_decompressor_free(msblk, msblk->stream);
+	squashfs_decompressor_destroy(msblk);
 	kfree(msblk->inode_lookup_table);
 	kfree(msblk->fragment_index);
 	kfree(msblk->id_table);
@@ -372,14 +470,27 @@ static int squashfs_remount(struct super_block *sb, int *flags, char *data)
 }
 
 
+static int squashfs_show_options(struct seq_file *m, struct vfsmount *mnt)
+{
+	struct squashfs_sb_info *msblk = mnt->mnt_sb->s_fs_info;
+
+	if (msblk->max_streams > 1)
+		seq_printf(m, ",threads=%d", msblk->max_streams);
+
+	return 0;
+}
+
+
 static void squashfs_put_super(struct super_block *sb)
 {
 	if (sb->s_fs_info) {
 		struct squashfs_sb_info *sbi = sb->s_fs_info;
+		if (squashfs_proc_root)
+			remove_proc_entry(sb->s_id, squashfs_proc_root);
 		squashfs_cache_delete(sbi->block_cache);
 		squashfs_cache_delete(sbi->fragment_cache);
 		squashfs_cache_delete(sbi->read_page);
-		squashfs_decompressor_free(sbi, sbi->stream);
+		squashfs_decompressor_destroy(sbi);
 		kfree(sbi->id_table);
 		kfree(sbi->fragment_index);
 		kfree(sbi->meta_index);
@@ -432,8 +543,13 @@ static int __init init_squashfs_fs(void)
 	if (err)
 		return err;
 
+	/* Only the per mount stats live here, so carry on without it */
+	squashfs_proc_root = proc_mkdir("fs/squashfs", NULL);
+
 	err = register_filesystem(&squashfs_fs_type);
 	if (err) {
+		if (squashfs_proc_root)
+			remove_proc_entry("fs/squashfs", NULL);
 		destroy_inodecache();
 		return err;
 	}
@@ -448,6 +564,8 @@ static int __init init_squashfs_fs(void)
 static void __exit exit_squashfs_fs(void)
 {
 	unregister_filesystem(&squashfs_fs_type);
+	if (squashfs_proc_root)
+		remove_proc_entry("fs/squashfs", NULL);
 	destroy_inodecache();
 }
 
@@ -486,6 +604,7 @@ static const struct super_operations squashfs_super_ops = {
 	.alloc_inode = squashfs_alloc_inode,
 	.destroy_inode = squashfs_destroy_inode,
 	.statfs = squashfs_statfs,
+	.show_options = squashfs_show_options,
 	.put_super = squashfs_put_super,
 	.remount_fs = squashfs_remount
 };
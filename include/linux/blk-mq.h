@@ -0,0 +1,91 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+/*
+ * Multi-queue request path, see Documentation/block/blk-mq.txt.
+ */
+
+struct blk_mq_ctx;
+
+struct blk_mq_hw_ctx {
+	spinlock_t		lock;
+	struct list_head	dispatch;	/* requests the driver bounced */
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+
+	struct work_struct	run_work;
+
+	/* software queues feeding this context, and which have requests */
+	struct blk_mq_ctx	**ctxs;
+	unsigned int		nr_ctx;
+	unsigned long		*ctx_map;
+
+	/* tag allocator: one preallocated request per tag */
+	struct request		**rqs;
+	unsigned long		*tag_map;
+	unsigned int		queue_depth;
+	wait_queue_head_t	tag_wait;
+
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued to the driver */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* driver is out of resources */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end the request with -EIO */
+
+	BLK_MQ_S_STOPPED	= 0,
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+/*
+ * @last is true for the last request of the current run, so that a
+ * driver can notify the hardware once per batch.
+ */
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *, bool last);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	queue_rq_fn		*queue_rq;
+	init_hctx_fn		*init_hctx;	/* optional */
+	exit_hctx_fn		*exit_hctx;	/* optional */
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* requests per hardware queue */
+	unsigned int		cmd_size;	/* driver data behind each request */
+	int			numa_node;
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data);
+
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp);
+void blk_mq_free_request(struct request *rq);
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run);
+void blk_mq_end_io(struct request *rq, int error);
+
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+void blk_mq_run_queues(struct request_queue *q, bool async);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+void blk_mq_start_stopped_hw_queues(struct request_queue *q);
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+/* Driver private data allocated behind each request, see cmd_size */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *)(rq + 1);
+}
+
+#endif
@@ -30,6 +30,9 @@ struct request_pm_state;
 struct blk_trace;
 struct request;
 struct sg_io_hdr;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -81,6 +84,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;	/* software queue, multi-queue only */
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -126,6 +130,10 @@ struct request {
 #ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
+#endif
+#ifdef CONFIG_BLK_LATENCY_HIST
+	u64 hist_start_ns;		/* for the disk's latency histogram */
+	unsigned int hist_bytes;	/* size when passed to the driver */
 #endif
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -276,6 +284,7 @@ struct request_queue
 
 	request_fn_proc		*request_fn;
 	make_request_fn		*make_request_fn;
+	struct blk_mq_ops	*mq_ops;	/* set for multi-queue devices */
 	prep_rq_fn		*prep_rq_fn;
 	unprep_rq_fn		*unprep_rq_fn;
 	merge_bvec_fn		*merge_bvec_fn;
@@ -303,6 +312,15 @@ struct request_queue
 	 */
 	void			*queuedata;
 
+	/*
+	 * multi-queue: per-cpu software queues, hardware contexts, and
+	 * which hardware context serves each cpu
+	 */
+	struct blk_mq_ctx __percpu	*queue_ctx;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+	unsigned int		*mq_map;
+
 	/*
 	 * queue needs bounce pages for pages above this limit
 	 */
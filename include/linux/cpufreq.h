@@ -22,6 +22,8 @@
 #include <linux/cpumask.h>
 #include <asm/div64.h>
 
+struct task_struct;
+
 #define CPUFREQ_NAME_LEN 16
 
 
@@ -358,6 +360,24 @@ extern struct cpufreq_governor cpufreq_gov_ondemand;
 #elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_CONSERVATIVE)
 extern struct cpufreq_governor cpufreq_gov_conservative;
 #define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_conservative)
+#elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE)
+extern struct cpufreq_governor cpufreq_gov_interactive;
+#define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_interactive)
+#elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED)
+extern struct cpufreq_governor cpufreq_gov_sched;
+#define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_sched)
+#endif
+
+/* Idle and wakeup notifications for the interactive governor */
+#ifdef CONFIG_CPU_FREQ_GOV_INTERACTIVE
+void cpufreq_interactive_idle_start(void);
+void cpufreq_interactive_idle_end(void);
+void cpufreq_interactive_wakeup(struct task_struct *p, int cpu);
+#else
+static inline void cpufreq_interactive_idle_start(void) {}
+static inline void cpufreq_interactive_idle_end(void) {}
+static inline void cpufreq_interactive_wakeup(struct task_struct *p,
+					      int cpu) {}
 #endif
 
 
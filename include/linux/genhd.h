@@ -88,6 +88,34 @@ struct disk_stats {
 	unsigned long time_in_queue;
 };
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+/*
+ * Completion latency histograms, see Documentation/block/latency_hist.txt.
+ * Bucket 0 counts requests that took less than 1us, bucket n those that
+ * took [2^(n-1), 2^n) us; the last bucket is open ended.
+ */
+#define LAT_HIST_BUCKETS	24
+
+enum {
+	LAT_HIST_READ,
+	LAT_HIST_WRITE,
+	LAT_HIST_FLUSH,
+	LAT_HIST_OPS,
+};
+
+enum {
+	LAT_HIST_4K,			/* up to 4KiB */
+	LAT_HIST_32K,			/* up to 32KiB */
+	LAT_HIST_256K,			/* up to 256KiB */
+	LAT_HIST_LARGE,
+	LAT_HIST_SIZES,
+};
+
+struct disk_latency_hist {
+	unsigned long count[LAT_HIST_OPS][LAT_HIST_SIZES][LAT_HIST_BUCKETS];
+};
+#endif
+
 #define PARTITION_META_INFO_VOLNAMELTH	64
 #define PARTITION_META_INFO_UUIDLTH	16
 
@@ -189,6 +217,9 @@ struct gendisk {
 	struct disk_events *ev;
 #ifdef  CONFIG_BLK_DEV_INTEGRITY
 	struct blk_integrity *integrity;
+#endif
+#ifdef CONFIG_BLK_LATENCY_HIST
+	struct disk_latency_hist __percpu *lat_hist;
 #endif
 	int node_id;
 };
@@ -32,6 +32,9 @@ enum mem_cgroup_page_stat_item {
 	MEMCG_NR_FILE_MAPPED, /* # of pages charged as file rss */
 };
 
+/* Ultra KSM scan weight of a memory cgroup: 0 opts it out of scanning */
+#define MEM_CGROUP_UKSM_WEIGHT_MAX	100
+
 extern unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 					struct list_head *dst,
 					unsigned long *scanned, int order,
@@ -164,6 +167,14 @@ void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail);
 bool mem_cgroup_bad_page_check(struct page *page);
 void mem_cgroup_print_bad_page(struct page *page);
 #endif
+
+#ifdef CONFIG_UKSM
+struct mem_cgroup *mem_cgroup_uksm_get(struct mm_struct *mm);
+void mem_cgroup_uksm_put(struct mem_cgroup *mem);
+unsigned int mem_cgroup_uksm_weight(struct mm_struct *mm);
+void mem_cgroup_uksm_merged(struct mem_cgroup *mem, int val);
+void mem_cgroup_uksm_scanned(struct mem_cgroup *mem, unsigned long nr);
+#endif
 #else /* CONFIG_CGROUP_MEM_RES_CTLR */
 struct mem_cgroup;
 
@@ -377,6 +388,29 @@ static inline void mem_cgroup_replace_page_cache(struct page *oldpage,
 				struct page *newpage)
 {
 }
+
+static inline struct mem_cgroup *mem_cgroup_uksm_get(struct mm_struct *mm)
+{
+	return NULL;
+}
+
+static inline void mem_cgroup_uksm_put(struct mem_cgroup *mem)
+{
+}
+
+static inline unsigned int mem_cgroup_uksm_weight(struct mm_struct *mm)
+{
+	return MEM_CGROUP_UKSM_WEIGHT_MAX;
+}
+
+static inline void mem_cgroup_uksm_merged(struct mem_cgroup *mem, int val)
+{
+}
+
+static inline void mem_cgroup_uksm_scanned(struct mem_cgroup *mem,
+					   unsigned long nr)
+{
+}
 #endif /* CONFIG_CGROUP_MEM_CONT */
 
 #if !defined(CONFIG_CGROUP_MEM_RES_CTLR) || !defined(CONFIG_DEBUG_VM)
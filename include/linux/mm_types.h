@@ -335,6 +335,10 @@ struct mm_struct {
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
 #endif
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	/* hash for PROCESS_PRIVATE futexes, allocated on first use */
+	struct futex_hash_bucket *futex_hash;
+#endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
@@ -89,6 +89,23 @@ static inline bool mmc_op_multi(u32 opcode)
 	       opcode == MMC_READ_MULTIPLE_BLOCK;
 }
 
+/*
+ * MMC_SET_BLOCK_COUNT argument flags
+ */
+#define MMC_CMD23_ARG_REL_WR	(1 << 31)
+#define MMC_CMD23_ARG_PACKED	(1 << 30)
+
+/*
+ * Packed command header (first block of a packed transfer): one 32-bit
+ * little-endian word with the entry count, read/write and version, then
+ * a CMD23 and a CMD18/CMD25 argument pair for each entry.
+ */
+#define PACKED_CMD_VER		0x01
+#define PACKED_CMD_RD		0x01
+#define PACKED_CMD_WR		0x02
+#define PACKED_CMD_HDR_WORDS	128
+#define PACKED_CMD_MAX_ENTRIES	(PACKED_CMD_HDR_WORDS / 2 - 1)
+
 /*
  * MMC_SWITCH argument format:
  *
@@ -138,6 +155,7 @@ static inline bool mmc_op_multi(u32 opcode)
 #define R1_CURRENT_STATE(x)	((x & 0x00001E00) >> 9)	/* sx, b (4 bits) */
 #define R1_READY_FOR_DATA	(1 << 8)	/* sx, a */
 #define R1_SWITCH_ERROR		(1 << 7)	/* sx, c */
+#define R1_EXCEPTION_EVENT	(1 << 6)	/* sr, a */
 #define R1_APP_CMD		(1 << 5)	/* sr, c */
 
 /*
@@ -260,6 +278,10 @@ struct _mmc_csd {
  * EXT_CSD fields
  */
 
+#define EXT_CSD_PACKED_FAILURE_INDEX	35	/* RO */
+#define EXT_CSD_PACKED_CMD_STATUS	36	/* RO */
+#define EXT_CSD_EXP_EVENTS_STATUS	54	/* RO, 2 bytes */
+#define EXT_CSD_EXP_EVENTS_CTRL		56	/* R/W, 2 bytes */
 #define EXT_CSD_PARTITION_ATTRIBUTE	156	/* R/W */
 #define EXT_CSD_PARTITION_SUPPORT	160	/* RO */
 #define EXT_CSD_WR_REL_PARAM		166	/* RO */
@@ -283,6 +305,8 @@ struct _mmc_csd {
 #define EXT_CSD_SEC_ERASE_MULT		230	/* RO */
 #define EXT_CSD_SEC_FEATURE_SUPPORT	231	/* RO */
 #define EXT_CSD_TRIM_MULT		232	/* RO */
+#define EXT_CSD_MAX_PACKED_WRITES	500	/* RO */
+#define EXT_CSD_MAX_PACKED_READS	501	/* RO */
 
 /*
  * EXT_CSD field definitions
@@ -318,6 +342,12 @@ struct _mmc_csd {
 #define EXT_CSD_SEC_BD_BLK_EN	BIT(2)
 #define EXT_CSD_SEC_GB_CL_EN	BIT(4)
 
+#define EXT_CSD_PACKED_EVENT_EN		BIT(3)	/* EXP_EVENTS_CTRL */
+#define EXT_CSD_PACKED_FAILURE		BIT(3)	/* EXP_EVENTS_STATUS */
+
+#define EXT_CSD_PACKED_GENERIC_ERROR	BIT(0)	/* PACKED_CMD_STATUS */
+#define EXT_CSD_PACKED_INDEXED_ERROR	BIT(1)
+
 /*
  * MMC_SWITCH access modes
  */
@@ -830,6 +830,30 @@ enum cpu_idle_type {
 #define SCHED_POWER_SHIFT	10
 #define SCHED_POWER_SCALE	(1L << SCHED_POWER_SHIFT)
 
+#ifdef CONFIG_SMP
+/*
+ * Capacity requests: the fair class calls the registered function with
+ * the runqueue of @cpu locked and interrupts disabled whenever the CPU's
+ * utilisation changes at enqueue, dequeue or tick.  @util is the decaying
+ * average of the CPU's busy time at its current speed, from 0 to
+ * SCHED_POWER_SCALE.  One user at a time, typically a cpufreq governor.
+ */
+typedef void (*sched_capacity_fn)(int cpu, unsigned long util);
+
+extern int sched_register_capacity_fn(sched_capacity_fn fn);
+extern void sched_unregister_capacity_fn(sched_capacity_fn fn);
+extern unsigned long sched_cpu_util(int cpu);
+#endif
+
+#ifdef CONFIG_SCHED_HMP
+/*
+ * Relative compute capacity of a CPU, SCHED_POWER_SCALE for the fastest
+ * kind of core in the system.  Architectures with asymmetric cores
+ * override the default, which treats every CPU as equal.
+ */
+extern unsigned long arch_scale_cpu_capacity(int cpu);
+#endif
+
 /*
  * sched-domains (multiprocessor balancing) declarations:
  */
@@ -1105,6 +1129,7 @@ struct sched_class {
 	void (*post_schedule) (struct rq *this_rq);
 	void (*task_waking) (struct task_struct *task);
 	void (*task_woken) (struct rq *this_rq, struct task_struct *task);
+	void (*migrate_task_rq)(struct task_struct *p, int next_cpu);
 
 	void (*set_cpus_allowed)(struct task_struct *p,
 				 const struct cpumask *newmask);
@@ -1157,6 +1182,11 @@ struct sched_statistics {
 	u64			nr_failed_migrations_running;
 	u64			nr_failed_migrations_hot;
 	u64			nr_forced_migrations;
+#ifdef CONFIG_SCHED_HMP
+	u64			nr_failed_migrations_hmp;
+	u64			nr_hmp_up_migrations;
+	u64			nr_hmp_down_migrations;
+#endif
 
 	u64			nr_wakeups;
 	u64			nr_wakeups_sync;
@@ -1170,6 +1200,22 @@ struct sched_statistics {
 };
 #endif
 
+#ifdef CONFIG_SMP
+/*
+ * Decaying averages of the time an entity was runnable and running,
+ * maintained by the fair class (see kernel/sched_fair.c).  The sums are
+ * geometric series bounded by LOAD_AVG_MAX, so a u32 holds them.
+ */
+struct sched_avg {
+	u32 runnable_avg_sum, runnable_avg_period;
+	u32 running_avg_sum;
+	u64 last_runnable_update;
+	s64 decay_count;
+	unsigned long load_avg_contrib;
+	unsigned long util_avg_contrib;
+};
+#endif
+
 struct sched_entity {
 	struct load_weight	load;		/* for load-balancing */
 	struct rb_node		run_node;
@@ -1183,6 +1229,10 @@ struct sched_entity {
 
 	u64			nr_migrations;
 
+#ifdef CONFIG_SMP
+	struct sched_avg	avg;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	struct sched_statistics statistics;
 #endif
@@ -2070,6 +2120,12 @@ int sched_rt_handler(struct ctl_table *table, int write,
 		void __user *buffer, size_t *lenp,
 		loff_t *ppos);
 
+#ifdef CONFIG_SCHED_HMP
+extern unsigned int sysctl_sched_hmp_up_threshold;
+extern unsigned int sysctl_sched_hmp_down_threshold;
+extern unsigned int sysctl_sched_hmp_packing_limit;
+#endif
+
 #ifdef CONFIG_SCHED_AUTOGROUP
 extern unsigned int sysctl_sched_autogroup_enabled;
 
@@ -20,6 +20,23 @@ extern unsigned long zero_pfn __read_mostly;
 extern unsigned long uksm_zero_pfn __read_mostly;
 extern struct page *empty_uksm_zero_page;
 
+/*
+ * Page compare and zero-check kernels, see mm/uksm_simd.c. memcmp() and
+ * is_zero() take page aligned kernel addresses of a whole page.
+ */
+struct uksm_page_ops {
+	const char *name;
+	int (*usable)(void);	/* NULL: always usable */
+	int (*memcmp)(const void *p1, const void *p2);
+	int (*is_zero)(const void *p);
+	int prefer;		/* the highest usable one is selected */
+};
+
+extern const struct uksm_page_ops *const uksm_page_ops_list[];
+extern const struct uksm_page_ops *uksm_page_ops;
+extern void uksm_select_page_ops(void);
+extern u32 uksm_sample_hash(void *addr, u32 hash_strength);
+
 /* must be done before linked to mm */
 extern void uksm_vma_add_new(struct vm_area_struct *vma);
 extern void uksm_remove_vma(struct vm_area_struct *vma);
@@ -29,6 +46,7 @@ extern void uksm_remove_vma(struct vm_area_struct *vma);
 #define UKSM_SLOT_SCANNED     	(1 << 2) /* It's scanned in this round */
 #define UKSM_SLOT_FUL_SCANNED 	(1 << 3)
 #define UKSM_SLOT_IN_UKSM 	(1 << 4)
+#define UKSM_SLOT_SCANNING	(1 << 5) /* A scan thread is visiting it */
 
 struct vma_slot {
 	struct sradix_tree_node *snode;
@@ -46,6 +64,7 @@ struct vma_slot {
 	unsigned long pool_size;
 	struct vm_area_struct *vma;
 	struct mm_struct *mm;
+	struct mem_cgroup *memcg; /* merged pages are accounted to it */
 	unsigned long ctime_j;
 	unsigned long pages;
 	unsigned long flags;
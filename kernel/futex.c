@@ -50,6 +50,9 @@
 #include <linux/file.h>
 #include <linux/jhash.h>
 #include <linux/init.h>
+#include <linux/bootmem.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/futex.h>
 #include <linux/mount.h>
 #include <linux/pagemap.h>
@@ -68,8 +71,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Futex flags used to encode options to functions and preserve them across
  * restarts.
@@ -147,20 +148,135 @@ static const struct futex_q futex_q_init = {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The global table is sized at boot, 256 buckets per possible CPU, so
+ * that unrelated futexes rarely share a bucket lock on large machines.
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned long futex_hashsize __read_mostly;
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+static unsigned int futex_private_hashsize __read_mostly;
+
+/* mm->futex_hash of a process whose table could not be allocated */
+#define FUTEX_HASH_GLOBAL	((struct futex_hash_bucket *)1UL)
+#endif
+
+/*
+ * Hash bucket lock statistics, see /sys/kernel/debug/futex_stats.
+ * "collisions" counts waiters futex_wake() had to skip because they
+ * wait on another futex that hashed to the same bucket.
+ */
+struct futex_stats {
+	unsigned long lock_acquired;
+	unsigned long lock_contended;
+	unsigned long collisions;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+static DEFINE_PER_CPU(struct futex_stats, futex_stats);
+
+#define futex_stat_inc(field)	this_cpu_inc(futex_stats.field)
+
+static void futex_init_buckets(struct futex_hash_bucket *hb, unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		plist_head_init(&hb[i].chain, &hb[i].lock);
+		spin_lock_init(&hb[i].lock);
+	}
+}
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
+	struct futex_hash_bucket *queues = futex_queues;
+	unsigned long size = futex_hashsize;
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	if (!(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED)) &&
+	    key->private.mm) {
+		struct futex_hash_bucket *fh;
+
+		/* set up by get_futex_key() before any private key exists */
+		fh = ACCESS_ONCE(key->private.mm->futex_hash);
+		if (fh && fh != FUTEX_HASH_GLOBAL) {
+			queues = fh;
+			size = futex_private_hashsize;
+		}
+	}
+#endif
+	return &queues[hash & (size - 1)];
+}
+
+/*
+ * Lock a hash bucket, counting how often somebody else held it.
+ */
+static inline void hb_lock(struct futex_hash_bucket *hb)
+{
+	futex_stat_inc(lock_acquired);
+	if (unlikely(!spin_trylock(&hb->lock))) {
+		futex_stat_inc(lock_contended);
+		spin_lock(&hb->lock);
+	}
+}
+
+static inline void hb_lock_nested(struct futex_hash_bucket *hb)
+{
+	futex_stat_inc(lock_acquired);
+	if (unlikely(!spin_trylock(&hb->lock))) {
+		futex_stat_inc(lock_contended);
+		spin_lock_nested(&hb->lock, SINGLE_DEPTH_NESTING);
+	}
+}
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+void futex_mm_init(struct mm_struct *mm)
+{
+	mm->futex_hash = NULL;
+}
+
+void futex_mm_free(struct mm_struct *mm)
+{
+	if (mm->futex_hash && mm->futex_hash != FUTEX_HASH_GLOBAL)
+		free_page((unsigned long)mm->futex_hash);
+}
+
+/*
+ * Give @mm its private hash before its first private key is handed out,
+ * so that all private waiters of a process always use the same table.
+ * The table is a single page, which keeps the buckets cacheline aligned.
+ * If that page cannot be had, the process uses the global table for
+ * good rather than failing the futex call.
+ */
+static void futex_mm_hash_prepare(struct mm_struct *mm)
+{
+	struct futex_hash_bucket *fh;
+
+	if (likely(!mm || ACCESS_ONCE(mm->futex_hash)))
+		return;
+
+	fh = (void *)__get_free_page(GFP_KERNEL | __GFP_NOWARN);
+	if (fh)
+		futex_init_buckets(fh, futex_private_hashsize);
+	else
+		fh = FUTEX_HASH_GLOBAL;
+
+	if (cmpxchg(&mm->futex_hash, NULL, fh) && fh != FUTEX_HASH_GLOBAL)
+		free_page((unsigned long)fh);
+}
+#else
+static inline void futex_mm_hash_prepare(struct mm_struct *mm)
+{
 }
+#endif
 
 /*
  * Return 1 if two futex_keys are equal, 0 otherwise.
@@ -258,6 +374,7 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
 	if (!fshared) {
 		if (unlikely(!access_ok(VERIFY_WRITE, uaddr, sizeof(u32))))
 			return -EFAULT;
+		futex_mm_hash_prepare(mm);
 		key->private.mm = mm;
 		key->private.address = address;
 		get_futex_key_refs(key);
@@ -561,7 +678,7 @@ void exit_pi_state_list(struct task_struct *curr)
 		hb = hash_futex(&key);
 		raw_spin_unlock_irq(&curr->pi_lock);
 
-		spin_lock(&hb->lock);
+		hb_lock(hb);
 
 		raw_spin_lock_irq(&curr->pi_lock);
 		/*
@@ -957,12 +1074,12 @@ static inline void
 double_lock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2)
 {
 	if (hb1 <= hb2) {
-		spin_lock(&hb1->lock);
+		hb_lock(hb1);
 		if (hb1 < hb2)
-			spin_lock_nested(&hb2->lock, SINGLE_DEPTH_NESTING);
+			hb_lock_nested(hb2);
 	} else { /* hb1 > hb2 */
-		spin_lock(&hb2->lock);
-		spin_lock_nested(&hb1->lock, SINGLE_DEPTH_NESTING);
+		hb_lock(hb2);
+		hb_lock_nested(hb1);
 	}
 }
 
@@ -994,7 +1111,7 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 		goto out;
 
 	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 	head = &hb->chain;
 
 	plist_for_each_entry_safe(this, next, head, list) {
@@ -1011,6 +1128,8 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 			wake_futex(this);
 			if (++ret >= nr_wake)
 				break;
+		} else {
+			futex_stat_inc(collisions);
 		}
 	}
 
@@ -1495,7 +1614,7 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 	hb = hash_futex(&q->key);
 	q->lock_ptr = &hb->lock;
 
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 	return hb;
 }
 
@@ -2138,7 +2257,7 @@ retry:
 		goto out;
 
 	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 
 	/*
 	 * To avoid races, try to do the TID -> 0 atomic transition
@@ -2365,7 +2484,7 @@ static int futex_wait_requeue_pi(u32 __user *uaddr, unsigned int flags,
 		current->pi_blocked_on = PI_WAKEUP_INPROGRESS;
 		raw_spin_unlock_irq(&current->pi_lock);
 
-		spin_lock(&hb->lock);
+		hb_lock(hb);
 
 		/*
 		 * Clean up pi_blocked_on. We might leak it otherwise
@@ -2400,7 +2519,7 @@ static int futex_wait_requeue_pi(u32 __user *uaddr, unsigned int flags,
 		 * did a lock-steal - fix up the PI-state in that case.
 		 */
 		if (q.pi_state && (q.pi_state->owner != current)) {
-			spin_lock(&hb2->lock);
+			hb_lock(hb2);
 			BUG_ON(&hb2->lock != q.lock_ptr);
 			ret = fixup_pi_state_owner(uaddr2, &q, current);
 			spin_unlock(&hb2->lock);
@@ -2416,7 +2535,7 @@ static int futex_wait_requeue_pi(u32 __user *uaddr, unsigned int flags,
 		ret = rt_mutex_finish_proxy_lock(pi_mutex, to, &rt_waiter, 1);
 		debug_rt_mutex_free_waiter(&rt_waiter);
 
-		spin_lock(&hb2->lock);
+		hb_lock(hb2);
 		BUG_ON(&hb2->lock != q.lock_ptr);
 		/*
 		 * Fixup the pi_state owner and possibly acquire the lock if we
@@ -2788,8 +2907,8 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2804,11 +2923,71 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+	futex_init_buckets(futex_queues, futex_hashsize);
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	/* A few buckets per CPU, as many as fit in a page */
+	futex_private_hashsize = min_t(unsigned int,
+			roundup_pow_of_two(max(4 * num_possible_cpus(), 16U)),
+			rounddown_pow_of_two(PAGE_SIZE /
+					     sizeof(struct futex_hash_bucket)));
+#endif
 
 	return 0;
 }
 __initcall(futex_init);
+
+#ifdef CONFIG_DEBUG_FS
+static int futex_stats_show(struct seq_file *m, void *v)
+{
+	struct futex_stats sum = { 0, };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct futex_stats *st = &per_cpu(futex_stats, cpu);
+
+		sum.lock_acquired += st->lock_acquired;
+		sum.lock_contended += st->lock_contended;
+		sum.collisions += st->collisions;
+	}
+
+	seq_printf(m, "hash_buckets:    %lu\n", futex_hashsize);
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	seq_printf(m, "private_buckets: %u\n", futex_private_hashsize);
+#endif
+	seq_printf(m, "lock_acquired:   %lu\n", sum.lock_acquired);
+	seq_printf(m, "lock_contended:  %lu\n", sum.lock_contended);
+	seq_printf(m, "collisions:      %lu\n", sum.collisions);
+	return 0;
+}
+
+static int futex_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, futex_stats_show, NULL);
+}
+
+static const struct file_operations futex_stats_fops = {
+	.open		= futex_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init futex_debugfs_init(void)
+{
+	debugfs_create_file("futex_stats", S_IRUGO, NULL, NULL,
+			    &futex_stats_fops);
+	return 0;
+}
+late_initcall(futex_debugfs_init);
+#endif
@@ -72,6 +72,7 @@
 #include <linux/ftrace.h>
 #include <linux/slab.h>
 #include <linux/init_task.h>
+#include <linux/cpufreq.h>
 
 #include <asm/tlb.h>
 #include <asm/irq_regs.h>
@@ -334,6 +335,22 @@ struct cfs_rq {
 	unsigned int nr_spread_over;
 #endif
 
+#ifdef CONFIG_SMP
+	/*
+	 * Per-entity load tracking: the summed load and utilisation
+	 * contributions of queued entities, and of entities that went to
+	 * sleep here.  The latter decay with decay_counter until their
+	 * entities wake up; migrating sleepers leave theirs in removed_*.
+	 */
+	unsigned long runnable_load_avg, blocked_load_avg;
+	unsigned long utilization_load_avg, utilization_blocked_avg;
+	atomic64_t decay_counter;
+	u64 last_decay;
+	atomic_long_t removed_load, removed_util;
+
+	unsigned long util_request;	/* last capacity request (root) */
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	/* cpu runqueue to which this cfs_rq is attached */
 
@@ -515,6 +532,10 @@ struct rq {
 	int active_balance;
 	int push_cpu;
 	struct cpu_stop_work active_balance_work;
+#ifdef CONFIG_SCHED_HMP
+	/* heavy task waiting to be pushed to a fast CPU */
+	struct task_struct *hmp_up_task;
+#endif
 	/* cpu of this runqueue: */
 	int cpu;
 	int online;
@@ -2030,6 +2051,10 @@ static void update_rq_clock_task(struct rq *rq, s64 delta)
 
 #endif /* CONFIG_IRQ_TIME_ACCOUNTING */
 
+#ifdef CONFIG_SCHED_HMP
+static int __migrate_task(struct task_struct *p, int src_cpu, int dest_cpu);
+#endif
+
 #include "sched_idletask.c"
 #include "sched_fair.c"
 #include "sched_rt.c"
@@ -2223,6 +2248,8 @@ void set_task_cpu(struct task_struct *p, unsigned int new_cpu)
 	trace_sched_migrate_task(p, new_cpu);
 
 	if (task_cpu(p) != new_cpu) {
+		if (p->sched_class->migrate_task_rq)
+			p->sched_class->migrate_task_rq(p, new_cpu);
 		p->se.nr_migrations++;
 		perf_sw_event(PERF_COUNT_SW_CPU_MIGRATIONS, 1, 1, NULL, 0);
 	}
@@ -2754,6 +2781,10 @@ try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags)
 	ttwu_queue(p, cpu);
 stat:
 	ttwu_stat(p, cpu, wake_flags);
+	raw_spin_unlock_irqrestore(&p->pi_lock, flags);
+
+	cpufreq_interactive_wakeup(p, cpu);
+	return success;
 out:
 	raw_spin_unlock_irqrestore(&p->pi_lock, flags);
 
@@ -2813,6 +2844,10 @@ static void __sched_fork(struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+#ifdef CONFIG_SMP
+	memset(&p->se.avg, 0, sizeof(p->se.avg));
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
@@ -8216,6 +8251,8 @@ void __init sched_init_smp(void)
 	mutex_unlock(&sched_domains_mutex);
 	put_online_cpus();
 
+	init_sched_hmp();
+
 	hotcpu_notifier(cpuset_cpu_active, CPU_PRI_CPUSET_ACTIVE);
 	hotcpu_notifier(cpuset_cpu_inactive, CPU_PRI_CPUSET_INACTIVE);
 
@@ -8263,6 +8300,12 @@ static void init_cfs_rq(struct cfs_rq *cfs_rq, struct rq *rq)
 #ifndef CONFIG_64BIT
 	cfs_rq->min_vruntime_copy = cfs_rq->min_vruntime;
 #endif
+#ifdef CONFIG_SMP
+	/* blocked entities have a positive decay_count */
+	atomic64_set(&cfs_rq->decay_counter, 1);
+	atomic_long_set(&cfs_rq->removed_load, 0);
+	atomic_long_set(&cfs_rq->removed_util, 0);
+#endif
 }
 
 static void init_rt_rq(struct rt_rq *rt_rq, struct rq *rq)
@@ -8467,6 +8510,9 @@ void __init sched_init(void)
 		rq->active_balance = 0;
 		rq->next_balance = jiffies;
 		rq->push_cpu = 0;
+#ifdef CONFIG_SCHED_HMP
+		rq->hmp_up_task = NULL;
+#endif
 		rq->cpu = i;
 		rq->online = 0;
 		rq->idle_stamp = 0;
@@ -280,6 +280,10 @@ static void print_cpu(struct seq_file *m, int cpu)
 	P(cpu_load[2]);
 	P(cpu_load[3]);
 	P(cpu_load[4]);
+#ifdef CONFIG_SCHED_HMP
+	SEQ_printf(m, "  .%-30s: %lu%s\n", "hmp_capacity",
+		   hmp_cpu_capacity[cpu], hmp_cpu_is_slow(cpu) ? " (slow)" : "");
+#endif
 #undef P
 #undef PN
 
@@ -447,6 +451,11 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.statistics.nr_failed_migrations_running);
 	P(se.statistics.nr_failed_migrations_hot);
 	P(se.statistics.nr_forced_migrations);
+#ifdef CONFIG_SCHED_HMP
+	P(se.statistics.nr_failed_migrations_hmp);
+	P(se.statistics.nr_hmp_up_migrations);
+	P(se.statistics.nr_hmp_down_migrations);
+#endif
 	P(se.statistics.nr_wakeups);
 	P(se.statistics.nr_wakeups_sync);
 	P(se.statistics.nr_wakeups_migrate);
@@ -862,6 +862,731 @@ static inline void update_entity_shares_tick(struct cfs_rq *cfs_rq)
 }
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
+#ifdef CONFIG_SMP
+/*
+ * Per-entity load tracking.
+ *
+ * The time an entity is runnable (queued or running) is accounted in
+ * ~1ms (1024us) periods and kept as a geometric series
+ *
+ *   sum = u_0 + u_1*y + u_2*y^2 + ...
+ *
+ * where u_i is the time runnable in the i-th most recent period and y
+ * is chosen so that y^32 = 1/2: a period's weight halves every 32ms.
+ * The same series over all time (runnable_avg_period) normalizes it
+ * into the fraction of time runnable, which scaled by the entity's
+ * weight is its load contribution.  The time actually running gives,
+ * scaled to SCHED_POWER_SCALE, its utilisation contribution.
+ *
+ * A cfs_rq sums the contributions of its queued entities, and keeps
+ * those of entities that went to sleep on it as blocked load that
+ * decays until they wake up or migrate away.  Group entities carry
+ * the utilisation of their group's cfs_rq, so a CPU's utilisation is
+ * that of its root cfs_rq.
+ */
+#define LOAD_AVG_PERIOD	32
+#define LOAD_AVG_MAX	47742	/* maximum possible load avg */
+#define LOAD_AVG_MAX_N	345	/* periods needed to reach LOAD_AVG_MAX */
+
+/* Precomputed fixed inverse multiplies for multiplication by y^n */
+static const u32 runnable_avg_yN_inv[] = {
+	0xffffffff, 0xfa83b2da, 0xf5257d14, 0xefe4b99a, 0xeac0c6e6, 0xe5b906e6,
+	0xe0ccdeeb, 0xdbfbb796, 0xd744fcc9, 0xd2a81d91, 0xce248c14, 0xc9b9bd85,
+	0xc5672a10, 0xc12c4cc9, 0xbd08a39e, 0xb8fbaf46, 0xb504f333, 0xb123f581,
+	0xad583ee9, 0xa9a15ab4, 0xa5fed6a9, 0xa2704302, 0x9ef5325f, 0x9b8d39b9,
+	0x9837f050, 0x94f4efa8, 0x91c3d373, 0x8ea4398a, 0x8b95c1e3, 0x88980e80,
+	0x85aac367, 0x82cd8698,
+};
+
+/* Precomputed \Sum y^k { 1<=k<=n }, scaled by 1024 */
+static const u32 runnable_avg_yN_sum[] = {
+	    0, 1002, 1982, 2941, 3880, 4798, 5697, 6576, 7437, 8279, 9103,
+	 9909,10698,11470,12226,12966,13690,14398,15091,15769,16433,17082,
+	17718,18340,18949,19545,20128,20698,21256,21802,22336,22859,23371,
+};
+
+/* Decay @val by n periods: val * y^n */
+static __always_inline u64 decay_load(u64 val, u64 n)
+{
+	unsigned int local_n;
+
+	if (!n)
+		return val;
+	else if (unlikely(n > LOAD_AVG_PERIOD * 63))
+		return 0;
+
+	/* after bounds checking we can collapse to 32-bit */
+	local_n = n;
+
+	/* y^n = 1/2^(n/PERIOD) * y^(n%PERIOD) */
+	if (unlikely(local_n >= LOAD_AVG_PERIOD)) {
+		val >>= local_n / LOAD_AVG_PERIOD;
+		local_n %= LOAD_AVG_PERIOD;
+	}
+
+	val *= runnable_avg_yN_inv[local_n];
+	return val >> 32;
+}
+
+/*
+ * The contribution of n full periods of runnable time:
+ * 1024 * (y + y^2 + ... + y^n).
+ */
+static u32 __compute_runnable_contrib(u64 n)
+{
+	u32 contrib = 0;
+
+	if (likely(n <= LOAD_AVG_PERIOD))
+		return runnable_avg_yN_sum[n];
+	else if (unlikely(n >= LOAD_AVG_MAX_N))
+		return LOAD_AVG_MAX;
+
+	/* Sum over whole halving intervals, then the remainder */
+	do {
+		contrib /= 2;	/* y^LOAD_AVG_PERIOD = 1/2 */
+		contrib += runnable_avg_yN_sum[LOAD_AVG_PERIOD];
+		n -= LOAD_AVG_PERIOD;
+	} while (n > LOAD_AVG_PERIOD);
+
+	contrib = decay_load(contrib, n);
+	return contrib + runnable_avg_yN_sum[n];
+}
+
+/*
+ * Account the time since the last update as runnable and/or running
+ * and decay the sums if a period boundary was crossed.  Returns 1 if
+ * it was, so that the contributions need recomputing.
+ */
+static __always_inline int __update_entity_runnable_avg(u64 now,
+							struct sched_avg *sa,
+							int runnable,
+							int running)
+{
+	u64 delta, periods;
+	u32 contrib;
+	int delta_w, decayed = 0;
+
+	delta = now - sa->last_runnable_update;
+	/* clock_task can be set backwards on migration, see set_task_rq */
+	if ((s64)delta < 0) {
+		sa->last_runnable_update = now;
+		return 0;
+	}
+
+	/* Use 1024ns as the unit of measurement, it approximates 1us */
+	delta >>= 10;
+	if (!delta)
+		return 0;
+	sa->last_runnable_update = now;
+
+	/* Time already accumulated in the current, partial period */
+	delta_w = sa->runnable_avg_period % 1024;
+	if (delta + delta_w >= 1024) {
+		decayed = 1;
+
+		/* Complete the partial period */
+		delta_w = 1024 - delta_w;
+		if (runnable)
+			sa->runnable_avg_sum += delta_w;
+		if (running)
+			sa->running_avg_sum += delta_w;
+		sa->runnable_avg_period += delta_w;
+
+		delta -= delta_w;
+
+		/* Decay over the whole periods that passed */
+		periods = delta >> 10;
+		delta &= 1023;
+
+		sa->runnable_avg_sum = decay_load(sa->runnable_avg_sum,
+						  periods + 1);
+		sa->running_avg_sum = decay_load(sa->running_avg_sum,
+						 periods + 1);
+		sa->runnable_avg_period = decay_load(sa->runnable_avg_period,
+						     periods + 1);
+
+		contrib = __compute_runnable_contrib(periods);
+		if (runnable)
+			sa->runnable_avg_sum += contrib;
+		if (running)
+			sa->running_avg_sum += contrib;
+		sa->runnable_avg_period += contrib;
+	}
+
+	/* Remainder of delta accrued against the new period */
+	if (runnable)
+		sa->runnable_avg_sum += delta;
+	if (running)
+		sa->running_avg_sum += delta;
+	sa->runnable_avg_period += delta;
+
+	return decayed;
+}
+
+/* Bring a blocked entity's contributions up to date with its cfs_rq */
+static inline u64 __synchronize_entity_decay(struct sched_entity *se)
+{
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+	u64 decays = atomic64_read(&cfs_rq->decay_counter);
+
+	decays -= se->avg.decay_count;
+	if (!decays)
+		return 0;
+
+	se->avg.load_avg_contrib = decay_load(se->avg.load_avg_contrib, decays);
+	se->avg.util_avg_contrib = decay_load(se->avg.util_avg_contrib, decays);
+	se->avg.decay_count = 0;
+
+	return decays;
+}
+
+/* Compute the current contributions and return how much they changed */
+static long __update_entity_load_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.load_avg_contrib;
+	u64 contrib;
+
+	contrib = (u64)se->avg.runnable_avg_sum *
+		  scale_load_down(se->load.weight);
+	se->avg.load_avg_contrib = scale_load(div_u64(contrib,
+					se->avg.runnable_avg_period + 1));
+
+	return se->avg.load_avg_contrib - old_contrib;
+}
+
+static long __update_entity_util_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.util_avg_contrib;
+	struct cfs_rq *my_q = group_cfs_rq(se);
+
+	if (my_q)
+		se->avg.util_avg_contrib = min_t(unsigned long,
+				my_q->utilization_load_avg +
+				my_q->utilization_blocked_avg,
+				SCHED_POWER_SCALE);
+	else
+		se->avg.util_avg_contrib = se->avg.running_avg_sum *
+			SCHED_POWER_SCALE / (se->avg.runnable_avg_period + 1);
+
+	return se->avg.util_avg_contrib - old_contrib;
+}
+
+static inline void subtract_blocked_load_contrib(struct cfs_rq *cfs_rq,
+						 long load_contrib,
+						 long util_contrib)
+{
+	if (likely(load_contrib < cfs_rq->blocked_load_avg))
+		cfs_rq->blocked_load_avg -= load_contrib;
+	else
+		cfs_rq->blocked_load_avg = 0;
+
+	if (likely(util_contrib < cfs_rq->utilization_blocked_avg))
+		cfs_rq->utilization_blocked_avg -= util_contrib;
+	else
+		cfs_rq->utilization_blocked_avg = 0;
+}
+
+/* Update an entity's averages, and its cfs_rq's sums if @update_cfs_rq */
+static inline void update_entity_load_avg(struct sched_entity *se,
+					  int update_cfs_rq)
+{
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+	long load_delta, util_delta;
+
+	if (!__update_entity_runnable_avg(rq_of(cfs_rq)->clock_task, &se->avg,
+					  se->on_rq, cfs_rq->curr == se))
+		return;
+
+	load_delta = __update_entity_load_avg_contrib(se);
+	util_delta = __update_entity_util_avg_contrib(se);
+
+	if (!update_cfs_rq)
+		return;
+
+	if (se->on_rq) {
+		cfs_rq->runnable_load_avg += load_delta;
+		cfs_rq->utilization_load_avg += util_delta;
+	} else {
+		subtract_blocked_load_contrib(cfs_rq, -load_delta, -util_delta);
+	}
+}
+
+/*
+ * Decay the blocked load once per 2^20ns (~1ms) and fold in what
+ * migrated sleepers left behind.
+ */
+static void update_cfs_rq_blocked_load(struct cfs_rq *cfs_rq, int force_update)
+{
+	u64 now = rq_of(cfs_rq)->clock_task >> 20;
+	u64 decays;
+
+	decays = now - cfs_rq->last_decay;
+	if (!decays && !force_update)
+		return;
+
+	if (atomic_long_read(&cfs_rq->removed_load) ||
+	    atomic_long_read(&cfs_rq->removed_util)) {
+		long removed_load = atomic_long_xchg(&cfs_rq->removed_load, 0);
+		long removed_util = atomic_long_xchg(&cfs_rq->removed_util, 0);
+
+		subtract_blocked_load_contrib(cfs_rq, removed_load,
+					      removed_util);
+	}
+
+	if (decays) {
+		cfs_rq->blocked_load_avg = decay_load(cfs_rq->blocked_load_avg,
+						      decays);
+		cfs_rq->utilization_blocked_avg =
+			decay_load(cfs_rq->utilization_blocked_avg, decays);
+		atomic64_add(decays, &cfs_rq->decay_counter);
+		cfs_rq->last_decay = now;
+	}
+}
+
+static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se,
+					   int wakeup)
+{
+	/*
+	 * A decay_count <= 0 means the entity is new, or migrated: while
+	 * runnable (0) or while asleep, in which case it is minus the
+	 * decays it missed on its old cfs_rq.
+	 */
+	if (unlikely(se->avg.decay_count <= 0)) {
+		se->avg.last_runnable_update = rq_of(cfs_rq)->clock_task;
+		if (se->avg.decay_count) {
+			/* Account the sleep as not runnable */
+			se->avg.last_runnable_update -=
+				(-se->avg.decay_count) << 20;
+			update_entity_load_avg(se, 0);
+			se->avg.decay_count = 0;
+		}
+		wakeup = 0;
+	} else {
+		__synchronize_entity_decay(se);
+	}
+
+	/* Migrated entities did not contribute to our blocked load */
+	if (wakeup) {
+		subtract_blocked_load_contrib(cfs_rq,
+					      se->avg.load_avg_contrib,
+					      se->avg.util_avg_contrib);
+		update_entity_load_avg(se, 0);
+	}
+
+	cfs_rq->runnable_load_avg += se->avg.load_avg_contrib;
+	cfs_rq->utilization_load_avg += se->avg.util_avg_contrib;
+	/* we force update consideration on load-balancer moves */
+	update_cfs_rq_blocked_load(cfs_rq, !wakeup);
+}
+
+static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se,
+					   int sleep)
+{
+	update_entity_load_avg(se, 1);
+	/* we force update consideration on load-balancer moves */
+	update_cfs_rq_blocked_load(cfs_rq, !sleep);
+
+	cfs_rq->runnable_load_avg -= se->avg.load_avg_contrib;
+	cfs_rq->utilization_load_avg -= se->avg.util_avg_contrib;
+	if (sleep) {
+		cfs_rq->blocked_load_avg += se->avg.load_avg_contrib;
+		cfs_rq->utilization_blocked_avg += se->avg.util_avg_contrib;
+		se->avg.decay_count = atomic64_read(&cfs_rq->decay_counter);
+	}
+}
+
+/*
+ * Capacity requests, see sched_register_capacity_fn().  Only called
+ * with the rq lock held and interrupts disabled, so unregistering
+ * waits for callers with synchronize_sched().
+ */
+static sched_capacity_fn capacity_request_fn;
+
+static inline unsigned long cpu_util(struct rq *rq)
+{
+	return min_t(unsigned long, rq->cfs.utilization_load_avg +
+		     rq->cfs.utilization_blocked_avg, SCHED_POWER_SCALE);
+}
+
+static inline void update_capacity_request(struct rq *rq)
+{
+	sched_capacity_fn fn = ACCESS_ONCE(capacity_request_fn);
+	unsigned long util;
+
+	if (!fn)
+		return;
+
+	util = cpu_util(rq);
+	if (util == rq->cfs.util_request)
+		return;
+
+	rq->cfs.util_request = util;
+	fn(cpu_of(rq), util);
+}
+
+int sched_register_capacity_fn(sched_capacity_fn fn)
+{
+	if (cmpxchg(&capacity_request_fn, NULL, fn))
+		return -EBUSY;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sched_register_capacity_fn);
+
+void sched_unregister_capacity_fn(sched_capacity_fn fn)
+{
+	int cpu;
+
+	if (cmpxchg(&capacity_request_fn, fn, NULL) != fn)
+		return;
+
+	synchronize_sched();
+
+	/* Make the next user get a first request from every CPU */
+	for_each_possible_cpu(cpu)
+		cpu_rq(cpu)->cfs.util_request = ULONG_MAX;
+}
+EXPORT_SYMBOL_GPL(sched_unregister_capacity_fn);
+
+/* The CPU's utilisation at its current speed, 0..SCHED_POWER_SCALE */
+unsigned long sched_cpu_util(int cpu)
+{
+	return cpu_util(cpu_rq(cpu));
+}
+EXPORT_SYMBOL_GPL(sched_cpu_util);
+#else
+static inline void update_entity_load_avg(struct sched_entity *se,
+					  int update_cfs_rq) {}
+static inline void update_cfs_rq_blocked_load(struct cfs_rq *cfs_rq,
+					      int force_update) {}
+static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se,
+					   int wakeup) {}
+static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se,
+					   int sleep) {}
+static inline void update_capacity_request(struct rq *rq) {}
+#endif /* CONFIG_SMP */
+
+#ifdef CONFIG_SCHED_HMP
+/*
+ * Heterogeneous multi-processing (big.LITTLE) support.
+ *
+ * CPUs reporting the highest capacity are "fast", all others "slow".
+ * A task's load is the fraction of the recent past it spent runnable,
+ * from the per-entity tracking above.  Tasks above
+ * sysctl_sched_hmp_up_threshold are placed on fast CPUs at wakeup and
+ * pushed there from the tick if they become heavy while running on a
+ * slow one; tasks below sysctl_sched_hmp_down_threshold are placed on
+ * slow CPUs, packed onto the first one with room for them so that the
+ * others can stay idle.  Everything in between is left to the normal
+ * load balancer, which is only stopped from pulling heavy tasks back
+ * down to slow CPUs.
+ */
+unsigned int sysctl_sched_hmp_up_threshold = 700;
+unsigned int sysctl_sched_hmp_down_threshold = 256;
+/* utilisation of a slow CPU up to which light tasks are packed on it */
+unsigned int sysctl_sched_hmp_packing_limit = 800;
+
+static int hmp_enabled __read_mostly;
+static struct cpumask hmp_slow_cpus;
+static struct cpumask hmp_fast_cpus;
+static unsigned long hmp_cpu_capacity[NR_CPUS] __read_mostly;
+static unsigned long hmp_capacity_override[NR_CPUS] __initdata;
+
+unsigned long __weak arch_scale_cpu_capacity(int cpu)
+{
+	return SCHED_POWER_SCALE;
+}
+
+/*
+ * hmp_capacity=<cpulist>:<capacity> overrides what the architecture
+ * reports, e.g. "hmp_capacity=2-3:430" turns CPUs 2 and 3 of an
+ * ordinary SMP machine into slow CPUs.  May be given more than once.
+ */
+static int __init hmp_capacity_setup(char *str)
+{
+	static struct cpumask mask __initdata;
+	unsigned long capacity;
+	char *sep = strchr(str, ':');
+	int cpu;
+
+	if (!sep)
+		goto bad;
+	*sep = '\0';
+	if (cpulist_parse(str, &mask) || kstrtoul(sep + 1, 0, &capacity) ||
+	    !capacity || capacity > SCHED_POWER_SCALE) {
+		*sep = ':';
+		goto bad;
+	}
+
+	for_each_cpu(cpu, &mask)
+		hmp_capacity_override[cpu] = capacity;
+	return 1;
+
+bad:
+	pr_warn("HMP: ignoring invalid hmp_capacity=%s\n", str);
+	return 1;
+}
+__setup("hmp_capacity=", hmp_capacity_setup);
+
+static void __init init_sched_hmp(void)
+{
+	char fast[64], slow[64];
+	unsigned long max = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		unsigned long capacity = hmp_capacity_override[cpu];
+
+		if (!capacity)
+			capacity = arch_scale_cpu_capacity(cpu);
+		hmp_cpu_capacity[cpu] = capacity;
+		max = max(max, capacity);
+	}
+
+	for_each_possible_cpu(cpu) {
+		if (hmp_cpu_capacity[cpu] == max)
+			cpumask_set_cpu(cpu, &hmp_fast_cpus);
+		else
+			cpumask_set_cpu(cpu, &hmp_slow_cpus);
+	}
+
+	if (cpumask_empty(&hmp_slow_cpus))
+		return;
+
+	hmp_enabled = 1;
+	cpulist_scnprintf(fast, sizeof(fast), &hmp_fast_cpus);
+	cpulist_scnprintf(slow, sizeof(slow), &hmp_slow_cpus);
+	pr_info("HMP: fast CPUs %s, slow CPUs %s\n", fast, slow);
+}
+
+static inline int hmp_cpu_is_slow(int cpu)
+{
+	return cpumask_test_cpu(cpu, &hmp_slow_cpus);
+}
+
+/* Share of the recent past @p was runnable, 0..SCHED_POWER_SCALE */
+static inline unsigned long hmp_task_load(struct task_struct *p)
+{
+	struct sched_avg *sa = &p->se.avg;
+
+	return (sa->runnable_avg_sum << SCHED_POWER_SHIFT) /
+		(sa->runnable_avg_period + 1);
+}
+
+/*
+ * An idle fast CPU that @p may run on, or with !@idle_only the least
+ * utilised one; -1 if there is none.
+ */
+static int hmp_select_fast_cpu(struct task_struct *p, int idle_only)
+{
+	unsigned long util, min_util = ULONG_MAX;
+	int cpu, best = -1;
+
+	for_each_cpu_and(cpu, &hmp_fast_cpus, tsk_cpus_allowed(p)) {
+		if (!cpu_active(cpu))
+			continue;
+		if (idle_cpu(cpu))
+			return cpu;
+		if (idle_only)
+			continue;
+		util = cpu_util(cpu_rq(cpu));
+		if (util < min_util) {
+			min_util = util;
+			best = cpu;
+		}
+	}
+	return best;
+}
+
+/*
+ * The first slow CPU, in mask order, that @p fits on without going over
+ * sysctl_sched_hmp_packing_limit; failing that the least utilised one.
+ */
+static int hmp_pack_slow_cpu(struct task_struct *p)
+{
+	unsigned long util, min_util = ULONG_MAX;
+	unsigned long task_util = p->se.avg.util_avg_contrib;
+	int cpu, best = -1;
+
+	for_each_cpu_and(cpu, &hmp_slow_cpus, tsk_cpus_allowed(p)) {
+		if (!cpu_active(cpu))
+			continue;
+		util = cpu_util(cpu_rq(cpu));
+		/* a sleeper still counts in its old CPU's blocked load */
+		if (cpu == task_cpu(p))
+			util -= min(util, task_util);
+		if (util + task_util <= sysctl_sched_hmp_packing_limit)
+			return cpu;
+		if (util < min_util) {
+			min_util = util;
+			best = cpu;
+		}
+	}
+	return best;
+}
+
+/*
+ * Wakeup and exec placement: a CPU for @p, or -1 to leave the decision
+ * to the normal domain walk.
+ */
+static int hmp_select_task_rq(struct task_struct *p, int sd_flag, int prev_cpu)
+{
+	unsigned long load;
+	int cpu;
+
+	/* Nothing is known yet about a task that never ran */
+	if (!hmp_enabled || !(sd_flag & (SD_BALANCE_WAKE | SD_BALANCE_EXEC)) ||
+	    !p->se.avg.runnable_avg_period)
+		return -1;
+
+	load = hmp_task_load(p);
+	if (load >= sysctl_sched_hmp_up_threshold) {
+		if (!hmp_cpu_is_slow(prev_cpu) && idle_cpu(prev_cpu))
+			return prev_cpu;
+		cpu = hmp_select_fast_cpu(p, 0);
+		if (cpu >= 0 && hmp_cpu_is_slow(prev_cpu))
+			schedstat_inc(p, se.statistics.nr_hmp_up_migrations);
+		return cpu;
+	}
+
+	if (load < sysctl_sched_hmp_down_threshold) {
+		cpu = hmp_pack_slow_cpu(p);
+		if (cpu >= 0 && !hmp_cpu_is_slow(prev_cpu))
+			schedstat_inc(p, se.statistics.nr_hmp_down_migrations);
+		return cpu;
+	}
+
+	return -1;
+}
+
+/*
+ * Periodic balancing must not pull a task from a fast CPU to a slow one
+ * when it would be up-migrated again right away.
+ */
+static inline int hmp_can_migrate_task(struct task_struct *p, int this_cpu)
+{
+	if (!hmp_enabled || !hmp_cpu_is_slow(this_cpu) ||
+	    hmp_cpu_is_slow(task_cpu(p)))
+		return 1;
+
+	return hmp_task_load(p) < sysctl_sched_hmp_up_threshold;
+}
+
+/*
+ * Called from the tick with the rq lock held: if @p has become heavy on
+ * a slow CPU and a fast one is idle, remember it; the SCHED_SOFTIRQ then
+ * pushes it over with hmp_force_up_migration(), as the stopper cannot be
+ * woken under the rq lock.
+ */
+static void hmp_check_up_migration(struct rq *rq, struct task_struct *p)
+{
+	if (!hmp_enabled || !hmp_cpu_is_slow(cpu_of(rq)) ||
+	    rq->hmp_up_task || rq->active_balance)
+		return;
+
+	if (hmp_task_load(p) < sysctl_sched_hmp_up_threshold ||
+	    hmp_select_fast_cpu(p, 1) < 0)
+		return;
+
+	get_task_struct(p);
+	rq->hmp_up_task = p;
+}
+
+/* A task to push that no stopper has been queued for yet */
+static inline int hmp_up_pending(struct rq *rq)
+{
+	return rq->hmp_up_task != NULL && !rq->active_balance;
+}
+
+static int hmp_migration_cpu_stop(void *data)
+{
+	struct rq *rq = data;
+	struct task_struct *p;
+	int src_cpu = cpu_of(rq);
+	int dst_cpu;
+
+	raw_spin_lock_irq(&rq->lock);
+	p = rq->hmp_up_task;
+	dst_cpu = rq->push_cpu;
+	rq->hmp_up_task = NULL;
+	rq->active_balance = 0;
+	raw_spin_unlock(&rq->lock);
+
+	if (p && src_cpu == smp_processor_id() &&
+	    __migrate_task(p, src_cpu, dst_cpu) && task_cpu(p) == dst_cpu)
+		schedstat_inc(p, se.statistics.nr_hmp_up_migrations);
+	local_irq_enable();
+
+	if (p)
+		put_task_struct(p);
+	return 0;
+}
+
+static void hmp_force_up_migration(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	struct task_struct *p;
+	unsigned long flags;
+	int target = -1;
+
+	if (!rq->hmp_up_task)
+		return;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	p = rq->hmp_up_task;
+	/*
+	 * A stopper is queued: ours, which now owns hmp_up_task, or one
+	 * of active load balancing, after which we get our turn.
+	 */
+	if (!p || rq->active_balance) {
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+		return;
+	}
+
+	if (task_rq(p) == rq && p->on_rq &&
+	    p->sched_class == &fair_sched_class &&
+	    hmp_task_load(p) >= sysctl_sched_hmp_up_threshold)
+		target = hmp_select_fast_cpu(p, 1);
+
+	if (target >= 0) {
+		/* shares active_balance_work with active load balancing */
+		rq->active_balance = 1;
+		rq->push_cpu = target;
+	} else {
+		rq->hmp_up_task = NULL;
+	}
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	if (target >= 0)
+		stop_one_cpu_nowait(cpu, hmp_migration_cpu_stop, rq,
+				    &rq->active_balance_work);
+	else
+		put_task_struct(p);
+}
+#else
+static inline void init_sched_hmp(void) {}
+static inline int hmp_select_task_rq(struct task_struct *p, int sd_flag,
+				     int prev_cpu)
+{
+	return -1;
+}
+static inline int hmp_can_migrate_task(struct task_struct *p, int this_cpu)
+{
+	return 1;
+}
+static inline void hmp_check_up_migration(struct rq *rq,
+					  struct task_struct *p) {}
+static inline int hmp_up_pending(struct rq *rq)
+{
+	return 0;
+}
+static inline void hmp_force_up_migration(int cpu) {}
+#endif /* CONFIG_SCHED_HMP */
+
 static void enqueue_sleeper(struct cfs_rq *cfs_rq, struct sched_entity *se)
 {
 #ifdef CONFIG_SCHEDSTATS
@@ -983,6 +1708,7 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	 * Update run-time statistics of the 'current'.
 	 */
 	update_curr(cfs_rq);
+	enqueue_entity_load_avg(cfs_rq, se, flags & ENQUEUE_WAKEUP);
 	update_cfs_load(cfs_rq, 0);
 	account_entity_enqueue(cfs_rq, se);
 	update_cfs_shares(cfs_rq);
@@ -1054,6 +1780,7 @@ dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	 * Update run-time statistics of the 'current'.
 	 */
 	update_curr(cfs_rq);
+	dequeue_entity_load_avg(cfs_rq, se, flags & DEQUEUE_SLEEP);
 
 	update_stats_dequeue(cfs_rq, se);
 	if (flags & DEQUEUE_SLEEP) {
@@ -1144,6 +1871,8 @@ set_next_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
 		 */
 		update_stats_wait_end(cfs_rq, se);
 		__dequeue_entity(cfs_rq, se);
+		/* close the period in which it was waiting, not running */
+		update_entity_load_avg(se, 1);
 	}
 
 	update_stats_curr_start(cfs_rq, se);
@@ -1218,6 +1947,8 @@ static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 		update_stats_wait_start(cfs_rq, prev);
 		/* Put 'current' back into the tree. */
 		__enqueue_entity(cfs_rq, prev);
+		/* in !on_rq case, update occurred at dequeue */
+		update_entity_load_avg(prev, 1);
 	}
 	cfs_rq->curr = NULL;
 }
@@ -1230,6 +1961,12 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 	 */
 	update_curr(cfs_rq);
 
+	/*
+	 * Ensure that runnable average is periodically updated.
+	 */
+	update_entity_load_avg(curr, 1);
+	update_cfs_rq_blocked_load(cfs_rq, 1);
+
 	/*
 	 * Update share accounting for long-running entities.
 	 */
@@ -1340,8 +2077,10 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 
 		update_cfs_load(cfs_rq, 0);
 		update_cfs_shares(cfs_rq);
+		update_entity_load_avg(se, 1);
 	}
 
+	update_capacity_request(rq);
 	hrtick_update(rq);
 }
 
@@ -1380,8 +2119,12 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 
 		update_cfs_load(cfs_rq, 0);
 		update_cfs_shares(cfs_rq);
+		/* the first one may be the entity just dequeued */
+		if (se->on_rq)
+			update_entity_load_avg(se, 1);
 	}
 
+	update_capacity_request(rq);
 	hrtick_update(rq);
 }
 
@@ -1408,6 +2151,26 @@ static void task_waking_fair(struct task_struct *p)
 	se->vruntime -= min_vruntime;
 }
 
+/*
+ * Called from set_task_cpu() without the old rq lock: leave a sleeping
+ * task's blocked contribution for its old cfs_rq to drop at the next
+ * update, and remember how much decay it missed.  Runnable tasks have
+ * a decay_count of 0 and were already dequeued.
+ */
+static void migrate_task_rq_fair(struct task_struct *p, int next_cpu)
+{
+	struct sched_entity *se = &p->se;
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+
+	if (se->avg.decay_count > 0) {
+		se->avg.decay_count = -__synchronize_entity_decay(se);
+		atomic_long_add(se->avg.load_avg_contrib,
+				&cfs_rq->removed_load);
+		atomic_long_add(se->avg.util_avg_contrib,
+				&cfs_rq->removed_util);
+	}
+}
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 /*
  * effective_load() calculates the load change as seen from the root_task_group
@@ -1697,6 +2460,11 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 	int want_sd = 1;
 	int sync = wake_flags & WF_SYNC;
 
+	new_cpu = hmp_select_task_rq(p, sd_flag, prev_cpu);
+	if (new_cpu >= 0)
+		return new_cpu;
+	new_cpu = cpu;
+
 	if (sd_flag & SD_BALANCE_WAKE) {
 		if (cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
 			want_affine = 1;
@@ -2073,6 +2841,11 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 	}
 	*all_pinned = 0;
 
+	if (!hmp_can_migrate_task(p, this_cpu)) {
+		schedstat_inc(p, se.statistics.nr_failed_migrations_hmp);
+		return 0;
+	}
+
 	if (task_running(rq, p)) {
 		schedstat_inc(p, se.statistics.nr_failed_migrations_running);
 		return 0;
@@ -3902,6 +4675,29 @@ static void update_max_interval(void)
  *
  * Balancing parameters are set up in arch_init_sched_domains.
  */
+/*
+ * Keep decaying the blocked load of CPUs that see no fair class
+ * activity, e.g. while idle, so that their capacity requests drop.
+ */
+static void update_blocked_averages(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	struct cfs_rq *cfs_rq;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	update_rq_clock(rq);
+
+	rcu_read_lock();
+	for_each_leaf_cfs_rq(rq, cfs_rq)
+		update_cfs_rq_blocked_load(cfs_rq, 1);
+	rcu_read_unlock();
+	update_cfs_rq_blocked_load(&rq->cfs, 1);
+
+	update_capacity_request(rq);
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+}
+
 static void rebalance_domains(int cpu, enum cpu_idle_type idle)
 {
 	int balance = 1;
@@ -3913,6 +4709,7 @@ static void rebalance_domains(int cpu, enum cpu_idle_type idle)
 	int update_next_balance = 0;
 	int need_serialize;
 
+	update_blocked_averages(cpu);
 	update_shares(cpu);
 
 	rcu_read_lock();
@@ -4075,6 +4872,7 @@ static void run_rebalance_domains(struct softirq_action *h)
 	enum cpu_idle_type idle = this_rq->idle_at_tick ?
 						CPU_IDLE : CPU_NOT_IDLE;
 
+	hmp_force_up_migration(this_cpu);
 	rebalance_domains(this_cpu, idle);
 
 	/*
@@ -4096,7 +4894,7 @@ static inline int on_null_domain(int cpu)
 static inline void trigger_load_balance(struct rq *rq, int cpu)
 {
 	/* Don't need to rebalance while attached to NULL domain */
-	if (time_after_eq(jiffies, rq->next_balance) &&
+	if ((time_after_eq(jiffies, rq->next_balance) || hmp_up_pending(rq)) &&
 	    likely(!on_null_domain(cpu)))
 		raise_softirq(SCHED_SOFTIRQ);
 #ifdef CONFIG_NO_HZ
@@ -4138,6 +4936,9 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	update_capacity_request(rq);
+	hmp_check_up_migration(rq, curr);
 }
 
 /*
@@ -4227,6 +5028,19 @@ static void switched_from_fair(struct rq *rq, struct task_struct *p)
 		place_entity(cfs_rq, se, 0);
 		se->vruntime -= cfs_rq->min_vruntime;
 	}
+
+#ifdef CONFIG_SMP
+	/*
+	 * Drop our blocked contribution when leaving the fair class, and
+	 * don't carry an old decay_count back into it.
+	 */
+	if (se->avg.decay_count > 0) {
+		__synchronize_entity_decay(se);
+		subtract_blocked_load_contrib(cfs_rq, se->avg.load_avg_contrib,
+					      se->avg.util_avg_contrib);
+	}
+	se->avg.decay_count = 0;
+#endif
 }
 
 /*
@@ -4277,11 +5091,36 @@ static void task_move_group_fair(struct task_struct *p, int on_rq)
 	 * to another cgroup's rq. This does somewhat interfere with the
 	 * fair sleeper stuff for the first placement, but who cares.
 	 */
-	if (!on_rq)
-		p->se.vruntime -= cfs_rq_of(&p->se)->min_vruntime;
+	struct sched_entity *se = &p->se;
+	struct cfs_rq *cfs_rq;
+
+	if (!on_rq) {
+		cfs_rq = cfs_rq_of(se);
+		se->vruntime -= cfs_rq->min_vruntime;
+#ifdef CONFIG_SMP
+		/* Move a sleeper's blocked contribution to the new group */
+		if (se->avg.decay_count > 0) {
+			__synchronize_entity_decay(se);
+			subtract_blocked_load_contrib(cfs_rq,
+						      se->avg.load_avg_contrib,
+						      se->avg.util_avg_contrib);
+		}
+#endif
+	}
 	set_task_rq(p, task_cpu(p));
-	if (!on_rq)
-		p->se.vruntime += cfs_rq_of(&p->se)->min_vruntime;
+	if (!on_rq) {
+		cfs_rq = cfs_rq_of(se);
+		se->vruntime += cfs_rq->min_vruntime;
+#ifdef CONFIG_SMP
+		if (se->avg.decay_count >= 0) {
+			se->avg.decay_count =
+				atomic64_read(&cfs_rq->decay_counter);
+			cfs_rq->blocked_load_avg += se->avg.load_avg_contrib;
+			cfs_rq->utilization_blocked_avg +=
+				se->avg.util_avg_contrib;
+		}
+#endif
+	}
 }
 #endif
 
@@ -4322,6 +5161,7 @@ static const struct sched_class fair_sched_class = {
 	.rq_offline		= rq_offline_fair,
 
 	.task_waking		= task_waking_fair,
+	.migrate_task_rq	= migrate_task_rq_fair,
 #endif
 
 	.set_curr_task          = set_curr_task_fair,
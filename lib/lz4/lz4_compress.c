@@ -0,0 +1,132 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ * Copyright (C) 2011-2012, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * You can contact the author at :
+ * - LZ4 homepage : http://fastcompression.blogspot.com/p/lz4.html
+ * - LZ4 source repository : http://code.google.com/p/lz4/
+ *
+ * Changed for kernel use:
+ *  Single-pass greedy compressor writing the LZ4 block format, using a
+ *  hash table of 32-bit input offsets kept in caller-provided workmem.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *token;
+	size_t lit_len;
+
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+
+	if (src_len < LZ4_MIN_LENGTH)
+		goto last_literals;
+
+	while (ip <= mflimit) {
+		const unsigned char *ref, *p, *r;
+		size_t match_len;
+		u32 seq, h;
+
+		seq = LZ4_READ32(ip);
+		h = LZ4_HASH_VALUE(seq);
+		ref = src + hash_table[h];
+		hash_table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+				LZ4_READ32(ref) != seq) {
+			ip += 1 + ((ip - anchor) >> SKIP_STRENGTH);
+			continue;
+		}
+
+		/* Catch up: extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Extend the match forwards */
+		p = ip + MINMATCH;
+		r = ref + MINMATCH;
+		while (p < matchlimit && *p == *r) {
+			p++;
+			r++;
+		}
+		match_len = p - ip - MINMATCH;
+
+		/* Encode literal length and copy literals */
+		lit_len = ip - anchor;
+		token = op++;
+		if (lit_len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, lit_len - RUN_MASK);
+		} else
+			*token = lit_len << ML_BITS;
+		memcpy(op, anchor, lit_len);
+		op += lit_len;
+
+		/* Encode offset */
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Encode match length */
+		if (match_len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, match_len - ML_MASK);
+		} else
+			*token |= match_len;
+
+		ip = p;
+		anchor = ip;
+
+		/* Index the tail of the match to find adjacent repeats */
+		if (ip <= mflimit)
+			hash_table[LZ4_HASH_VALUE(LZ4_READ32(ip - 2))] =
+				ip - 2 - src;
+	}
+
+last_literals:
+	lit_len = iend - anchor;
+	token = op++;
+	if (lit_len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit_len - RUN_MASK);
+	} else
+		*token = lit_len << ML_BITS;
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL(lz4_compress);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
@@ -0,0 +1,106 @@
+/*
+ * LZ4 Decompressor for Linux kernel
+ * Copyright (C) 2011-2012, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * You can contact the author at :
+ * - LZ4 homepage : http://fastcompression.blogspot.com/p/lz4.html
+ * - LZ4 source repository : http://code.google.com/p/lz4/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dest;
+	unsigned char * const oend = dest + *dest_len;
+
+	for (;;) {
+		const unsigned char *ref;
+		unsigned int token, s;
+		size_t length, offset;
+
+		if (unlikely(ip >= iend))
+			goto malformed;
+
+		/* Literals */
+		token = *ip++;
+		length = token >> ML_BITS;
+		if (length == RUN_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto malformed;
+				s = *ip++;
+				length += s;
+				if (unlikely(length > (size_t)(oend - op)))
+					goto malformed;
+			} while (s == 255);
+		}
+
+		if (unlikely(length > (size_t)(iend - ip) ||
+				length > (size_t)(oend - op)))
+			goto malformed;
+		memcpy(op, ip, length);
+		ip += length;
+		op += length;
+
+		/* The block always ends with a literal run */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (unlikely(iend - ip < 2))
+			goto malformed;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dest)))
+			goto malformed;
+		ref = op - offset;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto malformed;
+				s = *ip++;
+				length += s;
+				if (unlikely(length > (size_t)(oend - op)))
+					goto malformed;
+			} while (s == 255);
+		}
+		length += MINMATCH;
+		if (unlikely(length > (size_t)(oend - op)))
+			goto malformed;
+
+		if (offset >= length) {
+			memcpy(op, ref, length);
+			op += length;
+		} else {
+			/* Overlapping copy: replicates the last offset bytes */
+			while (length--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dest_len = op - dest;
+	return 0;
+
+malformed:
+	return -1;
+}
+EXPORT_SYMBOL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,36 @@
+/*
+ * lz4defs.h -- architecture specific defines
+ *
+ * Copyright (C) 2011-2012, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+
+/* The last match must start at least MFLIMIT bytes before end of block */
+#define MFLIMIT		12
+/* ... and the last LASTLITERALS bytes are always stored as literals */
+#define LASTLITERALS	5
+#define LZ4_MIN_LENGTH	(MFLIMIT + 1)
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/*
+ * Incompressible regions are skipped faster the longer no match has
+ * been found since the last anchor.
+ */
+#define SKIP_STRENGTH	6
+
+#define LZ4_HASH_VALUE(seq) \
+	(((seq) * 2654435761U) >> (32 - LZ4_HASH_LOG))
+
+#define LZ4_READ32(p)	get_unaligned((const u32 *)(p))
@@ -60,6 +60,26 @@ const struct raid6_calls * const raid6_algos[] = {
 	&raid6_altivec4,
 	&raid6_altivec8,
 #endif
+#ifdef CONFIG_KERNEL_MODE_NEON
+	&raid6_neonx1,
+	&raid6_neonx2,
+	&raid6_neonx4,
+	&raid6_neonx8,
+#endif
+	NULL
+};
+
+void (*raid6_2data_recov)(int, size_t, int, int, void **);
+EXPORT_SYMBOL_GPL(raid6_2data_recov);
+
+void (*raid6_datap_recov)(int, size_t, int, void **);
+EXPORT_SYMBOL_GPL(raid6_datap_recov);
+
+const struct raid6_recov_calls * const raid6_recov_algos[] = {
+#ifdef CONFIG_KERNEL_MODE_NEON
+	&raid6_recov_neon,
+#endif
+	&raid6_recov_intx1,
 	NULL
 };
 
@@ -71,6 +91,24 @@ const struct raid6_calls * const raid6_algos[] = {
 #define time_before(x, y) ((x) < (y))
 #endif
 
+/* Recovery routines are picked by priority, they only differ in how
+   the multiplications are done */
+static void __init raid6_choose_recov(void)
+{
+	const struct raid6_recov_calls * const * algo;
+	const struct raid6_recov_calls * best;
+
+	for ( best = NULL, algo = raid6_recov_algos ; *algo ; algo++ )
+		if ( !best || (*algo)->priority > best->priority )
+			if ( !(*algo)->valid || (*algo)->valid() )
+				best = *algo;
+
+	raid6_2data_recov = best->data2;
+	raid6_datap_recov = best->datap;
+
+	printk("raid6: using %s recovery algorithm\n", best->name);
+}
+
 /* Try to pick the best algorithm */
 /* This code uses the gfmul table as convenient data set to abuse */
 
@@ -140,6 +178,8 @@ int __init raid6_select_algo(void)
 
 	free_pages((unsigned long)syndromes, 1);
 
+	raid6_choose_recov();
+
 	return best ? 0 : -EINVAL;
 }
 
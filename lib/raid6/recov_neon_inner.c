@@ -0,0 +1,112 @@
+/*
+ * raid6/recov_neon_inner.c
+ *
+ * NEON inner loops of the RAID-6 dual failure recovery in recov_neon.c.
+ * Like neon$#.c, this file is built with -mfpu=neon and must not include
+ * kernel headers.
+ *
+ * The multiplications by a constant are done 16 bytes at a time with
+ * raid6_vgfmul[] tables: the products of the low and of the high nibble
+ * are looked up separately with vtbl and xored together.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <arm_neon.h>
+
+void __raid6_2data_recov_neon(int bytes, uint8_t *p, uint8_t *q, uint8_t *dp,
+			      uint8_t *dq, const uint8_t *pbmul,
+			      const uint8_t *qmul);
+void __raid6_datap_recov_neon(int bytes, uint8_t *p, uint8_t *q, uint8_t *dq,
+			      const uint8_t *qmul);
+
+/*
+ * 16-entry table lookup.  ARMv7 only has the 8-byte wide vtbl, so look
+ * up each half of @x in the 16-byte table @m.
+ */
+static inline uint8x16_t vtbl16(uint8x8x2_t m, uint8x16_t x)
+{
+	return vcombine_u8(vtbl2_u8(m, vget_low_u8(x)),
+			   vtbl2_u8(m, vget_high_u8(x)));
+}
+
+static inline uint8x8x2_t vld_tbl(const uint8_t *t)
+{
+	uint8x8x2_t m;
+
+	m.val[0] = vld1_u8(t);
+	m.val[1] = vld1_u8(t + 8);
+	return m;
+}
+
+/* Multiply each byte of @x by the constant whose tables are @lo/@hi. */
+static inline uint8x16_t gfmul16(uint8x8x2_t lo, uint8x8x2_t hi,
+				 uint8x16_t x)
+{
+	const uint8x16_t x0f = vdupq_n_u8(0x0f);
+
+	return veorq_u8(vtbl16(lo, vandq_u8(x, x0f)),
+			vtbl16(hi, vshrq_n_u8(x, 4)));
+}
+
+void __raid6_2data_recov_neon(int bytes, uint8_t *p, uint8_t *q, uint8_t *dp,
+			      uint8_t *dq, const uint8_t *pbmul,
+			      const uint8_t *qmul)
+{
+	uint8x8x2_t pm0 = vld_tbl(pbmul), pm1 = vld_tbl(pbmul + 16);
+	uint8x8x2_t qm0 = vld_tbl(qmul), qm1 = vld_tbl(qmul + 16);
+
+	/*
+	 * while ( bytes-- ) {
+	 *	px    = *p ^ *dp;
+	 *	qx    = qmul[*q ^ *dq];
+	 *	*dq++ = db = pbmul[px] ^ qx;
+	 *	*dp++ = db ^ px;
+	 *	p++; q++;
+	 * }
+	 */
+	while (bytes) {
+		uint8x16_t px, qx, db;
+
+		px = veorq_u8(vld1q_u8(p), vld1q_u8(dp));
+		qx = gfmul16(qm0, qm1, veorq_u8(vld1q_u8(q), vld1q_u8(dq)));
+		db = veorq_u8(gfmul16(pm0, pm1, px), qx);
+
+		vst1q_u8(dq, db);
+		vst1q_u8(dp, veorq_u8(db, px));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dp += 16;
+		dq += 16;
+	}
+}
+
+void __raid6_datap_recov_neon(int bytes, uint8_t *p, uint8_t *q, uint8_t *dq,
+			      const uint8_t *qmul)
+{
+	uint8x8x2_t qm0 = vld_tbl(qmul), qm1 = vld_tbl(qmul + 16);
+
+	/*
+	 * while ( bytes-- ) {
+	 *	*p++ ^= *dq = qmul[*q ^ *dq];
+	 *	q++; dq++;
+	 * }
+	 */
+	while (bytes) {
+		uint8x16_t vx;
+
+		vx = gfmul16(qm0, qm1, veorq_u8(vld1q_u8(q), vld1q_u8(dq)));
+
+		vst1q_u8(dq, vx);
+		vst1q_u8(p, veorq_u8(vx, vld1q_u8(p)));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dq += 16;
+	}
+}
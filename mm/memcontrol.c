@@ -86,6 +86,9 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_RSS,	   /* # of pages charged as anon rss */
 	MEM_CGROUP_STAT_FILE_MAPPED,  /* # of pages charged as file rss */
 	MEM_CGROUP_STAT_SWAPOUT, /* # of pages, swapped out */
+#ifdef CONFIG_UKSM
+	MEM_CGROUP_STAT_UKSM_MERGED, /* # of pages merged by uksm */
+#endif
 	MEM_CGROUP_STAT_DATA, /* end of data requires synchronization */
 	MEM_CGROUP_ON_MOVE,	/* someone is moving account between groups */
 	MEM_CGROUP_STAT_NSTATS,
@@ -97,6 +100,9 @@ enum mem_cgroup_events_index {
 	MEM_CGROUP_EVENTS_COUNT,	/* # of pages paged in/out */
 	MEM_CGROUP_EVENTS_PGFAULT,	/* # of page-faults */
 	MEM_CGROUP_EVENTS_PGMAJFAULT,	/* # of major page-faults */
+#ifdef CONFIG_UKSM
+	MEM_CGROUP_EVENTS_UKSM_SCANNED,	/* # of pages scanned by uksm */
+#endif
 	MEM_CGROUP_EVENTS_NSTATS,
 };
 /*
@@ -250,6 +256,10 @@ struct mem_cgroup {
 	atomic_t	refcnt;
 
 	unsigned int	swappiness;
+#ifdef CONFIG_UKSM
+	/* share of the uksm scan budget, 0..MEM_CGROUP_UKSM_WEIGHT_MAX */
+	unsigned int	uksm_weight;
+#endif
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
@@ -4144,6 +4154,10 @@ enum {
 	MCS_INACTIVE_FILE,
 	MCS_ACTIVE_FILE,
 	MCS_UNEVICTABLE,
+#ifdef CONFIG_UKSM
+	MCS_UKSM_MERGED,
+	MCS_UKSM_SCANNED,
+#endif
 	NR_MCS_STAT,
 };
 
@@ -4167,7 +4181,11 @@ struct {
 	{"active_anon", "total_active_anon"},
 	{"inactive_file", "total_inactive_file"},
 	{"active_file", "total_active_file"},
-	{"unevictable", "total_unevictable"}
+	{"unevictable", "total_unevictable"},
+#ifdef CONFIG_UKSM
+	{"uksm_merged", "total_uksm_merged"},
+	{"uksm_scanned", "total_uksm_scanned"},
+#endif
 };
 
 
@@ -4207,6 +4225,13 @@ mem_cgroup_get_local_stat(struct mem_cgroup *mem, struct mcs_total_stat *s)
 	s->stat[MCS_ACTIVE_FILE] += val * PAGE_SIZE;
 	val = mem_cgroup_get_local_zonestat(mem, LRU_UNEVICTABLE);
 	s->stat[MCS_UNEVICTABLE] += val * PAGE_SIZE;
+
+#ifdef CONFIG_UKSM
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_UKSM_MERGED);
+	s->stat[MCS_UKSM_MERGED] += val * PAGE_SIZE;
+	val = mem_cgroup_read_events(mem, MEM_CGROUP_EVENTS_UKSM_SCANNED);
+	s->stat[MCS_UKSM_SCANNED] += val;
+#endif
 }
 
 static void
@@ -4366,6 +4391,83 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+#ifdef CONFIG_UKSM
+/*
+ * Ultra KSM scans anonymous memory on its own, with one global CPU
+ * budget. Each VMA it tracks holds a reference on the cgroup of its mm
+ * from the time the VMA is created, which the merged pages of the VMA
+ * stay accounted to, like charges are when move_charge_at_immigrate is
+ * off. The scan weight is looked up each time the VMA is visited, so it
+ * follows tasks moving between cgroups.
+ */
+struct mem_cgroup *mem_cgroup_uksm_get(struct mm_struct *mm)
+{
+	struct mem_cgroup *mem;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (mem)
+		mem_cgroup_get(mem);
+	rcu_read_unlock();
+
+	return mem;
+}
+
+void mem_cgroup_uksm_put(struct mem_cgroup *mem)
+{
+	if (mem)
+		mem_cgroup_put(mem);
+}
+
+unsigned int mem_cgroup_uksm_weight(struct mm_struct *mm)
+{
+	struct mem_cgroup *mem;
+	unsigned int weight = MEM_CGROUP_UKSM_WEIGHT_MAX;
+
+	if (mem_cgroup_disabled())
+		return weight;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (mem)
+		weight = mem->uksm_weight;
+	rcu_read_unlock();
+
+	return weight;
+}
+
+void mem_cgroup_uksm_merged(struct mem_cgroup *mem, int val)
+{
+	if (mem)
+		this_cpu_add(mem->stat->count[MEM_CGROUP_STAT_UKSM_MERGED], val);
+}
+
+void mem_cgroup_uksm_scanned(struct mem_cgroup *mem, unsigned long nr)
+{
+	if (mem)
+		this_cpu_add(mem->stat->events[MEM_CGROUP_EVENTS_UKSM_SCANNED],
+			     nr);
+}
+
+static u64 mem_cgroup_uksm_weight_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return mem_cgroup_from_cont(cgrp)->uksm_weight;
+}
+
+static int mem_cgroup_uksm_weight_write(struct cgroup *cgrp,
+					struct cftype *cft, u64 val)
+{
+	if (val > MEM_CGROUP_UKSM_WEIGHT_MAX)
+		return -EINVAL;
+
+	mem_cgroup_from_cont(cgrp)->uksm_weight = val;
+	return 0;
+}
+#endif /* CONFIG_UKSM */
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -4778,6 +4880,13 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_swappiness_read,
 		.write_u64 = mem_cgroup_swappiness_write,
 	},
+#ifdef CONFIG_UKSM
+	{
+		.name = "uksm_weight",
+		.read_u64 = mem_cgroup_uksm_weight_read,
+		.write_u64 = mem_cgroup_uksm_weight_write,
+	},
+#endif
 	{
 		.name = "move_charge_at_immigrate",
 		.read_u64 = mem_cgroup_move_charge_read,
@@ -5058,6 +5167,10 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 
 	if (parent)
 		mem->swappiness = get_swappiness(parent);
+#ifdef CONFIG_UKSM
+	mem->uksm_weight = parent ? parent->uksm_weight :
+				    MEM_CGROUP_UKSM_WEIGHT_MAX;
+#endif
 	atomic_set(&mem->refcnt, 1);
 	mem->move_charge_at_immigrate = 0;
 	mutex_init(&mem->thresholds_lock);
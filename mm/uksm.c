@@ -28,8 +28,9 @@
  *
  *
  * 5. Misc changes upon KSM:
- *      * It has a fully x86-opitmized memcmp dedicated for 4-byte-aligned page
- *        comparison. It's much faster than default C version on x86.
+ *      * Page comparison and zero page checks use SSE2/AVX2 on x86 and NEON
+ *        on ARM when available (see uksm_simd.c), falling back to a
+ *        word-wise rep-cmps version on older x86.
  *      * rmap_item now has an struct *page member to loosely cache a
  *        address-->page mapping, which reduces too much time-costly
  *        follow_page().
@@ -40,10 +41,20 @@
  * 6. Full Zero Page consideration(contributed by Figo Zhang)
  *    Now uksmd consider full zero pages as special pages and merge them to an
  *    special unswappable uksm zero page.
+ *
+ * 7. Parallel scanning:
+ *    The slots of the scan ladder can be visited by several threads at once,
+ *    one per NUMA node in turn. /sys/kernel/mm/uksm/thread_num sets how many,
+ *    thread_stats shows what each of them did.
+ *
+ * 8. Memory cgroup awareness:
+ *    memory.uksm_weight sets the share of the scan budget of a memory cgroup,
+ *    or opts it out with 0. memory.stat shows what was scanned and merged.
  */
 
 #include <linux/errno.h>
 #include <linux/mm.h>
+#include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/mman.h>
 #include <linux/sched.h>
@@ -61,6 +72,7 @@
 #include <linux/mmu_notifier.h>
 #include <linux/swap.h>
 #include <linux/ksm.h>
+#include <linux/memcontrol.h>
 #include <linux/crypto.h>
 #include <linux/scatterlist.h>
 #include <crypto/hash.h>
@@ -69,117 +81,11 @@
 #include <linux/gcd.h>
 #include <linux/freezer.h>
 #include <linux/sradix-tree.h>
+#include <linux/prefetch.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
 
-#ifdef CONFIG_X86
-#undef memcmp
-
-#ifdef CONFIG_X86_32
-#define memcmp memcmpx86_32
-/*
- * Compare 4-byte-aligned address s1 and s2, with length n
- */
-int memcmpx86_32(void *s1, void *s2, size_t n)
-{
-	size_t num = n / 4;
-	register int res;
-
-	__asm__ __volatile__
-	(
-	 "testl %3,%3\n\t"
-	 "repe; cmpsd\n\t"
-	 "je        1f\n\t"
-	 "sbbl      %0,%0\n\t"
-	 "orl       $1,%0\n"
-	 "1:"
-	 : "=&a" (res), "+&S" (s1), "+&D" (s2), "+&c" (num)
-	 : "0" (0)
-	 : "cc");
-
-	return res;
-}
-
-/*
- * Check the page is all zero ?
- */
-static int is_full_zero(const void *s1, size_t len)
-{
-	unsigned char same;
-
-	len /= 4;
-
-	__asm__ __volatile__
-	("repe; scasl;"
-	 "sete %0"
-	 : "=qm" (same), "+D" (s1), "+c" (len)
-	 : "a" (0)
-	 : "cc");
-
-	return same;
-}
-
-
-#elif defined(CONFIG_X86_64)
-#define memcmp memcmpx86_64
-/*
- * Compare 8-byte-aligned address s1 and s2, with length n
- */
-int memcmpx86_64(void *s1, void *s2, size_t n)
-{
-	size_t num = n / 8;
-	register int res;
-
-	__asm__ __volatile__
-	(
-	 "testq %q3,%q3\n\t"
-	 "repe; cmpsq\n\t"
-	 "je        1f\n\t"
-	 "sbbq      %q0,%q0\n\t"
-	 "orq       $1,%q0\n"
-	 "1:"
-	 : "=&a" (res), "+&S" (s1), "+&D" (s2), "+&c" (num)
-	 : "0" (0)
-	 : "cc");
-
-	return res;
-}
-
-static int is_full_zero(const void *s1, size_t len)
-{
-	unsigned char same;
-
-	len /= 8;
-
-	__asm__ __volatile__
-	("repe; scasq;"
-	 "sete %0"
-	 : "=qm" (same), "+D" (s1), "+c" (len)
-	 : "a" (0)
-	 : "cc");
-
-	return same;
-}
-
-#endif
-#else
-static int is_full_zero(const void *s1, size_t len)
-{
-	unsigned long *src = s1;
-	int i;
-
-	len /= sizeof(*src);
-
-	for (i = 0; i < len; i++) {
-		if (src[i])
-			return 0;
-	}
-
-	return 1;
-}
-#endif
-
 #define U64_MAX		(~((u64)0))
 #define UKSM_RUNG_ROUND_FINISHED  (1 << 0)
 #define TIME_RATIO_SCALE	10000
@@ -437,6 +343,12 @@ struct rmap_list_entry {
 #define STABLE_FLAG	0x2
 #define get_rmap_addr(x)	((x)->address & PAGE_MASK)
 
+/* The unstable tree shard of an UNSTABLE_FLAG item is kept above the flags */
+#define SHARD_SHIFT		2
+#define address_shard(addr)	\
+	(&unstable_shards[((addr) >> SHARD_SHIFT) & (UNSTABLE_SHARDS - 1)])
+#define rmap_item_shard(x)	address_shard((x)->address)
+
 /*
  * rmap_list_entry helpers
  */
@@ -499,7 +411,7 @@ static unsigned long uksm_pages_shared;
 static unsigned long uksm_pages_sharing;
 
 /* The number of nodes in the unstable tree */
-static unsigned long uksm_pages_unshared;
+static atomic_long_t uksm_pages_unshared = ATOMIC_LONG_INIT(0);
 
 /*
  * Milliseconds ksmd should sleep between scans,
@@ -567,6 +479,52 @@ static unsigned int uksm_run = 1;
 static DECLARE_WAIT_QUEUE_HEAD(uksm_thread_wait);
 static DEFINE_MUTEX(uksm_thread_mutex);
 
+/*
+ * Scan threads. uksmd is thread 0: it sleeps, does the per round work and
+ * scans its share of a period. The others only scan, each bound to the
+ * CPUs of one NUMA node. In a scan period all of them pull slot visits
+ * from the ladder under uksm_ladder_mutex; a slot is only ever scanned by
+ * one thread at a time (UKSM_SLOT_SCANNING), so its rmap_list needs no
+ * further locking. uksmd waits for the others before it touches the
+ * ladder, the trees or the hash strength on its own again.
+ */
+#define UKSM_THREADS_MAX	32
+
+struct uksm_thread {
+	struct task_struct *task;
+	int node;		/* bound to this node's CPUs, -1 if unbound */
+	unsigned long seq;	/* last scan period it took part in */
+
+	/* under uksm_ladder_mutex */
+	u64 pages_scanned;
+	u64 pages_merged;
+	u64 exec_ns;
+
+	/* this period, read by uksmd once everyone is done */
+	unsigned long vpages;
+	u64 period_ns;
+};
+
+static struct uksm_thread uksm_threads[UKSM_THREADS_MAX];
+static unsigned int uksm_thread_num = 1;
+
+static unsigned long uksm_scan_seq;
+static atomic_t uksm_threads_busy;
+static DECLARE_WAIT_QUEUE_HEAD(uksm_scan_start_wait);
+static DECLARE_WAIT_QUEUE_HEAD(uksm_scan_done_wait);
+static DEFINE_MUTEX(uksm_ladder_mutex);
+
+/*
+ * The stable tree, its node_vma lists and uksm_pages_shared/sharing are
+ * protected by uksm_stable_mutex. The unstable tree is split by hash range
+ * into shards with a mutex each, so threads merging pages of different
+ * hashes do not serialize. Lock order: shard, uksm_stable_mutex, page lock.
+ *
+ * Counters feeding the hash strength adjustment are under uksm_stat_lock.
+ */
+static DEFINE_MUTEX(uksm_stable_mutex);
+static DEFINE_SPINLOCK(uksm_stat_lock);
+
 /*
  * List vma_slot_new is for newly created vma_slot waiting to be added by
  * ksmd. If one cannot be added(e.g. due to it's too small), it's moved to
@@ -578,15 +536,26 @@ struct list_head vma_slot_noadd = LIST_HEAD_INIT(vma_slot_noadd);
 struct list_head vma_slot_del = LIST_HEAD_INIT(vma_slot_del);
 static DEFINE_SPINLOCK(vma_slot_list_lock);
 
-/* The unstable tree heads */
-static struct rb_root root_unstable_tree = RB_ROOT;
-
 /*
- * All tree_nodes are in a list to be freed at once when unstable tree is
- * freed after each scan round.
+ * The unstable tree shards, indexed by the top bits of the hash. All
+ * tree_nodes of a shard are in a list to be freed at once when the
+ * unstable tree is freed after each scan round.
  */
-static struct list_head unstable_tree_node_list =
-				LIST_HEAD_INIT(unstable_tree_node_list);
+#define UNSTABLE_SHARD_SHIFT	4
+#define UNSTABLE_SHARDS		(1 << UNSTABLE_SHARD_SHIFT)
+
+struct unstable_shard {
+	struct mutex lock;
+	struct rb_root root;
+	struct list_head tree_node_list;
+} ____cacheline_aligned_in_smp;
+
+static struct unstable_shard unstable_shards[UNSTABLE_SHARDS];
+
+static inline unsigned long unstable_shard_index(u32 hash)
+{
+	return hash >> (32 - UNSTABLE_SHARD_SHIFT);
+}
 
 /* List contains all stable nodes */
 static struct list_head stable_node_list = LIST_HEAD_INIT(stable_node_list);
@@ -719,6 +688,7 @@ static inline struct vma_slot *alloc_vma_slot(void)
 
 static inline void free_vma_slot(struct vma_slot *vma_slot)
 {
+	mem_cgroup_uksm_put(vma_slot->memcg);
 	kmem_cache_free(vma_slot_cache, vma_slot);
 }
 
@@ -806,6 +776,8 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node,
 			hlist_for_each_entry(rmap_item, rmap_hlist,
 					     &node_vma->rmap_hlist, hlist) {
 				uksm_pages_sharing--;
+				mem_cgroup_uksm_merged(rmap_item->slot->memcg,
+						       -1);
 
 				uksm_drop_anon_vma(rmap_item);
 				rmap_item->address &= PAGE_MASK;
@@ -855,7 +827,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node,
  * a page to put something that might look like our key in page->mapping.
  *
  * include/linux/pagemap.h page_cache_get_speculative() is a good reference,
- * but this is different - made simpler by uksm_thread_mutex being held, but
+ * but this is different - made simpler by uksm_stable_mutex being held, but
  * interesting for assuming that no other use of the struct page could ever
  * put our expected_mapping into page->mapping (or a field of the union which
  * coincides with page->mapping).  The RCU calls are not for KSM at all, but
@@ -904,8 +876,9 @@ stale:
 /*
  * Removing rmap_item from stable or unstable tree.
  * This function will clean the information from the stable/unstable tree.
+ * The caller holds the lock of the tree the item is in.
  */
-static inline void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+static inline void __remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 {
 	if (rmap_item->address & STABLE_FLAG) {
 		struct stable_node *stable_node;
@@ -941,6 +914,7 @@ static inline void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 			uksm_pages_shared--;
 		} else
 			uksm_pages_sharing--;
+		mem_cgroup_uksm_merged(rmap_item->slot->memcg, -1);
 
 
 		uksm_drop_anon_vma(rmap_item);
@@ -951,13 +925,13 @@ static inline void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 				 &rmap_item->tree_node->sub_root);
 			if (RB_EMPTY_ROOT(&rmap_item->tree_node->sub_root)) {
 				rb_erase(&rmap_item->tree_node->node,
-					 &root_unstable_tree);
+					 &rmap_item_shard(rmap_item)->root);
 
 				free_tree_node(rmap_item->tree_node);
 			} else
 				rmap_item->tree_node->count--;
 		}
-		uksm_pages_unshared--;
+		atomic_long_dec(&uksm_pages_unshared);
 	}
 
 	rmap_item->address &= PAGE_MASK;
@@ -967,6 +941,37 @@ out:
 	cond_resched();		/* we're called from many long loops */
 }
 
+/*
+ * Another scan thread may move the item from the unstable to the stable
+ * tree, or drop it from the stable tree, until we hold the lock for the
+ * tree it is in. So check its flags again once the lock is taken.
+ */
+static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+{
+	unsigned long address;
+	struct mutex *lock;
+
+	for (;;) {
+		address = ACCESS_ONCE(rmap_item->address);
+		if (address & STABLE_FLAG)
+			lock = &uksm_stable_mutex;
+		else if (address & UNSTABLE_FLAG)
+			lock = &address_shard(address)->lock;
+		else {
+			cond_resched();
+			return;
+		}
+
+		mutex_lock(lock);
+		if (rmap_item->address == address)
+			break;
+		mutex_unlock(lock);
+	}
+
+	__remove_rmap_item_from_tree(rmap_item);
+	mutex_unlock(lock);
+}
+
 static inline int slot_in_uksm(struct vma_slot *slot)
 {
 	return list_empty(&slot->slot_list);
@@ -1126,6 +1131,7 @@ void uksm_vma_add_new(struct vm_area_struct *vma)
 	vma->vm_flags |= VM_MERGEABLE;
 	slot->vma = vma;
 	slot->mm = vma->vm_mm;
+	slot->memcg = mem_cgroup_uksm_get(vma->vm_mm);
 	slot->ctime_j = jiffies;
 	slot->pages = vma_pages(vma);
 	spin_lock(&vma_slot_list_lock);
@@ -1166,8 +1172,17 @@ void uksm_remove_vma(struct vm_area_struct *vma)
 #define shiftl	8
 #define shiftr	12
 
+/*
+ * The sampled words are spread randomly over the page, so the hardware
+ * prefetcher cannot help; fetch the word HASH_PREFETCH_DIST samples
+ * ahead by hand to overlap the cache misses with the hash chain.
+ */
+#define HASH_PREFETCH_DIST	8
+
 #define HASH_FROM_TO(from, to) 				\
 for (index = from; index < to; index++) {		\
+	if (index + HASH_PREFETCH_DIST < to)		\
+		prefetch(key + random_nums[index + HASH_PREFETCH_DIST]); \
 	pos = random_nums[index];			\
 	hash += key[pos];				\
 	hash += (hash << shiftl);			\
@@ -1207,6 +1222,12 @@ static u32 random_sample_hash(void *addr, u32 hash_strength)
 	return hash;
 }
 
+/* Exported for the uksm_bench module */
+u32 uksm_sample_hash(void *addr, u32 hash_strength)
+{
+	return random_sample_hash(addr, hash_strength);
+}
+EXPORT_SYMBOL_GPL(uksm_sample_hash);
 
 /**
  * It's used when hash strength is adjusted
@@ -1310,18 +1331,22 @@ static inline void reset_benefit(void)
 
 static inline void inc_rshash_pos(unsigned long delta)
 {
+	spin_lock(&uksm_stat_lock);
 	if (CAN_OVERFLOW_U64(rshash_pos, delta))
 		encode_benefit();
 
 	rshash_pos += delta;
+	spin_unlock(&uksm_stat_lock);
 }
 
 static inline void inc_rshash_neg(unsigned long delta)
 {
+	spin_lock(&uksm_stat_lock);
 	if (CAN_OVERFLOW_U64(rshash_neg, delta))
 		encode_benefit();
 
 	rshash_neg += delta;
+	spin_unlock(&uksm_stat_lock);
 }
 
 
@@ -1356,7 +1381,7 @@ static int memcmp_pages(struct page *page1, struct page *page2,
 
 	addr1 = kmap_atomic(page1, KM_USER0);
 	addr2 = kmap_atomic(page2, KM_USER1);
-	ret = memcmp(addr1, addr2, PAGE_SIZE);
+	ret = uksm_page_ops->memcmp(addr1, addr2);
 	kunmap_atomic(addr2, KM_USER1);
 	kunmap_atomic(addr1, KM_USER0);
 
@@ -1377,7 +1402,7 @@ static inline int is_page_full_zero(struct page *page)
 	int ret;
 
 	addr = kmap_atomic(page, KM_USER0);
-	ret = is_full_zero(addr, PAGE_SIZE);
+	ret = uksm_page_ops->is_zero(addr);
 	kunmap_atomic(addr, KM_USER0);
 
 	return ret;
@@ -2376,7 +2401,7 @@ static inline int get_tree_rmap_item_page(struct rmap_item *tree_rmap_item)
 
 	if (err == -EINVAL) {
 		/* its page map has been changed, remove it */
-		remove_rmap_item_from_tree(tree_rmap_item);
+		__remove_rmap_item_from_tree(tree_rmap_item);
 	}
 
 	/* The page is gotten and mmap_sem is locked now. */
@@ -2384,16 +2409,32 @@ static inline int get_tree_rmap_item_page(struct rmap_item *tree_rmap_item)
 }
 
 
+/* Link @rmap_item into the collision subtree of @tree_node */
+static inline void unstable_tree_link(struct rmap_item *rmap_item,
+				      struct tree_node *tree_node,
+				      struct rb_node *parent,
+				      struct rb_node **new)
+{
+	rmap_item->tree_node = tree_node;
+	rmap_item->address |= UNSTABLE_FLAG |
+		(unstable_shard_index(tree_node->hash) << SHARD_SHIFT);
+	rmap_item->hash_round = uksm_hash_round;
+	rb_link_node(&rmap_item->node, parent, new);
+	rb_insert_color(&rmap_item->node, &tree_node->sub_root);
+}
+
 /**
  * unstable_tree_search_insert() - search an unstable tree rmap_item with the
- * same hash value. Get its page and trylock the mmap_sem
+ * same hash value. Get its page and trylock the mmap_sem. The caller holds
+ * the lock of @shard, the shard of @hash.
  */
 static inline
-struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
+struct rmap_item *unstable_tree_search_insert(struct unstable_shard *shard,
+					      struct rmap_item *rmap_item,
 					      u32 hash)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_node **new = &shard->root.rb_node;
 	struct rb_node *parent = NULL;
 	struct tree_node *tree_node;
 	u32 hash_max;
@@ -2448,25 +2489,21 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 		}
 	} else {
 		/* alloc a new tree_node */
-		tree_node = alloc_tree_node(&unstable_tree_node_list);
+		tree_node = alloc_tree_node(&shard->tree_node_list);
 		if (!tree_node)
 			return NULL;
 
 		tree_node->hash = hash;
 		rb_link_node(&tree_node->node, parent, new);
-		rb_insert_color(&tree_node->node, &root_unstable_tree);
+		rb_insert_color(&tree_node->node, &shard->root);
 		parent = NULL;
 		new = &tree_node->sub_root.rb_node;
 	}
 
 	/* did not found even in sub-tree */
-	rmap_item->tree_node = tree_node;
-	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->hash_round = uksm_hash_round;
-	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &tree_node->sub_root);
+	unstable_tree_link(rmap_item, tree_node, parent, new);
 
-	uksm_pages_unshared++;
+	atomic_long_inc(&uksm_pages_unshared);
 	return NULL;
 
 get_page_out:
@@ -2502,6 +2539,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 
 	BUG_ON(!stable_node);
 	rmap_item->address |= STABLE_FLAG;
+	mem_cgroup_uksm_merged(rmap_item->slot->memcg, 1);
 
 	if (hlist_empty(&stable_node->hlist)) {
 		uksm_pages_shared++;
@@ -2676,7 +2714,7 @@ static inline void inc_uksm_pages_scanned(void)
 {
 	u64 delta;
 
-
+	spin_lock(&uksm_stat_lock);
 	if (uksm_pages_scanned == U64_MAX) {
 		encode_benefit();
 
@@ -2694,6 +2732,7 @@ static inline void inc_uksm_pages_scanned(void)
 	}
 
 	uksm_pages_scanned++;
+	spin_unlock(&uksm_stat_lock);
 }
 
 static inline int find_zero_page_hash(int strength, u32 hash)
@@ -2740,15 +2779,21 @@ out:
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ *
+ * The stable tree is only locked for searching and appending: the
+ * reference held on kpage keeps its stable node in the tree meanwhile.
+ * The unstable tree shard of @hash stays locked while its item found
+ * there is merged, so that its owner cannot free it under us.
  */
 static void cmp_and_merge_page(struct rmap_item *rmap_item, u32 hash)
 {
 	struct rmap_item *tree_rmap_item;
+	struct unstable_shard *shard;
 	struct page *page;
 	struct page *kpage = NULL;
 	u32 hash_max;
 	int err;
-	unsigned int success1, success2;
+	int success1, success2;
 	struct stable_node *snode;
 	int cmp;
 	struct rb_node *parent = NULL, **new;
@@ -2757,7 +2802,9 @@ static void cmp_and_merge_page(struct rmap_item *rmap_item, u32 hash)
 	page = rmap_item->page;
 
 	/* We first start with searching the page inside the stable tree */
+	mutex_lock(&uksm_stable_mutex);
 	kpage = stable_tree_search(rmap_item, hash);
+	mutex_unlock(&uksm_stable_mutex);
 	if (kpage) {
 		err = try_to_merge_with_uksm_page(rmap_item, kpage,
 						 hash);
@@ -2768,10 +2815,12 @@ static void cmp_and_merge_page(struct rmap_item *rmap_item, u32 hash)
 			 * page lock is needed because it's
 			 * racing with try_to_unmap_ksm(), etc.
 			 */
+			mutex_lock(&uksm_stable_mutex);
 			lock_page(kpage);
 			snode = page_stable_node(kpage);
 			stable_tree_append(rmap_item, snode, 1);
 			unlock_page(kpage);
+			mutex_unlock(&uksm_stable_mutex);
 			put_page(kpage);
 			return; /* success */
 		}
@@ -2787,8 +2836,10 @@ static void cmp_and_merge_page(struct rmap_item *rmap_item, u32 hash)
 			return;
 	}
 
+	shard = &unstable_shards[unstable_shard_index(hash)];
+	mutex_lock(&shard->lock);
 	tree_rmap_item =
-		unstable_tree_search_insert(rmap_item, hash);
+		unstable_tree_search_insert(shard, rmap_item, hash);
 	if (tree_rmap_item) {
 		err = try_to_merge_two_pages(rmap_item, tree_rmap_item, hash);
 		/*
@@ -2798,7 +2849,8 @@ static void cmp_and_merge_page(struct rmap_item *rmap_item, u32 hash)
 		 */
 		if (!err) {
 			kpage = page;
-			remove_rmap_item_from_tree(tree_rmap_item);
+			__remove_rmap_item_from_tree(tree_rmap_item);
+			mutex_lock(&uksm_stable_mutex);
 			lock_page(kpage);
 			snode = stable_tree_insert(&kpage, hash,
 						   rmap_item, tree_rmap_item,
@@ -2825,6 +2877,7 @@ static void cmp_and_merge_page(struct rmap_item *rmap_item, u32 hash)
 			 * break_cow().
 			 */
 			unlock_page(kpage);
+			mutex_unlock(&uksm_stable_mutex);
 
 			if (!success1)
 				break_cow(rmap_item);
@@ -2848,24 +2901,21 @@ static void cmp_and_merge_page(struct rmap_item *rmap_item, u32 hash)
 			else
 				goto put_up_out;
 
-			rmap_item->tree_node = tree_rmap_item->tree_node;
-			rmap_item->address |= UNSTABLE_FLAG;
-			rmap_item->hash_round = uksm_hash_round;
-			rb_link_node(&rmap_item->node, parent, new);
-			rb_insert_color(&rmap_item->node,
-					&tree_rmap_item->tree_node->sub_root);
+			unstable_tree_link(rmap_item, tree_rmap_item->tree_node,
+					   parent, new);
 			rmap_item->tree_node->count++;
 		} else {
 			/*
 			 * either one of the page has changed or they collide
 			 * at the max hash, we consider them as ill items.
 			 */
-			remove_rmap_item_from_tree(tree_rmap_item);
+			__remove_rmap_item_from_tree(tree_rmap_item);
 		}
 put_up_out:
 		put_page(tree_rmap_item->page);
 		up_read(&tree_rmap_item->slot->vma->vm_mm->mmap_sem);
 	}
+	mutex_unlock(&shard->lock);
 }
 
 
@@ -3311,8 +3361,11 @@ out2:
 	put_page(rmap_item->page);
 out1:
 	slot->pages_scanned++;
-	if (slot->fully_scanned_round != fully_scanned_round)
+	if (slot->fully_scanned_round != fully_scanned_round) {
+		spin_lock(&uksm_stat_lock);
 		scanned_virtual_pages++;
+		spin_unlock(&uksm_stat_lock);
+	}
 
 	if (vma_fully_scanned(slot))
 		slot->fully_scanned_round = fully_scanned_round;
@@ -3717,6 +3770,17 @@ static inline void free_all_tree_nodes(struct list_head *list)
 	}
 }
 
+/* Only called while no other scan thread is running */
+static void reset_unstable_tree(void)
+{
+	int i;
+
+	for (i = 0; i < UNSTABLE_SHARDS; i++) {
+		unstable_shards[i].root = RB_ROOT;
+		free_all_tree_nodes(&unstable_shards[i].tree_node_list);
+	}
+}
+
 /**
  * stable_tree_delta_hash() - Delta hash the stable tree from previous hash
  * strength to the current hash_strength. It re-structures the hole tree.
@@ -4222,10 +4286,11 @@ static noinline void uksm_calc_scan_pages(void)
 		uksm_sleep_jiffies = usecs_to_jiffies(sleep_usecs) + 1;
 	}
 
+	/* Each scan thread gets the CPU ratio of the rung */
 	for (i = 0; i < SCAN_LADDER_SIZE; i++) {
 		ratio = rung_real_ratio(ladder[i].cpu_ratio);
 		ladder[i].pages_to_scan = cpu_ratio_to_nsec(ratio) /
-					per_page;
+					per_page * uksm_thread_num;
 		BUG_ON(!ladder[i].pages_to_scan);
 		uksm_calc_rung_step(&ladder[i], per_page, ratio);
 	}
@@ -4348,19 +4413,21 @@ static inline int rung_round_finished(struct scan_rung *rung)
 	return rung->flags & UKSM_RUNG_ROUND_FINISHED;
 }
 
+/*
+ * Move the slot up or down the ladder at the end of its turn. The scan
+ * cursor was already moved on when the visit was claimed.
+ */
 static inline void judge_slot(struct vma_slot *slot)
 {
-	struct scan_rung *rung = slot->rung;
 	unsigned long dedup;
-	int deleted;
 
 	dedup = cal_dedup_ratio(slot);
 	if (vma_fully_scanned(slot) && uksm_thrash_threshold)
-		deleted = vma_rung_enter(slot, &uksm_scan_ladder[0]);
+		vma_rung_enter(slot, &uksm_scan_ladder[0]);
 	else if (dedup && dedup >= uksm_abundant_threshold)
-		deleted = vma_rung_up(slot);
+		vma_rung_up(slot);
 	else
-		deleted = vma_rung_down(slot);
+		vma_rung_down(slot);
 
 	slot->pages_merged = 0;
 	slot->pages_cowed = 0;
@@ -4369,10 +4436,6 @@ static inline void judge_slot(struct vma_slot *slot)
 		slot->pages_scanned = 0;
 
 	slot->last_scanned = slot->pages_scanned;
-
-	/* If its deleted in above, then rung was already advanced. */
-	if (!deleted)
-		advance_current_scan(rung);
 }
 
 
@@ -4393,138 +4456,274 @@ static inline int hash_round_finished(void)
 #define BUSY_RETRY		100
 
 /**
- * uksm_do_scan()  - the main worker function.
+ * claim_scan_visit() - take the slot under the scan cursor of @rung.
+ *
+ * Returns the number of pages to scan in it now, or 0 if the quota of the
+ * rung is used up or no slot could be taken. On success the slot is
+ * marked UKSM_SLOT_SCANNING with its mmap_sem read locked, and *@finish
+ * tells if this visit ends the turn of the slot; if so the cursor has
+ * already been moved on, so the other scan threads can go on meanwhile.
+ *
+ * Pages are charged to the quota of the rung in inverse proportion to
+ * the uksm weight of the memory cgroup of the slot, so a cgroup with a
+ * lower weight gets a smaller share of the scan budget. Slots of
+ * cgroups with weight 0 end their turn without being scanned.
  */
-static noinline void uksm_do_scan(void)
+static unsigned long claim_scan_visit(struct scan_rung *rung,
+				      struct vma_slot **slotp, int *finish)
 {
 	struct vma_slot *slot, *iter;
 	struct mm_struct *busy_mm;
-	unsigned char round_finished, all_rungs_emtpy;
-	int i, err, mmsem_batch;
-	unsigned long pcost;
-	long long delta_exec;
-	unsigned long vpages, max_cpu_ratio;
-	unsigned long long start_time, end_time, scan_time;
-	unsigned int expected_jiffies;
-
-	might_sleep();
-
-	vpages = 0;
+	int busy_retry = BUSY_RETRY;
+	unsigned long n, cost;
+	unsigned int weight;
+	int err, reset;
+
+	mutex_lock(&uksm_ladder_mutex);
+	while (rung->pages_to_scan && rung->vma_root.num) {
+		slot = rung->current_scan;
+
+		if (slot->flags & UKSM_SLOT_SCANNING) {
+			/* another scan thread is in it */
+			if (advance_current_scan(rung) || --busy_retry <= 0)
+				break;
+			continue;
+		}
 
-	start_time = task_sched_runtime(current);
-	max_cpu_ratio = 0;
-	mmsem_batch = 0;
+		BUG_ON(vma_fully_scanned(slot));
 
-	for (i = 0; i < SCAN_LADDER_SIZE;) {
-		struct scan_rung *rung = &uksm_scan_ladder[i];
-		unsigned long ratio;
-		int busy_retry;
+		err = try_down_read_slot_mmap_sem(slot);
+		if (err == -ENOENT) {
+			rung_rm_slot(slot);
+			continue;
+		}
 
-		if (!rung->pages_to_scan) {
-			i++;
+		if (err == -EBUSY) {
+			/* skip other vmas on the same mm */
+			busy_mm = slot->mm;
+			do {
+				reset = advance_current_scan(rung);
+				iter = rung->current_scan;
+			} while (iter->mm == busy_mm && --busy_retry > 0 &&
+				 !reset);
+
+			if (iter->mm == busy_mm || busy_retry <= 0)
+				break;
 			continue;
 		}
 
-		if (!rung->vma_root.num) {
-			rung->pages_to_scan = 0;
-			i++;
+		BUG_ON(!vma_can_enter(slot->vma));
+		if (uksm_test_exit(slot->mm)) {
+			up_read(&slot->mm->mmap_sem);
+			rung_rm_slot(slot);
 			continue;
 		}
 
-		ratio = rung_real_ratio(rung->cpu_ratio);
-		if (ratio > max_cpu_ratio)
-			max_cpu_ratio = ratio;
+		weight = mem_cgroup_uksm_weight(slot->mm);
+		if (!weight) {
+			up_read(&slot->mm->mmap_sem);
+			reset = advance_current_scan(rung);
+			judge_slot(slot);
+			if (reset || --busy_retry <= 0)
+				break;
+			continue;
+		}
 
-		busy_retry = BUSY_RETRY;
 		/*
-		 * Do not consider rung_round_finished() here, just used up the
-		 * rung->pages_to_scan quota.
+		 * One page at current_offset and then every rung->step pages
+		 * until the end of the slot, or until it is fully scanned.
 		 */
-		while (rung->pages_to_scan && rung->vma_root.num &&
-		       likely(!freezing(current))) {
-			int reset = 0;
+		n = slot->pages - slot->pages_scanned;
+		if (rung->current_offset < slot->pages)
+			n = min(n, (slot->pages - 1 - rung->current_offset) /
+				   rung->step + 1);
+		else
+			n = 1;
+
+		cost = DIV_ROUND_UP(n * MEM_CGROUP_UKSM_WEIGHT_MAX, weight);
+		*finish = cost <= rung->pages_to_scan;
+		if (*finish) {
+			rung->pages_to_scan -= cost;
+			rung->current_offset += (n - 1) * rung->step;
+			advance_current_scan(rung);
+		} else {
+			n = rung->pages_to_scan * weight /
+			    MEM_CGROUP_UKSM_WEIGHT_MAX;
+			rung->pages_to_scan = 0;
+			if (!n) {
+				up_read(&slot->mm->mmap_sem);
+				break;
+			}
+			rung->current_offset += n * rung->step;
+		}
 
-			slot = rung->current_scan;
+		slot->flags |= UKSM_SLOT_SCANNING;
+		mutex_unlock(&uksm_ladder_mutex);
 
-			BUG_ON(vma_fully_scanned(slot));
+		*slotp = slot;
+		return n;
+	}
+	mutex_unlock(&uksm_ladder_mutex);
 
-			if (mmsem_batch) {
-				err = 0;
-			} else {
-				err = try_down_read_slot_mmap_sem(slot);
-			}
+	return 0;
+}
 
-			if (err == -ENOENT) {
-rm_slot:
-				rung_rm_slot(slot);
-				continue;
+/*
+ * Scan @n pages of a claimed slot. mmap_sem is dropped and taken again
+ * every UKSM_MMSEM_BATCH pages; if that fails the visit ends early, with
+ * *@gone set if the VMA is going away. Returns the pages scanned.
+ */
+static unsigned long scan_visit(struct vma_slot *slot, unsigned long n,
+				int *gone)
+{
+	unsigned long i;
+	int err;
+
+	*gone = 0;
+	for (i = 0; i < n; i++) {
+		if (i && !(i % (UKSM_MMSEM_BATCH + 1))) {
+			up_read(&slot->mm->mmap_sem);
+			err = try_down_read_slot_mmap_sem(slot);
+			if (!err && uksm_test_exit(slot->mm)) {
+				up_read(&slot->mm->mmap_sem);
+				err = -ENOENT;
 			}
+			if (err) {
+				*gone = (err == -ENOENT);
+				return i;
+			}
+		}
 
-			busy_mm = slot->mm;
+		/* Ok, we have take the mmap_sem, ready to scan */
+		scan_vma_one_page(slot);
+		cond_resched();
+	}
+	up_read(&slot->mm->mmap_sem);
 
-			if (err == -EBUSY) {
-				/* skip other vmas on the same mm */
-				do {
-					reset = advance_current_scan(rung);
-					iter = rung->current_scan;
-					busy_retry--;
-					if (iter->vma->vm_mm != busy_mm ||
-					    !busy_retry || reset)
-						break;
-				} while (1);
-
-				if (iter->vma->vm_mm != busy_mm) {
-					continue;
-				} else {
-					/* scan round finsished */
-					break;
-				}
-			}
+	return n;
+}
 
-			BUG_ON(!vma_can_enter(slot->vma));
-			if (uksm_test_exit(slot->vma->vm_mm)) {
-				mmsem_batch = 0;
-				up_read(&slot->vma->vm_mm->mmap_sem);
-				goto rm_slot;
-			}
+static void release_scan_visit(struct uksm_thread *t, struct vma_slot *slot,
+			       unsigned long scanned, unsigned long merged,
+			       int finish, int gone)
+{
+	mutex_lock(&uksm_ladder_mutex);
+	slot->flags &= ~UKSM_SLOT_SCANNING;
+	t->pages_scanned += scanned;
+	t->pages_merged += merged;
+	mem_cgroup_uksm_scanned(slot->memcg, scanned);
 
-			if (mmsem_batch)
-				mmsem_batch--;
-			else
-				mmsem_batch = UKSM_MMSEM_BATCH;
-
-			/* Ok, we have take the mmap_sem, ready to scan */
-			scan_vma_one_page(slot);
-			rung->pages_to_scan--;
-			vpages++;
-
-			if (rung->current_offset + rung->step > slot->pages - 1
-			    || vma_fully_scanned(slot)) {
-				up_read(&slot->vma->vm_mm->mmap_sem);
-				judge_slot(slot);
-				mmsem_batch = 0;
-			} else {
-				rung->current_offset += rung->step;
-				if (!mmsem_batch)
-					up_read(&slot->vma->vm_mm->mmap_sem);
-			}
+	if (gone)
+		rung_rm_slot(slot);
+	else if (finish)
+		judge_slot(slot);
+	mutex_unlock(&uksm_ladder_mutex);
+}
 
-			busy_retry = BUSY_RETRY;
-			cond_resched();
+/*
+ * uksm_scan_pass() - the share of a scan thread in a scan period: visit
+ * slots until the quota of every rung is used up.
+ */
+static void uksm_scan_pass(struct uksm_thread *t)
+{
+	struct vma_slot *slot;
+	unsigned long n, scanned, merged;
+	unsigned long long start_time;
+	int i, finish, gone;
+
+	start_time = task_sched_runtime(current);
+	t->vpages = 0;
+
+	for (i = 0; i < SCAN_LADDER_SIZE && !freezing(current); i++) {
+		struct scan_rung *rung = &uksm_scan_ladder[i];
+
+		while (!freezing(current) &&
+		       (n = claim_scan_visit(rung, &slot, &finish))) {
+			/* Nobody else changes it while we are in the slot */
+			merged = slot->pages_merged;
+			scanned = scan_visit(slot, n, &gone);
+			merged = slot->pages_merged - merged;
+
+			release_scan_visit(t, slot, scanned, merged,
+					   finish, gone);
+			t->vpages += scanned;
 		}
 
-		if (mmsem_batch) {
-			up_read(&slot->vma->vm_mm->mmap_sem);
-			mmsem_batch = 0;
+		cond_resched();
+	}
+
+	t->period_ns = task_sched_runtime(current) - start_time;
+
+	mutex_lock(&uksm_ladder_mutex);
+	t->exec_ns += t->period_ns;
+	mutex_unlock(&uksm_ladder_mutex);
+}
+
+/* Let the scan threads other than uksmd join this scan period */
+static void uksm_start_scan_threads(void)
+{
+	if (uksm_thread_num == 1)
+		return;
+
+	atomic_set(&uksm_threads_busy, uksm_thread_num - 1);
+	smp_wmb();
+	uksm_scan_seq++;
+	wake_up_all(&uksm_scan_start_wait);
+}
+
+static void uksm_wait_scan_threads(void)
+{
+	while (atomic_read(&uksm_threads_busy))
+		wait_event_freezable(uksm_scan_done_wait,
+				     !atomic_read(&uksm_threads_busy));
+}
+
+/**
+ * uksm_do_scan()  - the main worker function.
+ */
+static noinline void uksm_do_scan(void)
+{
+	unsigned char round_finished, all_rungs_emtpy;
+	int i;
+	unsigned long pcost;
+	long long delta_exec;
+	unsigned long vpages, max_cpu_ratio;
+	unsigned long long start_time, end_time, scan_time;
+	unsigned int expected_jiffies;
+
+	might_sleep();
+
+	start_time = task_sched_runtime(current);
+	max_cpu_ratio = 0;
+
+	for (i = 0; i < SCAN_LADDER_SIZE; i++) {
+		struct scan_rung *rung = &uksm_scan_ladder[i];
+		unsigned long ratio;
+
+		if (!rung->pages_to_scan)
+			continue;
+
+		if (!rung->vma_root.num) {
+			rung->pages_to_scan = 0;
+			continue;
 		}
 
-		if (freezing(current))
-			break;
+		ratio = rung_real_ratio(rung->cpu_ratio);
+		if (ratio > max_cpu_ratio)
+			max_cpu_ratio = ratio;
+	}
 
-		cond_resched();
+	uksm_start_scan_threads();
+	uksm_scan_pass(&uksm_threads[0]);
+	uksm_wait_scan_threads();
+
+	/* The per page cost is in CPU time, summed over all scan threads */
+	vpages = 0;
+	delta_exec = 0;
+	for (i = 0; i < uksm_thread_num; i++) {
+		vpages += uksm_threads[i].vpages;
+		delta_exec += uksm_threads[i].period_ns;
 	}
-	end_time = task_sched_runtime(current);
-	delta_exec = end_time - start_time;
 
 	if (freezing(current))
 		return;
@@ -4554,8 +4753,7 @@ rm_slot:
 		if (hash_round_finished() && rshash_adjust()) {
 			/* Reset the unstable root iff hash strength changed */
 			uksm_hash_round++;
-			root_unstable_tree = RB_ROOT;
-			free_all_tree_nodes(&unstable_tree_node_list);
+			reset_unstable_tree();
 		}
 
 		/*
@@ -4630,6 +4828,84 @@ static int uksm_scan_thread(void *nothing)
 	return 0;
 }
 
+/* The scan threads other than uksmd only scan when uksmd tells them to */
+static int uksm_scan_helper(void *data)
+{
+	struct uksm_thread *t = data;
+
+	set_freezable();
+	set_user_nice(current, 5);
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(uksm_scan_start_wait,
+				     t->seq != ACCESS_ONCE(uksm_scan_seq) ||
+				     kthread_should_stop());
+		if (t->seq == ACCESS_ONCE(uksm_scan_seq))
+			continue;
+
+		smp_rmb();
+		t->seq = uksm_scan_seq;
+		uksm_scan_pass(t);
+
+		if (atomic_dec_and_test(&uksm_threads_busy))
+			wake_up(&uksm_scan_done_wait);
+	}
+	return 0;
+}
+
+/* Spread the scan threads other than uksmd over the nodes with CPUs */
+static int uksm_thread_node(unsigned int id)
+{
+	int node, n = (id - 1) % num_node_state(N_CPU);
+
+	for_each_node_state(node, N_CPU) {
+		if (!n--)
+			return node;
+	}
+
+	return -1;
+}
+
+/* Called with uksm_thread_mutex held, so no scan period is running */
+static int uksm_set_thread_num(unsigned int num)
+{
+	struct uksm_thread *t;
+	struct task_struct *task;
+	int node;
+
+	while (uksm_thread_num > num) {
+		t = &uksm_threads[--uksm_thread_num];
+		kthread_stop(t->task);
+		t->task = NULL;
+	}
+
+	while (uksm_thread_num < num) {
+		t = &uksm_threads[uksm_thread_num];
+		node = uksm_thread_node(uksm_thread_num);
+
+		task = kthread_create_on_node(uksm_scan_helper, t, node,
+					      "uksmd/%u", uksm_thread_num);
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+		if (node >= 0)
+			set_cpus_allowed_ptr(task, cpumask_of_node(node));
+
+		mutex_lock(&uksm_ladder_mutex);
+		t->task = task;
+		t->node = node;
+		t->seq = uksm_scan_seq;
+		t->pages_scanned = 0;
+		t->pages_merged = 0;
+		t->exec_ns = 0;
+		uksm_thread_num++;
+		mutex_unlock(&uksm_ladder_mutex);
+
+		wake_up_process(task);
+	}
+
+	return 0;
+}
+
 int page_referenced_ksm(struct page *page, struct mem_cgroup *memcg,
 			unsigned long *vm_flags)
 {
@@ -5252,7 +5528,7 @@ UKSM_ATTR_RO(pages_sharing);
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", uksm_pages_unshared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&uksm_pages_unshared));
 }
 UKSM_ATTR_RO(pages_unshared);
 
@@ -5309,6 +5585,53 @@ static ssize_t sleep_times_show(struct kobject *kobj,
 }
 UKSM_ATTR_RO(sleep_times);
 
+static ssize_t thread_num_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", uksm_thread_num);
+}
+
+static ssize_t thread_num_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long num;
+	int err;
+
+	err = strict_strtoul(buf, 10, &num);
+	if (err || !num || num > UKSM_THREADS_MAX ||
+	    num > num_possible_cpus())
+		return -EINVAL;
+
+	mutex_lock(&uksm_thread_mutex);
+	err = uksm_set_thread_num(num);
+	mutex_unlock(&uksm_thread_mutex);
+
+	return err ? err : count;
+}
+UKSM_ATTR(thread_num);
+
+/* One line per scan thread: id, node, pages scanned, pages merged, CPU ms */
+static ssize_t thread_stats_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	struct uksm_thread *t;
+	char *p = buf;
+	int i;
+
+	mutex_lock(&uksm_ladder_mutex);
+	for (i = 0; i < uksm_thread_num; i++) {
+		t = &uksm_threads[i];
+		p += sprintf(p, "%d %d %llu %llu %llu\n", i, t->node,
+			     t->pages_scanned, t->pages_merged,
+			     div_u64(t->exec_ns, NSEC_PER_MSEC));
+	}
+	mutex_unlock(&uksm_ladder_mutex);
+
+	return p - buf;
+}
+UKSM_ATTR_RO(thread_stats);
+
 
 static struct attribute *uksm_attrs[] = {
 	&max_cpu_percentage_attr.attr,
@@ -5327,6 +5650,8 @@ static struct attribute *uksm_attrs[] = {
 	&abundant_threshold_attr.attr,
 	&cpu_ratios_attr.attr,
 	&eval_intervals_attr.attr,
+	&thread_num_attr.attr,
+	&thread_stats_attr.attr,
 	NULL,
 };
 
@@ -5552,6 +5877,17 @@ struct page *ksm_does_need_to_copy(struct page *page,
 	return new_page;
 }
 
+static void __init init_unstable_shards(void)
+{
+	int i;
+
+	for (i = 0; i < UNSTABLE_SHARDS; i++) {
+		mutex_init(&unstable_shards[i].lock);
+		unstable_shards[i].root = RB_ROOT;
+		INIT_LIST_HEAD(&unstable_shards[i].tree_node_list);
+	}
+}
+
 static int __init uksm_init(void)
 {
 	struct task_struct *uksm_thread;
@@ -5562,7 +5898,10 @@ static int __init uksm_init(void)
 
 	slot_tree_init();
 	init_scan_ladder();
+	init_unstable_shards();
 
+	/* Before init_random_sampling() measures the compare cost */
+	uksm_select_page_ops();
 
 	err = init_random_sampling();
 	if (err)
@@ -5582,6 +5921,8 @@ static int __init uksm_init(void)
 		err = PTR_ERR(uksm_thread);
 		goto out_free;
 	}
+	uksm_threads[0].task = uksm_thread;
+	uksm_threads[0].node = -1;
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &uksm_attr_group);
@@ -0,0 +1,121 @@
+/*
+ * Throughput of the Ultra KSM page kernels.
+ *
+ * Loading this module times every page compare and zero-check
+ * implementation usable on this CPU, plus the sampled page hash at the
+ * default and at full strength, and prints the results in MB/s of page
+ * data processed. Compares are timed on identical pages, the worst
+ * case, and zero checks on a zero page.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/ksm.h>
+
+/* Run each kernel for at least this long */
+#define BENCH_NSEC		(100 * NSEC_PER_MSEC)
+#define BENCH_BATCH		256
+
+#define HASH_STRENGTH_FULL	(PAGE_SIZE / sizeof(u32))
+
+static u64 mbps(u64 loops, s64 ns)
+{
+	return div64_u64(loops * PAGE_SIZE * NSEC_PER_SEC, ns ? ns : 1) >>
+		20;
+}
+
+/* Defeat the compiler without adding much to the measured loop */
+static volatile int bench_sink;
+
+#define BENCH_LOOP(op)						\
+({								\
+	u64 __loops = 0;					\
+	ktime_t __start = ktime_get();				\
+	s64 __ns;						\
+	int __i;						\
+								\
+	do {							\
+		for (__i = 0; __i < BENCH_BATCH; __i++)		\
+			bench_sink = (op);			\
+		__loops += BENCH_BATCH;				\
+		__ns = ktime_to_ns(ktime_sub(ktime_get(), __start)); \
+		cond_resched();					\
+	} while (__ns < BENCH_NSEC);				\
+	mbps(__loops, __ns);					\
+})
+
+static int __init uksm_bench_init(void)
+{
+	const struct uksm_page_ops *const *ops;
+	unsigned long *p1, *p2, *zero;
+	unsigned int i;
+
+	p1 = (unsigned long *)__get_free_page(GFP_KERNEL);
+	p2 = (unsigned long *)__get_free_page(GFP_KERNEL);
+	zero = (unsigned long *)get_zeroed_page(GFP_KERNEL);
+	if (!p1 || !p2 || !zero)
+		goto out;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*p1); i++)
+		p1[i] = random32();
+	memcpy(p2, p1, PAGE_SIZE);
+
+	printk(KERN_INFO "uksm_bench: in use: %s\n", uksm_page_ops->name);
+
+	for (ops = uksm_page_ops_list; *ops; ops++) {
+		const struct uksm_page_ops *o = *ops;
+
+		if (o->usable && !o->usable()) {
+			printk(KERN_INFO "uksm_bench: %-10s not usable\n",
+			       o->name);
+			continue;
+		}
+
+		if (o->memcmp(p1, p2) || !o->is_zero(zero) ||
+		    o->is_zero(p1)) {
+			printk(KERN_ERR "uksm_bench: %s gives wrong results!\n",
+			       o->name);
+			continue;
+		}
+
+		printk(KERN_INFO "uksm_bench: %-10s memcmp %6llu MB/s, "
+		       "is_zero %6llu MB/s\n", o->name,
+		       BENCH_LOOP(o->memcmp(p1, p2)),
+		       BENCH_LOOP(o->is_zero(zero)));
+	}
+
+	printk(KERN_INFO "uksm_bench: hash strength %lu: %llu MB/s, "
+	       "strength %lu: %llu MB/s\n",
+	       HASH_STRENGTH_FULL >> 4,
+	       BENCH_LOOP(uksm_sample_hash(p1, HASH_STRENGTH_FULL >> 4)),
+	       HASH_STRENGTH_FULL,
+	       BENCH_LOOP(uksm_sample_hash(p1, HASH_STRENGTH_FULL)));
+
+out:
+	free_page((unsigned long)p1);
+	free_page((unsigned long)p2);
+	free_page((unsigned long)zero);
+
+	/* Like tcrypt: nothing to keep loaded once the numbers are out */
+	return -EAGAIN;
+}
+
+static void __exit uksm_bench_exit(void)
+{
+}
+
+module_init(uksm_bench_init);
+module_exit(uksm_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Ultra KSM page kernel benchmark");
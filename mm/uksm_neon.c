@@ -0,0 +1,91 @@
+/*
+ * NEON page compare and zero-check kernels for Ultra KSM.
+ *
+ * This file is built with -mfpu=neon, so its functions may only be
+ * called between kernel_neon_begin() and kernel_neon_end(); see
+ * uksm_simd.c. It must not include kernel headers, whose integer
+ * typedefs clash with <arm_neon.h>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <arm_neon.h>
+
+unsigned long uksm_neon_diff_block(const void *p1, const void *p2,
+				   unsigned long len);
+int uksm_neon_is_zero(const void *p, unsigned long len);
+
+/*
+ * Any bit set in @v? Moving data from NEON to the core registers
+ * stalls Cortex-A8/A9 for a long time, so this is done only once per
+ * 128-byte block, as a single 64-bit transfer.
+ */
+static inline int neon_nonzero(uint32x4_t v)
+{
+	uint32x2_t r = vorr_u32(vget_low_u32(v), vget_high_u32(v));
+
+	return vget_lane_u64(vreinterpret_u64_u32(r), 0) != 0;
+}
+
+/*
+ * Offset of the first 128-byte block in which the buffers differ, or
+ * @len if they are identical. @len must be a multiple of 128.
+ */
+unsigned long uksm_neon_diff_block(const void *p1, const void *p2,
+				   unsigned long len)
+{
+	const uint32_t *a = p1, *b = p2;
+	unsigned long off;
+
+	for (off = 0; off < len; off += 128, a += 32, b += 32) {
+		uint32x4_t x0, x1, x2, x3;
+
+		__builtin_prefetch(a + 64);
+		__builtin_prefetch(b + 64);
+
+		x0 = veorq_u32(vld1q_u32(a), vld1q_u32(b));
+		x1 = veorq_u32(vld1q_u32(a + 4), vld1q_u32(b + 4));
+		x2 = veorq_u32(vld1q_u32(a + 8), vld1q_u32(b + 8));
+		x3 = veorq_u32(vld1q_u32(a + 12), vld1q_u32(b + 12));
+		x0 = vorrq_u32(x0, veorq_u32(vld1q_u32(a + 16),
+					     vld1q_u32(b + 16)));
+		x1 = vorrq_u32(x1, veorq_u32(vld1q_u32(a + 20),
+					     vld1q_u32(b + 20)));
+		x2 = vorrq_u32(x2, veorq_u32(vld1q_u32(a + 24),
+					     vld1q_u32(b + 24)));
+		x3 = vorrq_u32(x3, veorq_u32(vld1q_u32(a + 28),
+					     vld1q_u32(b + 28)));
+
+		if (neon_nonzero(vorrq_u32(vorrq_u32(x0, x1),
+					   vorrq_u32(x2, x3))))
+			break;
+	}
+
+	return off;
+}
+
+/* @len must be a multiple of 128 */
+int uksm_neon_is_zero(const void *p, unsigned long len)
+{
+	const uint32_t *a = p;
+	unsigned long off;
+
+	for (off = 0; off < len; off += 128, a += 32) {
+		uint32x4_t x0, x1, x2, x3;
+
+		__builtin_prefetch(a + 64);
+
+		x0 = vorrq_u32(vld1q_u32(a), vld1q_u32(a + 4));
+		x1 = vorrq_u32(vld1q_u32(a + 8), vld1q_u32(a + 12));
+		x2 = vorrq_u32(vld1q_u32(a + 16), vld1q_u32(a + 20));
+		x3 = vorrq_u32(vld1q_u32(a + 24), vld1q_u32(a + 28));
+
+		if (neon_nonzero(vorrq_u32(vorrq_u32(x0, x1),
+					   vorrq_u32(x2, x3))))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,402 @@
+/*
+ * Page compare and zero-check kernels for Ultra KSM.
+ *
+ * uksmd spends most of its time comparing pages and checking for zero
+ * pages. Besides the plain versions, SSE2 and AVX2 (x86) and NEON
+ * (ARM) versions are provided; the best one the boot CPU supports is
+ * picked by uksm_select_page_ops().
+ *
+ * The vector versions only locate the first block in which two pages
+ * differ and hand the rest to the plain compare. So every version
+ * orders pages exactly like the plain one does, which is what the
+ * stable and unstable trees are sorted by.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/ksm.h>
+
+#ifdef CONFIG_X86
+#include <asm/i387.h>
+#include <asm/xsave.h>
+#endif
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+#endif
+
+#ifdef CONFIG_X86_32
+#define UKSM_PLAIN_NAME	"rep-cmpsd"
+/*
+ * Compare 4-byte-aligned address s1 and s2, with length n
+ */
+static int memcmp_words(const void *s1, const void *s2, size_t n)
+{
+	size_t num = n / 4;
+	register int res;
+
+	__asm__ __volatile__
+	(
+	 "testl %3,%3\n\t"
+	 "repe; cmpsd\n\t"
+	 "je        1f\n\t"
+	 "sbbl      %0,%0\n\t"
+	 "orl       $1,%0\n"
+	 "1:"
+	 : "=&a" (res), "+&S" (s1), "+&D" (s2), "+&c" (num)
+	 : "0" (0)
+	 : "cc");
+
+	return res;
+}
+
+/*
+ * Check the page is all zero ?
+ */
+static int is_full_zero(const void *s1, size_t len)
+{
+	unsigned char same;
+
+	len /= 4;
+
+	__asm__ __volatile__
+	("repe; scasl;"
+	 "sete %0"
+	 : "=qm" (same), "+D" (s1), "+c" (len)
+	 : "a" (0)
+	 : "cc");
+
+	return same;
+}
+
+#elif defined(CONFIG_X86_64)
+#define UKSM_PLAIN_NAME	"rep-cmpsq"
+/*
+ * Compare 8-byte-aligned address s1 and s2, with length n
+ */
+static int memcmp_words(const void *s1, const void *s2, size_t n)
+{
+	size_t num = n / 8;
+	register int res;
+
+	__asm__ __volatile__
+	(
+	 "testq %q3,%q3\n\t"
+	 "repe; cmpsq\n\t"
+	 "je        1f\n\t"
+	 "sbbq      %q0,%q0\n\t"
+	 "orq       $1,%q0\n"
+	 "1:"
+	 : "=&a" (res), "+&S" (s1), "+&D" (s2), "+&c" (num)
+	 : "0" (0)
+	 : "cc");
+
+	return res;
+}
+
+static int is_full_zero(const void *s1, size_t len)
+{
+	unsigned char same;
+
+	len /= 8;
+
+	__asm__ __volatile__
+	("repe; scasq;"
+	 "sete %0"
+	 : "=qm" (same), "+D" (s1), "+c" (len)
+	 : "a" (0)
+	 : "cc");
+
+	return same;
+}
+
+#else
+#define UKSM_PLAIN_NAME	"generic"
+
+static int memcmp_words(const void *s1, const void *s2, size_t n)
+{
+	return memcmp(s1, s2, n);
+}
+
+static int is_full_zero(const void *s1, size_t len)
+{
+	const unsigned long *src = s1;
+	int i;
+
+	len /= sizeof(*src);
+
+	for (i = 0; i < len; i++) {
+		if (src[i])
+			return 0;
+	}
+
+	return 1;
+}
+#endif
+
+static int plain_memcmp(const void *p1, const void *p2)
+{
+	return memcmp_words(p1, p2, PAGE_SIZE);
+}
+
+static int plain_is_zero(const void *p)
+{
+	return is_full_zero(p, PAGE_SIZE);
+}
+
+static const struct uksm_page_ops uksm_page_ops_plain = {
+	.name		= UKSM_PLAIN_NAME,
+	.memcmp		= plain_memcmp,
+	.is_zero	= plain_is_zero,
+	.prefer		= 0,
+};
+
+#ifdef CONFIG_X86
+static int sse2_usable(void)
+{
+	return cpu_has_xmm2;
+}
+
+/* Offset of the first 64-byte block in which the pages differ */
+static unsigned long sse2_diff_block(const void *p1, const void *p2)
+{
+	unsigned long off;
+	unsigned int mask;
+
+	for (off = 0; off < PAGE_SIZE; off += 64) {
+		asm volatile("movdqa   (%1), %%xmm0\n\t"
+			     "movdqa 16(%1), %%xmm1\n\t"
+			     "movdqa 32(%1), %%xmm2\n\t"
+			     "movdqa 48(%1), %%xmm3\n\t"
+			     "pcmpeqb   (%2), %%xmm0\n\t"
+			     "pcmpeqb 16(%2), %%xmm1\n\t"
+			     "pcmpeqb 32(%2), %%xmm2\n\t"
+			     "pcmpeqb 48(%2), %%xmm3\n\t"
+			     "pand %%xmm1, %%xmm0\n\t"
+			     "pand %%xmm3, %%xmm2\n\t"
+			     "pand %%xmm2, %%xmm0\n\t"
+			     "pmovmskb %%xmm0, %0"
+			     : "=r" (mask)
+			     : "r" (p1 + off), "r" (p2 + off)
+			     : "memory");
+		if (mask != 0xffff)
+			break;
+	}
+
+	return off;
+}
+
+static int sse2_memcmp(const void *p1, const void *p2)
+{
+	unsigned long off;
+
+	kernel_fpu_begin();
+	off = sse2_diff_block(p1, p2);
+	kernel_fpu_end();
+
+	if (off == PAGE_SIZE)
+		return 0;
+
+	return memcmp_words(p1 + off, p2 + off, PAGE_SIZE - off);
+}
+
+static int sse2_is_zero(const void *p)
+{
+	unsigned long off;
+	unsigned int mask = 0xffff;
+
+	kernel_fpu_begin();
+	asm volatile("pxor %xmm7, %xmm7");
+	for (off = 0; off < PAGE_SIZE && mask == 0xffff; off += 64) {
+		asm volatile("movdqa   (%1), %%xmm0\n\t"
+			     "movdqa 16(%1), %%xmm1\n\t"
+			     "por    32(%1), %%xmm0\n\t"
+			     "por    48(%1), %%xmm1\n\t"
+			     "por    %%xmm1, %%xmm0\n\t"
+			     "pcmpeqb %%xmm7, %%xmm0\n\t"
+			     "pmovmskb %%xmm0, %0"
+			     : "=r" (mask)
+			     : "r" (p + off)
+			     : "memory");
+	}
+	kernel_fpu_end();
+
+	return mask == 0xffff;
+}
+
+static const struct uksm_page_ops uksm_page_ops_sse2 = {
+	.name		= "sse2",
+	.usable		= sse2_usable,
+	.memcmp		= sse2_memcmp,
+	.is_zero	= sse2_is_zero,
+	.prefer		= 1,
+};
+
+#ifdef CONFIG_AS_AVX2
+static int avx2_usable(void)
+{
+	return boot_cpu_has(X86_FEATURE_AVX2) && cpu_has_xsave &&
+		(pcntxt_mask & XSTATE_YMM);
+}
+
+/* Offset of the first 128-byte block in which the pages differ */
+static unsigned long avx2_diff_block(const void *p1, const void *p2)
+{
+	unsigned long off;
+	unsigned int mask;
+
+	for (off = 0; off < PAGE_SIZE; off += 128) {
+		asm volatile("vmovdqa   (%1), %%ymm0\n\t"
+			     "vmovdqa 32(%1), %%ymm1\n\t"
+			     "vmovdqa 64(%1), %%ymm2\n\t"
+			     "vmovdqa 96(%1), %%ymm3\n\t"
+			     "vpcmpeqb   (%2), %%ymm0, %%ymm0\n\t"
+			     "vpcmpeqb 32(%2), %%ymm1, %%ymm1\n\t"
+			     "vpcmpeqb 64(%2), %%ymm2, %%ymm2\n\t"
+			     "vpcmpeqb 96(%2), %%ymm3, %%ymm3\n\t"
+			     "vpand %%ymm1, %%ymm0, %%ymm0\n\t"
+			     "vpand %%ymm3, %%ymm2, %%ymm2\n\t"
+			     "vpand %%ymm2, %%ymm0, %%ymm0\n\t"
+			     "vpmovmskb %%ymm0, %0"
+			     : "=r" (mask)
+			     : "r" (p1 + off), "r" (p2 + off)
+			     : "memory");
+		if (mask != 0xffffffff)
+			break;
+	}
+	asm volatile("vzeroupper");
+
+	return off;
+}
+
+static int avx2_memcmp(const void *p1, const void *p2)
+{
+	unsigned long off;
+
+	kernel_fpu_begin();
+	off = avx2_diff_block(p1, p2);
+	kernel_fpu_end();
+
+	if (off == PAGE_SIZE)
+		return 0;
+
+	return memcmp_words(p1 + off, p2 + off, PAGE_SIZE - off);
+}
+
+static int avx2_is_zero(const void *p)
+{
+	unsigned long off;
+	unsigned int mask = 0xffffffff;
+
+	kernel_fpu_begin();
+	asm volatile("vpxor %ymm7, %ymm7, %ymm7");
+	for (off = 0; off < PAGE_SIZE && mask == 0xffffffff; off += 128) {
+		asm volatile("vmovdqa   (%1), %%ymm0\n\t"
+			     "vmovdqa 32(%1), %%ymm1\n\t"
+			     "vpor    64(%1), %%ymm0, %%ymm0\n\t"
+			     "vpor    96(%1), %%ymm1, %%ymm1\n\t"
+			     "vpor    %%ymm1, %%ymm0, %%ymm0\n\t"
+			     "vpcmpeqb %%ymm7, %%ymm0, %%ymm0\n\t"
+			     "vpmovmskb %%ymm0, %0"
+			     : "=r" (mask)
+			     : "r" (p + off)
+			     : "memory");
+	}
+	asm volatile("vzeroupper");
+	kernel_fpu_end();
+
+	return mask == 0xffffffff;
+}
+
+static const struct uksm_page_ops uksm_page_ops_avx2 = {
+	.name		= "avx2",
+	.usable		= avx2_usable,
+	.memcmp		= avx2_memcmp,
+	.is_zero	= avx2_is_zero,
+	.prefer		= 2,
+};
+#endif /* CONFIG_AS_AVX2 */
+#endif /* CONFIG_X86 */
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/* In uksm_neon.c, which is built with -mfpu=neon */
+extern unsigned long uksm_neon_diff_block(const void *p1, const void *p2,
+					  unsigned long len);
+extern int uksm_neon_is_zero(const void *p, unsigned long len);
+
+static int neon_usable(void)
+{
+	return cpu_has_neon();
+}
+
+static int neon_memcmp(const void *p1, const void *p2)
+{
+	unsigned long off;
+
+	kernel_neon_begin();
+	off = uksm_neon_diff_block(p1, p2, PAGE_SIZE);
+	kernel_neon_end();
+
+	if (off == PAGE_SIZE)
+		return 0;
+
+	return memcmp_words(p1 + off, p2 + off, PAGE_SIZE - off);
+}
+
+static int neon_is_zero(const void *p)
+{
+	int ret;
+
+	kernel_neon_begin();
+	ret = uksm_neon_is_zero(p, PAGE_SIZE);
+	kernel_neon_end();
+
+	return ret;
+}
+
+static const struct uksm_page_ops uksm_page_ops_neon = {
+	.name		= "neon",
+	.usable		= neon_usable,
+	.memcmp		= neon_memcmp,
+	.is_zero	= neon_is_zero,
+	.prefer		= 1,
+};
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
+const struct uksm_page_ops *const uksm_page_ops_list[] = {
+	&uksm_page_ops_plain,
+#ifdef CONFIG_X86
+	&uksm_page_ops_sse2,
+#ifdef CONFIG_AS_AVX2
+	&uksm_page_ops_avx2,
+#endif
+#endif
+#ifdef CONFIG_KERNEL_MODE_NEON
+	&uksm_page_ops_neon,
+#endif
+	NULL
+};
+EXPORT_SYMBOL_GPL(uksm_page_ops_list);
+
+const struct uksm_page_ops *uksm_page_ops = &uksm_page_ops_plain;
+EXPORT_SYMBOL_GPL(uksm_page_ops);
+
+void __init uksm_select_page_ops(void)
+{
+	const struct uksm_page_ops *const *ops;
+
+	for (ops = uksm_page_ops_list; *ops; ops++) {
+		if ((*ops)->usable && !(*ops)->usable())
+			continue;
+		if ((*ops)->prefer > uksm_page_ops->prefer)
+			uksm_page_ops = *ops;
+	}
+
+	printk(KERN_INFO "UKSM: using %s page compare\n",
+	       uksm_page_ops->name);
+}